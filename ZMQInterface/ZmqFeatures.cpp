@@ -0,0 +1,177 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqFeatures.cpp
+    Created: 19 Oct 2026 5:24:34am
+
+  ==============================================================================
+*/
+
+#include <math.h>
+#include "ZmqFeatures.h"
+
+
+ZmqFeatureExtractor::ZmqFeatureExtractor()
+{
+}
+
+void ZmqFeatureExtractor::prepare(const Array<float> &sampleRates,
+                                  float bandLow, float bandHigh)
+{
+    nChannels = sampleRates.size();
+    bandEnabled = (bandLow > 0.f) && (bandHigh > bandLow);
+
+    filters.clearQuick();
+    for(int ch = 0; ch < nChannels; ch++)
+    {
+        // band pass biquad, constant 0 dB peak gain (RBJ audio EQ cookbook)
+        Biquad f;
+        zerostruct(f);
+        float fs = sampleRates[ch];
+        float hi = jmin(bandHigh, 0.45f * fs);
+        if(bandEnabled && fs > 0.f && hi > bandLow)
+        {
+            double f0 = sqrt((double)bandLow * hi);
+            double w0 = 2. * double_Pi * f0 / fs;
+            double bw = log((double)hi / bandLow) / log(2.);
+            double alpha = sin(w0) * sinh(log(2.) / 2. * bw * w0 / sin(w0));
+            double a0 = 1. + alpha;
+            f.b0 = (float)(alpha / a0);
+            f.b1 = 0.f;
+            f.b2 = (float)(-alpha / a0);
+            f.a1 = (float)(-2. * cos(w0) / a0);
+            f.a2 = (float)((1. - alpha) / a0);
+        }
+        filters.add(f);
+    }
+
+    scratch.malloc(SCRATCH_SIZE);
+}
+
+void ZmqFeatureExtractor::reset()
+{
+    for(int ch = 0; ch < filters.size(); ch++)
+    {
+        filters.getReference(ch).z1 = 0.f;
+        filters.getReference(ch).z2 = 0.f;
+    }
+}
+
+StringArray ZmqFeatureExtractor::getFeatureNames() const
+{
+    StringArray names;
+    names.add("min");
+    names.add("max");
+    names.add("mean");
+    names.add("rms");
+    if(bandEnabled)
+        names.add("band_power");
+    return names;
+}
+
+void ZmqFeatureExtractor::sumAndSumOfSquares(const float *x, int n, float &sum, float &sumSq)
+{
+    // four independent accumulators so that the compiler can keep them in one
+    // SIMD register
+    float s0 = 0.f, s1 = 0.f, s2 = 0.f, s3 = 0.f;
+    float q0 = 0.f, q1 = 0.f, q2 = 0.f, q3 = 0.f;
+    int i = 0;
+    for(; i + 3 < n; i += 4)
+    {
+        s0 += x[i];   q0 += x[i] * x[i];
+        s1 += x[i+1]; q1 += x[i+1] * x[i+1];
+        s2 += x[i+2]; q2 += x[i+2] * x[i+2];
+        s3 += x[i+3]; q3 += x[i+3] * x[i+3];
+    }
+    for(; i < n; i++)
+    {
+        s0 += x[i];
+        q0 += x[i] * x[i];
+    }
+    sum = (s0 + s1) + (s2 + s3);
+    sumSq = (q0 + q1) + (q2 + q3);
+}
+
+void ZmqFeatureExtractor::filterBlock(Biquad &f, const float *x, float *y, int n)
+{
+    // transposed direct form II
+    float z1 = f.z1, z2 = f.z2;
+    for(int i = 0; i < n; i++)
+    {
+        float out = f.b0 * x[i] + z1;
+        z1 = f.b1 * x[i] - f.a1 * out + z2;
+        z2 = f.b2 * x[i] - f.a2 * out;
+        y[i] = out;
+    }
+    f.z1 = z1;
+    f.z2 = z2;
+}
+
+void ZmqFeatureExtractor::process(const AudioSampleBuffer &buffer, const int *nSamples, float *out)
+{
+    int nFeatures = getNumFeatures();
+    int nCh = jmin(nChannels, buffer.getNumChannels());
+
+    for(int ch = 0; ch < nCh; ch++)
+    {
+        float *o = out + ch * nFeatures;
+        int n = jmin(nSamples[ch], buffer.getNumSamples());
+        if(n <= 0)
+        {
+            for(int k = 0; k < nFeatures; k++)
+                o[k] = 0.f;
+            continue;
+        }
+
+        const float *x = buffer.getReadPointer(ch);
+        Range<float> r = FloatVectorOperations::findMinAndMax(x, n);
+        float sum, sumSq;
+        sumAndSumOfSquares(x, n, sum, sumSq);
+
+        o[MIN] = r.getStart();
+        o[MAX] = r.getEnd();
+        o[MEAN] = sum / n;
+        o[RMS] = sqrtf(sumSq / n);
+
+        if(bandEnabled)
+        {
+            // filter in chunks, so that the scratch size does not depend on
+            // the buffer size
+            float power = 0.f;
+            for(int i = 0; i < n; i += SCRATCH_SIZE)
+            {
+                int m = jmin(n - i, (int)SCRATCH_SIZE);
+                filterBlock(filters.getReference(ch), x + i, scratch, m);
+                float fsum, fsumSq;
+                sumAndSumOfSquares(scratch, m, fsum, fsumSq);
+                power += fsumSq;
+            }
+            o[BAND_POWER] = power / n;
+        }
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqFeatures.h
+    Created: 19 Oct 2026 5:24:34am
+
+  ==============================================================================
+*/
+
+#ifndef ZMQFEATURES_H_INCLUDED
+#define ZMQFEATURES_H_INCLUDED
+
+#include <ProcessorHeaders.h>
+
+
+//=============================================================================
+/** Computes a small per-channel summary of each block (min, max, mean, RMS and
+ optionally the power in a frequency band), for the FEATURES stream.
+
+ All the allocation happens in prepare(), so process() is safe to call from
+ the audio thread.
+ */
+class ZmqFeatureExtractor
+{
+public:
+    enum Feature {
+        MIN = 0,
+        MAX,
+        MEAN,
+        RMS,
+        BAND_POWER,
+        MAX_FEATURES
+    };
+
+    ZmqFeatureExtractor();
+
+    /** Sets up filters and scratch memory. The band power feature is only
+     computed when 0 < bandLow < bandHigh. */
+    void prepare(const Array<float> &sampleRates, float bandLow, float bandHigh);
+
+    /** Clears the filter state, e.g. at the start of acquisition. */
+    void reset();
+
+    int getNumChannels() const { return nChannels; }
+    int getNumFeatures() const { return bandEnabled ? MAX_FEATURES : BAND_POWER; }
+    StringArray getFeatureNames() const;
+
+    /** Computes the features of the first nSamples[ch] samples of every channel.
+     out must hold getNumChannels() * getNumFeatures() floats, and is written
+     channel-major (all the features of channel 0 first). */
+    void process(const AudioSampleBuffer &buffer, const int *nSamples, float *out);
+
+private:
+    struct Biquad {
+        float b0, b1, b2, a1, a2;
+        float z1, z2;
+    };
+
+    static void sumAndSumOfSquares(const float *x, int n, float &sum, float &sumSq);
+    static void filterBlock(Biquad &f, const float *x, float *y, int n);
+
+    int nChannels = 0;
+    bool bandEnabled = false;
+    Array<Biquad> filters;
+    enum { SCRATCH_SIZE = 1024 };
+    HeapBlock<float> scratch;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ZmqFeatureExtractor);
+};
+
+
+#endif  // ZMQFEATURES_H_INCLUDED
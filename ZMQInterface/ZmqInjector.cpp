@@ -0,0 +1,170 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqInjector.cpp
+    Created: 19 Oct 2026 5:57:21am
+
+  ==============================================================================
+*/
+
+#include <string.h>
+#include "ZmqInjector.h"
+
+
+ZmqInjector::ZmqInjector()
+{
+}
+
+void ZmqInjector::prepare(int nChannels_, int delaySamples_)
+{
+    nChannels = jmax(0, nChannels_);
+    delaySamples = jmax(0, delaySamples_);
+
+    // room for the delay, a few late blocks and blocks sent ahead
+    capacity = nextPowerOfTwo(4 * delaySamples + 16384);
+    samples.malloc((size_t)nChannels * capacity);
+    tags.malloc((size_t)nChannels * capacity);
+    owners.malloc(jmax(1, nChannels));
+    reset();
+}
+
+void ZmqInjector::reset()
+{
+    for(int i = 0; i < nChannels * capacity; i++)
+        tags[i] = -1;
+    for(int ch = 0; ch < nChannels; ch++)
+        owners[ch] = -1;
+    readPosition = 0;
+    started = false;
+    nStreams = 0;
+    malformed = 0;
+}
+
+int ZmqInjector::findStream(const char *name)
+{
+    for(int i = 0; i < nStreams; i++)
+    {
+        if(strncmp(stats[i].name, name, sizeof(stats[i].name) - 1) == 0)
+            return i;
+    }
+    // the last slot is shared by the streams that don't fit
+    if(nStreams == MAX_STREAMS)
+        return MAX_STREAMS - 1;
+
+    Stats &st = stats[nStreams];
+    zerostruct(st);
+    strncpy(st.name, name, sizeof(st.name) - 1);
+    return nStreams++;
+}
+
+bool ZmqInjector::write(const char *name, const ZmqInjectHeader &header, const float *data)
+{
+    if(header.nChannels <= 0 || header.nSamples <= 0 || header.firstChannel < 0
+       || header.firstChannel + header.nChannels > nChannels)
+        return false;
+
+    int stream = findStream(name);
+    Stats &st = stats[stream];
+    st.blocks++;
+    st.samples += header.nSamples;
+
+    // the part of the block that can still be read and fits in the ring.
+    // Until the output starts, the newest samples simply replace the oldest
+    int64 first = header.sampleNum;
+    int64 last = first + header.nSamples;
+    int64 lo = jmax(first, started ? readPosition : (int64)0);
+    int64 hi = started ? jmin(last, readPosition + capacity) : last;
+    if(lo > first)
+        st.late += jmin(lo, last) - first;
+    if(hi < last)
+        st.overrun += last - jmax(hi, first);
+    if(!started && last - lo > capacity)
+        lo = last - capacity;
+    if(hi <= lo)
+        return true;
+
+    const int mask = capacity - 1;
+    for(int c = 0; c < header.nChannels; c++)
+    {
+        int ch = header.firstChannel + c;
+        owners[ch] = stream;
+        const float *in = data + (size_t)c * header.nSamples + (lo - first);
+        float *ring = samples + (size_t)ch * capacity;
+        int64 *tag = tags + (size_t)ch * capacity;
+        // in at most two pieces, around the end of the ring
+        for(int64 s = lo; s < hi; )
+        {
+            int pos = (int)(s & mask);
+            int n = (int)jmin(hi - s, (int64)(capacity - pos));
+            FloatVectorOperations::copy(ring + pos, in, n);
+            for(int i = 0; i < n; i++)
+                tag[pos + i] = s + i;
+            in += n;
+            s += n;
+        }
+    }
+    return true;
+}
+
+void ZmqInjector::render(AudioSampleBuffer &buffer, int firstChannel, int64 timestamp, int nSamples)
+{
+    int64 from = timestamp - delaySamples;
+    if(!started)
+    {
+        readPosition = from;
+        started = true;
+    }
+
+    const int mask = capacity - 1;
+    int nCh = jmin(nChannels, buffer.getNumChannels() - firstChannel);
+    for(int ch = 0; ch < nCh; ch++)
+    {
+        float *out = buffer.getWritePointer(firstChannel + ch);
+        const float *ring = samples + (size_t)ch * capacity;
+        const int64 *tag = tags + (size_t)ch * capacity;
+        int64 missing = 0;
+        for(int i = 0; i < nSamples; i++)
+        {
+            int64 s = from + i;
+            int pos = (int)(s & mask);
+            if(s >= 0 && tag[pos] == s)
+            {
+                out[i] = ring[pos];
+            }
+            else
+            {
+                out[i] = 0.f;
+                missing++;
+            }
+        }
+        // channels nobody wrote to yet are just silent
+        if(owners[ch] >= 0)
+            stats[owners[ch]].underrun += missing;
+    }
+    readPosition = from + nSamples;
+}
@@ -0,0 +1,125 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqInjector.h
+    Created: 19 Oct 2026 5:57:21am
+
+  ==============================================================================
+*/
+
+#ifndef ZMQINJECTOR_H_INCLUDED
+#define ZMQINJECTOR_H_INCLUDED
+
+#include <ProcessorHeaders.h>
+
+
+/** Binary header of an injected block, the second frame of the message (the
+ first is the stream name, the third the float32 n_channels x n_samples data) */
+struct ZmqInjectHeader {
+    int64 sampleNum; // timestamp of the first sample, as in the DATA messages
+    int32 firstChannel; // 0-based, among the injected channels
+    int32 nChannels;
+    int32 nSamples;
+    int32 reserved;
+};
+
+
+//=============================================================================
+/** Jitter buffer for the continuous channels computed by the clients and
+ injected back into the signal chain.
+
+ Each injected channel has a ring of samples tagged with their sample number.
+ Blocks are written as they arrive, in any order, and the output is read a
+ fixed delay behind the timestamp of the current block, so that blocks coming
+ back late by less than the delay are still in time. A sample missing when
+ it is read gives a zero (underrun), a sample older than what was already
+ read is dropped (late), and so is a sample too far ahead for the ring
+ (overrun).
+
+ All the allocation happens in prepare(), so write() and render() are safe
+ to call from the audio thread.
+ */
+class ZmqInjector
+{
+public:
+    ZmqInjector();
+
+    /** Sets up the rings of nChannels channels, for a delay of delaySamples */
+    void prepare(int nChannels, int delaySamples);
+
+    /** Forgets the samples and the statistics, e.g. at the start of acquisition */
+    void reset();
+
+    int getNumChannels() const { return nChannels; }
+    int getDelaySamples() const { return delaySamples; }
+
+    /** Stores one block of the stream called name. data holds
+     header.nChannels * header.nSamples floats, channel-major. False if the
+     block doesn't fit the injected channels */
+    bool write(const char *name, const ZmqInjectHeader &header, const float *data);
+
+    /** Writes nSamples samples of every injected channel into the buffer
+     channels starting at firstChannel, for the block starting at timestamp */
+    void render(AudioSampleBuffer &buffer, int firstChannel, int64 timestamp, int nSamples);
+
+    /** Counts a message that couldn't be decoded */
+    void addMalformed() { malformed++; }
+    int64 getMalformed() const { return malformed; }
+
+    struct Stats {
+        char name[32];
+        int64 blocks, samples;
+        int64 late, overrun; // samples dropped on arrival
+        int64 underrun; // samples missing at output time
+    };
+    enum { MAX_STREAMS = 8 };
+
+    int getNumStreams() const { return nStreams; }
+    const Stats &getStats(int stream) const { return stats[stream]; }
+
+private:
+    int findStream(const char *name);
+
+    int nChannels = 0;
+    int delaySamples = 0;
+    int capacity = 0; // per channel, a power of two
+    HeapBlock<float> samples; // channel-major rings
+    HeapBlock<int64> tags; // sample number stored at each position
+    HeapBlock<int> owners; // per channel, last stream that wrote to it
+    int64 readPosition = 0; // next sample number to output
+    bool started = false;
+
+    Stats stats[MAX_STREAMS];
+    int nStreams = 0;
+    int64 malformed = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ZmqInjector);
+};
+
+
+#endif  // ZMQINJECTOR_H_INCLUDED
@@ -36,36 +36,115 @@
 
 #include <zmq.h>
 #include <string.h>
+#include <stdio.h>
 #include <iostream>
 #include <time.h>
 #include <errno.h>
+#include <sched.h>
 #include <SpikeLib.h>
 #include "ZmqInterface.h"
 #include "ZmqInterfaceEditor.h"
+#include "ZmqPublisher.h"
+#include "ZmqMessagePlan.h"
+#include "ZmqTracer.h"
 
-#define DEBUG_ZMQ
 const int MAX_MESSAGE_LENGTH = 64000;
 
+// the Open Ephys event types have codes 0 to NUM_EVENT_TYPES - 1, the
+// unknown ones are published as OTHER_EVENT
+static const int NUM_EVENT_TYPES = 7;
+static const int OTHER_EVENT = NUM_EVENT_TYPES;
+// names in the EVENT topics, in the order of the codes
+static const char *eventTypeNames[OTHER_EVENT + 1] = { "TIMESTAMP", "BUFFER_SIZE",
+    "PARAMETER_CHANGE", "TTL", "SPIKE", "MESSAGE", "BINARY_MSG", "OTHER" };
+
+// only real events go through the pipe to the audio thread, heartbeats are
+// dealt with in the listening thread
 struct EventData {
     uint8 type;
     uint8 eventId;
     uint8 eventChannel;
     uint8 numBytes;
     int sampleNum;
-    time_t eventTime;
-    char application[256];
-    char uuid[256];
-    bool isEvent;
 };
 
 
 ZmqInterface::ZmqInterface(const String &processorName)
     : GenericProcessor(processorName), Thread("Zmq thread")
 {
-    createContext();
-    threadRunning = false;
-    openListenSocket();
-    openKillSocket();
+    // FEATURES stream: per block, per channel summary (see ZmqFeatureExtractor)
+    options.set("features_enabled", false);
+    options.set("features_band_low", 300.0);
+    options.set("features_band_high", 3000.0);
+    // SPIKES stream: threshold crossings detected in the plugin (see ZmqSpikeDetector)
+    options.set("spikes_enabled", false);
+    options.set("spikes_channels", String()); // e.g. "1-16,33", empty for all
+    options.set("spikes_threshold", 4.5);
+    options.set("spikes_pre_samples", 8);
+    options.set("spikes_post_samples", 24);
+    // liveness of the connected applications, in seconds
+    options.set("clients_timeout", 10.0);
+    options.set("clients_check_interval", 0.25);
+    // DATA streams: consecutive blocks packed in one message, as long as the
+    // first one is not delayed by more than coalesce_max_latency_ms
+    options.set("coalesce_max_latency_ms", 0.0); // 0 for one block per message
+    options.set("coalesce_topics", String()); // e.g. "DATA/100", empty for all
+    // DATA contents, changed on the fly (see DataConfig): channels published,
+    // boxcar decimation and sample format ("float32", or "int16" in units of
+    // the bit volts of the first channel of the stream)
+    options.set("data_channels", String()); // e.g. "1-16,33", empty for all
+    options.set("data_decimation", 1);
+    options.set("data_format", String("float32"));
+    // sockets, rebound on the fly
+    options.set("data_port", 5556);
+    options.set("listen_port", 5557);
+    options.set("latest_port", 5558); // conflated, newest message only
+    options.set("reliable_port", 5559); // credit based, no silent loss
+    options.set("inject_port", 5560); // blocks injected into the signal chain
+    // "latest only" socket for dashboards, messages per second and envelope
+    options.set("latest_rate", 0.0); // 0 for off
+    // credit based consumers: queue size per consumer, and silence before they
+    // are forgotten, in seconds
+    options.set("reliable_budget_mb", 256);
+    options.set("reliable_timeout", 30.0);
+    // ZeroMQ context, applied by restarting the network side (while not
+    // acquiring). CPU lists like "2-3", empty to leave it to the system
+    options.set("zmq_io_threads", 1);
+    options.set("zmq_cpu_affinity", String());
+    options.set("zmq_sched_policy", String()); // "fifo", "rr", "other" or empty
+    options.set("zmq_thread_priority", 0); // 0 for the system default
+    // our own threads (priorities 0-10, 5 is normal), applied right away
+    options.set("listener_priority", 5);
+    options.set("listener_cpu_affinity", String());
+    options.set("publisher_priority", 5);
+    options.set("publisher_cpu_affinity", String());
+    // continuous channels sent back by the clients, added after the input
+    // channels and played out inject_delay_ms behind the acquisition
+    options.set("inject_channels", 0); // 0 for none
+    options.set("inject_delay_ms", 50.0);
+    options.set("inject_bit_volts", 0.195); // resolution when recorded
+    // PSTH stream: spikes of each electrode binned around the rising edges of
+    // the TTL channels (see ZmqPsth), snapshots per second
+    options.set("psth_enabled", false);
+    options.set("psth_triggers", String()); // TTL channels from 1, e.g. "1,3", empty for all
+    options.set("psth_pre_ms", 100.0);
+    options.set("psth_post_ms", 500.0);
+    options.set("psth_bin_ms", 10.0);
+    options.set("psth_rate", 2.0);
+    psthIntervalMs = 500;
+    // SPIKE_FEATURES stream: peak, trough, width and principal component
+    // projections of the upstream spike waveforms (see ZmqSpikeFeatures)
+    options.set("spike_features_enabled", false);
+    options.set("spike_features_pcs", 3);
+    options.set("spike_features_refresh", 1000); // spikes per electrode between basis updates
+    // SYNC messages pairing sample numbers with the host clocks, in seconds
+    options.set("sync_interval", 1.0); // 0 for off
+    // stages of the audio, listening and publisher threads recorded for
+    // chrome://tracing (see ZmqTracer), saved from the editor
+    options.set("trace_enabled", false);
+    syncIntervalMs = 1000;
+    
+    startNetwork();
     
     
     // TODO mock implementation
@@ -91,32 +170,264 @@ ZmqInterface::ZmqInterface(const String &processorName)
 
 ZmqInterface::~ZmqInterface()
 {
-    threadRunning = false;
-    // send the kill signal to the thread
+    cancelPendingUpdate();
+    stopTimer();
+    stopNetwork();
+}
+
+/** Creates the context with the zmq_* options, the publisher thread with its
+ streams, and the listening thread */
+void ZmqInterface::startNetwork()
+{
+    createContext();
+    publisher = new ZmqPublisher(context, getOption("data_port"), getOption("latest_port"),
+                                 getOption("reliable_port"));
+    eventStreams.clearQuick();
+    for(int type = 0; type <= OTHER_EVENT; type++)
+        eventStreams.add(publisher->addStream(String("EVENT/") + eventTopic(type)));
+    featuresStream = publisher->addStream("FEATURES");
+    spikesStream = publisher->addStream("SPIKES");
+    psthStream = publisher->addStream("PSTH");
+    spikeFeaturesStream = publisher->addStream("SPIKE_FEATURES");
+    statusStream = publisher->addStream("STATUS");
+    syncStream = publisher->addStream("SYNC");
+    publisher->setLatestRate(getOption("latest_rate"));
+    publisher->setReliableLimits((int64)(int)getOption("reliable_budget_mb") << 20,
+                                 1000. * (double)getOption("reliable_timeout"));
+    publisher->setAffinityMask(parseCpuMask(getOption("publisher_cpu_affinity")));
+    publisher->startThread(getOption("publisher_priority"));
     
-    zmq_msg_t messageEnvelope;
-    zmq_msg_init_size(&messageEnvelope, strlen("STOP")+1);
-    memcpy(zmq_msg_data(&messageEnvelope), "STOP", strlen("STOP")+1);
-    zmq_msg_send(&messageEnvelope, killSocket, 0);
-    zmq_msg_close(&messageEnvelope);
+    // bound even without injected channels, so that clients can connect
+    // before the signal chain is set up
+    injectSocket = zmq_socket(context, ZMQ_PULL);
+    int linger = 0;
+    zmq_setsockopt(injectSocket, ZMQ_LINGER, &linger, sizeof(linger));
+    injectEndpoint = String::empty;
+    bindInjectSocket(getOption("inject_port"));
+    
+    threadRunning = false;
+    setAffinityMask(parseCpuMask(getOption("listener_cpu_affinity")));
+    openListenSocket();
+}
+
+/** Deterministic and quick: shutting the context down makes the zmq_poll()
+ of the listening and publisher threads fail right away, they close their
+ sockets (all with ZMQ_LINGER 0) and exit, and we join them */
+void ZmqInterface::stopNetwork()
+{
+    threadRunning = false;
+    signalThreadShouldExit();
+    if(publisher)
+        publisher->signalThreadShouldExit();
     
-    stopThread(200); // this is probably overkill but won't hurt
     closeDataSocket();
-    zmq_close(killSocket);
-    zmq_close(pipeOutSocket);
+    if(pipeOutSocket)
+    {
+        zmq_close(pipeOutSocket);
+        pipeOutSocket = 0;
+    }
+    settleInjectSocket();
+    if(injectSocket)
+    {
+        zmq_close(injectSocket);
+        injectSocket = 0;
+    }
     
-    sleep(500);
+    if(context)
+        zmq_ctx_shutdown(context);
+    waitForThreadToExit(-1);
+    publisher = nullptr;
     
     if(context)
     {
-        zmq_ctx_destroy(context);
+        zmq_ctx_term(context);
         context = 0;
     }
 }
 
-OwnedArray<ZmqApplication> *ZmqInterface::getApplicationList()
+/** The context options only apply to a new context. The audio thread opens
+ its sockets again at the next block */
+void ZmqInterface::restartNetwork()
+{
+    std::cout << "restarting the ZeroMQ context" << std::endl;
+    stopNetwork();
+    startNetwork();
+    prepareStreams();
+}
+
+Array<ZmqApplication> ZmqInterface::getApplications() const
+{
+    const ScopedLock sl(applicationLock);
+    Array<ZmqApplication> apps;
+    for(int i = 0; i < applications.size(); i++)
+        apps.add(*applications[i]);
+    return apps;
+}
+
+var ZmqInterface::getOption(const Identifier &name) const
+{
+    const ScopedLock sl(optionLock);
+    return options[name];
+}
+
+NamedValueSet ZmqInterface::getOptions() const
+{
+    const ScopedLock sl(optionLock);
+    return options;
+}
+
+bool ZmqInterface::hasOption(const Identifier &name) const
+{
+    const ScopedLock sl(optionLock);
+    return options.contains(name);
+}
+
+bool ZmqInterface::setOption(const Identifier &name, const var &value)
+{
+    {
+        const ScopedLock sl(optionLock);
+        if(!options.contains(name))
+        {
+            std::cout << "unknown option " << name.toString() << std::endl;
+            return false;
+        }
+        
+        const var &current = options[name];
+        var v;
+        if(current.isBool())
+        {
+            if(value.isString())
+                v = value.toString().equalsIgnoreCase("true") || value.toString().getIntValue() != 0;
+            else
+                v = (bool)value;
+        }
+        else if(current.isInt() || current.isInt64())
+            v = (int)value;
+        else if(current.isDouble())
+            v = (double)value;
+        else
+            v = value.toString();
+        if(v == current)
+            return true;
+        options.set(name, v);
+    }
+    applyOption(name);
+    return true;
+}
+
+void ZmqInterface::setOptions(const NamedValueSet &values)
+{
+    settingOptions++;
+    for(int i = 0; i < values.size(); i++)
+        setOption(values.getName(i), values.getValueAt(i));
+    if(--settingOptions == 0 && restartQueued)
+    {
+        restartQueued = false;
+        if(!acquisitionActive)
+            restartNetwork();
+        else
+            restartPending = true;
+    }
+}
+
+void ZmqInterface::applyOption(const Identifier &name)
 {
-    return &applications;
+    // options read by process() are mirrored in atomics, the others are
+    // picked up at the next updateSettings() or start of acquisition
+    if(name == Identifier("features_enabled"))
+    {
+        featuresEnabled = (bool)getOption(name) ? 1 : 0;
+    }
+    else if(name == Identifier("spikes_enabled"))
+    {
+        spikesEnabled = (bool)getOption(name) ? 1 : 0;
+    }
+    else if(name == Identifier("psth_enabled"))
+    {
+        psthEnabled = (bool)getOption(name) ? 1 : 0;
+    }
+    else if(name == Identifier("spike_features_enabled"))
+    {
+        spikeFeaturesEnabled = (bool)getOption(name) ? 1 : 0;
+    }
+    else if(name == Identifier("psth_rate"))
+    {
+        psthIntervalMs = roundToInt(1000. / jmax(0.01, (double)getOption(name)));
+    }
+    else if(name == Identifier("sync_interval"))
+    {
+        syncIntervalMs = roundToInt(1000. * (double)getOption(name));
+    }
+    else if(name == Identifier("trace_enabled"))
+    {
+        ZmqTracer::setEnabled(getOption(name));
+    }
+    else if(name == Identifier("latest_rate"))
+    {
+        publisher->setLatestRate(getOption(name));
+    }
+    else if(name.toString().endsWith("_port"))
+    {
+        if(name == Identifier("listen_port"))
+            listenPortChanged = 1;
+        else if(name == Identifier("inject_port"))
+            bindInjectSocket(getOption(name));
+        else
+            publisher->setPorts(getOption("data_port"), getOption("latest_port"),
+                                getOption("reliable_port"));
+    }
+    else if(name.toString().startsWith("data_") || name.toString().startsWith("coalesce_"))
+    {
+        // handed over to process() without stopping (see DataConfig)
+        prepareDataGroups();
+    }
+    else if(name.toString().startsWith("zmq_"))
+    {
+        if(settingOptions > 0)
+            restartQueued = true; // once all are set
+        else if(!acquisitionActive)
+            restartNetwork();
+        else
+            restartPending = true; // at the end of acquisition
+    }
+    else if(name == Identifier("listener_priority"))
+    {
+        setPriority(getOption(name));
+    }
+    else if(name == Identifier("listener_cpu_affinity"))
+    {
+        listenerAffinity = (int)parseCpuMask(getOption(name));
+        listenerAffinityChanged = 1;
+    }
+    else if(name == Identifier("publisher_priority"))
+    {
+        publisher->setPriority(getOption(name));
+    }
+    else if(name == Identifier("publisher_cpu_affinity"))
+    {
+        publisher->setCpuAffinity(parseCpuMask(getOption(name)));
+    }
+    else if(name.toString().startsWith("reliable_"))
+    {
+        publisher->setReliableLimits((int64)(int)getOption("reliable_budget_mb") << 20,
+                                     1000. * (double)getOption("reliable_timeout"));
+    }
+    else if(name == Identifier("inject_channels") || name == Identifier("inject_bit_volts"))
+    {
+        // the number of output channels changes, the whole chain must know
+        if(!acquisitionActive && editor != nullptr)
+            CoreServices::updateSignalChain(editor);
+    }
+    else if(name == Identifier("inject_delay_ms") && !acquisitionActive)
+    {
+        prepareInjector();
+    }
+    else if((name.toString().startsWith("features_") || name.toString().startsWith("spikes_") ||
+             name.toString().startsWith("psth_") || name.toString().startsWith("spike_features_"))
+             && !acquisitionActive)
+    {
+        prepareStreams();
+    }
 }
 
 int ZmqInterface::createContext()
@@ -124,6 +435,29 @@ int ZmqInterface::createContext()
     context = zmq_ctx_new();
     if(!context)
         return -1;
+    
+    // must be set before the first socket, which starts the I/O threads
+    zmq_ctx_set(context, ZMQ_IO_THREADS, jmax(1, (int)getOption("zmq_io_threads")));
+#ifdef ZMQ_THREAD_AFFINITY_CPU_ADD
+    uint32 mask = parseCpuMask(getOption("zmq_cpu_affinity"));
+    for(int cpu = 0; cpu < 32 && mask != 0xffffffff; cpu++)
+    {
+        if(mask & (1u << cpu))
+            zmq_ctx_set(context, ZMQ_THREAD_AFFINITY_CPU_ADD, cpu);
+    }
+#endif
+#ifdef ZMQ_THREAD_SCHED_POLICY
+    String policy = getOption("zmq_sched_policy").toString().trim().toLowerCase();
+    if(policy == "fifo")
+        zmq_ctx_set(context, ZMQ_THREAD_SCHED_POLICY, SCHED_FIFO);
+    else if(policy == "rr")
+        zmq_ctx_set(context, ZMQ_THREAD_SCHED_POLICY, SCHED_RR);
+    else if(policy == "other")
+        zmq_ctx_set(context, ZMQ_THREAD_SCHED_POLICY, SCHED_OTHER);
+    int priority = getOption("zmq_thread_priority");
+    if(priority > 0)
+        zmq_ctx_set(context, ZMQ_THREAD_PRIORITY, priority);
+#endif
     return 0;
 }
 
@@ -131,16 +465,18 @@ int ZmqInterface::createDataSocket()
 {
     if(!socket)
     {
-        socket = zmq_socket(context, ZMQ_PUB);
+        // the pipe to the publisher thread, which owns the actual data socket
+        socket = zmq_socket(context, ZMQ_PAIR);
         if(!socket)
             return -1;
-        String urlstring;
-        urlstring = String("tcp://*:") + String(dataPort);
-        std::cout << urlstring << std::endl;
-        int rc = zmq_bind(socket, urlstring.toRawUTF8());
+        int hwm = 10000;
+        zmq_setsockopt(socket, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+        int linger = 0;
+        zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+        int rc = zmq_connect(socket, ZmqPublisher::PIPE_URL);
         if(rc)
         {
-            std::cout << "couldn't open data socket" << std::endl;
+            std::cout << "couldn't connect to the publisher" << std::endl;
             std::cout << zmq_strerror(zmq_errno()) << std::endl;
             jassert(false);
         }
@@ -179,106 +515,163 @@ int ZmqInterface::closeListenSocket()
     return rc;
 }
 
-void ZmqInterface::openKillSocket()
-{
-    killSocket = zmq_socket(context, ZMQ_PAIR);
-    zmq_connect(killSocket, "inproc://zmqthreadcontrol");
-}
 
 void ZmqInterface::openPipeOutSocket()
 {
     pipeOutSocket = zmq_socket(context, ZMQ_PAIR);
+    int linger = 0;
+    zmq_setsockopt(pipeOutSocket, ZMQ_LINGER, &linger, sizeof(linger));
     zmq_bind(pipeOutSocket, "inproc://zmqthreadpipe");
 }
 
+/** By the listening thread */
+void ZmqInterface::bindListenSocket()
+{
+    ZmqPublisher::rebindSocket(listenSocket, getOption("listen_port"), listenEndpoint, "listen");
+}
+
+/** By the message thread. While acquiring the socket is process()'s, so the
+ port is bound by a new socket that process() takes at its next block */
+void ZmqInterface::bindInjectSocket(int port)
+{
+    if(!acquisitionActive)
+    {
+        settleInjectSocket();
+        ZmqPublisher::rebindSocket(injectSocket, port, injectEndpoint, "inject");
+        return;
+    }
+    if(injectEndpoint.endsWith(String(":") + String(port)))
+        return; // bound already, by the socket in use or the one on its way
+    void *socket = zmq_socket(context, ZMQ_PULL);
+    int linger = 0;
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+    String endpoint;
+    if(!ZmqPublisher::rebindSocket(socket, port, endpoint, "inject"))
+    {
+        zmq_close(socket);
+        return;
+    }
+    injectEndpoint = endpoint;
+    // one not taken yet was never read, it can go
+    void *stale = nextInjectSocket.exchange(socket);
+    if(stale)
+        zmq_close(stale);
+}
+
+/** By the message thread while process() isn't running: finishes the socket
+ changes of bindInjectSocket() */
+void ZmqInterface::settleInjectSocket()
+{
+    void *retired = retiredInjectSocket.exchange(nullptr);
+    if(retired)
+        zmq_close(retired);
+    void *next = nextInjectSocket.exchange(nullptr);
+    if(next)
+    {
+        zmq_close(injectSocket);
+        injectSocket = next;
+    }
+}
+
 void ZmqInterface::run()
 {
     listenSocket = zmq_socket(context, ZMQ_REP);
-    String urlstring;
-    urlstring = String("tcp://*:") + String(listenPort);
-    int rc = zmq_bind(listenSocket, urlstring.toRawUTF8()); // give the chance to change the port
-    jassert(rc == 0);
+    if(!listenSocket)
+        return; // stopped before we even started
+    int linger = 0;
+    zmq_setsockopt(listenSocket, ZMQ_LINGER, &linger, sizeof(linger));
+    listenEndpoint = String::empty;
+    listenPortChanged = 0;
+    bindListenSocket();
     threadRunning = true;
     char* buffer = new char[MAX_MESSAGE_LENGTH];
 
     int size;
 
-    controlSocket = zmq_socket(context, ZMQ_PAIR);
-    zmq_bind(controlSocket, "inproc://zmqthreadcontrol");
-    
     pipeInSocket = zmq_socket(context, ZMQ_PAIR);
+    zmq_setsockopt(pipeInSocket, ZMQ_LINGER, &linger, sizeof(linger));
     zmq_connect(pipeInSocket, "inproc://zmqthreadpipe");
     
     zmq_pollitem_t items [] = {
-        { listenSocket, 0, ZMQ_POLLIN, 0 },
-        { controlSocket, 0, ZMQ_POLLIN, 0 }
+        { listenSocket, 0, ZMQ_POLLIN, 0 }
     };
     
+    double lastCheck = Time::getMillisecondCounterHiRes();
 
     while(threadRunning && (!threadShouldExit()))
     {
-        zmq_poll (items, 2, -1);
+        // wake up at least once per check interval, so that applications
+        // going silent are noticed even without traffic
+        double checkInterval = 1000. * (double)getOption("clients_check_interval");
+        // fails with ETERM when stopNetwork() shuts the context down
+        zmq_poll (items, 1, jmax(1, (int)checkInterval));
+        if(listenerAffinityChanged.compareAndSetBool(0, 1))
+            setCurrentThreadAffinityMask((uint32)listenerAffinity.get());
+        if(listenPortChanged.compareAndSetBool(0, 1))
+            bindListenSocket();
+        double now = Time::getMillisecondCounterHiRes();
+        
         if(items[0].revents & ZMQ_POLLIN)
         {
+            ZMQ_TRACE("listen request");
+            ++listenRequests;
             size = zmq_recv(listenSocket, buffer, MAX_MESSAGE_LENGTH-1, 0);
-            buffer[size] = 0;
-            
-
-            
             if(size < 0)
             {
                 std::cout << "failed in receiving listen socket" << std::endl;
                 std::cout << zmq_strerror(zmq_errno()) << std::endl;
                 jassert(false);
+                break;
             }
+            buffer[jmin(size, MAX_MESSAGE_LENGTH-1)] = 0;
+            
             var v;
 #ifdef ZMQ_DEBUG
             std::cout << "in listening thread: " << String(buffer) << std::endl;
 #endif
             Result rs = JSON::parse(String(buffer), v);
             bool ok = rs.wasOk();
-
-
-            EventData ed;
-            String app = v["application"];
-            String appUuid = v["uuid"];
-            strncpy(ed.application, app.toRawUTF8(),  255);
-            strncpy(ed.uuid, appUuid.toRawUTF8(), 255);
-            ed.eventTime = time(NULL);
+            bool isEvent = false;
+            String configResponse;
             
-            String evT = v["type"];
-            
-            if(evT == "event")
-            {
-                ed.isEvent = true;
-                ed.eventChannel = (int)v["event"]["event_channel"];
-                ed.eventId = (int)v["event"]["event_id"];
-                ed.numBytes = 0; // TODO  allow for event data
-                ed.sampleNum = (int)v["event"]["sample_num"];
-                ed.type = (int)v["event"]["type"];
-//                std::cout << "chan " << (int)ed.eventChannel << " id " << (int)ed.eventId << " sample n "
-//                    << (int)ed.sampleNum << " type " << (int)ed.type <<
-//                    std::endl;
-            }
-            else
+            if(ok)
             {
-                ed.isEvent = false;
+                // heartbeats and events both tell that the application is alive
+                applicationSeen(v["application"], v["uuid"], now);
+                
+                String evT = v["type"];
+                if(evT == "event")
+                {
+                    isEvent = true;
+                    EventData ed;
+                    ed.eventChannel = (int)v["event"]["event_channel"];
+                    ed.eventId = (int)v["event"]["event_id"];
+                    ed.numBytes = 0; // TODO  allow for event data
+                    ed.sampleNum = (int)v["event"]["sample_num"];
+                    ed.type = (int)v["event"]["type"];
+                    
+                    zmq_msg_t message;
+                    zmq_msg_init_size(&message, sizeof(EventData));
+                    memcpy(zmq_msg_data(&message), &ed, sizeof(EventData));
+                    int size_m = zmq_msg_send(&message, pipeInSocket, 0);
+                    jassert(size_m);
+                    zmq_msg_close(&message);
+                }
+                else if(evT == "config")
+                {
+                    configResponse = handleConfigRequest(v);
+                }
             }
             
-            // TODO allow for event data
-            zmq_msg_t message;
-            zmq_msg_init_size(&message, sizeof(EventData));
-            memcpy(zmq_msg_data(&message), &ed, sizeof(EventData));
-            int size_m = zmq_msg_send(&message, pipeInSocket, 0);
-            jassert(size_m);
-            size += size_m;
-            zmq_msg_close(&message);
-            
             // send response
             String response;
             if(ok)
             {
-                if(ed.isEvent)
+                if(configResponse.isNotEmpty())
+                {
+                    response = configResponse;
+                }
+                else if(isEvent)
                 {
                     response = String("message correctly parsed");
                 }
@@ -292,36 +685,151 @@ void ZmqInterface::run()
                 response = String("JSON message could not be read");
             }
             zmq_send(listenSocket, response.getCharPointer(), response.length(), 0);
-            if((!threadRunning) || threadShouldExit())
-                break; // we're exiting
-
         }
-        else
-            break;
         
+        if(now - lastCheck >= checkInterval)
+        {
+            checkForApplications(now);
+            lastCheck = now;
+        }
     }
     closeListenSocket();
     
     zmq_close(pipeInSocket);
-    zmq_close(controlSocket);
     delete[] buffer;
     threadRunning = false;
     return;
 }
 
+/** {"type": "config", "set": {"option": value, ...}} on the listen socket.
+ Known options are queued for the message thread, which applies them as the
+ editor would (see applyOption()). The reply lists them, and all the options
+ with their values before the change: {"type": "config", "accepted": [...],
+ "unknown": [...], "options": {...}}. Without "set", only the options */
+String ZmqInterface::handleConfigRequest(const var &request)
+{
+    Array<var> accepted, unknown;
+    DynamicObject *set = request["set"].getDynamicObject();
+    if(set)
+    {
+        const NamedValueSet &values = set->getProperties();
+        {
+            const ScopedLock sl(pendingOptionLock);
+            for(int i = 0; i < values.size(); i++)
+            {
+                if(hasOption(values.getName(i)))
+                {
+                    pendingOptions.set(values.getName(i), values.getValueAt(i));
+                    accepted.add(values.getName(i).toString());
+                }
+                else
+                    unknown.add(values.getName(i).toString());
+            }
+        }
+        if(accepted.size() > 0)
+            triggerAsyncUpdate();
+    }
+    
+    DynamicObject::Ptr current = new DynamicObject();
+    NamedValueSet all = getOptions();
+    for(int i = 0; i < all.size(); i++)
+        current->setProperty(all.getName(i), all.getValueAt(i));
+    
+    DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty("type", "config");
+    obj->setProperty("accepted", accepted);
+    obj->setProperty("unknown", unknown);
+    obj->setProperty("options", var(current));
+    return JSON::toString(var(obj), true);
+}
+
+/** The option changes received by the listening thread, and the data plans
+ process() found too small */
+void ZmqInterface::handleAsyncUpdate()
+{
+    NamedValueSet changes;
+    {
+        const ScopedLock sl(pendingOptionLock);
+        changes = pendingOptions;
+        pendingOptions.clear();
+    }
+    setOptions(changes);
+    if(dataPlansTooSmall.compareAndSetBool(0, 1))
+        prepareDataGroups();
+    // replaced by process(), see bindInjectSocket()
+    void *retired = retiredInjectSocket.exchange(nullptr);
+    if(retired)
+        zmq_close(retired);
+}
+
 /* format for passing data
  JSON
  { "messageNo": number,
  "type": "data"|"event"|"parameter",
  "content":
- (for data)
- { "nChannels": nChannels,
- "nSamples": nSamples
+ (for data, envelope "DATA/<source node id>/<sample rate>", one message per
+ group of channels with the same source and sample rate)
+ { "nChannels": nChannels in the group,
+ "nSamples": nSamples in this message (no padding),
+ "n_real_samples": same as nSamples,
+ "timestamp": timestamp of the first sample,
+ "sequence": message number within the group,
+ "n_blocks": blocks packed in this message (see coalesce_max_latency_ms),
+ "source_node_id", "sample_rate" (of the samples sent),
+ "decimation": with data_decimation > 1, samples averaged in each sample sent
+ (the timestamps stay in input samples),
+ "dtype": "int16" and "scale": with data_format int16, value = sample * scale
+ }
+ with "schema_id" next to "content", matching the last metadata message.
+ The channels (data_channels), decimation and format can change while
+ acquiring, the schema id tells which configuration a message belongs to
+ (for metadata, envelope "METADATA", message_no -1, sent again to every new
+ subscriber)
+ {
+ "schema_id": id of this layout,
+ "n_channels": nChannels,
+ "channels": [{"name", "bit_volts", "sample_rate", "source_node_id"}, ...],
+ "sources": [{"topic", "source_node_id", "sample_rate", "decimation", "dtype",
+ "channels": [indices]}, ...]
+ }
+ (for status, envelope "STATUS", message_no -1, every second)
+ {
+ "dropped_messages": messages dropped because the publisher was behind,
+ "reliable_consumers": consumers connected to the credit based port,
+ "reliable_dropped": messages dropped over reliable_budget_mb since the start,
+ all consumers together (each one gets an OVERRUN message),
+ "unpublished_topics": DATA streams left out, past the streams the publisher
+ can track,
+ "inject": {"channels", "delay_samples", "malformed", "streams"}, with
+ injected channels only (see below),
+ "timing": {"blocks", "interval_mean_ms", "interval_sd_ms", "interval_min_ms",
+ "interval_max_ms", "process_mean_ms", "process_max_ms", "received_events",
+ "receive_mean_ms", "receive_max_ms"}, period of the calls to process() and
+ time spent in them, and in taking the events of the applications,
+ "listen_requests": requests (heartbeats, events, ...) answered by the
+ listening thread since the previous status,
+ "streams": [{"topic", "messages", "blocks", "bytes", "blocks_per_message",
+ "max_latency_ms", "mean_added_latency_ms", "max_added_latency_ms",
+ "messages_per_s", "mbytes_per_s"}, ...]
+ }
+ (for sync, envelope "SYNC", message_no -1, every sync_interval seconds)
+ {
+ "sequence": number of this sync message,
+ "monotonic_ns", "realtime_ns": CLOCK_MONOTONIC and CLOCK_REALTIME at the
+ start of process(),
+ "sources": [{"topic", "source_node_id", "sample_rate", "sample_num"}, ...]
+ with sample_num the number of samples acquired so far (timestamp + samples
+ of the block)
  }
- (for event)
+ (for event, envelope "EVENT/<type>/<channel>", with type one of TIMESTAMP,
+ BUFFER_SIZE, PARAMETER_CHANGE, TTL, MESSAGE, BINARY_MSG, OTHER; spikes from
+ the upstream processors use "EVENT/SPIKE/<electrode id>". Subscribe to
+ "EVENT/TTL/" for all the TTL channels, "EVENT/TTL/3\0" for channel 3 only)
  {
  "eventType": number,
- "sampleNum": sampleNum (number),
+ "sampleNum": sampleNum (number), offset of the event in the block,
+ "timestamp": timestamp of the first sample in the block, so the event is at
+ timestamp + sampleNum,
  "eventId": id (number),
  "eventChannel": channel (number),
  }
@@ -331,208 +839,949 @@ void ZmqInterface::run()
  "param_name2": param_value2,
  ...
  }
+ (for features, envelope "FEATURES")
+ {
+ "n_channels": nChannels,
+ "n_features": nFeatures,
+ "features": ["min", "max", "mean", "rms", ("band_power")],
+ "timestamp": timestamp of the first sample in the block,
+ "n_real_samples": number of samples summarized
+ }
+ followed by a float32 n_channels x n_features matrix
+ (for detected spikes, envelope "SPIKES", type "spike_batch")
+ {
+ "n_spikes": nSpikes,
+ "n_dropped": spikes not sent because the batch was full,
+ "snippet_length": samples per snippet,
+ "pre_samples": samples before the crossing in each snippet,
+ "timestamp": timestamp of the first sample in the block
+ }
+ followed by n_spikes records (int64 timestamp, int32 channel, float32 threshold)
+ and then a float32 n_spikes x snippet_length matrix, in the same frame
+ (for peri-event histograms, envelope "PSTH", type "psth", psth_rate times
+ per second, counts since the start of acquisition)
+ {
+ "timestamp": timestamp of the first sample in the block,
+ "sample_rate", "pre_ms", "post_ms", "bin_ms", "n_bins": bins from -pre_ms
+ to post_ms around the rising edges,
+ "trigger_channels": TTL event_channel of each row (as in "EVENT/TTL/<channel>"),
+ "trials": rising edges seen per trigger channel (the latest ones may not
+ have their post_ms yet),
+ "electrodes": electrode ids of the spikes from the upstream processors,
+ "n_spikes": spikes seen, "n_ignored": spikes and edges beyond the rows available
+ }
+ followed by the uint32 counts, n_triggers x n_electrodes x n_bins
+ (for the features of the upstream spikes, envelope "SPIKE_FEATURES", type
+ "spike_features", once per block with spikes)
+ {
+ "n_spikes": nSpikes,
+ "n_dropped": spikes not sent (batch full, too many electrodes or channels),
+ "feature_names": peak_<c>, trough_<c> (uV), width_<c> (trough to peak, ms)
+ for 4 channels, 0 for the missing ones, then pc_<k>,
+ "electrodes", "basis_versions", "explained_variance": the principal
+ components of each electrode, updated every spike_features_refresh spikes,
+ "timestamp": timestamp of the first sample in the block
+ }
+ followed by n_spikes records (int64 timestamp, int32 electrode_id,
+ int32 basis_version, 0 before the first basis) and then a float32
+ n_spikes x n_features matrix, in the same frame
  "dataSize": size (if size > 0 it's the size of binary data coming in in the next frame (multi-part message)
  }
  
  and then a possible data packet
+ 
+ On the "latest only" port (latest_rate > 0) the newest message of each
+ envelope is sent in a single frame: envelope, NUL, the JSON header above, NUL,
+ zeros up to the next multiple of 8 bytes, then the binary data
+ 
+ On the credit based port (DEALER clients, see ZmqPublisher) each message is
+ preceded by a uint64 sequence number, per consumer. Messages that didn't fit
+ in reliable_budget_mb are announced by an envelope "OVERRUN" message
+ (sequence 0, type "overrun") with {"first_sequence", "last_sequence",
+ "total_dropped", "budget_bytes"}
+ 
+ The other way, clients PUSH continuous blocks to the PULL socket on port 5560,
+ written into the inject_channels extra channels ("ZMQ1", ...) after the
+ input channels. Three frames: a stream name (up to 31 bytes, for the
+ statistics), a 24 byte header (int64 sample_num, int32 first_channel, int32
+ n_channels, int32 n_samples, int32 reserved, little endian) and the float32
+ n_channels x n_samples data. sample_num counts like the DATA timestamps, the
+ samples come out inject_delay_ms after the acquisition of the same sample
+ number. The "inject" part of the status message has per stream "blocks",
+ "samples", "late" and "overrun" (dropped on arrival) and "underrun" (missing
+ when played out, replaced by zeros)
+ 
+ The options can be changed on the listen socket (port 5557) as well, e.g.
+ {"application", "uuid", "type": "config", "set": {"data_decimation": 10,
+ "data_port": 6556}}, see handleConfigRequest(). Ports move without stopping,
+ the clients must connect again
  */
 
 
 
 
-int ZmqInterface::sendData(float *data, int nChannels, int nSamples, int nRealSamples)
+int ZmqInterface::sendData(const AudioSampleBuffer &buffer, DataGroup &group)
 {
-    
-    messageNumber++;
-    
+    ZMQ_TRACE("sendData");
+    int firstChannel = group.channels.getFirst();
+    // only the samples actually acquired for this group, no padding
+    int nSamples = jmin(getNumSamples(firstChannel), buffer.getNumSamples());
+    if(group.blockSamples <= 0)
+        return 0;
+    // a block larger than the plan (the buffer size changed) goes in parts
+    // until the message thread has made new plans
+    int size = 0;
+    for(int offset = 0; offset < nSamples; offset += group.blockSamples)
+        size += sendDataPart(buffer, group, offset, jmin(group.blockSamples, nSamples - offset));
+    return size;
+}
 
-    DynamicObject::Ptr obj = new DynamicObject();
+/** Samples offset to offset + nSamples of the block, at most blockSamples */
+int ZmqInterface::sendDataPart(const AudioSampleBuffer &buffer, DataGroup &group, int offset, int nSamples)
+{
+    int nChannels = group.channels.size();
+    int64 timestamp = (int64)getTimestamp(group.channels.getFirst()) + offset;
+    int size = 0;
     
-    int mn = messageNumber;
-    obj->setProperty("message_no", mn);
-    obj->setProperty("type", "data");
+    // from here on nSamples counts output samples, the timestamps stay in
+    // input samples
+    if(group.decimation > 1)
+    {
+        nSamples = decimate(buffer, group, offset, nSamples, timestamp, timestamp);
+        if(nSamples == 0)
+            return 0; // no complete average yet
+    }
     
-    DynamicObject::Ptr c_obj = new DynamicObject();
+    // a message only holds contiguous blocks
+    if(group.batchSamples > 0 &&
+       (timestamp != group.batchTimestamp + (int64)group.batchSamples * group.decimation ||
+        group.batchSamples + nSamples > group.planSamples))
+        size = flushData(group);
     
-    c_obj->setProperty("n_channels", nChannels);
-    c_obj->setProperty("n_samples", nSamples);
-    c_obj->setProperty("n_real_samples", nRealSamples);
+    if(group.batchSamples == 0)
+    {
+        group.batch = group.plan.begin();
+        group.batchTimestamp = timestamp;
+        group.batchStart = Time::getHighResolutionTicks();
+        group.firstBlockSamples = nSamples;
+    }
     
-    obj->setProperty("content", var(c_obj));
-    obj->setProperty("dataSize", (int)(nChannels * nSamples * sizeof(float)));
+    // channel i of the group goes at i * nSamples, straight into the frame.
+    // When coalescing, the channels are planSamples apart until flushData()
+    int stride = group.maxLatencySamples > 0 ? group.planSamples : nSamples;
+    for(int i = 0; i < nChannels; i++)
+    {
+        const float *in = group.decimation > 1 ? group.decimated + i * group.decimatedStride
+            : buffer.getReadPointer(group.channels.getUnchecked(i), offset);
+        char *out = group.batch + (size_t)(i * stride + group.batchSamples) * group.sampleSize;
+        if(group.scale > 0.f)
+        {
+            int16 *out16 = (int16 *)out;
+            const float k = 1.f / group.scale;
+            for(int j = 0; j < nSamples; j++)
+                out16[j] = (int16)jlimit(-32768, 32767, roundToInt(in[j] * k));
+        }
+        else
+            FloatVectorOperations::copy((float *)out, in, nSamples);
+    }
+    group.batchSamples += nSamples;
+    group.batchBlocks++;
     
-    var json(obj);
+    // send unless one more block of the same size still fits in the latency
+    // budget of the first one
+    if(group.batchSamples + nSamples - group.firstBlockSamples > group.maxLatencySamples)
+        size = flushData(group);
+    return size;
+}
+int ZmqInterface::flushData(DataGroup &group)
+{
+    ZMQ_TRACE("flushData");
+    int nChannels = group.channels.size();
+    int nSamples = group.batchSamples;
+    if(nSamples == 0)
+        return 0;
     
-    String s = JSON::toString(json);
-    void *headerData = (void *)s.toRawUTF8();
+    // close the gaps between the channels
+    if(group.maxLatencySamples > 0 && nSamples < group.planSamples)
+    {
+        for(int i = 1; i < nChannels; i++)
+            memmove(group.batch + (size_t)i * nSamples * group.sampleSize,
+                    group.batch + (size_t)i * group.planSamples * group.sampleSize,
+                    (size_t)group.sampleSize * nSamples);
+    }
     
-
-    size_t headerSize = s.length();
+    messageNumber++;
+    group.sequence++;
     
-    zmq_msg_t messageEnvelope;
-    zmq_msg_init_size(&messageEnvelope, strlen("DATA")+1);
-    memcpy(zmq_msg_data(&messageEnvelope), "DATA", strlen("DATA")+1);
-    int size = zmq_msg_send(&messageEnvelope, socket, ZMQ_SNDMORE);
-    jassert(size != -1);
-    zmq_msg_close(&messageEnvelope);
+    size_t dataSize = (size_t)group.sampleSize * nChannels * nSamples;
+    group.plan.setField(group.fields.messageNo, messageNumber);
+    group.plan.setField(group.fields.samples, nSamples);
+    group.plan.setField(group.fields.realSamples, nSamples);
+    group.plan.setField(group.fields.timestamp, group.batchTimestamp);
+    group.plan.setField(group.fields.sequence, group.sequence);
+    group.plan.setField(group.fields.blocks, group.batchBlocks);
+    group.plan.setField(group.fields.dataSize, dataSize);
+    int size = group.plan.send(socket, dataSize);
+    if(size == -1)
+    {
+        droppedMessages++;
+    }
+    else
+    {
+        double latency = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks()
+                                                            - group.batchStart) * 1000.0;
+        group.stats.messages++;
+        group.stats.blocks += group.batchBlocks;
+        group.stats.bytes += dataSize;
+        group.stats.latencySum += latency;
+        group.stats.latencyMax = jmax(group.stats.latencyMax, latency);
+    }
     
-    zmq_msg_t messageHeader;
-    zmq_msg_init_size(&messageHeader, headerSize);
-    memcpy(zmq_msg_data(&messageHeader), headerData, headerSize);
-    size = zmq_msg_send(&messageHeader, socket, ZMQ_SNDMORE);
-    jassert(size != -1);
-    zmq_msg_close(&messageHeader);
-    // std::cout << "size: " << size << std::endl;
-    
-    zmq_msg_t message;
-    zmq_msg_init_size(&message, sizeof(float)*nSamples*nChannels);
-    memcpy(zmq_msg_data(&message), data, sizeof(float)*nSamples*nChannels);
-    int size_m = zmq_msg_send(&message, socket, 0);
-    jassert(size_m);
-    size += size_m;
-    zmq_msg_close(&message);
- 
+    group.batch = nullptr;
+    group.batchSamples = 0;
+    group.batchBlocks = 0;
     return size;
 }
-
-
-int ZmqInterface::sendSpikeEvent(MidiMessage &event)
+/** Averages of group.decimation samples into group.decimated, aligned on the
+ sample numbers so that every stream and rig bins the same way. Returns the
+ number of averages completed in this block, the first one starting at
+ sample firstTimestamp */
+/** At a switch, for a stream in both configurations. The averages in
+ progress only go on if they are over the same channels and samples */
+void ZmqInterface::carryDataState(const DataGroup &from, DataGroup &to)
 {
-    messageNumber++;
-    int size = 0;
-
-    const uint8_t* dataptr = event.getRawData();
-    int bufferSize = event.getRawDataSize();
-    if(bufferSize)
+    to.sequence = from.sequence;
+    to.stats = from.stats;
+    if(to.decimation == from.decimation && to.channels == from.channels)
     {
-        SpikeObject spike;
-        bool isValid = unpackSpike(&spike, dataptr, bufferSize);
-        if(isValid)
-        {
-            DynamicObject::Ptr obj = new DynamicObject();
-            obj->setProperty("message_no", messageNumber);
-            obj->setProperty("type", "spike");
-            DynamicObject::Ptr c_obj = new DynamicObject();
-            c_obj->setProperty("timestamp", (int64)spike.timestamp);
-            c_obj->setProperty("timestamp_software",
-                             (int64)spike.timestamp_software);
-            c_obj->setProperty("n_channels", spike.nChannels);
-            c_obj->setProperty("n_samples", spike.nSamples);
-            c_obj->setProperty("electrode_id", spike.electrodeID);
-            c_obj->setProperty("channel", spike.channel);
-            c_obj->setProperty("source", spike.source);
-            var c_var(spike.color[0]);
-            c_var.append(spike.color[1]);
-            c_var.append(spike.color[2]);
-            c_obj->setProperty("color", c_var);
-            var p_var(spike.pcProj[0]);
-            p_var.append(spike.pcProj[1]);
-            c_obj->setProperty("pc_proj", p_var);
-            var g_var(spike.gain[0]);
-            for(int i = 1; i < spike.nChannels; i++)
-                g_var.append(spike.gain[i]);
-            c_obj->setProperty("gain", g_var);
-            var t_var = var(spike.threshold[0]);
-            for(int i = 1; i < spike.nChannels; i++)
-                t_var.append(spike.threshold[i]);
-            c_obj->setProperty("threshold", t_var);
-            obj->setProperty("spike", var(c_obj));
-            var json (obj);
-            String s = JSON::toString(json);
-            void *headerData = (void *)s.toRawUTF8();
-            size_t headerSize = s.length();
-            
-            
-            zmq_msg_t messageEnvelope;
-            zmq_msg_init_size(&messageEnvelope, strlen("EVENT")+1);
-            memcpy(zmq_msg_data(&messageEnvelope), "EVENT", strlen("EVENT")+1);
-            size = zmq_msg_send(&messageEnvelope, socket, ZMQ_SNDMORE);
-            jassert(size != -1);
-            zmq_msg_close(&messageEnvelope);
-
-            zmq_msg_t messageHeader;
-            zmq_msg_init_size(&messageHeader, headerSize);
-            memcpy(zmq_msg_data(&messageHeader), headerData, headerSize);
-            size = zmq_msg_send(&messageHeader, socket, ZMQ_SNDMORE);
-            jassert(size != -1);
-            zmq_msg_close(&messageHeader);
-            zmq_msg_t message;
-            zmq_msg_init_size(&message, spike.nChannels*spike.nSamples);
-            memcpy(zmq_msg_data(&message), spike.data, spike.nChannels*spike.nSamples);
-            size = zmq_msg_send(&message, socket, 0);
-            
-        }
+        FloatVectorOperations::copy(to.sums, from.sums, to.channels.size());
+        to.decimationCount = from.decimationCount;
+        to.decimationNext = from.decimationNext;
     }
-    return 0;
 }
 
-int ZmqInterface::sendEvent( uint8 type,
-                             int sampleNum,
-                             uint8 eventId,
-                             uint8 eventChannel,
-                             uint8 numBytes,
-                             const uint8* eventData)
+int ZmqInterface::decimate(const AudioSampleBuffer &buffer, DataGroup &group, int offset,
+                           int nSamples, int64 timestamp, int64 &firstTimestamp)
 {
-    int size;
+    const int d = group.decimation;
+    const int nChannels = group.channels.size();
+    if(timestamp != group.decimationNext)
+    {
+        // first block or a gap: start over at the next multiple of d
+        FloatVectorOperations::clear(group.sums, nChannels);
+        group.decimationCount = 0;
+    }
+    group.decimationNext = timestamp + nSamples;
     
-    messageNumber++;
+    int start = 0;
+    if(group.decimationCount == 0)
+        start = (int)((d - timestamp % d) % d);
+    if(start >= nSamples)
+        return 0;
+    int total = group.decimationCount + nSamples - start;
+    firstTimestamp = timestamp + start - group.decimationCount;
+    
+    for(int i = 0; i < nChannels; i++)
+    {
+        const float *in = buffer.getReadPointer(group.channels.getUnchecked(i), offset);
+        float *out = group.decimated + i * group.decimatedStride;
+        float sum = group.sums[i];
+        int count = group.decimationCount;
+        for(int j = start; j < nSamples; j++)
+        {
+            sum += in[j];
+            if(++count == d)
+            {
+                *out++ = sum / d;
+                sum = 0.f;
+                count = 0;
+            }
+        }
+        group.sums[i] = sum;
+    }
+    group.decimationCount = total % d;
+    return total / d;
+}
+
+void ZmqInterface::sendStatus(double now)
+{
+    double elapsed = (now - lastStatus) / 1000.;
+    
+    OwnedArray<DataGroup> &dataGroups = getDataConfig().groups;
+    Array<var> streams;
+    for(int i = 0; i < dataGroups.size(); i++)
+    {
+        DataGroup *group = dataGroups[i];
+        DynamicObject::Ptr st = new DynamicObject();
+        st->setProperty("topic", group->topic);
+        st->setProperty("messages", group->stats.messages);
+        st->setProperty("blocks", group->stats.blocks);
+        st->setProperty("bytes", group->stats.bytes);
+        st->setProperty("max_latency_ms", (double)group->maxLatencySamples * group->decimation * 1000.
+                        / group->sampleRate);
+        st->setProperty("blocks_per_message", group->stats.messages ?
+                        (double)group->stats.blocks / group->stats.messages : 0.);
+        st->setProperty("mean_added_latency_ms", group->stats.messages ?
+                        group->stats.latencySum / group->stats.messages : 0.);
+        st->setProperty("max_added_latency_ms", group->stats.latencyMax);
+        // since the previous status message
+        st->setProperty("messages_per_s", (group->stats.messages - group->stats.lastMessages) / elapsed);
+        st->setProperty("mbytes_per_s", (group->stats.bytes - group->stats.lastBytes) / elapsed / 1.e6);
+        group->stats.lastMessages = group->stats.messages;
+        group->stats.lastBytes = group->stats.bytes;
+        streams.add(var(st));
+    }
+    
+    // period of the process() calls and time spent in them, the jitter shows
+    // how much the audio thread is disturbed
+    DynamicObject::Ptr t_obj = new DynamicObject();
+    int64 n = timing.blocks;
+    double mean = n ? timing.intervalSum / n : 0.;
+    t_obj->setProperty("blocks", n);
+    t_obj->setProperty("interval_mean_ms", mean);
+    t_obj->setProperty("interval_sd_ms", n > 1 ?
+                       sqrt(jmax(0., (timing.intervalSumSq - n * mean * mean) / (n - 1))) : 0.);
+    t_obj->setProperty("interval_min_ms", timing.intervalMin);
+    t_obj->setProperty("interval_max_ms", timing.intervalMax);
+    t_obj->setProperty("process_mean_ms", n ? timing.processSum / n : 0.);
+    t_obj->setProperty("process_max_ms", timing.processMax);
+    t_obj->setProperty("received_events", timing.receivedEvents);
+    t_obj->setProperty("receive_mean_ms", n ? timing.receiveSum / n : 0.);
+    t_obj->setProperty("receive_max_ms", timing.receiveMax);
+    
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty("timing", var(t_obj));
+    c_obj->setProperty("dropped_messages", droppedMessages);
+    c_obj->setProperty("listen_requests", listenRequests.exchange(0));
+    c_obj->setProperty("reliable_consumers", publisher->getNumConsumers());
+    c_obj->setProperty("reliable_dropped", publisher->getReliableDropped());
+    c_obj->setProperty("unpublished_topics", unpublishedTopics.get());
+    
+    if(injector.getNumChannels() > 0)
+    {
+        Array<var> injected;
+        for(int i = 0; i < injector.getNumStreams(); i++)
+        {
+            const ZmqInjector::Stats &is = injector.getStats(i);
+            DynamicObject::Ptr st = new DynamicObject();
+            st->setProperty("name", String(is.name));
+            st->setProperty("blocks", is.blocks);
+            st->setProperty("samples", is.samples);
+            st->setProperty("late", is.late);
+            st->setProperty("overrun", is.overrun);
+            st->setProperty("underrun", is.underrun);
+            injected.add(var(st));
+        }
+        DynamicObject::Ptr i_obj = new DynamicObject();
+        i_obj->setProperty("channels", injector.getNumChannels());
+        i_obj->setProperty("delay_samples", injector.getDelaySamples());
+        i_obj->setProperty("malformed", injector.getMalformed());
+        i_obj->setProperty("streams", injected);
+        c_obj->setProperty("inject", var(i_obj));
+    }
+    c_obj->setProperty("streams", streams);
     
     DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty("message_no", -1); // outside of the sequence
+    obj->setProperty("type", "status");
+    obj->setProperty("content", var(c_obj));
+    obj->setProperty("data_size", 0);
     
-    obj->setProperty("message_no", messageNumber);
+    sendMessage("STATUS", JSON::toString(var(obj)), nullptr, 0);
+}
+/** Pairs the sample count of every source with the host clocks read at the
+ start of process(). Each pair is late by the buffering of the acquisition
+ and jitters with the audio thread, the clients fit a line over many */
+void ZmqInterface::sendSync(int64 monotonicNs, int64 realtimeNs)
+{
+    OwnedArray<DataGroup> &dataGroups = getDataConfig().groups;
+    Array<var> sources;
+    for(int i = 0; i < dataGroups.size(); i++)
+    {
+        DataGroup *group = dataGroups[i];
+        int ch = group->channels.getFirst();
+        DynamicObject::Ptr source = new DynamicObject();
+        source->setProperty("topic", group->topic);
+        source->setProperty("source_node_id", group->sourceNodeId);
+        source->setProperty("sample_rate", group->sampleRate);
+        // samples acquired so far, i.e. the number of the next one
+        source->setProperty("sample_num", (int64)getTimestamp(ch) + getNumSamples(ch));
+        sources.add(var(source));
+    }
+    
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty("sequence", syncSequence++);
+    c_obj->setProperty("monotonic_ns", monotonicNs);
+    c_obj->setProperty("realtime_ns", realtimeNs);
+    c_obj->setProperty("sources", sources);
+    
+    DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty("message_no", -1); // outside of the sequence
+    obj->setProperty("type", "sync");
+    obj->setProperty("content", var(c_obj));
+    obj->setProperty("data_size", 0);
+    
+    sendMessage("SYNC", JSON::toString(var(obj)), nullptr, 0);
+}
+
+void ZmqInterface::prepareDataPlan(DataGroup &group, int nSamples)
+{
+    int nChannels = group.channels.size();
+    
+    DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty("message_no", "${message_no}");
+    obj->setProperty("type", "data");
+    
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty("n_channels", nChannels);
+    c_obj->setProperty("n_samples", "${n_samples}");
+    c_obj->setProperty("n_real_samples", "${n_real_samples}");
+    c_obj->setProperty("timestamp", "${timestamp}");
+    c_obj->setProperty("sequence", "${sequence}");
+    c_obj->setProperty("n_blocks", "${n_blocks}");
+    c_obj->setProperty("source_node_id", group.sourceNodeId);
+    c_obj->setProperty("sample_rate", group.sampleRate / group.decimation);
+    if(group.decimation > 1)
+        c_obj->setProperty("decimation", group.decimation);
+    if(group.scale > 0.f)
+    {
+        c_obj->setProperty("dtype", "int16");
+        c_obj->setProperty("scale", group.scale);
+    }
+    
+    obj->setProperty("content", var(c_obj));
+    obj->setProperty("dataSize", "${data_size}");
+    obj->setProperty("schema_id", schemaId);
+    
+    // averages completed in one block, at most
+    int outSamples = (nSamples + group.decimation - 1) / group.decimation;
+    if(group.decimation > 1)
+    {
+        group.decimated.malloc(nChannels * outSamples);
+        group.decimatedStride = outSamples;
+    }
+    // room for the blocks collected within the latency budget
+    int capacity = outSamples + group.maxLatencySamples;
+    var json(obj);
+    group.plan.prepare(group.topic, JSON::toString(json, true), nChannels * capacity * group.sampleSize,
+                       DATA_PLAN_SLOTS);
+    group.fields.messageNo = group.plan.getField("message_no");
+    group.fields.samples = group.plan.getField("n_samples");
+    group.fields.realSamples = group.plan.getField("n_real_samples");
+    group.fields.timestamp = group.plan.getField("timestamp");
+    group.fields.sequence = group.plan.getField("sequence");
+    group.fields.blocks = group.plan.getField("n_blocks");
+    group.fields.dataSize = group.plan.getField("data_size");
+    group.planSamples = capacity;
+    group.blockSamples = nSamples;
+}
+
+/** Builds the DATA streams of the current options in the free slot, and
+ hands them over to process() (see DataConfig) */
+void ZmqInterface::prepareDataGroups()
+{
+    if(dataConfigState.get() & SWITCH_PENDING)
+    {
+        // the other slot is the one process() is about to take. Built from the
+        // options of the time once it did (see timerCallback)
+        dataConfigQueued = true;
+        return;
+    }
+    int slot = beginDataConfig();
+    OwnedArray<DataGroup> &dataGroups = dataConfigs[slot].groups;
+    
+    Array<int> published = parseChannelList(getOption("data_channels"), channels.size());
+    int decimation = jmax(1, (int)getOption("data_decimation"));
+    bool int16 = getOption("data_format").toString().trim().equalsIgnoreCase("int16");
+    for(int ch = 0; ch < channels.size(); ch++)
+    {
+        if(!published.contains(ch))
+            continue;
+        Channel *chan = channels[ch];
+        DataGroup *group = nullptr;
+        for(int i = 0; i < dataGroups.size() && !group; i++)
+        {
+            if(dataGroups[i]->sourceNodeId == chan->sourceNodeId &&
+               dataGroups[i]->sampleRate == chan->sampleRate)
+                group = dataGroups[i];
+        }
+        if(!group)
+        {
+            group = new DataGroup;
+            group->sourceNodeId = chan->sourceNodeId;
+            group->sampleRate = chan->sampleRate;
+            // the input sample rate, so that subscriptions survive a change
+            // of decimation
+            group->topic = String("DATA/") + String(chan->sourceNodeId) + "/" + String(roundToInt(chan->sampleRate));
+            group->stream = publisher->addStream(group->topic);
+            group->decimation = decimation;
+            group->scale = int16 ? (chan->bitVolts > 0.f ? chan->bitVolts : 1.f) : 0.f;
+            group->sampleSize = int16 ? sizeof(int16) : sizeof(float);
+            dataGroups.add(group);
+        }
+        group->channels.add(ch);
+    }
+    
+    // past the stream table the groups are built but never sent (see process)
+    int unpublished = 0;
+    for(int i = 0; i < dataGroups.size(); i++)
+    {
+        if(dataGroups[i]->stream < 0)
+        {
+            std::cout << "ZmqInterface: too many streams, " << dataGroups[i]->topic << " not published" << std::endl;
+            unpublished++;
+        }
+    }
+    if(unpublished > 0 && unpublished != unpublishedTopics.get())
+        CoreServices::sendStatusMessage(String("ZMQ: ") + String(unpublished) + " DATA streams not published, too many sources");
+    unpublishedTopics = unpublished;
+    
+    // coalescing, for the streams in coalesce_topics (all DATA streams if empty)
+    double maxLatency = (double)getOption("coalesce_max_latency_ms") / 1000.0;
+    StringArray topics;
+    topics.addTokens(getOption("coalesce_topics").toString(), ",", "");
+    topics.trim();
+    topics.removeEmptyStrings();
+    for(int i = 0; i < dataGroups.size(); i++)
+    {
+        DataGroup *group = dataGroups[i];
+        bool coalesce = topics.size() == 0;
+        for(int j = 0; j < topics.size() && !coalesce; j++)
+            coalesce = group->topic.startsWith(topics[j]);
+        if(coalesce && maxLatency > 0.0)
+            group->maxLatencySamples = (int)(maxLatency * group->sampleRate / group->decimation);
+        group->sums.calloc(group->channels.size());
+    }
+    
+    // the streams that stay keep their sequence numbers, statistics and the
+    // averages in progress, handed over at the switch (see carryDataState)
+    OwnedArray<DataGroup> &active = dataConfigs[1 - slot].groups;
+    for(int i = 0; i < dataGroups.size(); i++)
+    {
+        for(int j = 0; j < active.size() && dataGroups[i]->previous < 0; j++)
+        {
+            if(active[j]->topic == dataGroups[i]->topic)
+                dataGroups[i]->previous = j;
+        }
+    }
+    
+    // before the plans, which carry the schema id
+    builtDataConfig = slot;
+    updateMetadata();
+    
+    // for the buffer size process() sees. A larger block is sent in parts
+    // until the plans are made again for it (see dataPlansTooSmall)
+    int blockSize = lastBlockSize.get() > 0 ? lastBlockSize.get() : (int)DATA_BLOCK_SAMPLES;
+    for(int i = 0; i < dataGroups.size(); i++)
+        prepareDataPlan(*dataGroups[i], blockSize);
+    
+    commitDataConfig(slot);
+}
+
+/** The DATA streams process() is using */
+ZmqInterface::DataConfig &ZmqInterface::getDataConfig()
+{
+    return dataConfigs[dataConfigState.get() & 1];
+}
+
+/** The slot process() doesn't use, emptied. Never called while a switch is
+ pending (see prepareDataGroups) */
+int ZmqInterface::beginDataConfig()
+{
+    int state = dataConfigState.get();
+    jassert((state & SWITCH_PENDING) == 0);
+    int slot = 1 - (state & 1);
+    dataConfigs[slot].groups.clear();
+    return slot;
+}
+
+void ZmqInterface::commitDataConfig(int slot)
+{
+    if(!acquisitionActive)
+    {
+        dataConfigState = slot;
+        finishDataConfig();
+        return;
+    }
+    // taken at the next block. The streams of the old configuration stay
+    // registered until process() has flushed them, the timer waits for it
+    dataConfigState = (1 - slot) | SWITCH_PENDING;
+    startTimer(5);
+}
+
+/** Once process() uses the newest configuration: removes the streams it
+ doesn't have, and builds the configuration queued in the meantime */
+void ZmqInterface::finishDataConfig()
+{
+    StringArray groupTopics;
+    OwnedArray<DataGroup> &dataGroups = dataConfigs[builtDataConfig].groups;
+    for(int i = 0; i < dataGroups.size(); i++)
+        groupTopics.add(dataGroups[i]->topic);
+    publisher->removeStreams("DATA/", groupTopics); // the ones gone
+    // the plans of the replaced configuration, only the messages still in
+    // flight keep their slots (see ZmqMessagePlan)
+    dataConfigs[1 - builtDataConfig].groups.clear();
+    if(dataConfigQueued)
+    {
+        dataConfigQueued = false;
+        prepareDataGroups();
+    }
+}
+
+void ZmqInterface::timerCallback()
+{
+    if(dataConfigState.get() & SWITCH_PENDING)
+        return; // no block since
+    stopTimer();
+    finishDataConfig();
+}
+
+
+int ZmqInterface::sendSpikeEvent(MidiMessage &event)
+{
+    ZMQ_TRACE("sendSpikeEvent");
+    messageNumber++;
+    int size = 0;
+
+    const uint8_t* dataptr = event.getRawData();
+    int bufferSize = event.getRawDataSize();
+    if(bufferSize)
+    {
+        SpikeObject spike;
+        bool isValid = unpackSpike(&spike, dataptr, bufferSize);
+        if(isValid)
+        {
+            // subscribers can pick electrodes with "EVENT/SPIKE/<electrode>"
+            char envelope[32];
+            snprintf(envelope, sizeof(envelope), "EVENT/SPIKE/%d", (int)spike.electrodeID);
+            spikeEventPlan.setEnvelope(envelope);
+            
+            size_t dataSize = spike.nChannels*spike.nSamples;
+            char *payload = spikeEventPlan.begin();
+            memcpy(payload, spike.data, jmin(dataSize, spikeEventPlan.getMaxPayloadSize()));
+            spikeEventPlan.setField(spikeEventFields.messageNo, messageNumber);
+            spikeEventPlan.setField(spikeEventFields.timestamp, (int64)spike.timestamp);
+            spikeEventPlan.setField(spikeEventFields.timestampSoftware, (int64)spike.timestamp_software);
+            spikeEventPlan.setField(spikeEventFields.channels, spike.nChannels);
+            spikeEventPlan.setField(spikeEventFields.samples, spike.nSamples);
+            spikeEventPlan.setField(spikeEventFields.electrodeId, spike.electrodeID);
+            spikeEventPlan.setField(spikeEventFields.channel, spike.channel);
+            spikeEventPlan.setField(spikeEventFields.source, spike.source);
+            spikeEventPlan.beginArray(spikeEventFields.color);
+            for(int i = 0; i < 3; i++)
+                spikeEventPlan.addInteger(spike.color[i]);
+            spikeEventPlan.endArray();
+            spikeEventPlan.beginArray(spikeEventFields.pcProj);
+            for(int i = 0; i < 2; i++)
+                spikeEventPlan.addFloat(spike.pcProj[i]);
+            spikeEventPlan.endArray();
+            spikeEventPlan.beginArray(spikeEventFields.gain);
+            for(int i = 0; i < spike.nChannels; i++)
+                spikeEventPlan.addInteger(spike.gain[i]);
+            spikeEventPlan.endArray();
+            spikeEventPlan.beginArray(spikeEventFields.threshold);
+            for(int i = 0; i < spike.nChannels; i++)
+                spikeEventPlan.addInteger(spike.threshold[i]);
+            spikeEventPlan.endArray();
+            size = spikeEventPlan.send(socket, jmin(dataSize, spikeEventPlan.getMaxPayloadSize()));
+            if(size == -1)
+                droppedMessages++;
+        }
+    }
+    return size;
+}
+
+int ZmqInterface::sendEvent( uint8 type,
+                             int sampleNum,
+                             uint8 eventId,
+                             uint8 eventChannel,
+                             uint8 numBytes,
+                             const uint8* eventData)
+{
+    ZMQ_TRACE("sendEvent");
+    messageNumber++;
+    
+    // "EVENT/<type>/<channel>", so that ZeroMQ drops the events a client did
+    // not subscribe to before they leave the plugin
+    char envelope[32];
+    snprintf(envelope, sizeof(envelope), "EVENT/%s/%d", eventTopic(type), (int)eventChannel);
+    eventPlan.setEnvelope(envelope);
+    
+    char *payload = eventPlan.begin();
+    if(numBytes)
+        memcpy(payload, eventData, numBytes);
+    eventPlan.setField(eventFields.messageNo, messageNumber);
+    eventPlan.setField(eventFields.type, type);
+    eventPlan.setField(eventFields.sampleNum, sampleNum);
+    eventPlan.setField(eventFields.timestamp, (int64)getTimestamp(0));
+    eventPlan.setField(eventFields.eventId, eventId);
+    eventPlan.setField(eventFields.eventChannel, eventChannel);
+    eventPlan.setField(eventFields.dataSize, numBytes);
+    int size = eventPlan.send(socket, numBytes);
+    if(size == -1)
+        droppedMessages++;
+    return size;
+}
+
+void ZmqInterface::prepareEventPlan()
+{
+    DynamicObject::Ptr obj = new DynamicObject();
+    
+    obj->setProperty("message_no", "${message_no}");
     obj->setProperty("type", "event");
     
     DynamicObject::Ptr c_obj = new DynamicObject();
-    c_obj->setProperty("type", type);
-    c_obj->setProperty("sample_num", sampleNum);
-    c_obj->setProperty("event_id", eventId);
-    c_obj->setProperty("event_channel", eventChannel);
+    c_obj->setProperty("type", "${type}");
+    c_obj->setProperty("sample_num", "${sample_num}");
+    c_obj->setProperty("timestamp", "${timestamp}");
+    c_obj->setProperty("event_id", "${event_id}");
+    c_obj->setProperty("event_channel", "${event_channel}");
     obj->setProperty("content", var(c_obj));
-    obj->setProperty("data_size", numBytes);
+    obj->setProperty("data_size", "${data_size}");
     
     var json (obj);
-    String s = JSON::toString(json);
-    void *headerData = (void *)s.toRawUTF8();
-    size_t headerSize = s.length();
+    eventPlan.prepare("EVENT", JSON::toString(json, true), 255, 64);
+    eventFields.messageNo = eventPlan.getField("message_no");
+    eventFields.type = eventPlan.getField("type");
+    eventFields.sampleNum = eventPlan.getField("sample_num");
+    eventFields.timestamp = eventPlan.getField("timestamp");
+    eventFields.eventId = eventPlan.getField("event_id");
+    eventFields.eventChannel = eventPlan.getField("event_channel");
+    eventFields.dataSize = eventPlan.getField("data_size");
     
+    // the spike events of upstream processors, with their arrays as long as
+    // the channels of the electrode
+    const int maxChannels = sizeof(SpikeObject::gain) / sizeof(SpikeObject::gain[0]);
+    DynamicObject::Ptr s_obj = new DynamicObject();
+    s_obj->setProperty("message_no", "${message_no}");
+    s_obj->setProperty("type", "spike");
+    DynamicObject::Ptr sc_obj = new DynamicObject();
+    sc_obj->setProperty("timestamp", "${timestamp}");
+    sc_obj->setProperty("timestamp_software", "${timestamp_software}");
+    sc_obj->setProperty("n_channels", "${n_channels}");
+    sc_obj->setProperty("n_samples", "${n_samples}");
+    sc_obj->setProperty("electrode_id", "${electrode_id}");
+    sc_obj->setProperty("channel", "${channel}");
+    sc_obj->setProperty("source", "${source}");
+    sc_obj->setProperty("color", ZmqMessagePlan::getArrayTemplate("color", 3));
+    sc_obj->setProperty("pc_proj", ZmqMessagePlan::getArrayTemplate("pc_proj", 2));
+    sc_obj->setProperty("gain", ZmqMessagePlan::getArrayTemplate("gain", maxChannels));
+    sc_obj->setProperty("threshold", ZmqMessagePlan::getArrayTemplate("threshold", maxChannels));
+    s_obj->setProperty("spike", var(sc_obj));
     
+    spikeEventPlan.prepare("EVENT/SPIKE", JSON::toString(var(s_obj), true), sizeof(SpikeObject::data), 64);
+    spikeEventFields.messageNo = spikeEventPlan.getField("message_no");
+    spikeEventFields.timestamp = spikeEventPlan.getField("timestamp");
+    spikeEventFields.timestampSoftware = spikeEventPlan.getField("timestamp_software");
+    spikeEventFields.channels = spikeEventPlan.getField("n_channels");
+    spikeEventFields.samples = spikeEventPlan.getField("n_samples");
+    spikeEventFields.electrodeId = spikeEventPlan.getField("electrode_id");
+    spikeEventFields.channel = spikeEventPlan.getField("channel");
+    spikeEventFields.source = spikeEventPlan.getField("source");
+    spikeEventFields.color = spikeEventPlan.getField("color");
+    spikeEventFields.pcProj = spikeEventPlan.getField("pc_proj");
+    spikeEventFields.gain = spikeEventPlan.getField("gain");
+    spikeEventFields.threshold = spikeEventPlan.getField("threshold");
+}
+
+/** For the occasional messages (status, sync, parameters), the header and the
+ data are copied. Those sent per block or per spike have a ZmqMessagePlan */
+int ZmqInterface::sendMessage(const char *envelope, const String &header,
+                              const void *data, size_t dataSize)
+{
+    ZMQ_TRACE("sendMessage");
+    int size;
+    size_t headerSize = header.getNumBytesAsUTF8();
+    
+    // the pipe to the publisher would block when full, so never wait and
+    // count the message as dropped instead (the subscribers see a gap in the
+    // message numbers). Once the first frame is accepted, the others are too.
     zmq_msg_t messageEnvelope;
-    zmq_msg_init_size(&messageEnvelope, strlen("EVENT")+1);
-    memcpy(zmq_msg_data(&messageEnvelope), "EVENT", strlen("EVENT")+1);
-    size = zmq_msg_send(&messageEnvelope, socket, ZMQ_SNDMORE);
-    jassert(size != -1);
+    zmq_msg_init_size(&messageEnvelope, strlen(envelope)+1);
+    memcpy(zmq_msg_data(&messageEnvelope), envelope, strlen(envelope)+1);
+    size = zmq_msg_send(&messageEnvelope, socket, ZMQ_SNDMORE | ZMQ_DONTWAIT);
     zmq_msg_close(&messageEnvelope);
+    if(size == -1)
+    {
+        droppedMessages++;
+        return -1;
+    }
     
     zmq_msg_t messageHeader;
     zmq_msg_init_size(&messageHeader, headerSize);
-    memcpy(zmq_msg_data(&messageHeader), headerData, headerSize);
-    if(numBytes == 0)
-    {
-        size = zmq_msg_send(&messageHeader, socket, 0);
-        jassert(size != -1);
-        zmq_msg_close(&messageHeader);
-    }
-    else
+    memcpy(zmq_msg_data(&messageHeader), header.toRawUTF8(), headerSize);
+    size = zmq_msg_send(&messageHeader, socket, dataSize ? ZMQ_SNDMORE : 0);
+    jassert(size != -1);
+    zmq_msg_close(&messageHeader);
+    
+    if(dataSize)
     {
-        size = zmq_msg_send(&messageHeader, socket, ZMQ_SNDMORE);
-        jassert(size != -1);
-        zmq_msg_close(&messageHeader);
         zmq_msg_t message;
-        zmq_msg_init_size(&message, numBytes);
-        memcpy(zmq_msg_data(&message), eventData, numBytes);
+        zmq_msg_init_size(&message, dataSize);
+        memcpy(zmq_msg_data(&message), data, dataSize);
         int size_m = zmq_msg_send(&message, socket, 0);
-        jassert(size_m);
+        jassert(size_m != -1);
         size += size_m;
         zmq_msg_close(&message);
     }
     return size;
 }
 
-template<typename T> int ZmqInterface::sendParam(String name, T value)
+int ZmqInterface::sendFeatures(const AudioSampleBuffer &buffer)
 {
-    int size;
+    ZMQ_TRACE("sendFeatures");
+    int nChannels = featureExtractor.getNumChannels();
+    int nFeatures = featureExtractor.getNumFeatures();
+    if(nChannels == 0 || blockSamples.size() < nChannels || !featuresPlan.isPrepared())
+        return 0;
+    
+    // the features are computed in the message frame
+    float *out = (float *)featuresPlan.begin();
+    featureExtractor.process(buffer, blockSamples.getRawDataPointer(), out);
+    
+    messageNumber++;
+    featuresPlan.setField(featuresFields.messageNo, messageNumber);
+    featuresPlan.setField(featuresFields.timestamp, (int64)getTimestamp(0));
+    featuresPlan.setField(featuresFields.realSamples, blockSamples[0]);
+    int size = featuresPlan.send(socket, nChannels * nFeatures * sizeof(float));
+    if(size == -1)
+        droppedMessages++;
+    return size;
+}
+
+void ZmqInterface::analyzeEvent(int eventType, MidiMessage &event, int sampleNum)
+{
+    ZMQ_TRACE("analyzeEvent");
+    const uint8 *dataptr = event.getRawData();
+    const bool psthOn = psthEnabled.get() != 0;
+    if(eventType == TTL)
+    {
+        if(psthOn && *(dataptr+2) != 0) // rising edge
+            psth.addTrigger(*(dataptr+3), (int64)getTimestamp(0) + sampleNum);
+    }
+    else
+    {
+        // unpacked once for both
+        SpikeObject spike;
+        if(!unpackSpike(&spike, dataptr, event.getRawDataSize()))
+            return;
+        if(psthOn)
+            psth.addSpike(spike.electrodeID, (int64)spike.timestamp);
+        if(spikeFeaturesEnabled.get())
+            spikeFeatures.addSpike(spike.electrodeID, (int64)spike.timestamp, spike.nChannels,
+                                   spike.nSamples, spike.data, spike.gain);
+    }
+}
+
+int ZmqInterface::sendSpikeFeatures()
+{
+    ZMQ_TRACE("sendSpikeFeatures");
+    int nSpikes = spikeFeatures.getNumSpikes();
+    int nDropped = spikeFeatures.getNumDropped();
+    if(nSpikes == 0 && nDropped == 0)
+        return 0; // nothing to say, empty batches are not sent
+    if(!spikeFeaturesPlan.isPrepared())
+        return 0;
+    
+    int nFeatures = spikeFeatures.getNumFeatures();
+    size_t recordSize = nSpikes * sizeof(SpikeFeatureRecord);
+    size_t dataSize = recordSize + nSpikes * nFeatures * sizeof(float);
+    char *payload = spikeFeaturesPlan.begin();
+    memcpy(payload, spikeFeatures.getRecords(), recordSize);
+    memcpy(payload + recordSize, spikeFeatures.getFeatures(), dataSize - recordSize);
+    
+    messageNumber++;
+    spikeFeaturesPlan.setField(spikeFeaturesFields.messageNo, messageNumber);
+    spikeFeaturesPlan.setField(spikeFeaturesFields.spikes, nSpikes);
+    spikeFeaturesPlan.setField(spikeFeaturesFields.dropped, nDropped);
+    spikeFeaturesPlan.setField(spikeFeaturesFields.timestamp, (int64)getTimestamp(0));
+    spikeFeaturesPlan.setField(spikeFeaturesFields.dataSize, (int64)dataSize);
+    const int nElectrodes = spikeFeatures.getNumElectrodes();
+    spikeFeaturesPlan.beginArray(spikeFeaturesFields.electrodes);
+    for(int i = 0; i < nElectrodes; i++)
+        spikeFeaturesPlan.addInteger(spikeFeatures.getElectrodeId(i));
+    spikeFeaturesPlan.endArray();
+    spikeFeaturesPlan.beginArray(spikeFeaturesFields.versions);
+    for(int i = 0; i < nElectrodes; i++)
+        spikeFeaturesPlan.addInteger(spikeFeatures.getBasisVersion(i));
+    spikeFeaturesPlan.endArray();
+    spikeFeaturesPlan.beginArray(spikeFeaturesFields.explained);
+    for(int i = 0; i < nElectrodes; i++)
+        spikeFeaturesPlan.addFloat(spikeFeatures.getExplainedVariance(i));
+    spikeFeaturesPlan.endArray();
+    
+    int size = spikeFeaturesPlan.send(socket, dataSize);
+    if(size == -1)
+        droppedMessages++;
+    return size;
+}
+
+int ZmqInterface::sendPsth()
+{
+    ZMQ_TRACE("sendPsth");
+    if(psth.getNumTriggers() == 0 || psth.getNumElectrodes() == 0)
+        return 0; // nothing to show yet
+    if(!psthPlan.isPrepared())
+        return 0;
+    size_t dataSize = psth.copyCounts((uint32 *)psthPlan.begin());
     
     messageNumber++;
+    psthPlan.setField(psthFields.messageNo, messageNumber);
+    psthPlan.setField(psthFields.timestamp, (int64)getTimestamp(0));
+    psthPlan.setField(psthFields.spikes, psth.getNumSpikes());
+    psthPlan.setField(psthFields.ignored, psth.getNumIgnored());
+    psthPlan.setField(psthFields.dataSize, (int64)dataSize);
+    psthPlan.beginArray(psthFields.triggers);
+    for(int i = 0; i < psth.getNumTriggers(); i++)
+        psthPlan.addInteger(psth.getTriggerChannel(i));
+    psthPlan.endArray();
+    psthPlan.beginArray(psthFields.trials);
+    for(int i = 0; i < psth.getNumTriggers(); i++)
+        psthPlan.addInteger(psth.getTrials(i));
+    psthPlan.endArray();
+    psthPlan.beginArray(psthFields.electrodes);
+    for(int i = 0; i < psth.getNumElectrodes(); i++)
+        psthPlan.addInteger(psth.getElectrodeId(i));
+    psthPlan.endArray();
+    
+    int size = psthPlan.send(socket, dataSize);
+    if(size == -1)
+        droppedMessages++;
+    return size;
+}
+
+/** The spikes the detector found in this block (see process) */
+int ZmqInterface::sendSpikeBatch(int nSpikes)
+{
+    ZMQ_TRACE("sendSpikeBatch");
+    int nDropped = spikeDetector.getNumDropped();
+    if(nSpikes == 0 && nDropped == 0)
+        return 0; // nothing to say, empty batches are not sent
+    if(!spikesPlan.isPrepared())
+        return 0;
+    
+    int snippetLength = spikeDetector.getSnippetLength();
+    size_t recordSize = nSpikes * sizeof(DetectedSpike);
+    size_t dataSize = recordSize + nSpikes * snippetLength * sizeof(float);
+    char *payload = spikesPlan.begin();
+    memcpy(payload, spikeDetector.getSpikes(), recordSize);
+    memcpy(payload + recordSize, spikeDetector.getSnippets(), dataSize - recordSize);
+    
+    messageNumber++;
+    spikesPlan.setField(spikesFields.messageNo, messageNumber);
+    spikesPlan.setField(spikesFields.spikes, nSpikes);
+    spikesPlan.setField(spikesFields.dropped, nDropped);
+    spikesPlan.setField(spikesFields.timestamp, blockTimestamps[0]);
+    spikesPlan.setField(spikesFields.dataSize, (int64)dataSize);
+    int size = spikesPlan.send(socket, dataSize);
+    if(size == -1)
+        droppedMessages++;
+    return size;
+}
+
+template<typename T> int ZmqInterface::sendParam(String name, T value)
+{
+    messageNumber++;
     
 //    MemoryOutputStream jsonHeader;
 //    jsonHeader << "{ \"messageNo\": " << messageNumber << "," << newLine;
@@ -555,26 +1804,7 @@ template<typename T> int ZmqInterface::sendParam(String name, T value)
     obj->setProperty("data_size", 0);
     
     var json (obj);
-    String s = JSON::toString(json);
-    void *headerData = (void *)s.toRawUTF8();
-    size_t headerSize = s.length();
-    
-    zmq_msg_t messageEnvelope;
-    zmq_msg_init_size(&messageEnvelope, strlen("PARAM")+1);
-    memcpy(zmq_msg_data(&messageEnvelope), "PARAM", strlen("PARAM")+1);
-    size = zmq_msg_send(&messageEnvelope, socket, ZMQ_SNDMORE);
-    jassert(size != -1);
-    zmq_msg_close(&messageEnvelope);
-    
-    
-    zmq_msg_t messageHeader;
-    zmq_msg_init_size(&messageHeader, headerSize);
-    memcpy(zmq_msg_data(&messageHeader), headerData, headerSize);
-    size = zmq_msg_send(&messageHeader, socket, 0);
-    jassert(size != -1);
-    zmq_msg_close(&messageHeader);
-    
-    return size;
+    return sendMessage("PARAM", JSON::toString(json), nullptr, 0);
 }
 
 
@@ -591,6 +1821,46 @@ bool ZmqInterface::isReady()
     return true;
 }
 
+bool ZmqInterface::enable()
+{
+    // before the first block, so that neither the first block pays for them
+    // nor early events are lost
+    createDataSocket();
+    if(!pipeOutSocket)
+        openPipeOutSocket();
+    prepareStreams();
+    injector.reset();
+    acquisitionActive = true;
+    return GenericProcessor::enable();
+}
+
+bool ZmqInterface::disable()
+{
+    timing.lastTicks = 0; // no interval across acquisitions
+    // what is left of the coalesced messages
+    OwnedArray<DataGroup> &dataGroups = getDataConfig().groups;
+    for(int i = 0; i < dataGroups.size(); i++)
+        flushData(*dataGroups[i]);
+    acquisitionActive = false;
+    // changes process() didn't see
+    int state = dataConfigState.get();
+    if(state & SWITCH_PENDING)
+        dataConfigState = 1 - (state & 1);
+    if(isTimerRunning())
+    {
+        stopTimer();
+        finishDataConfig();
+    }
+    settleInjectSocket();
+    bool ok = GenericProcessor::disable();
+    if(restartPending)
+    {
+        restartPending = false;
+        restartNetwork();
+    }
+    return ok;
+}
+
 void ZmqInterface::setParameter(int parameterIndex, float newValue)
 {
     editor->updateParameterButtons(parameterIndex);
@@ -613,8 +1883,21 @@ void ZmqInterface::resetConnections()
     return;
 }
 
+const char *ZmqInterface::eventTopic(int type)
+{
+    return eventTypeNames[type >= 0 && type < NUM_EVENT_TYPES ? type : OTHER_EVENT];
+}
+
 void ZmqInterface::handleEvent(int eventType, MidiMessage& event, int sampleNum)
 {
+    // all the events count for the histograms and the spike features,
+    // subscribed or not
+    if((psthEnabled.get() || spikeFeaturesEnabled.get()) && (eventType == TTL || eventType == SPIKE))
+        analyzeEvent(eventType, event, sampleNum);
+    
+    int type = eventType >= 0 && eventType < NUM_EVENT_TYPES ? eventType : OTHER_EVENT;
+    if(!publisher->hasSubscribers(eventStreams[type]))
+        return;
     
     const uint8* dataptr = event.getRawData();
     int size = event.getRawDataSize();
@@ -629,123 +1912,634 @@ void ZmqInterface::handleEvent(int eventType, MidiMessage& event, int sampleNum)
     if(eventType == SPIKE)
         sendSpikeEvent(event);
     else
+    {
         sendEvent(eventType,
                   sampleNum,
                   eventId,
                   eventChannel,
                   numBytes,
                   dataptr+6);
+    }
 }
 
 int ZmqInterface::receiveEvents(MidiBuffer &events)
 {
-    
+    ZMQ_TRACE("receiveEvents");
     EventData ed;
+    int n = 0;
     while(true)
     {
         int size = zmq_recv(pipeOutSocket, &ed, sizeof(ed), ZMQ_DONTWAIT);
         if(size == -1)
         {
-            if(zmq_errno() == EAGAIN)
+            if(zmq_errno() != EAGAIN)
             {
-                break;
+                std::cout << "pipe out error: " << zmq_strerror(zmq_errno()) << std::endl;
             }
-            else
+            break;
+        }
+        
+        addEvent(events, ed.type, ed.sampleNum, ed.eventId, ed.eventChannel, ed.numBytes, NULL, false);
+        // TODO allow for event data
+        n++;
+    }
+
+    return n;
+}
+
+/** Takes the blocks queued on the inject socket into the jitter buffer.
+ Three frames: stream name, ZmqInjectHeader, float32 data */
+int ZmqInterface::receiveInjected()
+{
+    ZMQ_TRACE("receiveInjected");
+    const int maxMessages = 256; // per block, the rest waits for the next one
+    int n = 0;
+    for(; n < maxMessages; n++)
+    {
+        zmq_msg_t frames[3];
+        int nFrames = 0;
+        bool more = true;
+        while(more)
+        {
+            zmq_msg_t &frame = frames[jmin(nFrames, 2)];
+            if(nFrames > 2)
+                zmq_msg_close(&frame); // extra frames are dropped
+            zmq_msg_init(&frame);
+            if(zmq_msg_recv(&frame, injectSocket, ZMQ_DONTWAIT) == -1)
             {
-                std::cout << "pipe out error: " << zmq_strerror(zmq_errno()) << std::endl;
+                // the frames of a message arrive together, so this is the
+                // end of the queue
+                zmq_msg_close(&frame);
+                for(int i = 0; i < jmin(nFrames, 2); i++)
+                    zmq_msg_close(&frames[i]);
+                return n;
             }
+            more = zmq_msg_more(&frame) != 0;
+            nFrames++;
         }
-//        std::cout << "adding events" << std::endl;
-//        std::cout << "chan " << (int)ed.eventChannel << " id " << (int)ed.eventId << " sample n "
-//        << (int)ed.sampleNum << " type " << (int)ed.type <<
-//        std::endl;
         
-        int appNo = -1;
+        bool ok = nFrames == 3 && zmq_msg_size(&frames[1]) == sizeof(ZmqInjectHeader);
+        if(ok)
+        {
+            char name[32];
+            size_t nameSize = jmin(zmq_msg_size(&frames[0]), sizeof(name) - 1);
+            memcpy(name, zmq_msg_data(&frames[0]), nameSize);
+            name[nameSize] = 0;
+            ZmqInjectHeader header;
+            memcpy(&header, zmq_msg_data(&frames[1]), sizeof(header));
+            ok = header.nChannels > 0 && header.nSamples > 0 &&
+                zmq_msg_size(&frames[2]) == (size_t)header.nChannels * header.nSamples * sizeof(float) &&
+                injector.write(name, header, (const float *)zmq_msg_data(&frames[2]));
+        }
+        if(!ok)
+            injector.addMalformed();
+        for(int i = 0; i < jmin(nFrames, 3); i++)
+            zmq_msg_close(&frames[i]);
+    }
+    return n;
+}
+
+void ZmqInterface::applicationSeen(const String &name, const String &uuid, double now)
+{
+    bool changed = false;
+    {
+        const ScopedLock sl(applicationLock);
+        ZmqApplication *app = nullptr;
         for(int i = 0; i < applications.size(); i++)
         {
-            ZmqApplication *app = applications[i];
-            if(app->Uuid == String(ed.uuid))
+            if(applications[i]->Uuid == uuid)
             {
-                bool refreshEd = false;
-                appNo = i;
-                app->lastSeen = ed.eventTime;
-                if(!app->alive)
-                    refreshEd = true;
-                app->alive = true;
-                ZmqInterfaceEditor *zed =    dynamic_cast<ZmqInterfaceEditor *> (getEditor());
-                zed->refreshListAsync();
-
+                app = applications[i];
                 break;
             }
         }
-
-        if(appNo == -1)
+        
+        if(!app)
         {
-            ZmqApplication *app = new ZmqApplication;
-            app->name = String(ed.application);
-            app->Uuid = String(ed.uuid);
-            app->lastSeen = ed.eventTime;
-            app->alive = true;
+            app = new ZmqApplication;
+            app->name = name;
+            app->Uuid = uuid;
+            app->alive = false;
             applications.add(app);
             std::cout << "adding new application " << app->name << " " << app->Uuid << std::endl;
             std::cout << " now there are " << applications.size() << " apps" << std::endl;
-            ZmqInterfaceEditor *zed =    dynamic_cast<ZmqInterfaceEditor *> (getEditor());
-            zed->refreshListAsync();
-//            MessageManagerLock mmlock;
-//            editor->repaint();
-    
         }
-
-
-            
         
-        if(ed.isEvent)
-            addEvent(events, ed.type, ed.sampleNum, ed.eventId, ed.eventChannel, ed.numBytes, NULL, false);
-        // TODO allow for event data
+        app->lastSeen = now;
+        if(!app->alive)
+        {
+            app->alive = true;
+            changed = true;
+        }
     }
-
-    return 0;
+    if(changed)
+        notifyApplicationsChanged();
 }
 
-void ZmqInterface::checkForApplications()
+void ZmqInterface::checkForApplications(double now)
 {
-    time_t timeNow = time(NULL);
-    for(int i = 0; i < applications.size(); i++)
+    ZMQ_TRACE("checkForApplications");
+    double timeout = 1000. * (double)getOption("clients_timeout");
+    bool changed = false;
     {
-        ZmqApplication *app = applications[i];
-        if((timeNow - app->lastSeen) > 10 && app->alive)
+        const ScopedLock sl(applicationLock);
+        for(int i = 0; i < applications.size(); i++)
         {
-            app->alive = false;
-            std::cout << "app " << app->name << " not alive" << std::endl;
-            ZmqInterfaceEditor *zed =    dynamic_cast<ZmqInterfaceEditor *> (getEditor());
-            zed->refreshListAsync();
+            ZmqApplication *app = applications[i];
+            if((now - app->lastSeen) > timeout && app->alive)
+            {
+                app->alive = false;
+                changed = true;
+                std::cout << "app " << app->name << " not alive" << std::endl;
+            }
         }
     }
+    if(changed)
+        notifyApplicationsChanged();
+}
 
+void ZmqInterface::notifyApplicationsChanged()
+{
+    // the editor only repaints when an application appears or changes state
+    ZmqInterfaceEditor *zed = dynamic_cast<ZmqInterfaceEditor *> (getEditor());
+    if(zed)
+        zed->refreshListAsync();
 }
 
 void ZmqInterface::process(AudioSampleBuffer& buffer,
                            MidiBuffer& events)
 {
-    if(!socket)
-        createDataSocket();
+    ZMQ_TRACE("process");
+    const int64 startTicks = Time::getHighResolutionTicks();
+    // as close as we get to the arrival of the block, for the SYNC messages
+    struct timespec monotonic, realtime;
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    if(timing.lastTicks != 0)
+    {
+        double interval = Time::highResolutionTicksToSeconds(startTicks - timing.lastTicks) * 1000.;
+        if(timing.blocks == 0 || interval < timing.intervalMin)
+            timing.intervalMin = interval;
+        if(timing.blocks == 0 || interval > timing.intervalMax)
+            timing.intervalMax = interval;
+        timing.intervalSum += interval;
+        timing.intervalSumSq += interval * interval;
+        timing.blocks++;
+    }
+    timing.lastTicks = startTicks;
+
+    {
+        ZMQ_TRACE("checkForEvents");
+        checkForEvents(events); // see if we got any TTL events
+    }
     
-    if(!pipeOutSocket)
-        openPipeOutSocket();
+    // changes from the message thread, without locks (see DataConfig)
+    int state = dataConfigState.get();
+    if(state & SWITCH_PENDING)
+    {
+        OwnedArray<DataGroup> &previous = dataConfigs[state & 1].groups;
+        OwnedArray<DataGroup> &next = dataConfigs[1 - (state & 1)].groups;
+        for(int i = 0; i < previous.size(); i++)
+            flushData(*previous[i]);
+        for(int i = 0; i < next.size(); i++)
+        {
+            if(next[i]->previous >= 0)
+                carryDataState(*previous[next[i]->previous], *next[i]);
+        }
+        dataConfigState.compareAndSetBool(1 - (state & 1), state);
+    }
+    OwnedArray<DataGroup> &dataGroups = getDataConfig().groups;
+    lastBlockSize = buffer.getNumSamples();
+    // a new inject port, bound by the message thread. The old socket is
+    // closed there too, once the previous swap is done with
+    if(nextInjectSocket.get() != nullptr && retiredInjectSocket.get() == nullptr)
+    {
+        if(void *next = nextInjectSocket.exchange(nullptr))
+        {
+            retiredInjectSocket = injectSocket;
+            injectSocket = next;
+            triggerAsyncUpdate();
+        }
+    }
+    
+    // before sending, so that the injected channels are published too
+    if(injector.getNumChannels() > 0)
+    {
+        receiveInjected();
+        ZMQ_TRACE("injector.render");
+        injector.render(buffer, injectFirstChannel, (int64)getTimestamp(0),
+                        jmin(getNumSamples(0), buffer.getNumSamples()));
+    }
 
+    // a buffer larger than the plans is sent in parts (see sendData), and
+    // the message thread makes new plans for lastBlockSize
+    for(int i = 0; i < dataGroups.size(); i++)
+    {
+        if(buffer.getNumSamples() > dataGroups[i]->blockSamples)
+        {
+            if(dataPlansTooSmall.compareAndSetBool(1, 0))
+                triggerAsyncUpdate();
+            break;
+        }
+    }
+    
+    // nothing is serialized for streams nobody subscribed to
+    for(int i = 0; i < dataGroups.size(); i++)
+    {
+        DataGroup *group = dataGroups.getUnchecked(i);
+        if(publisher->hasSubscribers(group->stream))
+            sendData(buffer, *group);
+        else
+            flushData(*group); // the last subscriber left during a batch
+    }
+    
+    bool features = featuresEnabled.get() && publisher->hasSubscribers(featuresStream);
+    if(features)
+    {
+        updateBlockInfo(buffer);
+        sendFeatures(buffer);
+    }
+    
+    // the detector sees every block, subscribed or not, so that its noise
+    // estimates and the snippets spanning two blocks stay right
+    if(spikesEnabled.get())
+    {
+        if(!features)
+            updateBlockInfo(buffer);
+        ZMQ_TRACE("spikeDetector.process");
+        int nSpikes = spikeDetector.process(buffer, blockSamples.getRawDataPointer(),
+                                            blockTimestamps.getRawDataPointer());
+        if(publisher->hasSubscribers(spikesStream))
+            sendSpikeBatch(nSpikes);
+    }
+    
+    // the spikes of this block, analyzed by handleEvent()
+    if(spikeFeaturesEnabled.get())
+    {
+        if(publisher->hasSubscribers(spikeFeaturesStream))
+            sendSpikeFeatures();
+        spikeFeatures.clearBatch();
+    }
+    
+    // a few times per second, built like the status
+    if(psthEnabled.get() && publisher->hasSubscribers(psthStream))
+    {
+        double psthNow = Time::getMillisecondCounterHiRes();
+        if(psthNow - lastPsth >= psthIntervalMs.get())
+        {
+            sendPsth();
+            lastPsth = psthNow;
+        }
+    }
+    
+    // the cost of the applications' events, grows with their number
+    const int64 receiveTicks = Time::getHighResolutionTicks();
+    timing.receivedEvents += receiveEvents(events);
+    double receive = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - receiveTicks) * 1000.;
+    timing.receiveSum += receive;
+    timing.receiveMax = jmax(timing.receiveMax, receive);
+    
+    const int64 monotonicNs = (int64)monotonic.tv_sec * 1000000000 + monotonic.tv_nsec;
+    const int syncInterval = syncIntervalMs.get();
+    if(syncInterval > 0 && monotonicNs - lastSync >= (int64)syncInterval * 1000000)
+    {
+        if(publisher->hasSubscribers(syncStream))
+            sendSync(monotonicNs, (int64)realtime.tv_sec * 1000000000 + realtime.tv_nsec);
+        lastSync = monotonicNs;
+    }
+    
+    double busy = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks) * 1000.;
+    timing.processSum += busy;
+    timing.processMax = jmax(timing.processMax, busy);
+    
+    double now = Time::getMillisecondCounterHiRes();
+    if(now - lastStatus >= 1000.)
+    {
+        if(publisher->hasSubscribers(statusStream))
+            sendStatus(now);
+        lastStatus = now;
+        int64 lastTicks = timing.lastTicks;
+        timing = {};
+        timing.lastTicks = lastTicks;
+    }
+}
 
-    checkForEvents(events); // see if we got any TTL events
+void ZmqInterface::updateSettings()
+{
+    addInjectedChannels();
+    prepareInjector();
+    prepareStreams();
+}
 
-    sendData(*(buffer.getArrayOfWritePointers()), buffer.getNumChannels(), buffer.getNumSamples(), getNumSamples(0));
+void ZmqInterface::updateMetadata()
+{
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty("n_channels", channels.size());
+    
+    Array<var> chans;
+    for(int ch = 0; ch < channels.size(); ch++)
+    {
+        Channel *chan = channels[ch];
+        DynamicObject::Ptr ch_obj = new DynamicObject();
+        ch_obj->setProperty("name", chan->getName());
+        ch_obj->setProperty("bit_volts", chan->bitVolts);
+        ch_obj->setProperty("sample_rate", chan->sampleRate);
+        ch_obj->setProperty("source_node_id", chan->sourceNodeId);
+        chans.add(var(ch_obj));
+    }
+    
+    // one DATA stream per group of channels (see prepareDataGroups), as in
+    // the newest configuration
+    OwnedArray<DataGroup> &dataGroups = dataConfigs[builtDataConfig].groups;
+    Array<var> sources;
+    for(int i = 0; i < dataGroups.size(); i++)
+    {
+        DataGroup *group = dataGroups[i];
+        DynamicObject::Ptr source = new DynamicObject();
+        source->setProperty("topic", group->topic);
+        source->setProperty("source_node_id", group->sourceNodeId);
+        source->setProperty("sample_rate", group->sampleRate / group->decimation);
+        source->setProperty("decimation", group->decimation);
+        source->setProperty("dtype", group->scale > 0.f ? "int16" : "float32");
+        Array<var> sourceChannels;
+        for(int j = 0; j < group->channels.size(); j++)
+            sourceChannels.add(group->channels[j]);
+        source->setProperty("channels", sourceChannels);
+        sources.add(var(source));
+    }
+    c_obj->setProperty("channels", chans);
+    c_obj->setProperty("sources", sources);
     
-    receiveEvents(events);
-    checkForApplications();
+    // the schema id only depends on the layout, so that clients can keep
+    // their buffers when the same configuration comes back
+    schemaId = JSON::toString(var(c_obj), true).hashCode() & 0x7fffffff;
+    c_obj->setProperty("schema_id", schemaId);
     
+    DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty("message_no", -1); // latched, outside of the sequence
+    obj->setProperty("type", "metadata");
+    obj->setProperty("content", var(c_obj));
+    obj->setProperty("data_size", 0);
+    
+    publisher->setMetadata(JSON::toString(var(obj)));
 }
 
-void ZmqInterface::updateSettings()
+void ZmqInterface::prepareStreams()
 {
+    prepareDataGroups();
+    prepareEventPlan();
+
+    blockSamples.clearQuick();
+    blockSamples.insertMultiple(0, 0, channels.size());
+    blockTimestamps.clearQuick();
+    blockTimestamps.insertMultiple(0, 0, channels.size());
     
+    prepareFeatures();
+    prepareSpikeDetector();
+    preparePsth();
+    prepareSpikeFeatures();
+}
+
+/** The injected channels follow the input channels, with the sample rate and
+ timestamps of the first one */
+void ZmqInterface::addInjectedChannels()
+{
+    injectFirstChannel = channels.size();
+    int nInjected = getOption("inject_channels");
+    if(nInjected <= 0)
+        return;
+    if(channels.size() == 0)
+    {
+        std::cout << "no input channel, nothing to align the injected channels to" << std::endl;
+        return;
+    }
+    
+    Channel *reference = channels[0];
+    for(int i = 0; i < nInjected; i++)
+    {
+        Channel *chan = new Channel(this, injectFirstChannel + i, HEADSTAGE_CHANNEL);
+        chan->setName(String("ZMQ") + String(i + 1));
+        chan->sampleRate = reference->sampleRate;
+        chan->sourceNodeId = reference->sourceNodeId;
+        chan->bitVolts = (float)(double)getOption("inject_bit_volts");
+        channels.add(chan);
+    }
+    settings.numOutputs = channels.size();
+}
+
+void ZmqInterface::prepareInjector()
+{
+    int nInjected = channels.size() - injectFirstChannel;
+    float sampleRate = nInjected > 0 ? channels[injectFirstChannel]->sampleRate : 0.f;
+    injector.prepare(nInjected, (int)((double)getOption("inject_delay_ms") * sampleRate / 1000.));
+}
+
+void ZmqInterface::updateBlockInfo(const AudioSampleBuffer &buffer)
+{
+    int nCh = jmin(buffer.getNumChannels(), blockSamples.size());
+    for(int ch = 0; ch < nCh; ch++)
+    {
+        blockSamples.set(ch, getNumSamples(ch));
+        blockTimestamps.set(ch, (int64)getTimestamp(ch));
+    }
+}
+
+void ZmqInterface::prepareFeatures()
+{
+    Array<float> sampleRates;
+    for(int ch = 0; ch < channels.size(); ch++)
+        sampleRates.add(channels[ch]->sampleRate);
+    
+    featureExtractor.prepare(sampleRates,
+                             (float)(double)getOption("features_band_low"),
+                             (float)(double)getOption("features_band_high"));
+    featureExtractor.reset();
+    
+    int nChannels = featureExtractor.getNumChannels();
+    int nFeatures = featureExtractor.getNumFeatures();
+    
+    DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty("message_no", "${message_no}");
+    obj->setProperty("type", "features");
+    
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty("n_channels", nChannels);
+    c_obj->setProperty("n_features", nFeatures);
+    var f_var;
+    StringArray names = featureExtractor.getFeatureNames();
+    for(int i = 0; i < names.size(); i++)
+        f_var.append(names[i]);
+    c_obj->setProperty("features", f_var);
+    c_obj->setProperty("timestamp", "${timestamp}");
+    c_obj->setProperty("n_real_samples", "${n_real_samples}");
+    obj->setProperty("content", var(c_obj));
+    size_t dataSize = nChannels * nFeatures * sizeof(float);
+    obj->setProperty("data_size", (int)dataSize);
+    
+    var json(obj);
+    featuresPlan.prepare("FEATURES", JSON::toString(json, true), dataSize, 8);
+    featuresFields.messageNo = featuresPlan.getField("message_no");
+    featuresFields.timestamp = featuresPlan.getField("timestamp");
+    featuresFields.realSamples = featuresPlan.getField("n_real_samples");
+}
+
+void ZmqInterface::prepareSpikeDetector()
+{
+    const int maxSpikes = 1024; // per block
+    Array<int> spikeChannels = parseChannelList(getOption("spikes_channels"), channels.size());
+    spikeDetector.prepare(spikeChannels,
+                          (float)(double)getOption("spikes_threshold"),
+                          getOption("spikes_pre_samples"),
+                          getOption("spikes_post_samples"),
+                          maxSpikes);
+    
+    DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty("message_no", "${message_no}");
+    obj->setProperty("type", "spike_batch");
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty("n_spikes", "${n_spikes}");
+    c_obj->setProperty("n_dropped", "${n_dropped}");
+    c_obj->setProperty("snippet_length", spikeDetector.getSnippetLength());
+    c_obj->setProperty("pre_samples", spikeDetector.getPreSamples());
+    c_obj->setProperty("timestamp", "${timestamp}");
+    obj->setProperty("content", var(c_obj));
+    obj->setProperty("data_size", "${data_size}");
+    
+    spikesPlan.prepare("SPIKES", JSON::toString(var(obj), true),
+                       maxSpikes * (sizeof(DetectedSpike) + spikeDetector.getSnippetLength() * sizeof(float)), 3);
+    spikesFields.messageNo = spikesPlan.getField("message_no");
+    spikesFields.spikes = spikesPlan.getField("n_spikes");
+    spikesFields.dropped = spikesPlan.getField("n_dropped");
+    spikesFields.timestamp = spikesPlan.getField("timestamp");
+    spikesFields.dataSize = spikesPlan.getField("data_size");
+}
+
+void ZmqInterface::preparePsth()
+{
+    // numbered from 1 like the channels, from 0 in the events
+    String list = getOption("psth_triggers");
+    Array<int> triggers; // empty for any channel
+    if(list.trim().isNotEmpty())
+        triggers = parseChannelList(list, 256);
+    psth.prepare(triggers, channels.size() > 0 ? channels[0]->sampleRate : 30000.,
+                 getOption("psth_pre_ms"), getOption("psth_post_ms"), getOption("psth_bin_ms"));
+    
+    DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty("message_no", "${message_no}");
+    obj->setProperty("type", "psth");
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty("timestamp", "${timestamp}");
+    c_obj->setProperty("sample_rate", channels.size() > 0 ? channels[0]->sampleRate : 30000.f);
+    c_obj->setProperty("pre_ms", psth.getPreMs());
+    c_obj->setProperty("post_ms", psth.getPostMs());
+    c_obj->setProperty("bin_ms", psth.getBinMs());
+    c_obj->setProperty("n_bins", psth.getNumBins());
+    c_obj->setProperty("trigger_channels", ZmqMessagePlan::getArrayTemplate("trigger_channels", ZmqPsth::MAX_TRIGGERS));
+    c_obj->setProperty("trials", ZmqMessagePlan::getArrayTemplate("trials", ZmqPsth::MAX_TRIGGERS));
+    c_obj->setProperty("electrodes", ZmqMessagePlan::getArrayTemplate("electrodes", ZmqPsth::MAX_ELECTRODES));
+    c_obj->setProperty("n_spikes", "${n_spikes}");
+    c_obj->setProperty("n_ignored", "${n_ignored}");
+    obj->setProperty("content", var(c_obj));
+    obj->setProperty("data_size", "${data_size}");
+    
+    // a few messages per second, two slots are plenty
+    psthPlan.prepare("PSTH", JSON::toString(var(obj), true), psth.getMaxCountsSize(), 2);
+    psthFields.messageNo = psthPlan.getField("message_no");
+    psthFields.timestamp = psthPlan.getField("timestamp");
+    psthFields.triggers = psthPlan.getField("trigger_channels");
+    psthFields.trials = psthPlan.getField("trials");
+    psthFields.electrodes = psthPlan.getField("electrodes");
+    psthFields.spikes = psthPlan.getField("n_spikes");
+    psthFields.ignored = psthPlan.getField("n_ignored");
+    psthFields.dataSize = psthPlan.getField("data_size");
+}
+
+void ZmqInterface::prepareSpikeFeatures()
+{
+    spikeFeatures.prepare(channels.size() > 0 ? channels[0]->sampleRate : 30000.,
+                          getOption("spike_features_pcs"), getOption("spike_features_refresh"));
+    
+    DynamicObject::Ptr obj = new DynamicObject();
+    obj->setProperty("message_no", "${message_no}");
+    obj->setProperty("type", "spike_features");
+    DynamicObject::Ptr c_obj = new DynamicObject();
+    c_obj->setProperty("n_spikes", "${n_spikes}");
+    c_obj->setProperty("n_dropped", "${n_dropped}");
+    Array<var> names;
+    StringArray featureNames = spikeFeatures.getFeatureNames();
+    for(int i = 0; i < featureNames.size(); i++)
+        names.add(featureNames[i]);
+    c_obj->setProperty("feature_names", names);
+    c_obj->setProperty("electrodes", ZmqMessagePlan::getArrayTemplate("electrodes", ZmqSpikeFeatures::MAX_ELECTRODES));
+    c_obj->setProperty("basis_versions", ZmqMessagePlan::getArrayTemplate("basis_versions",
+                                                                         ZmqSpikeFeatures::MAX_ELECTRODES));
+    c_obj->setProperty("explained_variance", ZmqMessagePlan::getArrayTemplate("explained_variance",
+                                                                             ZmqSpikeFeatures::MAX_ELECTRODES));
+    c_obj->setProperty("timestamp", "${timestamp}");
+    obj->setProperty("content", var(c_obj));
+    obj->setProperty("data_size", "${data_size}");
+    
+    spikeFeaturesPlan.prepare("SPIKE_FEATURES", JSON::toString(var(obj), true),
+                              ZmqSpikeFeatures::MAX_BATCH * (sizeof(SpikeFeatureRecord) +
+                                                             spikeFeatures.getNumFeatures() * sizeof(float)), 3);
+    spikeFeaturesFields.messageNo = spikeFeaturesPlan.getField("message_no");
+    spikeFeaturesFields.spikes = spikeFeaturesPlan.getField("n_spikes");
+    spikeFeaturesFields.dropped = spikeFeaturesPlan.getField("n_dropped");
+    spikeFeaturesFields.electrodes = spikeFeaturesPlan.getField("electrodes");
+    spikeFeaturesFields.versions = spikeFeaturesPlan.getField("basis_versions");
+    spikeFeaturesFields.explained = spikeFeaturesPlan.getField("explained_variance");
+    spikeFeaturesFields.timestamp = spikeFeaturesPlan.getField("timestamp");
+    spikeFeaturesFields.dataSize = spikeFeaturesPlan.getField("data_size");
+}
+
+/** Parses 1-based channel lists like "1-16,33". An empty list means all channels.
+ Returns 0-based indices. */
+Array<int> ZmqInterface::parseChannelList(const String &list, int nChannels)
+{
+    Array<int> result;
+    if(list.trim().isEmpty())
+    {
+        for(int ch = 0; ch < nChannels; ch++)
+            result.add(ch);
+        return result;
+    }
+    
+    StringArray tokens;
+    tokens.addTokens(list, ",; ", String::empty);
+    tokens.removeEmptyStrings();
+    for(int i = 0; i < tokens.size(); i++)
+    {
+        int first = tokens[i].upToFirstOccurrenceOf("-", false, false).getIntValue();
+        int last = tokens[i].contains("-") ?
+            tokens[i].fromFirstOccurrenceOf("-", false, false).getIntValue() : first;
+        for(int ch = first; ch <= last; ch++)
+        {
+            if(ch >= 1 && ch <= nChannels)
+                result.addIfNotAlreadyThere(ch - 1);
+        }
+    }
+    return result;
+}
+
+/** CPU lists like "0-3,6" to an affinity mask (CPUs 0-31). Empty for all */
+uint32 ZmqInterface::parseCpuMask(const String &list)
+{
+    if(list.trim().isEmpty())
+        return 0xffffffff;
+    
+    uint32 mask = 0;
+    StringArray tokens;
+    tokens.addTokens(list, ",; ", String::empty);
+    tokens.removeEmptyStrings();
+    for(int i = 0; i < tokens.size(); i++)
+    {
+        int first = tokens[i].upToFirstOccurrenceOf("-", false, false).getIntValue();
+        int last = tokens[i].contains("-") ?
+            tokens[i].fromFirstOccurrenceOf("-", false, false).getIntValue() : first;
+        for(int cpu = jmax(0, first); cpu <= jmin(31, last); cpu++)
+            mask |= 1u << cpu;
+    }
+    return mask != 0 ? mask : 0xffffffff;
 }
 
 
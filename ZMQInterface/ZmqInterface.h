@@ -41,11 +41,20 @@
 
 #include <queue>
 
+#include "ZmqFeatures.h"
+#include "ZmqSpikeDetector.h"
+#include "ZmqMessagePlan.h"
+#include "ZmqInjector.h"
+#include "ZmqPsth.h"
+#include "ZmqSpikeFeatures.h"
+
+class ZmqPublisher;
+
 
 struct ZmqApplication {
     String name;
     String Uuid;
-    time_t lastSeen;
+    double lastSeen; // Time::getMillisecondCounterHiRes() of the last message
     bool alive;
 };
 
@@ -53,7 +62,7 @@ struct ZmqApplication {
 //=============================================================================
 /*
  */
-class ZmqInterface    : public GenericProcessor, public Thread
+class ZmqInterface    : public GenericProcessor, public Thread, private AsyncUpdater, private Timer
 {
 public:
     /** The class constructor, used to initialize any members. */
@@ -103,11 +112,26 @@ public:
     void updateSettings();
     
     bool isReady();
+    bool enable();
+    bool disable();
     
     void resetConnections();
     void run();
 
-    OwnedArray<ZmqApplication> *getApplicationList();
+    /** A copy of the application list, safe to call from any thread. The list
+     itself is maintained by the listening thread */
+    Array<ZmqApplication> getApplications() const;
+
+    /** Named options of the plugin (see the constructor for the list).
+     Values are converted to the type of the option default, so they can come
+     from the XML settings or from JSON as strings. */
+    var getOption(const Identifier &name) const;
+    bool setOption(const Identifier &name, const var &value);
+    /** Several options at once (saved settings, requests of the clients),
+     the network is restarted once at the end if any zmq_* option changed */
+    void setOptions(const NamedValueSet &values);
+    NamedValueSet getOptions() const;
+    bool hasOption(const Identifier &name) const;
 
     // TODO void saveCustomParametersToXml(XmlElement* parentElement);
     // TODO void loadCustomParametersFromXml();
@@ -119,15 +143,26 @@ public:
     
 private:
     int createContext();
+    void startNetwork();
+    void stopNetwork();
+    void restartNetwork();
     void openListenSocket();
-    void openKillSocket();
     void openPipeOutSocket();
     int closeListenSocket();
+    void bindListenSocket();
+    void bindInjectSocket(int port);
+    void settleInjectSocket();
     int createDataSocket();
     int closeDataSocket();
 
     void handleEvent(int eventType, MidiMessage& event, int sampleNum);
-    int sendData(float *data, int nChannels, int nSamples, int nRealSamples);
+    struct DataGroup;
+    int sendData(const AudioSampleBuffer &buffer, DataGroup &group);
+    int sendDataPart(const AudioSampleBuffer &buffer, DataGroup &group, int offset, int nSamples);
+    int flushData(DataGroup &group);
+    void carryDataState(const DataGroup &from, DataGroup &to);
+    void sendStatus(double now);
+    void sendSync(int64 monotonicNs, int64 realtimeNs);
     int sendEvent( uint8 type,
                   int sampleNum,
                   uint8 eventId,
@@ -135,28 +170,209 @@ private:
                   uint8 numBytes,
                   const uint8* eventData);
     int sendSpikeEvent(MidiMessage &event);
+    static const char *eventTopic(int type);
+    int sendFeatures(const AudioSampleBuffer &buffer);
+    int sendSpikeBatch(int nSpikes);
+    void analyzeEvent(int eventType, MidiMessage &event, int sampleNum);
+    int sendPsth();
+    int sendSpikeFeatures();
+    int sendMessage(const char *envelope, const String &header,
+                    const void *data, size_t dataSize);
     
+    /** Adds the events of the applications to the block, returns how many */
     int receiveEvents(MidiBuffer &events);
-    void checkForApplications();
+    String handleConfigRequest(const var &request);
+    void handleAsyncUpdate() override;
+    void timerCallback() override;
+    int receiveInjected();
+    void applicationSeen(const String &name, const String &uuid, double now);
+    void checkForApplications(double now);
+    void notifyApplicationsChanged();
     
     template<typename T> int sendParam(String name, T value);
+    
+    void applyOption(const Identifier &name);
+    void updateMetadata();
+    void prepareStreams();
+    void prepareDataGroups();
+    void prepareDataPlan(DataGroup &group, int nSamples);
+    int decimate(const AudioSampleBuffer &buffer, DataGroup &group, int offset, int nSamples, int64 timestamp,
+                 int64 &firstTimestamp);
+    struct DataConfig;
+    DataConfig &getDataConfig();
+    int beginDataConfig();
+    void commitDataConfig(int slot);
+    void finishDataConfig();
+    void prepareEventPlan();
+    void prepareFeatures();
+    void prepareSpikeDetector();
+    void preparePsth();
+    void prepareSpikeFeatures();
+    void addInjectedChannels();
+    void prepareInjector();
+    void updateBlockInfo(const AudioSampleBuffer &buffer);
+    static Array<int> parseChannelList(const String &list, int nChannels);
+    static uint32 parseCpuMask(const String &list);
 
     
     void *context = 0;
-    void *socket = 0;
+    ScopedPointer<ZmqPublisher> publisher;
+    void *socket = 0; // pipe to the publisher
+    // publisher stream indices, to check for subscribers
+    // one per event type, "EVENT/<type>" (see eventTopic())
+    Array<int> eventStreams;
+    int featuresStream = -1;
+    int spikesStream = -1;
+    int psthStream = -1;
+    int spikeFeaturesStream = -1;
+    int statusStream = -1;
+    int syncStream = -1;
     void *listenSocket = 0;
-    void *controlSocket = 0;
-    void *killSocket = 0;
     void *pipeInSocket = 0;
     void *pipeOutSocket = 0;
+    void *injectSocket = 0; // PULL, read by the audio thread
+    String listenEndpoint, injectEndpoint; // as bound, to unbind them
+    Atomic<int> listenPortChanged; // rebound by the listening thread
+    /** While acquiring the inject socket belongs to the audio thread: a new
+     port gets a new socket, bound by the message thread and swapped in by
+     process(), which leaves the old one to handleAsyncUpdate() to close */
+    Atomic<void *> nextInjectSocket;
+    Atomic<void *> retiredInjectSocket;
     
     
     OwnedArray<ZmqApplication> applications;
+    CriticalSection applicationLock;
+    
+    NamedValueSet options;
+    CriticalSection optionLock;
+    // changes asked on the listen socket, applied by the message thread
+    NamedValueSet pendingOptions;
+    CriticalSection pendingOptionLock;
+    bool acquisitionActive = false;
+    bool restartPending = false; // zmq_* options changed while acquiring
+    int settingOptions = 0; // within setOptions()
+    bool restartQueued = false; // by setOption(), for the end of setOptions()
+    
+    Atomic<int> featuresEnabled;
+    ZmqFeatureExtractor featureExtractor;
+    
+    Atomic<int> spikesEnabled;
+    ZmqSpikeDetector spikeDetector;
+    ZmqMessagePlan spikesPlan;
+    struct { int messageNo, spikes, dropped, timestamp, dataSize; } spikesFields;
+    
+    Atomic<int> psthEnabled;
+    Atomic<int> psthIntervalMs; // psth_rate, for process()
+    ZmqPsth psth;
+    ZmqMessagePlan psthPlan;
+    struct { int messageNo, timestamp, triggers, trials, electrodes, spikes, ignored, dataSize; } psthFields;
+    double lastPsth = 0.0; // Time::getMillisecondCounterHiRes()
+    
+    Atomic<int> spikeFeaturesEnabled;
+    ZmqSpikeFeatures spikeFeatures;
+    ZmqMessagePlan spikeFeaturesPlan;
+    struct { int messageNo, spikes, dropped, electrodes, versions, explained, timestamp, dataSize; } spikeFeaturesFields;
+    
+    // continuous channels computed by the clients, after the input channels
+    ZmqInjector injector;
+    int injectFirstChannel = 0;
+    
+    // per channel number of samples and first timestamp of the current block
+    Array<int> blockSamples;
+    Array<int64> blockTimestamps;
+    
+    // preformatted messages, only numbers are patched when sending
+    
+    /** Channels with the same source and sample rate, published together
+     under the topic "DATA/<source node id>/<sample rate>" */
+    struct DataGroup {
+        String topic;
+        int sourceNodeId;
+        float sampleRate;
+        Array<int> channels;
+        int stream;
+        int64 sequence = 0;
+        ZmqMessagePlan plan;
+        int planSamples = 0; // capacity of the plan, per channel
+        int blockSamples = 0; // buffer size the plan was made for
+        struct { int messageNo, samples, realSamples, timestamp, sequence, blocks, dataSize; } fields;
+        // coalescing: consecutive blocks are collected in the frame of the
+        // plan until waiting for one more would exceed maxLatencySamples
+        int maxLatencySamples = 0; // 0 for one block per message, in output samples
+        // data_decimation and data_format: boxcar averages aligned on the
+        // sample numbers, and int16 samples in units of scale
+        int decimation = 1;
+        float scale = 0.f; // 0 for float32
+        int sampleSize = sizeof(float);
+        HeapBlock<float> decimated; // channels x decimatedStride, this block
+        int decimatedStride = 0;
+        HeapBlock<float> sums; // per channel, of the group in progress
+        int decimationCount = 0;
+        int64 decimationNext = -1; // sample number expected next
+        char *batch = nullptr;
+        int batchSamples = 0;
+        int batchBlocks = 0;
+        int firstBlockSamples = 0;
+        int64 batchTimestamp = 0;
+        int64 batchStart = 0; // Time::getHighResolutionTicks()
+        struct {
+            int64 messages = 0, blocks = 0, bytes = 0;
+            double latencySum = 0.0, latencyMax = 0.0; // added latency, ms
+            int64 lastBytes = 0, lastMessages = 0;
+        } stats;
+        int previous = -1; // the group of the same topic in the configuration replaced
+    };
+    /** The DATA streams. process() uses one of the two slots, the message thread
+     builds the next configuration in the other and hands it over without a
+     lock: dataConfigState is the slot in use, plus SWITCH_PENDING until
+     process() takes the other one at its next block. Changes made while a
+     switch is pending are built after it (see timerCallback) */
+    struct DataConfig {
+        OwnedArray<DataGroup> groups;
+    };
+    DataConfig dataConfigs[2];
+    Atomic<int> dataConfigState;
+    enum { SWITCH_PENDING = 2 };
+    int builtDataConfig = 0; // the newest slot, for the message thread
+    bool dataConfigQueued = false; // changed while a switch was pending
+    Atomic<int> lastBlockSize; // for the plans of the next configuration, 0 until a block
+    Atomic<int> dataPlansTooSmall; // set by process(), rebuilt in handleAsyncUpdate()
+    enum { DATA_BLOCK_SAMPLES = 1024 }; // plans made before process() saw a block
+    enum { DATA_PLAN_SLOTS = 3 }; // messages in flight per stream before copies
+    ZmqMessagePlan eventPlan;
+    struct { int messageNo, type, sampleNum, timestamp, eventId, eventChannel, dataSize; } eventFields;
+    ZmqMessagePlan spikeEventPlan; // the spikes of upstream processors, one per message
+    struct { int messageNo, timestamp, timestampSoftware, channels, samples, electrodeId, channel, source,
+        color, pcProj, gain, threshold; } spikeEventFields;
+    ZmqMessagePlan featuresPlan;
+    struct { int messageNo, timestamp, realSamples; } featuresFields;
     
     int flag = 0;
     int messageNumber = 0;
-    int dataPort = 5556; //TODO make this editable
-    int listenPort = 5557;
+    int schemaId = 0;
+    int64 droppedMessages = 0; // pipe to the publisher full
+    Atomic<int> unpublishedTopics; // DATA streams past ZmqPublisher::MAX_STREAMS
+    double lastStatus = 0.0; // Time::getMillisecondCounterHiRes()
+    Atomic<int> syncIntervalMs; // sync_interval, for process()
+    int64 lastSync = 0; // CLOCK_MONOTONIC ns
+    int64 syncSequence = 0;
+    
+    // listening thread affinity, applied by the thread itself
+    Atomic<int> listenerAffinity;
+    Atomic<int> listenerAffinityChanged;
+    
+    // audio thread timing since the last status message, to see the effect of
+    // the thread settings
+    struct {
+        int64 lastTicks = 0; // start of the previous process()
+        int64 blocks = 0;
+        double intervalSum = 0.0, intervalSumSq = 0.0;
+        double intervalMin = 0.0, intervalMax = 0.0;
+        double processSum = 0.0, processMax = 0.0;
+        int64 receivedEvents = 0; // from the applications, see receiveEvents()
+        double receiveSum = 0.0, receiveMax = 0.0;
+    } timing;
+    Atomic<int> listenRequests; // answered by the listening thread, since the last status
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ZmqInterface);
     
 };
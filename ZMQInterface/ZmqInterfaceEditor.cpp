@@ -39,6 +39,7 @@
 
 #include "ZmqInterfaceEditor.h"
 #include "ZmqInterface.h"
+#include "ZmqTracer.h"
 
 class ZmqInterfaceEditor::ZmqInterfaceEditorListBox: public ListBox,
 private ListBoxModel, public AsyncUpdater
@@ -69,6 +70,8 @@ public:
     
     void refresh()
     {
+        ZMQ_TRACE("editor refresh");
+        items = editor->getApplications();
         updateContent();
         repaint();
         
@@ -76,27 +79,26 @@ public:
     
     int getNumRows() override
     {
-        return editor->getApplicationList()->size();
+        return items.size();
     }
     
     
     void paintListBoxItem (int row, Graphics& g, int width, int height, bool rowIsSelected) override
     {
-        OwnedArray<ZmqApplication> *items = editor->getApplicationList();
-        if (isPositiveAndBelow (row, items->size()))
+        if (isPositiveAndBelow (row, items.size()))
         {
             g.fillAll(Colour(155, 155, 155));
             if (rowIsSelected)
                 g.fillAll (findColour (TextEditor::highlightColourId)
                            .withMultipliedAlpha (0.3f));
             
-            ZmqApplication *i = (*items)[row];
-            const String item (i->name); // TODO change when we put a map
+            const ZmqApplication &i = items.getReference(row);
+            const String item (i.name); // TODO change when we put a map
                 
             const int x = getTickX();
             
             g.setFont (height * 0.6f);
-            if(i->alive)
+            if(i.alive)
                 g.setColour(Colours::green);
             else
                 g.setColour(Colours::red);
@@ -115,7 +117,7 @@ public:
         ListBox::paint (g);
         g.setColour (Colours::grey);
         g.setGradientFill(backgroundGradient);
-        if (editor->getApplicationList()->size() == 0)
+        if (items.size() == 0)
         {
             g.setColour (Colours::grey);
             g.setFont (13.0f);
@@ -131,6 +133,8 @@ public:
 private:
     const String noItemsMessage;
     ZmqInterfaceEditor *editor;
+    /** Copy of the application list, taken at each refresh */
+    Array<ZmqApplication> items;
     /** Stores the editor's background color. */
     Colour backgroundColor;
     
@@ -145,12 +149,181 @@ private:
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ZmqInterfaceEditorListBox)
 };
 
+/** Boolean option, shown as an on/off toggle */
+class OptionBoolProperty: public BooleanPropertyComponent
+{
+public:
+    OptionBoolProperty(ZmqInterface *p, const Identifier &option, const String &label):
+    BooleanPropertyComponent(label, "on", "off"), processor(p), optionName(option)
+    {
+    }
+    
+    void setState(bool newState) override
+    {
+        processor->setOption(optionName, newState);
+        refresh();
+    }
+    
+    bool getState() const override
+    {
+        return processor->getOption(optionName);
+    }
+    
+private:
+    ZmqInterface *processor;
+    Identifier optionName;
+};
+
+/** Numeric or string option, edited as text. The processor converts the text
+ to the option type */
+class OptionTextProperty: public TextPropertyComponent
+{
+public:
+    OptionTextProperty(ZmqInterface *p, const Identifier &option, const String &label, int maxChars = 32):
+    TextPropertyComponent(label, maxChars, false), processor(p), optionName(option)
+    {
+    }
+    
+    void setText(const String &newText) override
+    {
+        processor->setOption(optionName, newText);
+        refresh();
+    }
+    
+    String getText() const override
+    {
+        return processor->getOption(optionName).toString();
+    }
+    
+private:
+    ZmqInterface *processor;
+    Identifier optionName;
+};
+
+/** Saves what the tracer recorded, for chrome://tracing or ui.perfetto.dev */
+class SaveTraceProperty: public ButtonPropertyComponent
+{
+public:
+    SaveTraceProperty(): ButtonPropertyComponent("Recorded stages", false)
+    {
+    }
+    
+    void buttonClicked() override
+    {
+        FileChooser chooser("Save the trace", File::getSpecialLocation(File::userHomeDirectory)
+                            .getChildFile("zmq_trace.json"), "*.json");
+        if(chooser.browseForFileToSave(true) && !ZmqTracer::writeChromeTrace(chooser.getResult()))
+            AlertWindow::showMessageBoxAsync(AlertWindow::WarningIcon, "Trace not saved",
+                                             "Nothing was recorded, or the file could not be written.");
+    }
+    
+    String getButtonText() const override
+    {
+        return "Save...";
+    }
+};
+
+class ZmqInterfaceEditor::OptionsPanel: public PropertyPanel
+{
+public:
+    OptionsPanel(ZmqInterface *p)
+    {
+        Array<PropertyComponent *> data;
+        data.add(new OptionTextProperty(p, "data_channels", "Channels", 256));
+        data.add(new OptionTextProperty(p, "data_decimation", "Decimation"));
+        data.add(new OptionTextProperty(p, "data_format", "Format (float32, int16)"));
+        data.add(new OptionTextProperty(p, "coalesce_max_latency_ms", "Max added latency (ms)"));
+        data.add(new OptionTextProperty(p, "coalesce_topics", "Coalesced topics", 256));
+        data.add(new OptionTextProperty(p, "latest_rate", "Latest only (msg/s)"));
+        data.add(new OptionTextProperty(p, "sync_interval", "Clock sync every (s)"));
+        addSection("DATA streams", data);
+        
+        Array<PropertyComponent *> features;
+        features.add(new OptionBoolProperty(p, "features_enabled", "Publish"));
+        features.add(new OptionTextProperty(p, "features_band_low", "Band low (Hz)"));
+        features.add(new OptionTextProperty(p, "features_band_high", "Band high (Hz)"));
+        addSection("FEATURES stream", features);
+        
+        Array<PropertyComponent *> spikes;
+        spikes.add(new OptionBoolProperty(p, "spikes_enabled", "Detect"));
+        spikes.add(new OptionTextProperty(p, "spikes_channels", "Channels", 256));
+        spikes.add(new OptionTextProperty(p, "spikes_threshold", "Threshold (x MAD)"));
+        spikes.add(new OptionTextProperty(p, "spikes_pre_samples", "Samples before"));
+        spikes.add(new OptionTextProperty(p, "spikes_post_samples", "Samples after"));
+        addSection("SPIKES stream", spikes);
+        
+        Array<PropertyComponent *> psth;
+        psth.add(new OptionBoolProperty(p, "psth_enabled", "Publish"));
+        psth.add(new OptionTextProperty(p, "psth_triggers", "TTL channels", 64));
+        psth.add(new OptionTextProperty(p, "psth_pre_ms", "Before (ms)"));
+        psth.add(new OptionTextProperty(p, "psth_post_ms", "After (ms)"));
+        psth.add(new OptionTextProperty(p, "psth_bin_ms", "Bin (ms)"));
+        psth.add(new OptionTextProperty(p, "psth_rate", "Updates per second"));
+        addSection("PSTH stream", psth);
+        
+        Array<PropertyComponent *> spikeFeatures;
+        spikeFeatures.add(new OptionBoolProperty(p, "spike_features_enabled", "Publish"));
+        spikeFeatures.add(new OptionTextProperty(p, "spike_features_pcs", "Components"));
+        spikeFeatures.add(new OptionTextProperty(p, "spike_features_refresh", "Basis update (spikes)"));
+        addSection("Spike features stream", spikeFeatures);
+        
+        Array<PropertyComponent *> reliable;
+        reliable.add(new OptionTextProperty(p, "reliable_budget_mb", "Queue per consumer (MB)"));
+        reliable.add(new OptionTextProperty(p, "reliable_timeout", "Timeout (s)"));
+        addSection("Reliable consumers", reliable);
+        
+        Array<PropertyComponent *> inject;
+        inject.add(new OptionTextProperty(p, "inject_channels", "Channels"));
+        inject.add(new OptionTextProperty(p, "inject_delay_ms", "Delay (ms)"));
+        inject.add(new OptionTextProperty(p, "inject_bit_volts", "Bit volts"));
+        addSection("Injected channels", inject);
+        
+        Array<PropertyComponent *> ports;
+        ports.add(new OptionTextProperty(p, "data_port", "Data"));
+        ports.add(new OptionTextProperty(p, "listen_port", "Events and heartbeats"));
+        ports.add(new OptionTextProperty(p, "latest_port", "Latest only"));
+        ports.add(new OptionTextProperty(p, "reliable_port", "Reliable consumers"));
+        ports.add(new OptionTextProperty(p, "inject_port", "Injected channels"));
+        addSection("Ports", ports);
+        
+        Array<PropertyComponent *> threads;
+        threads.add(new OptionTextProperty(p, "zmq_io_threads", "ZeroMQ I/O threads"));
+        threads.add(new OptionTextProperty(p, "zmq_cpu_affinity", "ZeroMQ CPUs"));
+        threads.add(new OptionTextProperty(p, "zmq_sched_policy", "ZeroMQ policy"));
+        threads.add(new OptionTextProperty(p, "zmq_thread_priority", "ZeroMQ priority"));
+        threads.add(new OptionTextProperty(p, "listener_priority", "Listener priority"));
+        threads.add(new OptionTextProperty(p, "listener_cpu_affinity", "Listener CPUs"));
+        threads.add(new OptionTextProperty(p, "publisher_priority", "Publisher priority"));
+        threads.add(new OptionTextProperty(p, "publisher_cpu_affinity", "Publisher CPUs"));
+        addSection("Threads", threads);
+        
+        Array<PropertyComponent *> clients;
+        clients.add(new OptionTextProperty(p, "clients_timeout", "Timeout (s)"));
+        clients.add(new OptionTextProperty(p, "clients_check_interval", "Check every (s)"));
+        addSection("Applications", clients);
+        
+        Array<PropertyComponent *> trace;
+        trace.add(new OptionBoolProperty(p, "trace_enabled", "Record"));
+        trace.add(new SaveTraceProperty());
+        addSection("Tracing", trace);
+        
+        setSize(300, getTotalContentHeight());
+    }
+};
+
 ZmqInterfaceEditor::ZmqInterfaceEditor(GenericProcessor *parentNode, bool useDefaultParameters): GenericEditor(parentNode, useDefaultParameters)
 {
     ZmqProcessor = (ZmqInterface *)parentNode;
+    desiredWidth = 200;
     listBox = new ZmqInterfaceEditorListBox(String("no app connected"), this);
     listBox->setBounds(2,25,130,105);
     addAndMakeVisible(listBox);
+    
+    optionsButton = new UtilityButton("options", Font("Small Text", 12, Font::plain));
+    optionsButton->addListener(this);
+    optionsButton->setBounds(138, 28, 56, 20);
+    addAndMakeVisible(optionsButton);
+    
     setEnabledState(false);
     
 }
@@ -160,14 +333,34 @@ ZmqInterfaceEditor::~ZmqInterfaceEditor()
     deleteAllChildren();
 }
 
+void ZmqInterfaceEditor::buttonEvent(Button* button)
+{
+    if(button == optionsButton)
+    {
+        CallOutBox::launchAsynchronously(new OptionsPanel(ZmqProcessor),
+                                         optionsButton->getScreenBounds(), nullptr);
+    }
+}
+
 void ZmqInterfaceEditor::saveCustomParameters(XmlElement *xml)
 {
-    
+    xml->setAttribute("Type", "ZmqInterface");
+    XmlElement *optionsXml = xml->createNewChildElement("OPTIONS");
+    NamedValueSet options = ZmqProcessor->getOptions();
+    for(int i = 0; i < options.size(); i++)
+        optionsXml->setAttribute(options.getName(i), options.getValueAt(i).toString());
 }
 
 void ZmqInterfaceEditor::loadCustomParameters(XmlElement* xml)
 {
-    
+    // all at once, so that the network restarts only once
+    NamedValueSet options;
+    forEachXmlChildElementWithTagName(*xml, optionsXml, "OPTIONS")
+    {
+        for(int i = 0; i < optionsXml->getNumAttributes(); i++)
+            options.set(optionsXml->getAttributeName(i), optionsXml->getAttributeValue(i));
+    }
+    ZmqProcessor->setOptions(options);
 }
 
 void ZmqInterfaceEditor::refreshListAsync()
@@ -175,10 +368,8 @@ void ZmqInterfaceEditor::refreshListAsync()
     listBox->triggerAsyncUpdate();
 }
 
-OwnedArray<ZmqApplication> *ZmqInterfaceEditor::getApplicationList()
+Array<ZmqApplication> ZmqInterfaceEditor::getApplications()
 {
-    OwnedArray<ZmqApplication> *ar = ZmqProcessor->getApplicationList();
-    return ar;
-    
+    return ZmqProcessor->getApplications();
 }
 
@@ -52,14 +52,17 @@ public:
     void saveCustomParameters(XmlElement *xml);
     void loadCustomParameters(XmlElement* xml);
     void refreshListAsync();
+    void buttonEvent(Button* button);
     
     
 private:
     //TODO UI components
     class ZmqInterfaceEditorListBox;
-    OwnedArray<ZmqApplication> *getApplicationList();
+    class OptionsPanel;
+    Array<ZmqApplication> getApplications();
     ZmqInterface *ZmqProcessor;
     ZmqInterfaceEditorListBox *listBox;
+    UtilityButton *optionsButton;
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ZmqInterfaceEditor)
 
     
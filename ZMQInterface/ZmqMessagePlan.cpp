@@ -0,0 +1,358 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqMessagePlan.cpp
+    Created: 19 Oct 2026 5:40:25am
+
+  ==============================================================================
+*/
+
+#include <zmq.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "ZmqMessagePlan.h"
+#include "ZmqTracer.h"
+
+
+struct ZmqMessagePlan::Slot
+{
+    Atomic<int> users; // frames still owned by ZeroMQ, or 1 while being built
+    char *header;
+    char *payload;
+    SlotPool *pool;
+};
+
+class ZmqMessagePlan::SlotPool : public ReferenceCountedObject
+{
+public:
+    SlotPool(int numSlots, size_t headerSize, size_t payloadSize)
+    {
+        // payloads 16 byte aligned, for whoever reads the floats in place
+        headerCapacity = (headerSize + 15) & ~(size_t)15;
+        payloadCapacity = (payloadSize + 15) & ~(size_t)15;
+        storage.allocate(numSlots * (headerCapacity + payloadCapacity) + 16, true);
+        char *p = (char *)(((pointer_sized_int)storage.getData() + 15) & ~(pointer_sized_int)15);
+        for(int i = 0; i < numSlots; i++)
+        {
+            Slot *s = new Slot;
+            s->users = 0;
+            s->header = p;
+            s->payload = p + headerCapacity;
+            s->pool = this;
+            p += headerCapacity + payloadCapacity;
+            slots.add(s);
+        }
+    }
+
+    OwnedArray<Slot> slots;
+
+private:
+    HeapBlock<char> storage;
+    size_t headerCapacity;
+    size_t payloadCapacity;
+};
+
+
+ZmqMessagePlan::ZmqMessagePlan()
+{
+}
+
+ZmqMessagePlan::~ZmqMessagePlan()
+{
+    // slots still in flight keep the pool alive, see releaseSlot()
+}
+
+void ZmqMessagePlan::setEnvelope(const char *env)
+{
+    envelopeSize = jmin(strlen(env) + 1, sizeof(envelope));
+    memcpy(envelope, env, envelopeSize - 1);
+    envelope[envelopeSize - 1] = 0;
+}
+
+void ZmqMessagePlan::prepare(const String &env, const String &templ,
+                             size_t maxPayload, int numSlots)
+{
+    setEnvelope(env.toRawUTF8());
+
+    // replace the "${name}" strings with fixed width fields, numbers right
+    // aligned, arrays left aligned
+    fieldNames.clear();
+    fieldOffsets.clearQuick();
+    fieldWidths.clearQuick();
+    String header;
+    int pos = 0;
+    while(true)
+    {
+        int start = templ.indexOf(pos, "\"${");
+        int end = start < 0 ? -1 : templ.indexOf(start, "}\"");
+        if(end < 0)
+            break;
+        header += templ.substring(pos, start);
+        String name = templ.substring(start + 3, end);
+        fieldOffsets.add(header.getNumBytesAsUTF8());
+        if(name.containsChar(':'))
+        {
+            int width = jmax(4, name.fromLastOccurrenceOf(":", false, false).getIntValue());
+            fieldNames.add(name.upToLastOccurrenceOf(":", false, false));
+            fieldWidths.add(-width);
+            header += "null" + String::repeatedString(" ", width - 4);
+        }
+        else
+        {
+            fieldNames.add(name);
+            fieldWidths.add(FIELD_WIDTH);
+            header += String::repeatedString(" ", FIELD_WIDTH - 1) + "0";
+        }
+        pos = end + 2;
+    }
+    header += templ.substring(pos);
+
+    headerSize = header.getNumBytesAsUTF8();
+    headerTemplate.malloc(headerSize);
+    memcpy(headerTemplate, header.toRawUTF8(), headerSize);
+    maxPayloadSize = maxPayload;
+
+    pool = new SlotPool(jmax(1, numSlots), headerSize, maxPayloadSize);
+    nextSlot = 0;
+    current = nullptr;
+    spareHeader.malloc(headerSize);
+    sparePayload.malloc(jmax((size_t)1, maxPayloadSize));
+    copies = 0;
+}
+
+int ZmqMessagePlan::getField(const String &name) const
+{
+    return fieldNames.indexOf(name);
+}
+
+String ZmqMessagePlan::getArrayTemplate(const String &name, int maxSize)
+{
+    // brackets, and a comma after each number
+    return "${" + name + ":" + String(2 + jmax(1, maxSize) * (FIELD_WIDTH + 1)) + "}";
+}
+
+char *ZmqMessagePlan::begin()
+{
+    jassert(isPrepared());
+    current = nullptr;
+    int n = pool->slots.size();
+    for(int i = 0; i < n; i++)
+    {
+        Slot *s = pool->slots.getUnchecked((nextSlot + i) % n);
+        if(s->users.get() == 0)
+        {
+            s->users = 1;
+            current = s;
+            nextSlot = (nextSlot + i + 1) % n;
+            break;
+        }
+    }
+
+    if(current)
+    {
+        currentHeader = current->header;
+        currentPayload = current->payload;
+    }
+    else
+    {
+        currentHeader = spareHeader;
+        currentPayload = sparePayload;
+    }
+    memcpy(currentHeader, headerTemplate, headerSize);
+    return currentPayload;
+}
+
+/** Writes value at text, at most FIELD_WIDTH characters, returns how many */
+int ZmqMessagePlan::formatInteger(char *text, int64 value)
+{
+    char digits[FIELD_WIDTH];
+    bool negative = value < 0;
+    uint64 v = negative ? (uint64)(-(value + 1)) + 1 : (uint64)value;
+    int n = 0;
+    do
+    {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while(v && n < FIELD_WIDTH);
+    int length = 0;
+    if(negative && n < FIELD_WIDTH)
+        text[length++] = '-';
+    while(n > 0)
+        text[length++] = digits[--n];
+    return length;
+}
+
+void ZmqMessagePlan::setField(int field, int64 value)
+{
+    if(field < 0 || field >= fieldOffsets.size() || fieldWidths.getUnchecked(field) < 0)
+        return;
+    // right aligned, padded with spaces (valid JSON whitespace)
+    char *f = currentHeader + fieldOffsets.getUnchecked(field);
+    char text[FIELD_WIDTH];
+    int length = formatInteger(text, value);
+    memset(f, ' ', FIELD_WIDTH - length);
+    memcpy(f + FIELD_WIDTH - length, text, length);
+}
+
+void ZmqMessagePlan::beginArray(int field)
+{
+    array = nullptr;
+    if(field < 0 || field >= fieldOffsets.size() || fieldWidths.getUnchecked(field) > 0)
+        return;
+    array = currentHeader + fieldOffsets.getUnchecked(field);
+    arrayWidth = -fieldWidths.getUnchecked(field);
+    arraySize = 0;
+    arrayLength = 0;
+    addText("[", 1);
+}
+
+void ZmqMessagePlan::addText(const char *text, int length)
+{
+    // room left for the closing bracket
+    if(arrayLength < 0 || arrayLength + length + 1 > arrayWidth)
+    {
+        arrayLength = -1;
+        return;
+    }
+    memcpy(array + arrayLength, text, length);
+    arrayLength += length;
+}
+
+void ZmqMessagePlan::addInteger(int64 value)
+{
+    if(!array)
+        return;
+    char text[FIELD_WIDTH + 1];
+    int length = 0;
+    if(arraySize++ > 0)
+        text[length++] = ',';
+    length += formatInteger(text + length, value);
+    addText(text, length);
+}
+
+void ZmqMessagePlan::addFloat(double value)
+{
+    if(!array)
+        return;
+    char text[32];
+    int length = 0;
+    if(arraySize++ > 0)
+        text[length++] = ',';
+    // at most 16 characters, below FIELD_WIDTH. JSON has no NaN or infinity
+    if(isfinite(value))
+        length += snprintf(text + length, sizeof(text) - length, "%.9g", value);
+    else
+        length += snprintf(text + length, sizeof(text) - length, "null");
+    addText(text, length);
+}
+
+void ZmqMessagePlan::endArray()
+{
+    if(!array)
+        return;
+    if(arrayLength >= 0)
+    {
+        array[arrayLength++] = ']';
+        memset(array + arrayLength, ' ', arrayWidth - arrayLength);
+    }
+    else
+    {
+        jassertfalse; // see getArrayTemplate()
+        memcpy(array, "null", 4);
+        memset(array + 4, ' ', arrayWidth - 4);
+    }
+    array = nullptr;
+}
+
+void ZmqMessagePlan::releaseSlot(void *, void *hint)
+{
+    // called by ZeroMQ, possibly from its own threads
+    Slot *s = (Slot *)hint;
+    SlotPool *p = s->pool;
+    --s->users;
+    p->decReferenceCount();
+}
+
+int ZmqMessagePlan::send(void *socket, size_t payloadSize)
+{
+    ZMQ_TRACE("zmq_msg_send");
+    jassert(payloadSize <= maxPayloadSize);
+    Slot *slot = current;
+    current = nullptr;
+
+    // small enough to be stored in the message itself
+    zmq_msg_t messageEnvelope;
+    zmq_msg_init_size(&messageEnvelope, envelopeSize);
+    memcpy(zmq_msg_data(&messageEnvelope), envelope, envelopeSize);
+    int size = zmq_msg_send(&messageEnvelope, socket, ZMQ_SNDMORE | ZMQ_DONTWAIT);
+    zmq_msg_close(&messageEnvelope);
+    if(size == -1)
+    {
+        if(slot)
+            slot->users = 0;
+        return -1;
+    }
+
+    zmq_msg_t messageHeader;
+    zmq_msg_t message;
+    if(slot)
+    {
+        slot->users = payloadSize ? 2 : 1;
+        slot->pool->incReferenceCount();
+        zmq_msg_init_data(&messageHeader, slot->header, headerSize, releaseSlot, slot);
+        if(payloadSize)
+        {
+            slot->pool->incReferenceCount();
+            zmq_msg_init_data(&message, slot->payload, payloadSize, releaseSlot, slot);
+        }
+    }
+    else
+    {
+        copies++;
+        zmq_msg_init_size(&messageHeader, headerSize);
+        memcpy(zmq_msg_data(&messageHeader), spareHeader, headerSize);
+        if(payloadSize)
+        {
+            zmq_msg_init_size(&message, payloadSize);
+            memcpy(zmq_msg_data(&message), sparePayload, payloadSize);
+        }
+    }
+
+    size = zmq_msg_send(&messageHeader, socket, payloadSize ? ZMQ_SNDMORE : 0);
+    jassert(size != -1);
+    zmq_msg_close(&messageHeader);
+    if(payloadSize)
+    {
+        int size_m = zmq_msg_send(&message, socket, 0);
+        jassert(size_m != -1);
+        size += size_m;
+        zmq_msg_close(&message);
+    }
+    return size;
+}
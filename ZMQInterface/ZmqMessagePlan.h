@@ -0,0 +1,131 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqMessagePlan.h
+    Created: 19 Oct 2026 5:40:25am
+
+  ==============================================================================
+*/
+
+#ifndef ZMQMESSAGEPLAN_H_INCLUDED
+#define ZMQMESSAGEPLAN_H_INCLUDED
+
+#include <ProcessorHeaders.h>
+
+
+//=============================================================================
+/** A message layout (envelope, JSON header, optional binary frame) prepared
+ once per configuration, so that sending only patches a few numbers.
+
+ The header template is normal JSON text where the fields that change from
+ message to message are the strings "${name}". prepare() turns them into
+ space padded numbers of fixed width, patched in place by setField(). Arrays
+ of numbers whose length changes are "${name:width}" fields, at most width
+ characters of JSON (see getArrayTemplate()), written with beginArray().
+
+ Messages are built in a pool of preallocated slots, handed to ZeroMQ without
+ copies (zmq_msg_init_data); a slot is reused once ZeroMQ is done with it.
+ If all slots are in flight (e.g. slow subscribers) the message is copied
+ instead. begin()/setField()/send() build no JUCE strings or JSON and take no
+ memory of their own; libzmq still allocates the small message frames
+ (zmq_msg_init_size).
+ */
+class ZmqMessagePlan
+{
+public:
+    ZmqMessagePlan();
+    ~ZmqMessagePlan();
+
+    void prepare(const String &envelope, const String &headerTemplate,
+                 size_t maxPayloadSize, int numSlots);
+    bool isPrepared() const { return headerSize > 0; }
+
+    /** Index of the "${name}" field, -1 if the template has none */
+    int getField(const String &name) const;
+    /** The "${name:width}" string for arrays of up to maxSize numbers */
+    static String getArrayTemplate(const String &name, int maxSize);
+    size_t getMaxPayloadSize() const { return maxPayloadSize; }
+
+    /** Starts a new message, returns the buffer for its payload */
+    char *begin();
+    void setField(int field, int64 value);
+
+    /** Writes an array field of the message started: beginArray(), the
+     numbers, endArray(). An array too long for the field is sent as null */
+    void beginArray(int field);
+    void addInteger(int64 value);
+    void addFloat(double value);
+    void endArray();
+
+    /** Changes the envelope of the next messages, e.g. for topics that
+     depend on the content. Truncated to 31 bytes */
+    void setEnvelope(const char *envelope);
+
+    /** Sends the message started by begin(), with payloadSize bytes of payload
+     (no binary frame if 0). Never blocks, returns -1 if the socket is full */
+    int send(void *socket, size_t payloadSize);
+
+    /** Messages that were copied because no slot was free */
+    int64 getNumCopies() const { return copies; }
+
+    enum { FIELD_WIDTH = 20 };
+
+private:
+    struct Slot;
+    class SlotPool;
+    static void releaseSlot(void *data, void *hint);
+    static int formatInteger(char *text, int64 value);
+    void addText(const char *text, int length);
+
+    char envelope[32];
+    size_t envelopeSize = 0;
+    HeapBlock<char> headerTemplate;
+    size_t headerSize = 0;
+    size_t maxPayloadSize = 0;
+    StringArray fieldNames;
+    Array<int> fieldOffsets;
+    Array<int> fieldWidths;
+    char *array = nullptr; // the array field being written
+    int arrayWidth = 0;
+    int arrayLength = 0; // -1 once too long
+    int arraySize = 0;
+
+    ReferenceCountedObjectPtr<SlotPool> pool;
+    int nextSlot = 0;
+    Slot *current = nullptr;
+    char *currentHeader = nullptr;
+    char *currentPayload = nullptr;
+    HeapBlock<char> spareHeader;
+    HeapBlock<char> sparePayload;
+    int64 copies = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ZmqMessagePlan);
+};
+
+
+#endif  // ZMQMESSAGEPLAN_H_INCLUDED
@@ -0,0 +1,145 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqPsth.cpp
+    Created: 19 Oct 2026 6:21:59am
+
+  ==============================================================================
+*/
+
+#include <math.h>
+#include "ZmqPsth.h"
+
+
+ZmqPsth::ZmqPsth()
+{
+}
+
+void ZmqPsth::prepare(const Array<int> &triggerChannels_, double sampleRate,
+                      double preMs_, double postMs_, double binMs_)
+{
+    triggerChannels = triggerChannels_;
+    preMs = preMs_;
+    postMs = postMs_;
+    binMs = binMs_;
+    preSamples = jmax((int64)0, (int64)(preMs * sampleRate / 1000.));
+    postSamples = jmax((int64)1, (int64)(postMs * sampleRate / 1000.));
+    binSamples = jmax(1., binMs * sampleRate / 1000.);
+    nBins = jlimit(1, (int)MAX_BINS, (int)ceil((preSamples + postSamples) / binSamples));
+
+    // rows are added by the audio thread, without allocating
+    triggers.ensureStorageAllocated(MAX_TRIGGERS);
+    electrodes.ensureStorageAllocated(MAX_ELECTRODES);
+    counts.malloc(MAX_TRIGGERS * MAX_ELECTRODES * nBins);
+    trials.malloc(MAX_TRIGGERS);
+    recentSpikes.malloc(SPIKE_HISTORY);
+    recentTriggers.malloc(TRIGGER_HISTORY);
+    reset();
+}
+
+void ZmqPsth::reset()
+{
+    triggers.clearQuick();
+    electrodes.clearQuick();
+    if(nBins > 0)
+        memset(counts, 0, MAX_TRIGGERS * MAX_ELECTRODES * nBins * sizeof(uint32));
+    nSpikes = nTriggers = nIgnored = 0;
+}
+
+void ZmqPsth::count(int trigger, int electrode, int64 lag)
+{
+    if(lag < -preSamples || lag >= postSamples)
+        return;
+    int bin = jmin(nBins - 1, (int)((lag + preSamples) / binSamples));
+    counts[(trigger * MAX_ELECTRODES + electrode) * nBins + bin]++;
+}
+
+void ZmqPsth::addSpike(int electrodeId, int64 timestamp)
+{
+    if(nBins == 0)
+        return;
+    int electrode = electrodes.indexOf(electrodeId);
+    if(electrode < 0)
+    {
+        if(electrodes.size() >= MAX_ELECTRODES)
+        {
+            nIgnored++;
+            return;
+        }
+        electrode = electrodes.size();
+        electrodes.add(electrodeId);
+    }
+
+    // the triggers seen so far, the later ones will find this spike
+    const int n = (int)jmin(nTriggers, (int64)TRIGGER_HISTORY);
+    for(int i = 0; i < n; i++)
+        count(recentTriggers[i].index, electrode, timestamp - recentTriggers[i].timestamp);
+
+    Recent &r = recentSpikes[nSpikes % SPIKE_HISTORY];
+    r.timestamp = timestamp;
+    r.index = electrode;
+    nSpikes++;
+}
+
+void ZmqPsth::addTrigger(int channel, int64 timestamp)
+{
+    if(nBins == 0 || (triggerChannels.size() > 0 && !triggerChannels.contains(channel)))
+        return;
+    int trigger = triggers.indexOf(channel);
+    if(trigger < 0)
+    {
+        if(triggers.size() >= MAX_TRIGGERS)
+        {
+            nIgnored++;
+            return;
+        }
+        trigger = triggers.size();
+        triggers.add(channel);
+        trials[trigger] = 0;
+    }
+    trials[trigger]++;
+
+    // spikes before the trigger (and after it, if they came first)
+    const int n = (int)jmin(nSpikes, (int64)SPIKE_HISTORY);
+    for(int i = 0; i < n; i++)
+        count(trigger, recentSpikes[i].index, recentSpikes[i].timestamp - timestamp);
+
+    Recent &r = recentTriggers[nTriggers % TRIGGER_HISTORY];
+    r.timestamp = timestamp;
+    r.index = trigger;
+    nTriggers++;
+}
+
+size_t ZmqPsth::copyCounts(uint32 *dest) const
+{
+    const int nElectrodes = electrodes.size();
+    const size_t rowSize = nElectrodes * nBins * sizeof(uint32);
+    for(int t = 0; t < triggers.size(); t++)
+        memcpy(dest + t * nElectrodes * nBins, counts + t * MAX_ELECTRODES * nBins, rowSize);
+    return triggers.size() * rowSize;
+}
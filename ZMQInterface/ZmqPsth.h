@@ -0,0 +1,116 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqPsth.h
+    Created: 19 Oct 2026 6:21:59am
+
+  ==============================================================================
+*/
+
+#ifndef ZMQPSTH_H_INCLUDED
+#define ZMQPSTH_H_INCLUDED
+
+#include <ProcessorHeaders.h>
+
+
+//=============================================================================
+/** Peri-event time histograms of the spikes of each electrode around the
+ rising edges of TTL channels, updated as the events go by.
+
+ Each (spike, trigger) pair is counted by whichever of the two comes second:
+ a spike is compared with the recent triggers, a trigger with the recent
+ spikes, so the spikes before a trigger are counted too and the order of the
+ events within a block doesn't matter. Counts accumulate until reset().
+
+ Electrodes and trigger channels get a row the first time they are seen, up
+ to MAX_ELECTRODES and MAX_TRIGGERS. Nothing allocates after prepare().
+ */
+class ZmqPsth
+{
+public:
+    ZmqPsth();
+
+    /** triggerChannels: the TTL channels used, empty for all. Windows in ms,
+     converted to samples at sampleRate */
+    void prepare(const Array<int> &triggerChannels, double sampleRate,
+                 double preMs, double postMs, double binMs);
+    void reset();
+
+    void addSpike(int electrodeId, int64 timestamp);
+    void addTrigger(int channel, int64 timestamp);
+
+    int getNumBins() const { return nBins; }
+    /** The windows as given to prepare(), for the messages */
+    double getPreMs() const { return preMs; }
+    double getPostMs() const { return postMs; }
+    double getBinMs() const { return binMs; }
+    int getNumTriggers() const { return triggers.size(); }
+    int getNumElectrodes() const { return electrodes.size(); }
+    int getTriggerChannel(int i) const { return triggers.getUnchecked(i); }
+    int getElectrodeId(int i) const { return electrodes.getUnchecked(i); }
+    int64 getTrials(int trigger) const { return trials[trigger]; }
+    int64 getNumSpikes() const { return nSpikes; }
+    /** Spikes and triggers beyond the rows available */
+    int64 getNumIgnored() const { return nIgnored; }
+
+    /** Copies the counts of the triggers and electrodes seen so far, as
+     uint32 [trigger][electrode][bin]. Returns the number of bytes */
+    size_t copyCounts(uint32 *dest) const;
+    size_t getMaxCountsSize() const { return MAX_TRIGGERS * MAX_ELECTRODES * nBins * sizeof(uint32); }
+
+    enum { MAX_TRIGGERS = 16, MAX_ELECTRODES = 128, MAX_BINS = 1000,
+        SPIKE_HISTORY = 16384, TRIGGER_HISTORY = 256 };
+
+private:
+    struct Recent {
+        int64 timestamp;
+        int index; // electrode or trigger row
+    };
+
+    void count(int trigger, int electrode, int64 lag);
+
+    Array<int> triggerChannels; // allowed, empty for all
+    Array<int> triggers; // channel of each row
+    Array<int> electrodes; // electrode id of each row
+    double preMs = 0., postMs = 0., binMs = 0.;
+    double binSamples = 1.;
+    int64 preSamples = 0, postSamples = 0;
+    int nBins = 0;
+    HeapBlock<uint32> counts; // [MAX_TRIGGERS][MAX_ELECTRODES][nBins]
+    HeapBlock<int64> trials;
+
+    // the last events, to pair with the ones still to come
+    HeapBlock<Recent> recentSpikes;
+    HeapBlock<Recent> recentTriggers;
+    int64 nSpikes = 0, nTriggers = 0, nIgnored = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ZmqPsth);
+};
+
+
+#endif  // ZMQPSTH_H_INCLUDED
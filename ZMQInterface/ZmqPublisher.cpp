@@ -0,0 +1,750 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqPublisher.cpp
+    Created: 19 Oct 2026 5:36:21am
+
+  ==============================================================================
+*/
+
+#include <zmq.h>
+#include <string.h>
+#include <iostream>
+#include <deque>
+#include "ZmqPublisher.h"
+#include "ZmqTracer.h"
+
+const char *ZmqPublisher::PIPE_URL = "inproc://zmqpublisherpipe";
+
+static const char *METADATA_ENVELOPE = "METADATA";
+
+// envelopes kept for the conflated socket, hierarchical topics included
+static const int MAX_LATEST = 64;
+
+struct ZmqPublisher::LatestMessage
+{
+    LatestMessage(const void *env, size_t size): envelope(env, size)
+    {
+        zmq_msg_init(&header);
+        zmq_msg_init(&data);
+    }
+    ~LatestMessage()
+    {
+        zmq_msg_close(&header);
+        zmq_msg_close(&data);
+    }
+    MemoryBlock envelope; // with its NUL
+    zmq_msg_t header;
+    zmq_msg_t data;
+    bool hasData = false;
+    bool pending = false;
+};
+
+
+/** A message waiting for credits, or on its way to a consumer */
+struct ZmqPublisher::QueuedMessage
+{
+    QueuedMessage()
+    {
+        for(int i = 0; i < MAX_FRAMES; i++)
+            zmq_msg_init(&frames[i]);
+    }
+    ~QueuedMessage()
+    {
+        for(int i = 0; i < MAX_FRAMES; i++)
+            zmq_msg_close(&frames[i]);
+    }
+    /** References the frame when sent right away, copies it when queued, so
+     that the sender's buffers are not held */
+    void add(zmq_msg_t *frame, bool copy)
+    {
+        if(nFrames >= MAX_FRAMES)
+            return;
+        zmq_msg_t *f = &frames[nFrames++];
+        if(copy)
+        {
+            zmq_msg_close(f);
+            zmq_msg_init_size(f, zmq_msg_size(frame));
+            memcpy(zmq_msg_data(f), zmq_msg_data(frame), zmq_msg_size(frame));
+        }
+        else
+            zmq_msg_copy(f, frame);
+        size += zmq_msg_size(frame);
+    }
+    enum { MAX_FRAMES = 3 }; // envelope, header, data
+    zmq_msg_t frames[MAX_FRAMES];
+    int nFrames = 0;
+    size_t size = 0;
+    uint64 sequence = 0;
+};
+
+struct ZmqPublisher::Consumer
+{
+    ~Consumer()
+    {
+        for(size_t i = 0; i < queue.size(); i++)
+            delete queue[i];
+    }
+    bool wants(const void *envelope, size_t size) const
+    {
+        for(int i = 0; i < topics.size(); i++)
+        {
+            const MemoryBlock &t = topics.getReference(i);
+            if(t.getSize() <= size && memcmp(t.getData(), envelope, t.getSize()) == 0)
+                return true;
+        }
+        return false;
+    }
+    /** Bytes held for the consumer: queued here, or sent and not given back
+     (see handleConsumers) */
+    int64 getPendingBytes() const { return queuedBytes + inFlightBytes; }
+    MemoryBlock identity;
+    Array<MemoryBlock> topics;
+    int64 credits = 0;
+    uint64 sequence = 0; // of the last message delivered or dropped
+    std::deque<QueuedMessage *> queue;
+    int64 queuedBytes = 0;
+    std::deque<int64> inFlight; // sizes of the messages sent, oldest first
+    int64 inFlightBytes = 0;
+    int64 dropped = 0;
+    int64 reported = 0;
+    uint64 firstDropped = 0; // since the last report
+    double lastSeen = 0.0;
+};
+
+// credits are capped, the queue is what absorbs the bursts. The messages
+// sent count against the budget until their credits come back, and libzmq
+// never holds more than the credits allow (SNDHWM)
+static const int64 MAX_CREDITS = 4096;
+
+
+ZmqPublisher::ZmqPublisher(void *c, int p, int lp, int rp)
+    : Thread("Zmq publisher"), context(c), port(p), latestPort(lp), reliablePort(rp),
+      reliableBudget((int64)256 << 20), reliableTimeout(30000)
+{
+}
+
+ZmqPublisher::~ZmqPublisher()
+{
+    // the poll timeout bounds the wait, or zmq_ctx_shutdown() ends it at once
+    signalThreadShouldExit();
+    waitForThreadToExit(-1);
+}
+
+void ZmqPublisher::setMetadata(const String &header)
+{
+    {
+        const ScopedLock sl(metadataLock);
+        metadata = header;
+    }
+    metadataChanged = 1;
+}
+
+int ZmqPublisher::addStream(const String &envelope)
+{
+    int stream;
+    {
+        const ScopedLock sl(streamLock);
+        stream = streams.indexOf(envelope);
+        if(stream < 0)
+        {
+            stream = streams.indexOf(String::empty); // a removed one
+            if(stream >= 0)
+                streams.set(stream, envelope);
+        }
+        if(stream < 0)
+        {
+            jassert(streams.size() < MAX_STREAMS);
+            if(streams.size() >= MAX_STREAMS)
+                return -1;
+            streams.add(envelope);
+            stream = streams.size() - 1;
+        }
+    }
+    streamsChanged = 1; // picked up by the publisher thread
+    return stream;
+}
+
+void ZmqPublisher::removeStreams(const String &prefix, const StringArray &except)
+{
+    {
+        const ScopedLock sl(streamLock);
+        for(int i = 0; i < streams.size(); i++)
+        {
+            if(streams[i].isNotEmpty() && streams[i].startsWith(prefix) && !except.contains(streams[i]))
+                streams.set(i, String::empty);
+        }
+    }
+    streamsChanged = 1;
+}
+
+void ZmqPublisher::setLatestRate(double rate)
+{
+    latestInterval = rate > 0. ? jmax(1, roundToInt(1000. / rate)) : 0;
+}
+
+void ZmqPublisher::setReliableLimits(int64 budgetBytes, double timeoutMs)
+{
+    reliableBudget = budgetBytes;
+    reliableTimeout = roundToInt(timeoutMs);
+}
+
+void ZmqPublisher::setPorts(int newPort, int newLatestPort, int newReliablePort)
+{
+    port = newPort;
+    latestPort = newLatestPort;
+    reliablePort = newReliablePort;
+    portsChanged = 1;
+}
+
+bool ZmqPublisher::rebindSocket(void *socket, int port, String &endpoint, const char *name)
+{
+    if(endpoint.isNotEmpty())
+        zmq_unbind(socket, endpoint.toRawUTF8());
+    endpoint = String::empty;
+    String url = String("tcp://*:") + String(port);
+    if(zmq_bind(socket, url.toRawUTF8()))
+    {
+        std::cout << "couldn't open " << name << " socket on " << url << std::endl;
+        std::cout << zmq_strerror(zmq_errno()) << std::endl;
+        return false;
+    }
+    char bound[256];
+    size_t size = sizeof(bound);
+    if(zmq_getsockopt(socket, ZMQ_LAST_ENDPOINT, bound, &size) == 0)
+        endpoint = String(bound);
+    return true;
+}
+
+/** (Re)binds the three sockets to their ports, where they changed */
+void ZmqPublisher::bindSockets()
+{
+    if(!endpoint.endsWith(String(":") + String(port.get())))
+    {
+        std::cout << "tcp://*:" << port.get() << std::endl;
+        rebindSocket(xpubSocket, port.get(), endpoint, "data");
+    }
+    if(!latestEndpoint.endsWith(String(":") + String(latestPort.get())))
+        rebindSocket(latestSocket, latestPort.get(), latestEndpoint, "latest data");
+    if(!reliableEndpoint.endsWith(String(":") + String(reliablePort.get())))
+        rebindSocket(routerSocket, reliablePort.get(), reliableEndpoint, "reliable data");
+}
+
+void ZmqPublisher::setCpuAffinity(uint32 mask)
+{
+    affinity = (int)mask;
+    affinityChanged = 1;
+}
+
+void ZmqPublisher::run()
+{
+    xpubSocket = zmq_socket(context, ZMQ_XPUB);
+    // report every subscription (and unsubscription, where supported), not
+    // only the first and last for a topic
+    int verbose = 1;
+#ifdef ZMQ_XPUB_VERBOSER
+    zmq_setsockopt(xpubSocket, ZMQ_XPUB_VERBOSER, &verbose, sizeof(verbose));
+#else
+    zmq_setsockopt(xpubSocket, ZMQ_XPUB_VERBOSE, &verbose, sizeof(verbose));
+#endif
+
+    latestSocket = zmq_socket(context, ZMQ_PUB);
+#ifdef ZMQ_CONFLATE
+    int conflate = 1;
+    zmq_setsockopt(latestSocket, ZMQ_CONFLATE, &conflate, sizeof(conflate));
+#endif
+
+    routerSocket = zmq_socket(context, ZMQ_ROUTER);
+    // the credits bound what is in flight, and sending to a consumer that
+    // went away or fell behind fails instead of being dropped silently
+    int sndhwm = (int)MAX_CREDITS;
+    int mandatory = 1;
+    zmq_setsockopt(routerSocket, ZMQ_SNDHWM, &sndhwm, sizeof(sndhwm));
+    zmq_setsockopt(routerSocket, ZMQ_ROUTER_MANDATORY, &mandatory, sizeof(mandatory));
+    endpoint = latestEndpoint = reliableEndpoint = String::empty;
+    portsChanged = 0;
+    bindSockets();
+
+    pipeSocket = zmq_socket(context, ZMQ_PAIR);
+    int hwm = 10000;
+    zmq_setsockopt(pipeSocket, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+    zmq_bind(pipeSocket, PIPE_URL);
+
+    zmq_pollitem_t items [] = {
+        { pipeSocket, 0, ZMQ_POLLIN, 0 },
+        { xpubSocket, 0, ZMQ_POLLIN, 0 },
+        { routerSocket, 0, ZMQ_POLLIN, 0 }
+    };
+
+    while(!threadShouldExit())
+    {
+        // the timeout bounds the delay of metadata changes and of exiting
+        int interval = latestInterval.get();
+        zmq_poll(items, 3, interval > 0 ? jmin(50, interval) : 50);
+        if(items[0].revents & ZMQ_POLLIN)
+            forwardMessages();
+        if(items[1].revents & ZMQ_POLLIN)
+            handleSubscriptions();
+        if(items[2].revents & ZMQ_POLLIN)
+            handleConsumers();
+        if(consumers.size() > 0)
+            checkConsumers(Time::getMillisecondCounterHiRes());
+        if(metadataChanged.compareAndSetBool(0, 1))
+            publishMetadata();
+        if(streamsChanged.compareAndSetBool(0, 1))
+            updateInterest();
+        if(affinityChanged.compareAndSetBool(0, 1))
+            setCurrentThreadAffinityMask((uint32)affinity.get());
+        if(portsChanged.compareAndSetBool(0, 1))
+            bindSockets();
+        
+        if(interval > 0)
+        {
+            double now = Time::getMillisecondCounterHiRes();
+            if(now - lastLatest >= interval)
+            {
+                publishLatest();
+                lastLatest = now;
+            }
+        }
+        else if(latest.size() > 0)
+            latest.clear(); // gives the frames back
+    }
+
+    latest.clear();
+    consumers.clear();
+    numConsumers = 0;
+    // nothing left to deliver matters once we are stopped
+    int linger = 0;
+    zmq_setsockopt(xpubSocket, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(pipeSocket, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(latestSocket, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(routerSocket, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_close(pipeSocket);
+    zmq_close(xpubSocket);
+    zmq_close(latestSocket);
+    zmq_close(routerSocket);
+    pipeSocket = xpubSocket = latestSocket = routerSocket = 0;
+    
+    subscriptions.clear();
+    subscriptionCounts.clear();
+    updateInterest();
+}
+
+void ZmqPublisher::forwardMessages()
+{
+    ZMQ_TRACE("forwardMessages");
+    bool keepLatest = latestInterval.get() > 0;
+    zmq_msg_t part;
+    zmq_msg_init(&part);
+    // whole multipart messages only: once the first frame is there, so are
+    // the others
+    while(zmq_msg_recv(&part, pipeSocket, ZMQ_DONTWAIT) != -1)
+    {
+        LatestMessage *last = nullptr;
+        if(keepLatest)
+            last = findLatest(zmq_msg_data(&part), zmq_msg_size(&part));
+        
+        matching.clearQuick();
+        outgoing.clearQuick();
+        for(int i = 0; i < consumers.size(); i++)
+        {
+            Consumer *c = consumers.getUnchecked(i);
+            if(c->wants(zmq_msg_data(&part), zmq_msg_size(&part)))
+            {
+                matching.add(c);
+                outgoing.add(new QueuedMessage);
+            }
+        }
+        
+        int frame = 0;
+        while(true)
+        {
+            bool more = zmq_msg_more(&part);
+            // header and data are shared with the message sent, not copied
+            if(last && frame == 1)
+                zmq_msg_copy(&last->header, &part);
+            else if(last && frame == 2)
+                zmq_msg_copy(&last->data, &part);
+            for(int i = 0; i < matching.size(); i++)
+            {
+                Consumer *c = matching.getUnchecked(i);
+                outgoing.getUnchecked(i)->add(&part, !c->queue.empty() || c->credits <= 0);
+            }
+            zmq_msg_send(&part, xpubSocket, more ? ZMQ_SNDMORE : 0);
+            if(!more)
+                break;
+            zmq_msg_recv(&part, pipeSocket, 0);
+            frame++;
+        }
+        if(last && frame > 0)
+        {
+            last->hasData = frame > 1;
+            last->pending = true;
+        }
+        for(int i = 0; i < matching.size(); i++)
+            deliver(matching.getUnchecked(i), outgoing.getUnchecked(i));
+    }
+    zmq_msg_close(&part);
+    
+    for(int i = 0; i < consumers.size(); i++)
+    {
+        if(consumers[i]->dropped != consumers[i]->reported)
+            reportOverrun(consumers[i]);
+    }
+}
+
+void ZmqPublisher::handleSubscriptions()
+{
+    ZMQ_TRACE("handleSubscriptions");
+    zmq_msg_t sub;
+    zmq_msg_init(&sub);
+    bool resend = false;
+    bool changed = false;
+    while(zmq_msg_recv(&sub, xpubSocket, ZMQ_DONTWAIT) != -1)
+    {
+        // first byte 1 for subscribe, 0 for unsubscribe, then the topic
+        const char *data = (const char *)zmq_msg_data(&sub);
+        size_t size = zmq_msg_size(&sub);
+        if(size == 0 || (data[0] != 0 && data[0] != 1))
+            continue;
+        MemoryBlock topic(data + 1, size - 1);
+        int i = subscriptions.indexOf(topic);
+        if(data[0] == 1)
+        {
+            if(i < 0)
+            {
+                subscriptions.add(topic);
+                subscriptionCounts.add(1);
+            }
+            else
+                subscriptionCounts.getReference(i)++;
+            
+            // the subscription matches the metadata envelope (with its NUL)
+            // if it is a prefix of it
+            size_t topicSize = size - 1;
+            if(topicSize <= strlen(METADATA_ENVELOPE) + 1 &&
+               memcmp(data + 1, METADATA_ENVELOPE, topicSize) == 0)
+                resend = true;
+        }
+        else if(i >= 0)
+        {
+#ifdef ZMQ_XPUB_VERBOSER
+            if(--subscriptionCounts.getReference(i) <= 0)
+#endif
+            {
+                // without XPUB_VERBOSER only the last unsubscription of a
+                // topic is reported
+                subscriptions.remove(i);
+                subscriptionCounts.remove(i);
+            }
+        }
+        changed = true;
+    }
+    zmq_msg_close(&sub);
+    if(resend)
+        publishMetadata();
+    if(changed)
+        updateInterest();
+}
+
+/** A subscription topic matches a stream if it is a prefix of the envelope
+ (sent with its terminating NUL), or a topic below it, e.g. "EVENT/TTL" for
+ "EVENT" */
+static bool topicMatches(const MemoryBlock &topic, const MemoryBlock &envelope)
+{
+    size_t n = topic.getSize();
+    bool matches = n <= envelope.getSize() &&
+        memcmp(topic.getData(), envelope.getData(), n) == 0;
+    bool below = n > envelope.getSize() - 1 &&
+        memcmp(topic.getData(), envelope.getData(), envelope.getSize() - 1) == 0 &&
+        ((const char *)topic.getData())[envelope.getSize() - 1] == '/';
+    return matches || below;
+}
+
+void ZmqPublisher::updateInterest()
+{
+    int total = 0;
+    for(int i = 0; i < subscriptionCounts.size(); i++)
+        total += subscriptionCounts[i];
+    numSubscriptions = total;
+    numConsumers = consumers.size();
+
+    const ScopedLock sl(streamLock);
+    int bits[MAX_STREAMS / 32] = { 0 };
+    for(int s = 0; s < streams.size(); s++)
+    {
+        if(streams[s].isEmpty())
+            continue;
+        MemoryBlock envelope(streams[s].toRawUTF8(), streams[s].getNumBytesAsUTF8() + 1);
+        bool wanted = false;
+        for(int i = 0; i < subscriptions.size() && !wanted; i++)
+            wanted = topicMatches(subscriptions.getReference(i), envelope);
+        // reliable consumers count as subscribers
+        for(int c = 0; c < consumers.size() && !wanted; c++)
+        {
+            for(int i = 0; i < consumers[c]->topics.size() && !wanted; i++)
+                wanted = topicMatches(consumers[c]->topics.getReference(i), envelope);
+        }
+        if(wanted)
+            bits[s >> 5] |= (int)(1u << (s & 31));
+    }
+    for(int w = 0; w < MAX_STREAMS / 32; w++)
+        interest[w] = bits[w];
+}
+
+void ZmqPublisher::publishMetadata()
+{
+    String header;
+    {
+        const ScopedLock sl(metadataLock);
+        header = metadata;
+    }
+    if(header.isEmpty())
+        return;
+
+    zmq_send(xpubSocket, METADATA_ENVELOPE, strlen(METADATA_ENVELOPE)+1, ZMQ_SNDMORE);
+    zmq_send(xpubSocket, header.toRawUTF8(), header.getNumBytesAsUTF8(), 0);
+}
+
+ZmqPublisher::LatestMessage *ZmqPublisher::findLatest(const void *envelope, size_t size)
+{
+    for(int i = 0; i < latest.size(); i++)
+    {
+        const MemoryBlock &e = latest[i]->envelope;
+        if(e.getSize() == size && memcmp(e.getData(), envelope, size) == 0)
+            return latest[i];
+    }
+    if(latest.size() >= MAX_LATEST)
+        return nullptr;
+    return latest.add(new LatestMessage(envelope, size));
+}
+
+void ZmqPublisher::publishLatest()
+{
+    ZMQ_TRACE("publishLatest");
+    for(int i = 0; i < latest.size(); i++)
+    {
+        LatestMessage *last = latest[i];
+        if(!last->pending)
+            continue;
+        
+        // envelope and header are NUL terminated, the data starts at the
+        // next multiple of 8 so that clients can map it in place
+        size_t envelopeSize = last->envelope.getSize();
+        size_t headerSize = zmq_msg_size(&last->header);
+        size_t dataSize = last->hasData ? zmq_msg_size(&last->data) : 0;
+        size_t offset = (envelopeSize + headerSize + 1 + 7) & ~(size_t)7;
+        
+        zmq_msg_t frame;
+        zmq_msg_init_size(&frame, offset + dataSize);
+        char *out = (char *)zmq_msg_data(&frame);
+        memcpy(out, last->envelope.getData(), envelopeSize);
+        memcpy(out + envelopeSize, zmq_msg_data(&last->header), headerSize);
+        memset(out + envelopeSize + headerSize, 0, offset - envelopeSize - headerSize);
+        if(dataSize)
+            memcpy(out + offset, zmq_msg_data(&last->data), dataSize);
+        if(zmq_msg_send(&frame, latestSocket, ZMQ_DONTWAIT) == -1)
+            zmq_msg_close(&frame);
+        
+        // don't hold on to the sender's buffers until the next message
+        zmq_msg_close(&last->header);
+        zmq_msg_init(&last->header);
+        zmq_msg_close(&last->data);
+        zmq_msg_init(&last->data);
+        last->hasData = false;
+        last->pending = false;
+    }
+}
+
+void ZmqPublisher::handleConsumers()
+{
+    ZMQ_TRACE("handleConsumers");
+    double now = Time::getMillisecondCounterHiRes();
+    bool changed = false;
+    zmq_msg_t identity, body;
+    zmq_msg_init(&identity);
+    zmq_msg_init(&body);
+    while(zmq_msg_recv(&identity, routerSocket, ZMQ_DONTWAIT) != -1)
+    {
+        if(!zmq_msg_more(&identity))
+            continue;
+        zmq_msg_recv(&body, routerSocket, 0);
+        while(zmq_msg_more(&body)) // only the first frame is read
+            zmq_msg_recv(&body, routerSocket, 0);
+        
+        MemoryBlock id(zmq_msg_data(&identity), zmq_msg_size(&identity));
+        Consumer *c = nullptr;
+        for(int i = 0; i < consumers.size() && !c; i++)
+        {
+            if(consumers[i]->identity == id)
+                c = consumers[i];
+        }
+        
+        var v;
+        String request = String::fromUTF8((const char *)zmq_msg_data(&body), (int)zmq_msg_size(&body));
+        if(JSON::parse(request, v).failed())
+            continue;
+        String type = v["type"];
+        if(type == "hello")
+        {
+            if(!c)
+            {
+                c = consumers.add(new Consumer);
+                c->identity = id;
+            }
+            c->topics.clear();
+            if(Array<var> *topics = v["topics"].getArray())
+            {
+                for(int i = 0; i < topics->size(); i++)
+                {
+                    String t = (*topics)[i];
+                    c->topics.add(MemoryBlock(t.toRawUTF8(), t.getNumBytesAsUTF8()));
+                }
+            }
+            changed = true;
+        }
+        else if(type == "bye" && c)
+        {
+            removeConsumer(c);
+            changed = true;
+            continue;
+        }
+        if(!c)
+            continue;
+        
+        // credits come back for the messages taken, oldest first; the ones of
+        // the hello are the initial window
+        int64 credits = jmax((int64)0, (int64)v["credits"]);
+        for(int64 i = 0; type != "hello" && i < credits && !c->inFlight.empty(); i++)
+        {
+            c->inFlightBytes -= c->inFlight.front();
+            c->inFlight.pop_front();
+        }
+        c->credits = jmin(MAX_CREDITS - (int64)c->inFlight.size(), c->credits + credits);
+        c->lastSeen = now;
+        drainQueue(c);
+    }
+    zmq_msg_close(&identity);
+    zmq_msg_close(&body);
+    if(changed)
+        updateInterest();
+}
+
+void ZmqPublisher::deliver(Consumer *consumer, QueuedMessage *message)
+{
+    // dropped messages use up their sequence numbers, so that the gap shows
+    message->sequence = ++consumer->sequence;
+    if(consumer->queue.empty() && consumer->credits > 0 && sendToConsumer(consumer, message))
+    {
+        delete message;
+    }
+    else if(consumer->getPendingBytes() + (int64)message->size > reliableBudget.get())
+    {
+        if(consumer->dropped == consumer->reported)
+            consumer->firstDropped = message->sequence;
+        consumer->dropped++;
+        delete message;
+    }
+    else
+    {
+        consumer->queue.push_back(message);
+        consumer->queuedBytes += message->size;
+    }
+}
+
+bool ZmqPublisher::sendToConsumer(Consumer *consumer, QueuedMessage *message)
+{
+    // the other frames go through once the first one did
+    if(zmq_send(routerSocket, consumer->identity.getData(), consumer->identity.getSize(),
+                ZMQ_SNDMORE | ZMQ_DONTWAIT) == -1)
+        return false; // unreachable (forgotten at the next check) or full
+    zmq_send(routerSocket, &message->sequence, sizeof(message->sequence), ZMQ_SNDMORE);
+    for(int i = 0; i < message->nFrames; i++)
+        zmq_msg_send(&message->frames[i], routerSocket, i < message->nFrames - 1 ? ZMQ_SNDMORE : 0);
+    consumer->credits--;
+    consumer->inFlight.push_back((int64)message->size);
+    consumer->inFlightBytes += (int64)message->size;
+    return true;
+}
+
+void ZmqPublisher::drainQueue(Consumer *consumer)
+{
+    while(consumer->credits > 0 && !consumer->queue.empty())
+    {
+        QueuedMessage *message = consumer->queue.front();
+        if(!sendToConsumer(consumer, message))
+            break;
+        consumer->queue.pop_front();
+        consumer->queuedBytes -= message->size;
+        delete message;
+    }
+}
+
+void ZmqPublisher::reportOverrun(Consumer *consumer)
+{
+    int64 dropped = consumer->dropped - consumer->reported;
+    reliableDropped += dropped; // for the status messages
+    
+    // out of band: no credit needed, and no sequence number of its own
+    String header = String("{\"message_no\": -1, \"type\": \"overrun\", \"content\": {")
+        + "\"first_sequence\": " + String(consumer->firstDropped)
+        + ", \"last_sequence\": " + String(consumer->firstDropped + dropped - 1)
+        + ", \"total_dropped\": " + String(consumer->dropped)
+        + ", \"budget_bytes\": " + String(reliableBudget.get())
+        + "}, \"data_size\": 0}";
+    uint64 sequence = 0;
+    if(zmq_send(routerSocket, consumer->identity.getData(), consumer->identity.getSize(),
+                ZMQ_SNDMORE) != -1)
+    {
+        zmq_send(routerSocket, &sequence, sizeof(sequence), ZMQ_SNDMORE);
+        zmq_send(routerSocket, "OVERRUN", strlen("OVERRUN")+1, ZMQ_SNDMORE);
+        zmq_send(routerSocket, header.toRawUTF8(), header.getNumBytesAsUTF8(), 0);
+    }
+    consumer->reported = consumer->dropped;
+}
+
+void ZmqPublisher::removeConsumer(Consumer *consumer)
+{
+    consumers.removeObject(consumer);
+}
+
+void ZmqPublisher::checkConsumers(double now)
+{
+    bool changed = false;
+    for(int i = consumers.size(); --i >= 0;)
+    {
+        if(now - consumers[i]->lastSeen > reliableTimeout.get())
+        {
+            removeConsumer(consumers[i]);
+            changed = true;
+        }
+    }
+    if(changed)
+        updateInterest();
+}
@@ -0,0 +1,198 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqPublisher.h
+    Created: 19 Oct 2026 5:36:21am
+
+  ==============================================================================
+*/
+
+#ifndef ZMQPUBLISHER_H_INCLUDED
+#define ZMQPUBLISHER_H_INCLUDED
+
+#include <ProcessorHeaders.h>
+
+
+//=============================================================================
+/** Owns the XPUB data socket. The audio thread writes its messages to an
+ inproc pipe (see PIPE_URL), and this thread forwards them to the subscribers.
+
+ Because it sees the subscriptions, it can also latch the stream metadata:
+ every time a client subscribes to METADATA the last metadata message is sent
+ again, so late joiners don't have to wait for a configuration change.
+
+ It also counts the subscriptions, so that the audio thread can skip building
+ the messages of streams nobody listens to (see hasSubscribers()).
+
+ A second, conflated PUB socket ("latest only") serves dashboards: the last
+ message of each envelope is kept, and at most latestRate times per second it
+ is published as a single self-describing frame (envelope, NUL, JSON header,
+ NUL, zero padding to a multiple of 8 bytes, then the binary data). With
+ ZMQ_CONFLATE each subscriber only ever has the newest frame queued, so a slow
+ viewer neither lags behind nor takes memory from the main stream.
+
+ Consumers that can't lose data (writing features to disk, ...) connect a
+ DEALER to the ROUTER socket on reliablePort instead, and pull with credits:
+ {"type": "hello", "topics": [...], "credits": n}, then {"type": "credit",
+ "credits": n} for the n messages taken since, and {"type": "bye"}. Each
+ message matching their topics costs one credit and is preceded by a frame
+ with a uint64 sequence number of their own, without gaps unless reported.
+ At most setReliableLimits() bytes are held per consumer, counting the
+ messages waiting for credits and the ones sent whose credits haven't come
+ back; beyond it they are dropped and an OVERRUN message gives the range of
+ the sequence numbers lost. Credits are capped at 4096 messages in flight.
+ */
+class ZmqPublisher : public Thread
+{
+public:
+    ZmqPublisher(void *context, int port, int latestPort, int reliablePort);
+    ~ZmqPublisher();
+
+    /** The inproc endpoint the audio thread connects a ZMQ_PAIR socket to */
+    static const char *PIPE_URL;
+
+    /** Binds socket to tcp://*:port, after unbinding it from endpoint if set,
+     and keeps the address actually bound in endpoint for the next time */
+    static bool rebindSocket(void *socket, int port, String &endpoint, const char *name);
+
+    /** Replaces the latched metadata header, and publishes it. Can be called
+     from any thread */
+    void setMetadata(const String &header);
+
+    /** Registers an envelope (e.g. "DATA"), returns the index to pass to
+     hasSubscribers(), or -1 past MAX_STREAMS streams */
+    int addStream(const String &envelope);
+
+    /** Forgets the streams whose envelope starts with prefix, but those in
+     except. Their indices can be given to new streams */
+    void removeStreams(const String &prefix, const StringArray &except = StringArray());
+
+    /** True if some subscription matches the stream envelope, or a topic
+     below it ("EVENT/..."). Cheap, meant for the audio thread */
+    bool hasSubscribers(int stream) const
+    {
+        return stream >= 0 && (((interest[stream >> 5].get() >> (stream & 31)) & 1) != 0 ||
+                               latestInterval.get() > 0);
+    }
+
+    int getNumSubscriptions() const { return numSubscriptions.get(); }
+
+    /** Messages per second and envelope on the conflated socket, 0 to turn it
+     off. While it is on all the streams are built, since the conflated
+     subscribers can't be seen */
+    void setLatestRate(double rate);
+
+    /** Queue size per reliable consumer, and how long one can stay silent
+     before it is forgotten */
+    void setReliableLimits(int64 budgetBytes, double timeoutMs);
+
+    int getNumConsumers() const { return numConsumers.get(); }
+    /** Messages dropped over the budget, all the consumers together */
+    int64 getReliableDropped() const { return reliableDropped.get(); }
+
+    /** Moves the sockets to new ports, done by the running thread. The
+     clients have to connect again */
+    void setPorts(int port, int latestPort, int reliablePort);
+
+    /** Moves the running thread to the CPUs in mask (setAffinityMask() is
+     for before startThread()) */
+    void setCpuAffinity(uint32 mask);
+
+    /** The fixed streams take 14, the rest is for the DATA ones (one per
+     source and sample rate) */
+    enum { MAX_STREAMS = 256 };
+
+    void run() override;
+
+private:
+    void forwardMessages();
+    void handleSubscriptions();
+    void publishMetadata();
+    void updateInterest();
+    struct LatestMessage;
+    LatestMessage *findLatest(const void *envelope, size_t size);
+    void publishLatest();
+    struct QueuedMessage;
+    struct Consumer;
+    void handleConsumers();
+    void deliver(Consumer *consumer, QueuedMessage *message);
+    bool sendToConsumer(Consumer *consumer, QueuedMessage *message);
+    void drainQueue(Consumer *consumer);
+    void reportOverrun(Consumer *consumer);
+    void removeConsumer(Consumer *consumer);
+    void checkConsumers(double now);
+    void bindSockets();
+
+    void *context;
+    Atomic<int> port;
+    Atomic<int> latestPort;
+    Atomic<int> reliablePort;
+    Atomic<int> portsChanged;
+    String endpoint, latestEndpoint, reliableEndpoint; // as bound
+    void *xpubSocket = 0;
+    void *pipeSocket = 0;
+    void *latestSocket = 0;
+    void *routerSocket = 0;
+
+    CriticalSection metadataLock;
+    String metadata;
+    Atomic<int> metadataChanged;
+
+    // current subscriptions, only touched by this thread
+    Array<MemoryBlock> subscriptions;
+    Array<int> subscriptionCounts;
+    Atomic<int> numSubscriptions;
+    Atomic<int> streamsChanged;
+
+    CriticalSection streamLock;
+    StringArray streams;
+    Atomic<int> interest[MAX_STREAMS / 32]; // one bit per stream
+
+    /** Last message of an envelope, kept for the conflated socket. The frames
+     are references to the forwarded ones, not copies */
+    OwnedArray<LatestMessage> latest;
+    Atomic<int> latestInterval; // ms, 0 when off
+    double lastLatest = 0.0;
+
+    // credit based consumers, only touched by this thread
+    OwnedArray<Consumer> consumers;
+    Array<Consumer *> matching; // scratch, consumers of the message forwarded
+    Array<QueuedMessage *> outgoing;
+    Atomic<int> numConsumers;
+    Atomic<int64> reliableDropped;
+    Atomic<int64> reliableBudget;
+    Atomic<int> reliableTimeout; // ms
+
+    Atomic<int> affinity;
+    Atomic<int> affinityChanged;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ZmqPublisher);
+};
+
+
+#endif  // ZMQPUBLISHER_H_INCLUDED
@@ -0,0 +1,172 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqSpikeDetector.cpp
+    Created: 19 Oct 2026 5:26:15am
+
+  ==============================================================================
+*/
+
+#include <math.h>
+#include <limits>
+#include "ZmqSpikeDetector.h"
+
+// relative step of the median tracker, per update
+const float MEDIAN_RATE = 0.002f;
+
+
+ZmqSpikeDetector::ZmqSpikeDetector()
+{
+}
+
+void ZmqSpikeDetector::prepare(const Array<int> &channels, float thresholdFactor_,
+                               int preSamples_, int postSamples_, int maxSpikes_)
+{
+    thresholdFactor = thresholdFactor_;
+    preSamples = jmax(1, preSamples_);
+    postSamples = jmax(1, postSamples_);
+    maxSpikes = jmax(1, maxSpikes_);
+
+    channelState.clear();
+    for(int i = 0; i < channels.size(); i++)
+    {
+        ChannelState *s = new ChannelState;
+        s->channel = channels[i];
+        s->work.calloc(getSnippetLength() + CHUNK_SIZE);
+        channelState.add(s);
+    }
+    reset();
+
+    spikes.malloc(maxSpikes);
+    snippets.malloc(maxSpikes * getSnippetLength());
+    nSpikes = 0;
+    nDropped = 0;
+}
+
+void ZmqSpikeDetector::reset()
+{
+    for(int i = 0; i < channelState.size(); i++)
+    {
+        ChannelState *s = channelState[i];
+        s->medianAbs = -1.f; // initialized from the first block
+        s->lastSpike = std::numeric_limits<int64>::min() / 2;
+        FloatVectorOperations::clear(s->work, getSnippetLength());
+    }
+}
+
+int ZmqSpikeDetector::process(const AudioSampleBuffer &buffer, const int *nSamples,
+                              const int64 *timestamps)
+{
+    nSpikes = 0;
+    nDropped = 0;
+
+    for(int i = 0; i < channelState.size(); i++)
+    {
+        ChannelState &s = *channelState[i];
+        if(s.channel >= buffer.getNumChannels())
+            continue;
+        const float *x = buffer.getReadPointer(s.channel);
+        int n = jmin(nSamples[s.channel], buffer.getNumSamples());
+        int64 ts = timestamps[s.channel];
+        for(int k = 0; k < n; k += CHUNK_SIZE)
+        {
+            int m = jmin(n - k, (int)CHUNK_SIZE);
+            processChunk(s, x + k, m, ts + k);
+        }
+    }
+    return nSpikes;
+}
+
+void ZmqSpikeDetector::updateMedian(ChannelState &s, const float *x, int n)
+{
+    if(s.medianAbs < 0.f)
+    {
+        // first block: start from the RMS, which is MAD / 0.6745 for gaussian noise
+        double sumSq = 0.;
+        for(int i = 0; i < n; i++)
+            sumSq += x[i] * x[i];
+        s.medianAbs = jmax(1e-6f, 0.6745f * (float)sqrt(sumSq / jmax(n, 1)));
+        return;
+    }
+
+    float m = s.medianAbs;
+    for(int i = 0; i < n; i += STRIDE)
+    {
+        float step = MEDIAN_RATE * m;
+        m += (fabsf(x[i]) > m) ? step : -step;
+    }
+    s.medianAbs = jmax(1e-6f, m);
+}
+
+void ZmqSpikeDetector::processChunk(ChannelState &s, const float *x, int n, int64 firstSample)
+{
+    int h = getSnippetLength();
+    float *w = s.work;
+
+    updateMedian(s, x, n);
+    float threshold = thresholdFactor * s.medianAbs / 0.6745f;
+
+    // w = [last h samples | this chunk]. Candidates are in [preSamples, preSamples + n),
+    // i.e. the samples that have a full snippet available.
+    FloatVectorOperations::copy(w + h, x, n);
+    int64 w0 = firstSample - h;
+
+    // vectorized fast path: nothing below threshold in the candidate range
+    if(FloatVectorOperations::findMinimum(w + preSamples - 1, n + 1) < -threshold)
+    {
+        for(int i = preSamples; i < preSamples + n; i++)
+        {
+            if(w[i] < -threshold && w[i-1] >= -threshold)
+            {
+                int64 t = w0 + i;
+                if(t - s.lastSpike < postSamples)
+                    continue; // refractory
+                s.lastSpike = t;
+                addSpike(s, w + i - preSamples, t, threshold);
+            }
+        }
+    }
+
+    // keep the tail for the next chunk
+    memmove(w, w + n, h * sizeof(float));
+}
+
+void ZmqSpikeDetector::addSpike(ChannelState &s, const float *snippet, int64 timestamp, float threshold)
+{
+    if(nSpikes >= maxSpikes)
+    {
+        nDropped++;
+        return;
+    }
+    DetectedSpike &sp = spikes[nSpikes];
+    sp.timestamp = timestamp;
+    sp.channel = s.channel;
+    sp.threshold = threshold;
+    FloatVectorOperations::copy(snippets + nSpikes * getSnippetLength(), snippet, getSnippetLength());
+    nSpikes++;
+}
@@ -0,0 +1,113 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqSpikeDetector.h
+    Created: 19 Oct 2026 5:26:15am
+
+  ==============================================================================
+*/
+
+#ifndef ZMQSPIKEDETECTOR_H_INCLUDED
+#define ZMQSPIKEDETECTOR_H_INCLUDED
+
+#include <ProcessorHeaders.h>
+
+
+/** One threshold crossing, as sent in the SPIKES stream (16 bytes, followed
+ in the message by the snippets of all the spikes in the batch) */
+struct DetectedSpike {
+    int64 timestamp;
+    int32 channel;
+    float threshold;
+};
+
+
+//=============================================================================
+/** Negative threshold crossing detector for a subset of the channels.
+
+ The threshold is thresholdFactor * MAD / 0.6745, where the median of |x| is
+ tracked incrementally (stochastic approximation on every STRIDE-th sample),
+ so there is no per block sort. Detection works on the concatenation of the
+ last preSamples + postSamples samples of the previous block and the current
+ block, so that snippets never need to wait for the next block. The price is
+ that spikes are reported with a latency of postSamples samples.
+
+ The input is expected to be band-pass filtered already.
+ */
+class ZmqSpikeDetector
+{
+public:
+    ZmqSpikeDetector();
+
+    void prepare(const Array<int> &channels, float thresholdFactor,
+                 int preSamples, int postSamples, int maxSpikes);
+    void reset();
+
+    /** Detects spikes in the current block. nSamples and timestamps are
+     indexed by buffer channel. Returns the number of spikes found. */
+    int process(const AudioSampleBuffer &buffer, const int *nSamples,
+                const int64 *timestamps);
+
+    int getNumChannels() const { return channelState.size(); }
+    int getNumSpikes() const { return nSpikes; }
+    int getNumDropped() const { return nDropped; }
+    int getSnippetLength() const { return preSamples + postSamples; }
+    int getPreSamples() const { return preSamples; }
+    const DetectedSpike *getSpikes() const { return spikes; }
+    const float *getSnippets() const { return snippets; }
+
+private:
+    enum { CHUNK_SIZE = 1024, STRIDE = 8 };
+
+    struct ChannelState {
+        int channel;
+        float medianAbs;
+        int64 lastSpike;
+        HeapBlock<float> work;
+    };
+
+    void processChunk(ChannelState &s, const float *x, int n, int64 firstSample);
+    void updateMedian(ChannelState &s, const float *x, int n);
+    void addSpike(ChannelState &s, const float *snippet, int64 timestamp, float threshold);
+
+    OwnedArray<ChannelState> channelState;
+    float thresholdFactor = 4.5f;
+    int preSamples = 8;
+    int postSamples = 24;
+    int maxSpikes = 0;
+
+    int nSpikes = 0;
+    int nDropped = 0;
+    HeapBlock<DetectedSpike> spikes;
+    HeapBlock<float> snippets;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ZmqSpikeDetector);
+};
+
+
+#endif  // ZMQSPIKEDETECTOR_H_INCLUDED
@@ -0,0 +1,322 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqSpikeFeatures.cpp
+    Created: 19 Oct 2026 6:25:35am
+
+  ==============================================================================
+*/
+
+#include <math.h>
+#include "ZmqSpikeFeatures.h"
+
+
+ZmqSpikeFeatures::ZmqSpikeFeatures()
+{
+}
+
+void ZmqSpikeFeatures::prepare(double sampleRate_, int nComponents_, int refreshSpikes_)
+{
+    sampleRate = sampleRate_ > 0. ? sampleRate_ : 30000.;
+    nComponents = jlimit(1, (int)MAX_COMPONENTS, nComponents_);
+    refreshSpikes = jmax(10, refreshSpikes_);
+
+    // rows are added by the audio thread, without allocating
+    electrodes.ensureStorageAllocated(MAX_ELECTRODES);
+    centers.malloc(MAX_ELECTRODES * MAX_DIMS);
+    sums.malloc(MAX_ELECTRODES * MAX_DIMS);
+    outers.malloc(MAX_ELECTRODES * MAX_DIMS * MAX_DIMS);
+    bases.malloc(MAX_ELECTRODES * MAX_COMPONENTS * MAX_DIMS);
+    covariance.malloc(MAX_DIMS * MAX_DIMS);
+    work.malloc((MAX_COMPONENTS + 1) * MAX_DIMS);
+    waveform.malloc(MAX_DIMS);
+    records.malloc(MAX_BATCH);
+    features.malloc(MAX_BATCH * (3 * MAX_CHANNELS + MAX_COMPONENTS));
+    reset();
+}
+
+void ZmqSpikeFeatures::reset()
+{
+    electrodes.clearQuick();
+    clearBatch();
+}
+
+void ZmqSpikeFeatures::clearBatch()
+{
+    nSpikes = 0;
+    nDropped = 0;
+}
+
+StringArray ZmqSpikeFeatures::getFeatureNames() const
+{
+    StringArray names;
+    for(int c = 0; c < MAX_CHANNELS; c++)
+        names.add("peak_" + String(c));
+    for(int c = 0; c < MAX_CHANNELS; c++)
+        names.add("trough_" + String(c));
+    for(int c = 0; c < MAX_CHANNELS; c++)
+        names.add("width_" + String(c));
+    for(int k = 0; k < nComponents; k++)
+        names.add("pc_" + String(k));
+    return names;
+}
+
+float ZmqSpikeFeatures::dot(const float *a, const float *b, int n)
+{
+    // four independent accumulators, as in ZmqFeatureExtractor
+    float s0 = 0.f, s1 = 0.f, s2 = 0.f, s3 = 0.f;
+    int i = 0;
+    for(; i + 3 < n; i += 4)
+    {
+        s0 += a[i] * b[i];
+        s1 += a[i+1] * b[i+1];
+        s2 += a[i+2] * b[i+2];
+        s3 += a[i+3] * b[i+3];
+    }
+    for(; i < n; i++)
+        s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+void ZmqSpikeFeatures::toMicrovolts(const uint16 *data, float scale, float *out, int n)
+{
+    for(int i = 0; i < n; i++)
+        out[i] = ((float)data[i] - 32768.f) * scale;
+}
+
+void ZmqSpikeFeatures::peakTroughWidth(const float *x, int n, float &peak, float &trough, int &width)
+{
+    Range<float> r = FloatVectorOperations::findMinAndMax(x, n);
+    peak = r.getEnd();
+    trough = r.getStart();
+    // the indices are found again, the searches stop early
+    int t = 0;
+    while(t < n - 1 && x[t] != trough)
+        t++;
+    float after = FloatVectorOperations::findMaximum(x + t, n - t);
+    int p = t;
+    while(p < n - 1 && x[p] != after)
+        p++;
+    width = p - t;
+}
+
+int ZmqSpikeFeatures::getElectrode(int electrodeId, int nChannels, int nSamples)
+{
+    int i = 0;
+    while(i < electrodes.size() && electrodes.getReference(i).id != electrodeId)
+        i++;
+    if(i == electrodes.size())
+    {
+        if(i >= MAX_ELECTRODES)
+            return -1;
+        Electrode e;
+        e.id = electrodeId;
+        e.nChannels = 0;
+        e.center = centers + i * MAX_DIMS;
+        e.sum = sums + i * MAX_DIMS;
+        e.outer = outers + i * MAX_DIMS * MAX_DIMS;
+        e.basis = bases + i * MAX_COMPONENTS * MAX_DIMS;
+        electrodes.add(e);
+    }
+
+    Electrode &e = electrodes.getReference(i);
+    if(e.nChannels != nChannels || e.nSamples != nSamples)
+    {
+        // new, or the spike length changed: start over
+        e.nChannels = nChannels;
+        e.nSamples = nSamples;
+        e.dims = nChannels * nSamples;
+        e.basisVersion = 0;
+        e.explained = 0.f;
+        e.weight = 0.;
+        e.sinceRefresh = 0;
+        FloatVectorOperations::clear(e.center, MAX_DIMS);
+        FloatVectorOperations::clear(e.sum, MAX_DIMS);
+        for(int d = 0; d < e.dims; d++)
+            FloatVectorOperations::clear(e.outer + d * MAX_DIMS, MAX_DIMS);
+    }
+    return i;
+}
+
+void ZmqSpikeFeatures::addSpike(int electrodeId, int64 timestamp, int nChannels, int nSamples,
+                                const uint16 *data, const float *gain)
+{
+    if(nChannels < 1 || nChannels > MAX_CHANNELS || nSamples < 2 || nSamples > MAX_SAMPLES)
+    {
+        nDropped++;
+        return;
+    }
+    int row = getElectrode(electrodeId, nChannels, nSamples);
+    if(row < 0)
+    {
+        nDropped++;
+        return;
+    }
+    Electrode &e = electrodes.getReference(row);
+    const int dims = e.dims;
+
+    float *x = waveform;
+    for(int c = 0; c < nChannels; c++)
+        toMicrovolts(data + c * nSamples, gain[c] != 0.f ? 1000.f / gain[c] : 0.f,
+                     x + c * nSamples, nSamples);
+
+    float *f = nullptr; // in the batch
+    if(nSpikes < MAX_BATCH)
+    {
+        SpikeFeatureRecord &r = records[nSpikes];
+        r.timestamp = timestamp;
+        r.electrodeId = electrodeId;
+        r.basisVersion = e.basisVersion;
+
+        f = features + nSpikes * getNumFeatures();
+        FloatVectorOperations::clear(f, getNumFeatures());
+        for(int c = 0; c < nChannels; c++)
+        {
+            int width;
+            peakTroughWidth(x + c * nSamples, nSamples, f[c], f[MAX_CHANNELS + c], width);
+            f[2 * MAX_CHANNELS + c] = (float)(width * 1000. / sampleRate);
+        }
+        nSpikes++;
+    }
+    else
+        nDropped++;
+
+    // from here on x is relative to the mean at the last refresh
+    FloatVectorOperations::subtract(x, e.center, dims);
+    if(f && e.basisVersion > 0)
+    {
+        for(int k = 0; k < nComponents; k++)
+            f[3 * MAX_CHANNELS + k] = dot(e.basis + k * MAX_DIMS, x, dims);
+    }
+
+    // rank-1 update of the upper triangle, one row at a time
+    FloatVectorOperations::add(e.sum, x, dims);
+    for(int d = 0; d < dims; d++)
+        FloatVectorOperations::addWithMultiply(e.outer + d * MAX_DIMS + d, x + d, x[d], dims - d);
+    e.weight += 1.;
+
+    if(++e.sinceRefresh >= refreshSpikes)
+        refreshBasis(e);
+}
+
+void ZmqSpikeFeatures::refreshBasis(Electrode &e)
+{
+    const int dims = e.dims;
+    const float w = (float)e.weight;
+    float *z = work;
+    float *mean = work + MAX_COMPONENTS * MAX_DIMS; // relative to center
+
+    for(int i = 0; i < dims; i++)
+        mean[i] = e.sum[i] / w;
+    float trace = 0.f;
+    for(int i = 0; i < dims; i++)
+    {
+        const float *o = e.outer + i * MAX_DIMS;
+        for(int j = i; j < dims; j++)
+        {
+            float c = o[j] / w - mean[i] * mean[j];
+            covariance[i * MAX_DIMS + j] = c;
+            covariance[j * MAX_DIMS + i] = c;
+        }
+        trace += covariance[i * MAX_DIMS + i];
+    }
+
+    // around the new mean, and the spikes so far count half from now on
+    FloatVectorOperations::add(e.center, mean, dims);
+    FloatVectorOperations::clear(e.sum, dims);
+    for(int i = 0; i < dims; i++)
+    {
+        float *o = e.outer + i * MAX_DIMS + i;
+        FloatVectorOperations::addWithMultiply(o, mean + i, -w * mean[i], dims - i);
+        FloatVectorOperations::multiply(o, 0.5f, dims - i);
+    }
+    e.weight *= 0.5;
+    e.sinceRefresh = 0;
+
+    // subspace iteration from the previous basis, or from a fixed
+    // pseudo-random one
+    if(e.basisVersion == 0)
+    {
+        uint32 seed = 12345;
+        for(int k = 0; k < nComponents; k++)
+            for(int i = 0; i < dims; i++)
+            {
+                seed = seed * 1664525 + 1013904223;
+                e.basis[k * MAX_DIMS + i] = (float)(seed >> 8) / (float)(1 << 24) - 0.5f;
+            }
+    }
+    float variance = 0.f;
+    for(int it = 0; it < ITERATIONS; it++)
+    {
+        const bool last = it == ITERATIONS - 1;
+        const float *q = it == 0 ? e.basis : z;
+        // z = C q, then Gram-Schmidt. z can be q, the products go through
+        // the spare row first
+        float *product = mean;
+        for(int k = 0; k < nComponents; k++)
+        {
+            const float *qk = q + k * MAX_DIMS;
+            for(int i = 0; i < dims; i++)
+                product[i] = dot(covariance + i * MAX_DIMS, qk, dims);
+            if(last) // Rayleigh quotients, q is normalized by then
+                variance += dot(product, qk, dims);
+            FloatVectorOperations::copy(z + k * MAX_DIMS, product, dims);
+        }
+        for(int k = 0; k < nComponents; k++)
+        {
+            float *zk = z + k * MAX_DIMS;
+            for(int l = 0; l < k; l++)
+                FloatVectorOperations::addWithMultiply(zk, z + l * MAX_DIMS, -dot(zk, z + l * MAX_DIMS, dims), dims);
+            float norm = sqrtf(dot(zk, zk, dims));
+            if(norm > 1e-20f)
+                FloatVectorOperations::multiply(zk, 1.f / norm, dims);
+            else
+                FloatVectorOperations::clear(zk, dims); // fewer directions than components
+        }
+    }
+
+    // signs kept from one basis to the next, so that the projections don't
+    // flip. The first one has its largest weight positive
+    for(int k = 0; k < nComponents; k++)
+    {
+        float *zk = z + k * MAX_DIMS;
+        float s;
+        if(e.basisVersion > 0)
+            s = dot(zk, e.basis + k * MAX_DIMS, dims);
+        else
+        {
+            Range<float> r = FloatVectorOperations::findMinAndMax(zk, dims);
+            s = r.getEnd() + r.getStart();
+        }
+        if(s < 0.f)
+            FloatVectorOperations::negate(zk, zk, dims);
+        FloatVectorOperations::copy(e.basis + k * MAX_DIMS, zk, dims);
+    }
+    e.explained = trace > 0.f ? jmin(1.f, variance / trace) : 0.f;
+    e.basisVersion++;
+}
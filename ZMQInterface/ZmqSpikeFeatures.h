@@ -0,0 +1,141 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqSpikeFeatures.h
+    Created: 19 Oct 2026 6:25:35am
+
+  ==============================================================================
+*/
+
+#ifndef ZMQSPIKEFEATURES_H_INCLUDED
+#define ZMQSPIKEFEATURES_H_INCLUDED
+
+#include <ProcessorHeaders.h>
+
+
+/** One spike, as sent in the SPIKE_FEATURES stream (16 bytes, followed in the
+ message by the features of all the spikes in the batch) */
+struct SpikeFeatureRecord {
+    int64 timestamp;
+    int32 electrodeId;
+    int32 basisVersion; // 0 until the electrode has a basis
+};
+
+
+//=============================================================================
+/** Low-dimensional features of the waveforms of the upstream spikes: peak,
+ trough and trough to peak width of each channel, and the projections on the
+ first principal components of the electrode.
+
+ The principal components are estimated incrementally. Each spike adds to a
+ running mean and covariance of its electrode (a rank-1 update), and every
+ refreshSpikes spikes the basis is updated by a few subspace iterations
+ started from the previous one, after which the older spikes count half.
+ Projections are on the basis of the time, the basis version is sent with
+ each spike so that the jumps at refreshes can be told apart.
+
+ Electrodes get a row the first time they are seen, up to MAX_ELECTRODES.
+ Nothing allocates after prepare().
+ */
+class ZmqSpikeFeatures
+{
+public:
+    ZmqSpikeFeatures();
+
+    void prepare(double sampleRate, int nComponents, int refreshSpikes);
+    void reset();
+
+    /** data: nChannels x nSamples unsigned samples as in SpikeObject (0 V is
+     32768), gain: per channel, in units per mV */
+    void addSpike(int electrodeId, int64 timestamp, int nChannels, int nSamples,
+                  const uint16 *data, const float *gain);
+
+    int getNumFeatures() const { return 3 * MAX_CHANNELS + nComponents; }
+    StringArray getFeatureNames() const;
+    int getNumComponents() const { return nComponents; }
+
+    /** The spikes added since clearBatch() */
+    int getNumSpikes() const { return nSpikes; }
+    int getNumDropped() const { return nDropped; }
+    const SpikeFeatureRecord *getRecords() const { return records; }
+    /** nSpikes x getNumFeatures() */
+    const float *getFeatures() const { return features; }
+    void clearBatch();
+
+    int getNumElectrodes() const { return electrodes.size(); }
+    int getElectrodeId(int i) const { return electrodes.getReference(i).id; }
+    int getBasisVersion(int i) const { return electrodes.getReference(i).basisVersion; }
+    /** Fraction of the variance of the electrode captured by its basis */
+    float getExplainedVariance(int i) const { return electrodes.getReference(i).explained; }
+
+    enum { MAX_ELECTRODES = 64, MAX_CHANNELS = 4, MAX_SAMPLES = 40,
+        MAX_DIMS = MAX_CHANNELS * MAX_SAMPLES, MAX_COMPONENTS = 8, MAX_BATCH = 4096,
+        ITERATIONS = 8 };
+
+private:
+    struct Electrode {
+        int id;
+        int nChannels, nSamples, dims;
+        int basisVersion;
+        float explained;
+        double weight; // spikes in sum and outer, older ones discounted
+        int sinceRefresh;
+        // MAX_DIMS wide rows in the HeapBlocks below, at row index
+        // (dims are relative to center, the mean at the last refresh)
+        float *center; // MAX_DIMS
+        float *sum; // MAX_DIMS
+        float *outer; // MAX_DIMS x MAX_DIMS, upper triangle
+        float *basis; // MAX_COMPONENTS x MAX_DIMS
+    };
+
+    int getElectrode(int electrodeId, int nChannels, int nSamples);
+    void refreshBasis(Electrode &e);
+
+    static float dot(const float *a, const float *b, int n);
+    static void toMicrovolts(const uint16 *data, float scale, float *out, int n);
+    static void peakTroughWidth(const float *x, int n, float &peak, float &trough, int &width);
+
+    double sampleRate = 30000.;
+    int nComponents = 3;
+    int refreshSpikes = 1000;
+
+    Array<Electrode> electrodes;
+    HeapBlock<float> centers, sums, outers, bases;
+    HeapBlock<float> covariance, work; // refreshes
+    HeapBlock<float> waveform; // the current spike, converted
+
+    int nSpikes = 0;
+    int nDropped = 0;
+    HeapBlock<SpikeFeatureRecord> records;
+    HeapBlock<float> features;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ZmqSpikeFeatures);
+};
+
+
+#endif  // ZMQSPIKEFEATURES_H_INCLUDED
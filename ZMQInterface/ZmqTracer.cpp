@@ -0,0 +1,188 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqTracer.cpp
+    Created: 19 Oct 2026 6:15:40am
+
+  ==============================================================================
+*/
+
+#include "ZmqTracer.h"
+
+
+/** Written by one thread only. count is the number of stages recorded since
+ the thread claimed the buffer, the last EVENTS_PER_THREAD are in events */
+struct ZmqTracer::ThreadBuffer
+{
+    struct Event {
+        const char *name;
+        int64 startTicks, endTicks;
+    };
+    Event events[EVENTS_PER_THREAD];
+    Atomic<int64> count;
+    char threadName[32];
+};
+
+OwnedArray<ZmqTracer::ThreadBuffer> ZmqTracer::buffers;
+Atomic<int> ZmqTracer::enabled;
+Atomic<int> ZmqTracer::generation;
+Atomic<int> ZmqTracer::numThreads;
+Atomic<int64> ZmqTracer::dropped;
+
+// the buffer of the calling thread, claimed again for each recording
+static thread_local int threadSlot = -1;
+static thread_local int threadGeneration = -1;
+
+
+void ZmqTracer::setEnabled(bool shouldBeEnabled)
+{
+    if(!shouldBeEnabled)
+    {
+        enabled = 0;
+        return;
+    }
+    if(isEnabled())
+        return;
+    // once, on the message thread, so that tracing never allocates
+    while(buffers.size() < MAX_THREADS)
+        buffers.add(new ThreadBuffer());
+    numThreads = 0;
+    dropped = 0;
+    ++generation;
+    enabled = 1;
+}
+
+ZmqTracer::ThreadBuffer *ZmqTracer::claimBuffer()
+{
+    const int current = generation.get();
+    if(threadGeneration != current)
+    {
+        threadGeneration = current;
+        threadSlot = ++numThreads - 1;
+        if(threadSlot >= MAX_THREADS)
+            threadSlot = -1;
+        else
+        {
+            ThreadBuffer *buffer = buffers.getUnchecked(threadSlot);
+            buffer->count = 0;
+            // copied, a new String would allocate
+            if(Thread *thread = Thread::getCurrentThread())
+                thread->getThreadName().copyToUTF8(buffer->threadName, sizeof(buffer->threadName));
+            else
+            {
+                // the audio device callbacks are not always JUCE threads
+                const char *name = MessageManager::existsAndIsCurrentThread() ? "Message thread" : "Audio thread";
+                strncpy(buffer->threadName, name, sizeof(buffer->threadName) - 1);
+                buffer->threadName[sizeof(buffer->threadName) - 1] = 0;
+            }
+        }
+    }
+    return threadSlot >= 0 ? buffers.getUnchecked(threadSlot) : nullptr;
+}
+
+void ZmqTracer::record(const char *name, int64 startTicks, int64 endTicks)
+{
+    ThreadBuffer *buffer = claimBuffer();
+    if(!buffer)
+    {
+        ++dropped;
+        return;
+    }
+    const int64 n = buffer->count.get();
+    ThreadBuffer::Event &event = buffer->events[n & (EVENTS_PER_THREAD - 1)];
+    event.name = name;
+    event.startTicks = startTicks;
+    event.endTicks = endTicks;
+    buffer->count = n + 1; // published once the event is complete
+}
+
+bool ZmqTracer::writeChromeTrace(const File &file)
+{
+    // the threads keep recording while we read, so each buffer is copied and
+    // its count read again afterwards, like a seqlock: the events a thread
+    // may have overwritten in the meantime (it writes event count before
+    // publishing count + 1) are left out, and so is a buffer claimed again
+    const int nThreads = jmin(numThreads.get(), (int)MAX_THREADS, buffers.size());
+    HeapBlock<ThreadBuffer::Event> events((size_t)jmax(1, nThreads) * EVENTS_PER_THREAD);
+    HeapBlock<int64> first(jmax(1, nThreads)), last(jmax(1, nThreads));
+    int64 origin = 0;
+    int64 nEvents = 0;
+    for(int t = 0; t < nThreads; t++)
+    {
+        const ThreadBuffer *buffer = buffers.getUnchecked(t);
+        ThreadBuffer::Event *copy = events + (size_t)t * EVENTS_PER_THREAD;
+        const int64 before = buffer->count.get();
+        memcpy(copy, buffer->events, sizeof(buffer->events));
+        const int64 after = buffer->count.get(); // a full barrier, after the copy
+        first[t] = jmax((int64)0, before - EVENTS_PER_THREAD, after - EVENTS_PER_THREAD + 1);
+        last[t] = after >= before ? before : 0;
+        for(int64 i = first[t]; i < last[t]; i++)
+        {
+            const int64 start = copy[i & (EVENTS_PER_THREAD - 1)].startTicks;
+            if(nEvents++ == 0 || start < origin)
+                origin = start;
+        }
+    }
+
+    bool ok = false;
+    if(nEvents > 0)
+    {
+        file.deleteFile();
+        FileOutputStream out(file);
+        if(out.openedOk())
+        {
+            const double ticksToUs = 1.0e6 / (double)Time::getHighResolutionTicksPerSecond();
+            out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+            bool firstThread = true;
+            for(int t = 0; t < nThreads; t++)
+            {
+                const ThreadBuffer *buffer = buffers.getUnchecked(t);
+                out << (firstThread ? "" : ",\n")
+                    << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t + 1
+                    << ", \"args\": {\"name\": " << JSON::toString(String(buffer->threadName)) << "}}";
+                firstThread = false;
+
+                const ThreadBuffer::Event *copy = events + (size_t)t * EVENTS_PER_THREAD;
+                for(int64 i = first[t]; i < last[t]; i++)
+                {
+                    const ThreadBuffer::Event &event = copy[i & (EVENTS_PER_THREAD - 1)];
+                    out << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << t + 1
+                        << ", \"ts\": " << String((event.startTicks - origin) * ticksToUs, 3)
+                        << ", \"dur\": " << String((event.endTicks - event.startTicks) * ticksToUs, 3) << "}";
+                }
+            }
+            out << "\n]}\n";
+            out.flush();
+            ok = out.getStatus().wasOk();
+        }
+        std::cout << "trace: " << nEvents << " stages of " << nThreads << " threads written to "
+            << file.getFullPathName() << ", " << dropped.get() << " dropped" << std::endl;
+    }
+
+    return ok;
+}
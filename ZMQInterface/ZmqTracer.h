@@ -0,0 +1,112 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ based on
+ Open Ephys GUI
+ Copyright (C) 2013, 2015 Open Ephys
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqTracer.h
+    Created: 19 Oct 2026 6:15:40am
+
+  ==============================================================================
+*/
+
+#ifndef ZMQTRACER_H_INCLUDED
+#define ZMQTRACER_H_INCLUDED
+
+#include <ProcessorHeaders.h>
+
+
+//=============================================================================
+/** Records where the time goes in the threads of the plugin (audio thread,
+ listening thread, publisher, editor), to be looked at in chrome://tracing or
+ ui.perfetto.dev.
+
+ Stages are marked with ZMQ_TRACE("name") at the start of a scope; the name
+ must be a string literal. Each thread writes the begin and end ticks of its
+ stages to a ring buffer of its own, without locks or allocations, so the
+ last EVENTS_PER_THREAD stages of every thread are kept. When recording is off
+ a stage costs one atomic load.
+
+ The buffers are allocated by setEnabled(true), which also starts a new
+ recording. writeChromeTrace() saves a copy while the threads go on
+ recording, without waiting for them.
+ */
+class ZmqTracer
+{
+public:
+    static void setEnabled(bool shouldBeEnabled);
+    static bool isEnabled() { return enabled.get() != 0; }
+
+    /** Saves what was recorded in the Trace Event Format (one "complete"
+     event per stage, and the thread names). False if the file can't be
+     written or nothing was recorded */
+    static bool writeChromeTrace(const File &file);
+
+    /** Stages not recorded because more than MAX_THREADS threads traced */
+    static int64 getNumDropped() { return dropped.get(); }
+
+    static void record(const char *name, int64 startTicks, int64 endTicks);
+
+    /** Records the lifetime of the scope it is declared in */
+    class Scope
+    {
+    public:
+        explicit Scope(const char *stageName)
+        : name(stageName), startTicks(isEnabled() ? Time::getHighResolutionTicks() : 0)
+        {
+        }
+
+        ~Scope()
+        {
+            if(startTicks != 0)
+                record(name, startTicks, Time::getHighResolutionTicks());
+        }
+
+    private:
+        const char *name;
+        const int64 startTicks;
+
+        JUCE_DECLARE_NON_COPYABLE(Scope);
+    };
+
+    enum { MAX_THREADS = 16, EVENTS_PER_THREAD = 1 << 14 };
+
+private:
+    struct ThreadBuffer;
+    static ThreadBuffer *claimBuffer();
+
+    static OwnedArray<ThreadBuffer> buffers; // MAX_THREADS, never freed before exit
+    static Atomic<int> enabled;
+    static Atomic<int> generation; // bumped by each new recording
+    static Atomic<int> numThreads;
+    static Atomic<int64> dropped;
+};
+
+#define ZMQ_TRACE_CONCAT_(a, b) a ## b
+#define ZMQ_TRACE_CONCAT(a, b) ZMQ_TRACE_CONCAT_(a, b)
+#define ZMQ_TRACE(name) ZmqTracer::Scope ZMQ_TRACE_CONCAT(zmqTraceScope, __LINE__) (name)
+
+
+#endif  // ZMQTRACER_H_INCLUDED
@@ -2,6 +2,7 @@
 export GIT_PREFIX=/usr/local
 export CONFIG=Release
 ln -s ../../../ZMQInterface/ZMQInterface/ ../plugin-GUI/Source/Plugins/ZMQInterface
+make -C tools ZMQ_PREFIX=${ZMQ_PREFIX:-/usr/local}
 cd ../plugin-GUI/Builds/Linux/
 make   -f Makefile.plugins
 
@@ -0,0 +1,259 @@
+import json
+import time
+import zmq
+import numpy as np
+
+from .plot_process_zmq import PlotProcess
+
+__author__ = 'fpbatta'
+
+# Receive path for high data rates. Each wakeup takes every message already
+# waiting on the SUB socket (up to max_batch), parses all their JSON headers
+# with one json.loads, and copies the DATA blocks into a preallocated ring per
+# topic, so a block costs two slice copies and no new arrays. Events and
+# heartbeats go through a DEALER socket, which never waits for the replies of
+# the plugin (they are read when they come, at the next wakeup).
+
+
+class DataRing(object):
+    """the last capacity samples of one DATA topic, n_channels x capacity float32. written counts the samples
+    since the start, the newest sample is in column (written - 1) % capacity"""
+    def __init__(self, n_channels, capacity):
+        self.n_channels = n_channels
+        self.capacity = capacity
+        self.buffer = np.zeros((n_channels, capacity), dtype=np.float32)
+        self.written = 0
+        self.timestamp = None  # of the first sample of the last block
+        self.sequence = None  # of the last block, to count gaps
+
+    def append(self, block, scale=None):
+        """block: n_channels x n_samples view of the frame, float32, or int16 with scale"""
+        n = block.shape[1]
+        if n > self.capacity:
+            self.written += n - self.capacity
+            block = block[:, n - self.capacity:]
+            n = self.capacity
+        pos = self.written % self.capacity
+        first = min(n, self.capacity - pos)
+        self._copy(block[:, 0:first], self.buffer[:, pos:pos + first], scale)
+        if first < n:
+            self._copy(block[:, first:n], self.buffer[:, 0:n - first], scale)
+        self.written += n
+
+    @staticmethod
+    def _copy(src, dest, scale):
+        if scale is None:
+            np.copyto(dest, src)
+        else:
+            np.multiply(src, scale, out=dest)
+
+    def segments(self, n):
+        """the newest n samples as one or two views of the buffer, oldest first"""
+        n = min(n, self.capacity, self.written)
+        end = self.written % self.capacity or self.capacity
+        if n <= end:
+            return [self.buffer[:, end - n:end]]
+        return [self.buffer[:, self.capacity - (n - end):], self.buffer[:, 0:end]]
+
+    def last(self, n):
+        """the newest n samples, a copy when they wrap around"""
+        s = self.segments(n)
+        return s[0] if len(s) == 1 else np.concatenate(s, axis=1)
+
+
+class AsyncPlotProcess(PlotProcess):
+    """drop-in replacement for PlotProcess, same update_plot_* hooks. Data blocks end up in self.rings (one
+    DataRing per DATA topic) and update_plot_ring is called once per wakeup for each topic that got samples"""
+    def __init__(self, host='localhost', data_port=5556, listen_port=5557, ring_seconds=10., max_batch=1000,
+                 poll_ms=1):
+        super(AsyncPlotProcess, self).__init__()
+        self.host = host
+        self.data_port = data_port
+        self.listen_port = listen_port
+        self.ring_seconds = ring_seconds
+        self.max_batch = max_batch
+        self.poll_ms = poll_ms
+        self.rings = {}
+        self._topics = {}  # envelope frame: topic
+        self.outstanding = 0  # requests not answered yet
+        self.stats = dict.fromkeys(('wakeups', 'messages', 'bytes', 'blocks', 'missing_messages', 'gaps',
+                                    'malformed', 'events_sent', 'events_dropped', 'replies'), 0)
+
+    def connect(self):
+        self.data_socket = self.context.socket(zmq.SUB)
+        self.data_socket.setsockopt(zmq.RCVHWM, 100000)
+        self.data_socket.connect("tcp://{0}:{1}".format(self.host, self.data_port))
+        for t in self.topics:
+            self.data_socket.setsockopt(zmq.SUBSCRIBE, t)
+
+        # a DEALER talks to the REP listen socket like a REQ with an empty delimiter frame, but can have any
+        # number of requests in flight. IMMEDIATE: nothing is queued while the plugin is away
+        self.event_socket = self.context.socket(zmq.DEALER)
+        self.event_socket.setsockopt(zmq.LINGER, 0)
+        self.event_socket.setsockopt(zmq.IMMEDIATE, 1)
+        self.event_socket.setsockopt(zmq.SNDHWM, 1000)
+        self.event_socket.connect("tcp://{0}:{1}".format(self.host, self.listen_port))
+
+        self.poller.register(self.data_socket, zmq.POLLIN)
+        self.poller.register(self.event_socket, zmq.POLLIN)
+
+    def _request(self, d):
+        try:
+            self.event_socket.send_multipart([b'', json.dumps(d).encode('utf-8')], zmq.NOBLOCK)
+        except zmq.Again:
+            return False
+        self.outstanding += 1
+        return True
+
+    def send_heartbeat(self):
+        self._request({'application': self.app_name, 'uuid': self.uuid, 'type': 'heartbeat'})
+        self.last_heartbeat_time = time.time()
+
+    def send_event(self, event_list=None, event_type=3, sample_num=0, event_id=2, event_channel=1):
+        """sent right away, whether the previous ones were answered or not"""
+        if event_list is None:
+            event_list = [{'event_type': event_type, 'sample_num': sample_num, 'event_id': event_id % 2 + 1,
+                           'event_channel': event_channel}]
+        for e in event_list:
+            de = {'type': e['event_type'], 'sample_num': e['sample_num'], 'event_id': e['event_id'],
+                  'event_channel': e['event_channel']}
+            if self._request({'application': self.app_name, 'uuid': self.uuid, 'type': 'event', 'event': de}):
+                self.stats['events_sent'] += 1
+            else:
+                self.stats['events_dropped'] += 1
+        self.event_no += 1
+
+    def server_alive(self):
+        """False when requests have been waiting for more than 10 s"""
+        return self.outstanding == 0 or time.time() - self.last_reply_time < 10.
+
+    def update_plot_ring(self, topic, ring, n_new):
+        """called once per wakeup for each DATA topic with new samples, the newest n_new are in ring.last(n_new)
+        (fewer when more than the capacity came at once). Calls update_plot by default, with views of the ring"""
+        for s in ring.segments(n_new):
+            self.update_plot(s)
+
+    def drain(self):
+        """the messages waiting on the SUB socket, without blocking, as lists of zmq.Frame. Frame.more is much
+        cheaper than the RCVMORE option read by recv_multipart"""
+        messages = []
+        recv = self.data_socket.recv
+        flags = int(zmq.NOBLOCK)
+        try:
+            while len(messages) < self.max_batch:
+                f = recv(flags, copy=False)
+                m = [f]
+                while f.more:
+                    f = recv(flags, copy=False)
+                    m.append(f)
+                messages.append(m)
+        except zmq.Again:
+            pass
+        return messages
+
+    def decode_headers(self, messages):
+        """the header dicts of all the messages, one json.loads for the whole batch. None for the headers that
+        couldn't be read"""
+        frames = [m[1].bytes if len(m) > 1 else b'null' for m in messages]
+        try:
+            return json.loads(b'[' + b','.join(frames) + b']')
+        except ValueError:
+            headers = []
+            for f in frames:
+                try:
+                    headers.append(json.loads(f))
+                except ValueError:
+                    headers.append(None)
+            return headers
+
+    def process_messages(self, messages):
+        headers = self.decode_headers(messages)
+        touched = {}
+        stats = self.stats
+        stats['messages'] += len(messages)
+        for m, header in zip(messages, headers):
+            if header is None or len(m) < 2:
+                stats['malformed'] += 1
+                continue
+            envelope = m[0].bytes
+            stats['missing_messages'] += self.missing_before(envelope, header)
+
+            if header['type'] != 'data' or len(m) < 3:
+                payload = m[2].bytes if len(m) > 2 else b''
+                self.dispatch(header, [m[0].bytes, m[1].bytes, payload])
+                continue
+
+            c = header['content']
+            n_real = c['n_real_samples']
+            if n_real <= 0:
+                continue
+            data = m[2].buffer
+            stats['bytes'] += len(data)
+            stats['blocks'] += c.get('n_blocks', 1)
+            envelope = m[0].bytes
+            topic = self._topics.get(envelope)
+            if topic is None:
+                topic = self._topics[envelope] = envelope.rstrip(b'\0').decode('utf-8')
+            ring = self.rings.get(topic)
+            n_channels = c['n_channels']
+            if ring is None or ring.n_channels != n_channels:
+                # first block of the topic, or the channels changed (new schema)
+                ring = DataRing(n_channels, max(int(self.ring_seconds * c['sample_rate']), n_real))
+                self.rings[topic] = ring
+            if ring.sequence is not None and c['sequence'] != ring.sequence + 1:
+                stats['gaps'] += 1
+            ring.sequence = c['sequence']
+            ring.timestamp = c['timestamp']
+
+            n_samples = c['n_samples']
+            if c.get('dtype') == 'int16':
+                block = np.frombuffer(data, dtype=np.int16, count=n_channels * n_samples)
+                scale = np.float32(c['scale'])
+            else:
+                block = np.frombuffer(data, dtype=np.float32, count=n_channels * n_samples)
+                scale = None
+            block = block.reshape((n_channels, n_samples))
+            if n_real < n_samples:
+                block = block[:, 0:n_real]
+            if topic not in touched:
+                touched[topic] = ring.written
+            ring.append(block, scale)
+
+        for topic, before in touched.items():
+            ring = self.rings[topic]
+            self.update_plot_ring(topic, ring, min(ring.written - before, ring.capacity))
+
+    def receive_replies(self):
+        try:
+            while True:
+                self.event_socket.recv_multipart(zmq.NOBLOCK)
+                self.outstanding = max(0, self.outstanding - 1)
+                self.stats['replies'] += 1
+                self.last_reply_time = time.time()
+        except zmq.Again:
+            pass
+
+    def callback(self):
+        if not self.data_socket:
+            self.connect()
+
+        # every two seconds a "heartbeat" so that Open Ephys knows we're alive
+        if time.time() - self.last_heartbeat_time > 2.:
+            self.send_heartbeat()
+
+        if self.isTesting:
+            if np.random.random() < 0.005:
+                self.send_event(event_type=3, sample_num=0, event_id=self.event_no, event_channel=1)
+
+        if not self.poller.poll(self.poll_ms):
+            return True
+        self.stats['wakeups'] += 1
+        while True:
+            messages = self.drain()
+            if not messages:
+                break
+            self.process_messages(messages)
+            if len(messages) < self.max_batch:
+                break
+        self.receive_replies()
+        return True
@@ -0,0 +1,36 @@
+import json
+import uuid
+import zmq
+
+__author__ = 'fpbatta'
+
+# Changes the options of the plugin while it runs, through the listen socket
+# (port 5557), e.g. configure(data_decimation=10, data_format='int16'). The
+# plugin applies them right after replying. Moving data_port or listen_port
+# means connecting again on the new port.
+
+
+def configure(host='localhost', port=5557, timeout_ms=2000, app_name='config client', **options):
+    """sets the given options, returns the reply: {'accepted': [...], 'unknown': [...],
+    'options': {all the options, before the change}}, or None without an answer"""
+    context = zmq.Context.instance()
+    socket = context.socket(zmq.REQ)
+    socket.setsockopt(zmq.LINGER, 0)
+    socket.setsockopt(zmq.RCVTIMEO, timeout_ms)
+    socket.connect("tcp://{0}:{1}".format(host, port))
+    d = {'application': app_name, 'uuid': str(uuid.uuid4()), 'type': 'config'}
+    if options:
+        d['set'] = options
+    try:
+        socket.send(json.dumps(d).encode('utf-8'))
+        return json.loads(socket.recv().decode('utf-8'))
+    except zmq.Again:
+        return None
+    finally:
+        socket.close()
+
+
+def get_options(host='localhost', port=5557, timeout_ms=2000):
+    """the current options of the plugin, or None without an answer"""
+    reply = configure(host, port, timeout_ms)
+    return reply['options'] if reply else None
@@ -0,0 +1,37 @@
+import struct
+import zmq
+import numpy as np
+
+__author__ = 'fpbatta'
+
+# Sends continuous blocks back to the plugin (port 5560), where they are played
+# out on the extra "ZMQ" channels inject_delay_ms after the acquisition. Blocks
+# only need the sample number of their first sample, the same as the timestamp
+# of the DATA message they were computed from.
+
+inject_header = struct.Struct('<qiiii')  # sample_num, first_channel, n_channels, n_samples, reserved
+
+
+class InjectClient(object):
+    def __init__(self, name='inject', host='localhost', port=5560, hwm=1000):
+        self.name = name.encode('utf-8')[:31]
+        self.context = zmq.Context.instance()
+        self.socket = self.context.socket(zmq.PUSH)
+        self.socket.setsockopt(zmq.SNDHWM, hwm)
+        self.socket.setsockopt(zmq.LINGER, 0)
+        self.socket.connect("tcp://{0}:{1}".format(host, port))
+
+    def send(self, sample_num, block, first_channel=0):
+        """block: n_channels x n_samples array (or a single channel), written to the injected channels
+        first_channel (0-based) onwards. Returns False if the plugin is not keeping up"""
+        block = np.ascontiguousarray(np.atleast_2d(block), dtype='<f4')
+        n_channels, n_samples = block.shape
+        header = inject_header.pack(int(sample_num), first_channel, n_channels, n_samples, 0)
+        try:
+            self.socket.send_multipart([self.name, header, block], zmq.NOBLOCK, copy=False)
+        except zmq.Again:
+            return False
+        return True
+
+    def close(self):
+        self.socket.close()
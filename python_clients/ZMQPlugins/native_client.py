@@ -0,0 +1,201 @@
+import ctypes
+import ctypes.util
+import json
+import os
+import numpy as np
+
+from .plot_process_zmq import PlotProcess
+
+__author__ = 'fpbatta'
+
+# ctypes binding of libzmqclient (tools/client). The library receives on its own
+# thread, keeps the messages in a ring and hands out pointers to the data frames,
+# which are wrapped here as numpy arrays without copying.
+
+
+class ZicBlock(ctypes.Structure):
+    _fields_ = [('message_no', ctypes.c_int64),
+                ('timestamp', ctypes.c_int64),
+                ('sequence', ctypes.c_uint64),
+                ('n_channels', ctypes.c_int32),
+                ('n_samples', ctypes.c_int32),
+                ('stride', ctypes.c_int32),
+                ('reserved', ctypes.c_int32),
+                ('data', ctypes.POINTER(ctypes.c_float)),
+                ('topic', ctypes.c_char_p)]
+
+
+class ZicMessage(ctypes.Structure):
+    _fields_ = [('message_no', ctypes.c_int64),
+                ('envelope', ctypes.c_char_p),
+                ('type', ctypes.c_char_p),
+                ('header', ctypes.c_void_p),
+                ('header_size', ctypes.c_size_t),
+                ('payload', ctypes.c_void_p),
+                ('payload_size', ctypes.c_size_t),
+                ('sample_num', ctypes.c_int64),
+                ('event_type', ctypes.c_int32),
+                ('event_id', ctypes.c_int32),
+                ('event_channel', ctypes.c_int32),
+                ('reserved', ctypes.c_int32)]
+
+
+class ZicStats(ctypes.Structure):
+    _fields_ = [('messages', ctypes.c_int64),
+                ('blocks', ctypes.c_int64),
+                ('gaps', ctypes.c_int64),
+                ('missing_messages', ctypes.c_int64),
+                ('dropped_blocks', ctypes.c_int64),
+                ('dropped_messages', ctypes.c_int64),
+                ('heartbeats_sent', ctypes.c_int64),
+                ('replies_received', ctypes.c_int64),
+                ('events_sent', ctypes.c_int64),
+                ('server_alive', ctypes.c_int32),
+                ('reserved', ctypes.c_int32)]
+
+
+class ZicClock(ctypes.Structure):
+    _fields_ = [('ref_sample', ctypes.c_int64),
+                ('ref_monotonic_ns', ctypes.c_int64),
+                ('ref_realtime_ns', ctypes.c_int64),
+                ('ns_per_sample', ctypes.c_double),
+                ('nominal_rate', ctypes.c_double),
+                ('residual_ns', ctypes.c_double),
+                ('n_points', ctypes.c_int32),
+                ('reserved', ctypes.c_int32)]
+
+    def to_monotonic_ns(self, sample):
+        return self.ref_monotonic_ns + int((sample - self.ref_sample) * self.ns_per_sample)
+
+    def to_realtime_ns(self, sample):
+        return self.ref_realtime_ns + int((sample - self.ref_sample) * self.ns_per_sample)
+
+
+def load_library(path=None):
+    """finds libzmqclient: explicit path, $ZMQ_CLIENT_LIB, tools/build in the source tree, then the system"""
+    candidates = [path, os.environ.get('ZMQ_CLIENT_LIB'),
+                  os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                               '..', '..', 'tools', 'build', 'libzmqclient.so'),
+                  ctypes.util.find_library('zmqclient')]
+    for c in candidates:
+        if c and (os.path.exists(c) or not os.path.dirname(c)):
+            lib = ctypes.CDLL(c)
+            break
+    else:
+        raise OSError("libzmqclient not found, build it with make -C tools or set ZMQ_CLIENT_LIB")
+
+    lib.zic_create.restype = ctypes.c_void_p
+    lib.zic_create.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_char_p]
+    lib.zic_destroy.argtypes = [ctypes.c_void_p]
+    lib.zic_subscribe.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+    lib.zic_start.argtypes = [ctypes.c_void_p]
+    lib.zic_next_block.argtypes = [ctypes.c_void_p, ctypes.POINTER(ZicBlock), ctypes.c_int]
+    lib.zic_next_message.argtypes = [ctypes.c_void_p, ctypes.POINTER(ZicMessage), ctypes.c_int]
+    lib.zic_send_event.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int64, ctypes.c_int, ctypes.c_int]
+    lib.zic_get_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(ZicStats)]
+    lib.zic_get_clock.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(ZicClock)]
+    return lib
+
+
+class NativeClient(object):
+    def __init__(self, host='localhost', data_port=5556, listen_port=5557, app_name='Native Client',
+                 topics=None, lib_path=None):
+        self.lib = load_library(lib_path)
+        self.handle = self.lib.zic_create(host.encode('utf-8'), data_port, listen_port, app_name.encode('utf-8'))
+        for t in topics or []:
+            self.lib.zic_subscribe(self.handle, t.encode('utf-8'))
+        if self.lib.zic_start(self.handle) != 0:
+            raise IOError("couldn't connect to {0}:{1}".format(host, data_port))
+        self._block = ZicBlock()
+        self._message = ZicMessage()
+        self.last_topic = None
+
+    def next_block(self, timeout_ms=0):
+        """returns (n_channels x n_samples float32 view, timestamp) or None. The view is only valid until the
+        next call, copy it to keep the data. The topic of the block is in last_topic"""
+        if not self.lib.zic_next_block(self.handle, ctypes.byref(self._block), timeout_ms):
+            return None
+        b = self._block
+        self.last_topic = b.topic.decode('utf-8')
+        arr = np.ctypeslib.as_array(b.data, shape=(b.n_channels, b.stride))
+        return arr[:, 0:b.n_samples], b.timestamp
+
+    def next_message(self, timeout_ms=0):
+        """returns (header dict, payload bytes) of the next non-data message, or None"""
+        if not self.lib.zic_next_message(self.handle, ctypes.byref(self._message), timeout_ms):
+            return None
+        m = self._message
+        header = json.loads(ctypes.string_at(m.header, m.header_size).decode('utf-8'))
+        payload = ctypes.string_at(m.payload, m.payload_size) if m.payload else b''
+        return header, payload
+
+    def send_event(self, event_type=3, sample_num=0, event_id=2, event_channel=1):
+        self.lib.zic_send_event(self.handle, event_type, sample_num, event_id, event_channel)
+
+    def stats(self):
+        s = ZicStats()
+        self.lib.zic_get_stats(self.handle, ctypes.byref(s))
+        return dict((f[0], getattr(s, f[0])) for f in ZicStats._fields_ if f[0] != 'reserved')
+
+    def clock(self, topic=None):
+        """sample number to host time mapping of a DATA topic (the first one by default), fitted on the SYNC
+        messages (subscribe to 'SYNC'). None until two of them were received"""
+        c = ZicClock()
+        ok = self.lib.zic_get_clock(self.handle, topic.encode('utf-8') if topic else None, ctypes.byref(c))
+        return c if ok else None
+
+    def close(self):
+        if self.handle:
+            self.lib.zic_destroy(self.handle)
+            self.handle = None
+
+    def __del__(self):
+        self.close()
+
+
+class NativePlotProcess(PlotProcess):
+    """drop-in replacement for PlotProcess, same update_plot_* hooks, receiving through libzmqclient.
+    Heartbeats and reconnection are handled by the library thread."""
+    def __init__(self, host='localhost', data_port=5556, listen_port=5557):
+        super(NativePlotProcess, self).__init__()
+        self.host = host
+        self.data_port = data_port
+        self.listen_port = listen_port
+        self.client = None
+
+    def send_heartbeat(self):
+        pass
+
+    def send_event(self, event_list=None, event_type=3, sample_num=0, event_id=2, event_channel=1):
+        if event_list:
+            for e in event_list:
+                self.client.send_event(e['event_type'], e['sample_num'], e['event_id'], e['event_channel'])
+        else:
+            self.client.send_event(event_type, sample_num, event_id % 2 + 1, event_channel)
+        self.event_no += 1
+
+    def callback(self):
+        if not self.client:
+            # the library takes a final '$' for the NUL of an exact topic
+            topics = [t.replace(b'\0', b'$').decode('utf-8') for t in self.topics if t]
+            self.client = NativeClient(self.host, self.data_port, self.listen_port, self.app_name, topics)
+
+        if self.isTesting:
+            if np.random.random() < 0.005:
+                self.send_event(event_type=3, sample_num=0, event_id=self.event_no, event_channel=1)
+
+        while True:
+            b = self.client.next_block()
+            if b is None:
+                break
+            if b[0].shape[1] > 0:
+                self.update_plot(b[0])
+
+        while True:
+            m = self.client.next_message()
+            if m is None:
+                break
+            header, payload = m
+            self.dispatch(header, [b'', b'', payload])
+
+        return True
@@ -8,6 +8,31 @@ import time
 __author__ = 'fpbatta'
 
 
+# layout of the records in a "spike_batch" message
+spike_record_dtype = np.dtype([('timestamp', '<i8'), ('channel', '<i4'), ('threshold', '<f4')])
+# and in a "spike_features" message
+spike_feature_record_dtype = np.dtype([('timestamp', '<i8'), ('electrode_id', '<i4'), ('basis_version', '<i4')])
+
+
+def event_topic(event_type, channel=None):
+    """subscription topic for the events of one type ('TTL', 'SPIKE', ...), optionally one channel (electrode for
+    spikes) only. Topics match by prefix, the final NUL keeps channel 3 from matching 31"""
+    if channel is None:
+        return 'EVENT/{0}/'.format(event_type).encode('utf-8')
+    return 'EVENT/{0}/{1}\0'.format(event_type, channel).encode('utf-8')
+
+
+def decode_latest(frame):
+    """splits a single frame from the "latest only" port (5558) into envelope, header dict and payload.
+    The payload starts at a multiple of 8 bytes, so np.frombuffer can use it in place"""
+    frame = memoryview(frame)
+    raw = frame[:65536].tobytes()  # envelope and header are short
+    e = raw.index(b'\0')
+    h = raw.index(b'\0', e + 1)
+    offset = (h + 1 + 7) & ~7
+    return raw[:e].decode('utf-8'), json.loads(raw[e + 1:h].decode('utf-8')), frame[offset:]
+
+
 class OpenEphysEvent(object):
     event_types = {0: 'TIMESTAMP', 1: 'BUFFER_SIZE', 2: 'PARAMETER_CHANGE',
                    3: 'TTL', 4: 'SPIKE', 5: 'MESSAGE', 6: 'BINARY_MSG'}
@@ -69,6 +94,7 @@ class PlotProcess(object):  # TODO more configuration stuff that may be obtained
         self.event_socket = None
         self.poller = zmq.Poller()
         self.message_no = -1
+        self.sequences = {}  # last "sequence" per topic, see missing_before
         self.socket_waits_reply = False
         self.event_no = 0
         self.app_name = 'Plot Process'
@@ -76,6 +102,9 @@ class PlotProcess(object):  # TODO more configuration stuff that may be obtained
         self.last_heartbeat_time = 0
         self.last_reply_time = time.time()
         self.isTesting = True
+        self.metadata = None
+        # envelope prefixes to subscribe to, e.g. [b'DATA', event_topic('TTL', 3)]. Everything by default
+        self.topics = [b'']
 
     def startup(self):
         pass
@@ -97,6 +126,37 @@ class PlotProcess(object):  # TODO more configuration stuff that may be obtained
     def update_plot_spike(self, spike):
         print(spike)
 
+    def update_plot_features(self, features, names):
+        """features: n_channels x n_features array, columns named as in names"""
+        pass
+
+    def update_plot_metadata(self, metadata):
+        """metadata: the content of the latest metadata message (channels, sources, schema_id)"""
+        pass
+
+    def update_plot_status(self, status):
+        """status: the content of the periodic status message (per stream throughput and added latency)"""
+        pass
+
+    def update_plot_sync(self, sync):
+        """sync: content of a SYNC message, the sample count of each source with the host clocks (ns)"""
+        pass
+
+    def update_plot_spike_features(self, spikes, features, content):
+        """spikes: record array (timestamp, electrode_id, basis_version), features: n_spikes x n_features array,
+        columns named in content['feature_names']. Projections with different basis versions are not comparable"""
+        pass
+
+    def update_plot_psth(self, counts, psth):
+        """counts: n_triggers x n_electrodes x n_bins spike counts since the start of acquisition, rows as in
+        psth['trigger_channels'] and psth['electrodes'], bins of psth['bin_ms'] from -psth['pre_ms'].
+        Divide by psth['trials'] (per trigger) and the bin width for rates"""
+        pass
+
+    def update_plot_spike_batch(self, spikes, snippets):
+        """spikes: record array (timestamp, channel, threshold), snippets: n_spikes x snippet_length array"""
+        pass
+
     def send_heartbeat(self):
         d = {'application': self.app_name, 'uuid': self.uuid, 'type': 'heartbeat'}
         j_msg = json.dumps(d)
@@ -127,6 +187,103 @@ class PlotProcess(object):  # TODO more configuration stuff that may be obtained
         else:
             print("can't send event, still waiting for previous reply")
 
+    def dispatch(self, header, message):
+        """decodes one message (header already parsed) and calls the matching update_plot_* hook"""
+        if header['type'] == 'data':
+            c = header['content']
+            n_samples = c['n_samples']
+            n_channels = c['n_channels']
+            n_real_samples = c['n_real_samples']
+
+            try:
+                if c.get('dtype') == 'int16':
+                    n_arr = np.frombuffer(message[2], dtype=np.int16).astype(np.float32) * c['scale']
+                else:
+                    n_arr = np.frombuffer(message[2], dtype=np.float32)
+                n_arr = np.reshape(n_arr, (n_channels, n_samples))
+                if n_real_samples > 0:
+                    n_arr = n_arr[:, 0:n_real_samples]
+                    self.update_plot(n_arr)
+            except IndexError as e:
+                print(e)
+                print(header)
+                print(message[1])
+                if len(message) > 2:
+                    print(len(message[2]))
+                else:
+                    print("only one frame???")
+
+        elif header['type'] == 'event':
+
+            if header['data_size'] > 0:
+                event = OpenEphysEvent(header['content'], message[2])
+            else:
+                event = OpenEphysEvent(header['content'])
+            self.update_plot_event(event)
+        elif header['type'] == 'spike':
+            spike = OpenEphysSpikeEvent(header['spike'], message[2])
+            self.update_plot_spike(spike)
+
+        elif header['type'] == 'features':
+            c = header['content']
+            f_arr = np.frombuffer(message[2], dtype=np.float32)
+            f_arr = np.reshape(f_arr, (c['n_channels'], c['n_features']))
+            self.update_plot_features(f_arr, c['features'])
+
+        elif header['type'] == 'spike_batch':
+            c = header['content']
+            n_spikes = c['n_spikes']
+            spikes = np.frombuffer(message[2], dtype=spike_record_dtype, count=n_spikes)
+            snippets = np.frombuffer(message[2], dtype=np.float32,
+                                     offset=n_spikes * spike_record_dtype.itemsize)
+            snippets = np.reshape(snippets, (n_spikes, c['snippet_length']))
+            self.update_plot_spike_batch(spikes, snippets)
+
+        elif header['type'] == 'spike_features':
+            c = header['content']
+            n_spikes = c['n_spikes']
+            spikes = np.frombuffer(message[2], dtype=spike_feature_record_dtype, count=n_spikes)
+            features = np.frombuffer(message[2], dtype=np.float32,
+                                     offset=n_spikes * spike_feature_record_dtype.itemsize)
+            features = np.reshape(features, (n_spikes, len(c['feature_names'])))
+            self.update_plot_spike_features(spikes, features, c)
+
+        elif header['type'] == 'psth':
+            c = header['content']
+            counts = np.frombuffer(message[2], dtype=np.uint32)
+            counts = np.reshape(counts, (len(c['trigger_channels']), len(c['electrodes']), c['n_bins']))
+            self.update_plot_psth(counts, c)
+
+        elif header['type'] == 'metadata':
+            self.metadata = header['content']
+            self.update_plot_metadata(self.metadata)
+
+        elif header['type'] == 'status':
+            self.update_plot_status(header['content'])
+
+        elif header['type'] == 'sync':
+            self.update_plot_sync(header['content'])
+
+        elif header['type'] == 'param':
+            c = header['content']
+            self.__dict__.update(c)
+            print(c)
+        else:
+            raise ValueError("message type unknown")
+
+    def missing_before(self, envelope, header):
+        """messages of the topic lost before this one, from the per stream "sequence" of DATA and SYNC (message_no
+        counts the messages of all the topics, also the ones not subscribed to). 0 after a restart"""
+        content = header.get('content')
+        sequence = content.get('sequence', -1) if isinstance(content, dict) else -1
+        if sequence < 0:
+            return 0
+        last = self.sequences.get(envelope)
+        self.sequences[envelope] = sequence
+        if last is None or sequence <= last:
+            return 0
+        return sequence - last - 1
+
     def callback(self):
         events = []
 
@@ -139,7 +296,8 @@ class PlotProcess(object):  # TODO more configuration stuff that may be obtained
             self.event_socket.connect("tcp://localhost:5557")
 
             # self.data_socket.connect("ipc://data.ipc")
-            self.data_socket.setsockopt(zmq.SUBSCRIBE, b'')
+            for t in self.topics:
+                self.data_socket.setsockopt(zmq.SUBSCRIBE, t)
             self.poller.register(self.data_socket, zmq.POLLIN)
             self.poller.register(self.event_socket, zmq.POLLIN)
 
@@ -185,47 +343,11 @@ class PlotProcess(object):  # TODO more configuration stuff that may be obtained
                     except ValueError as e:
                         print("ValueError: ", e)
                         print(message[1])
-                    if self.message_no != -1 and header['message_no'] != self.message_no + 1:
-                        print("missing a message at number", self.message_no)
+                    missing = self.missing_before(message[0], header)
+                    if missing:
+                        print("missing a message: {0} on {1}".format(missing, message[0].rstrip(b'\0').decode('utf-8')))
                     self.message_no = header['message_no']
-                    if header['type'] == 'data':
-                        c = header['content']
-                        n_samples = c['n_samples']
-                        n_channels = c['n_channels']
-                        n_real_samples = c['n_real_samples']
-
-                        try:
-                            n_arr = np.frombuffer(message[2], dtype=np.float32)
-                            n_arr = np.reshape(n_arr, (n_channels, n_samples))
-                            if n_real_samples > 0:
-                                n_arr = n_arr[:, 0:n_real_samples]
-                                self.update_plot(n_arr)
-                        except IndexError as e:
-                            print(e)
-                            print(header)
-                            print(message[1])
-                            if len(message) > 2:
-                                print(len(message[2]))
-                            else:
-                                print("only one frame???")
-
-                    elif header['type'] == 'event':
-
-                        if header['data_size'] > 0:
-                            event = OpenEphysEvent(header['content'], message[2])
-                        else:
-                            event = OpenEphysEvent(header['content'])
-                        self.update_plot_event(event)
-                    elif header['type'] == 'spike':
-                        spike = OpenEphysSpikeEvent(header['spike'], message[2])
-                        self.update_plot_spike(spike)
-
-                    elif header['type'] == 'param':
-                        c = header['content']
-                        self.__dict__.update(c)
-                        print(c)
-                    else:
-                        raise ValueError("message type unknown")
+                    self.dispatch(header, message)
                 else:
                     print("got not data")
 
@@ -0,0 +1,68 @@
+import json
+import struct
+import zmq
+import numpy as np
+
+__author__ = 'fpbatta'
+
+# Client of the credit based port (5559). Nothing is lost silently: every message
+# carries a sequence number of this client, and whatever didn't fit in the plugin
+# queue is announced by an "overrun" message with the range of numbers lost.
+
+
+class ReliableClient(object):
+    def __init__(self, host='localhost', port=5559, topics=('DATA',), window=256):
+        self.context = zmq.Context.instance()
+        self.socket = self.context.socket(zmq.DEALER)
+        self.socket.connect("tcp://{0}:{1}".format(host, port))
+        self.window = window
+        self.outstanding = window
+        self.sequence = 0
+        self.missing = []  # (first, last) sequence ranges reported lost
+        self._send({'type': 'hello', 'topics': list(topics), 'credits': window})
+
+    def _send(self, d):
+        self.socket.send(json.dumps(d).encode('utf-8'))
+
+    def next_message(self, timeout_ms=1000):
+        """returns (envelope, header dict, payload bytes) or None. Credits are given back
+        as messages are taken, half a window at a time"""
+        if not self.socket.poll(timeout_ms):
+            return None
+        frames = self.socket.recv_multipart()
+        sequence = struct.unpack('<Q', frames[0])[0]
+        envelope = frames[1].rstrip(b'\0').decode('utf-8')
+        header = json.loads(frames[2].decode('utf-8'))
+        payload = frames[3] if len(frames) > 3 else b''
+
+        if header['type'] == 'overrun':
+            c = header['content']
+            self.missing.append((c['first_sequence'], c['last_sequence']))
+            return envelope, header, payload
+
+        if sequence != self.sequence + 1:
+            # only expected right after an overrun, otherwise it's a bug
+            reported = any(first <= self.sequence + 1 <= last for first, last in self.missing)
+            if not reported:
+                raise IOError("unreported gap before sequence {0}".format(sequence))
+        self.sequence = sequence
+
+        self.outstanding -= 1
+        if self.outstanding <= self.window // 2:
+            self._send({'type': 'credit', 'credits': self.window - self.outstanding})
+            self.outstanding = self.window
+        return envelope, header, payload
+
+    def keepalive(self):
+        """to be called at least every reliable_timeout seconds when not consuming"""
+        self._send({'type': 'credit', 'credits': 0})
+
+    def close(self):
+        self._send({'type': 'bye'})
+        self.socket.close(linger=100)
+
+
+def data_block(header, payload):
+    """n_channels x n_samples view of a data message"""
+    c = header['content']
+    return np.frombuffer(payload, dtype=np.float32).reshape((c['n_channels'], c['n_samples']))
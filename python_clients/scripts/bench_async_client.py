@@ -0,0 +1,143 @@
+import argparse
+import contextlib
+import io
+import json
+import multiprocessing as mp
+import os
+import sys
+import time
+
+import numpy as np
+import zmq
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from ZMQPlugins.plot_process_zmq import PlotProcess
+from ZMQPlugins.async_client import AsyncPlotProcess
+
+__author__ = 'fpbatta'
+
+# Throughput of the Python receive paths. A separate process publishes DATA messages in the format of the
+# plugin (envelope, header, n_channels x n_samples frame) as fast as it can, or at --rate MB/s, on the data
+# port. Each client then runs its callback() for --seconds; the PUB socket drops what a slow client doesn't take,
+# so the MB/s received is what the client sustains and the gaps show what it lost.
+#
+#   python scripts/bench_async_client.py --channels 64 --samples 1024 --seconds 5
+#
+# The legacy client (PlotProcess) always connects to port 5556, which must be free.
+
+
+def publish(port, channels, samples, dtype, rate, seconds, ready):
+    context = zmq.Context()
+    socket = context.socket(zmq.PUB)
+    socket.setsockopt(zmq.SNDHWM, 1000)
+    socket.bind("tcp://127.0.0.1:{0}".format(port))
+    envelope = b'DATA/100/30000\0'
+    content = {'n_channels': channels, 'n_samples': samples, 'n_real_samples': samples, 'timestamp': 0,
+               'sequence': 0, 'n_blocks': 1, 'source_node_id': 100, 'sample_rate': 30000.}
+    if dtype == 'int16':
+        content.update(dtype='int16', scale=0.195)
+        data = (np.random.standard_normal((channels, samples)) * 100).astype(np.int16).tobytes()
+    else:
+        data = np.random.standard_normal((channels, samples)).astype(np.float32).tobytes()
+    header = {'message_no': 0, 'type': 'data', 'content': content, 'data_size': len(data), 'schema_id': 1}
+    # only the numbers change, as in the plans of the plugin
+    template = json.dumps(header).replace('"message_no": 0', '"message_no": %d').replace(
+        '"timestamp": 0', '"timestamp": %d').replace('"sequence": 0', '"sequence": %d').encode('utf-8')
+    interval = len(data) / (rate * 1e6) if rate else 0.
+    ready.set()
+
+    n = 0
+    start = time.time()
+    while time.time() - start < seconds:
+        socket.send(envelope, zmq.SNDMORE)
+        socket.send(template % (n, n * samples, n), zmq.SNDMORE)
+        socket.send(data, copy=False)
+        n += 1
+        if interval:
+            wait = start + n * interval - time.time()
+            if wait > 0:
+                time.sleep(wait)
+    socket.close(linger=0)
+    context.term()
+
+
+class LegacyCounter(PlotProcess):
+    def __init__(self, sample_size):
+        super(LegacyCounter, self).__init__()
+        self.isTesting = False
+        self.last_heartbeat_time = float('inf')  # no listen socket here
+        self.sample_size = sample_size  # as sent, int16 blocks arrive converted
+        self.blocks = 0
+        self.bytes = 0
+        self.first = None
+
+    def update_plot(self, n_arr):
+        if self.first is None:
+            self.first = time.time()
+        self.blocks += 1
+        self.bytes += n_arr.size * self.sample_size
+
+
+class AsyncCounter(AsyncPlotProcess):
+    def __init__(self, port):
+        super(AsyncCounter, self).__init__(data_port=port)
+        self.isTesting = False
+        self.last_heartbeat_time = float('inf')
+        self.first = None
+
+    def update_plot_ring(self, topic, ring, n_new):
+        if self.first is None:
+            self.first = time.time()
+
+
+def run(name, args):
+    ready = mp.Event()
+    port = 5556 if name == 'legacy' else args.port
+    publisher = mp.Process(target=publish, args=(port, args.channels, args.samples, args.dtype, args.rate,
+                                                 args.seconds + 1., ready))
+    publisher.start()
+    ready.wait()
+
+    if name == 'legacy':
+        client = LegacyCounter(2 if args.dtype == 'int16' else 4)
+    else:
+        client = AsyncCounter(port)
+    # the legacy client prints every gap
+    log = io.StringIO()
+    end = time.time() + args.seconds + 0.5
+    with contextlib.redirect_stdout(log):
+        while time.time() < end:
+            client.callback()
+    stop = time.time()
+    publisher.join()
+
+    if name == 'legacy':
+        blocks, received = client.blocks, client.bytes
+        gaps = '{0} gaps,'.format(log.getvalue().count('missing a message'))
+    else:
+        s = client.stats
+        blocks, received = s['blocks'], s['bytes']
+        gaps = '{0} messages'.format(s['missing_messages'])
+        print("  {0} wakeups, {1:.1f} messages per wakeup".format(s['wakeups'], s['messages'] / max(1, s['wakeups'])))
+    elapsed = stop - client.first if client.first else 0.
+    if elapsed <= 0.:
+        print("{0}: nothing received".format(name))
+        return
+    print("{0}: {1:.1f} MB/s, {2:.0f} blocks/s, {3} lost".format(
+        name, received / elapsed / 1e6, blocks / elapsed, gaps))
+    client.data_socket.close(linger=0)
+    client.event_socket.close(linger=0)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description="sustained throughput of the Python clients")
+    parser.add_argument('--channels', type=int, default=64)
+    parser.add_argument('--samples', type=int, default=1024, help="samples per block")
+    parser.add_argument('--dtype', choices=('float32', 'int16'), default='float32')
+    parser.add_argument('--rate', type=float, default=0., help="MB/s published, 0 for as fast as possible")
+    parser.add_argument('--seconds', type=float, default=5.)
+    parser.add_argument('--port', type=int, default=5560, help="data port for the async client")
+    parser.add_argument('--client', choices=('async', 'legacy', 'both'), default='both')
+    args = parser.parse_args()
+    for c in (('legacy', 'async') if args.client == 'both' else (args.client,)):
+        run(c, args)
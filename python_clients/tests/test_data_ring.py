@@ -0,0 +1,131 @@
+import json
+import os
+import sys
+import unittest
+
+import numpy as np
+
+os.environ.setdefault('MPLBACKEND', 'Agg')
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from ZMQPlugins.async_client import DataRing, AsyncPlotProcess  # noqa: E402
+
+# run with python -m unittest discover python_clients/tests
+
+
+def block(n_channels, first, n):
+    """samples first .. first + n - 1, channel c offset by 1000 c"""
+    return (np.arange(first, first + n, dtype=np.float32)[None, :] +
+            1000. * np.arange(n_channels, dtype=np.float32)[:, None])
+
+
+class TestDataRing(unittest.TestCase):
+    def test_wraps_around(self):
+        ring = DataRing(2, 10)
+        ring.append(block(2, 0, 7))
+        self.assertEqual(len(ring.segments(7)), 1)
+        np.testing.assert_array_equal(ring.last(7), block(2, 0, 7))
+        ring.append(block(2, 7, 6))
+        self.assertEqual(ring.written, 13)
+        # the newest 10 are in two pieces, oldest first
+        s = ring.segments(10)
+        self.assertEqual([x.shape[1] for x in s], [7, 3])
+        np.testing.assert_array_equal(ring.last(10), block(2, 3, 10))
+        np.testing.assert_array_equal(ring.last(2), block(2, 11, 2))
+        # no more than there is
+        self.assertEqual(ring.last(50).shape, (2, 10))
+
+    def test_views_not_copies(self):
+        ring = DataRing(1, 8)
+        ring.append(block(1, 0, 5))
+        self.assertTrue(np.shares_memory(ring.segments(5)[0], ring.buffer))
+
+    def test_block_longer_than_ring(self):
+        ring = DataRing(3, 8)
+        ring.append(block(3, 0, 3))
+        ring.append(block(3, 3, 20))
+        self.assertEqual(ring.written, 23)
+        np.testing.assert_array_equal(ring.last(8), block(3, 15, 8))
+
+    def test_int16_scaled(self):
+        ring = DataRing(2, 16)
+        raw = np.array([[-32768, -1, 0, 1, 32767], [100, 200, 300, 400, 500]], dtype=np.int16)
+        ring.append(raw, np.float32(0.195))
+        self.assertEqual(ring.buffer.dtype, np.float32)
+        np.testing.assert_allclose(ring.last(5), raw.astype(np.float32) * np.float32(0.195), rtol=1e-6)
+
+
+class Frame(object):
+    """stands in for the zmq.Frame of a message received with copy=False"""
+    def __init__(self, data):
+        self.bytes = data
+        self.buffer = memoryview(data)
+
+
+class RecordingProcess(AsyncPlotProcess):
+    def __init__(self):
+        super(RecordingProcess, self).__init__(ring_seconds=1.)
+        self.updates = []
+
+    def update_plot_ring(self, topic, ring, n_new):
+        self.updates.append((topic, n_new))
+
+
+def data_message(sequence, timestamp, samples, int16_scale=None, n_real=None):
+    """a DATA message of the plugin (or of zmq_relay with int16=SCALE), samples n_channels x n_samples"""
+    n_channels, n_samples = samples.shape
+    content = {'n_channels': n_channels, 'n_samples': n_samples,
+               'n_real_samples': n_samples if n_real is None else n_real, 'sample_rate': 100,
+               'timestamp': timestamp, 'sequence': sequence}
+    if int16_scale is None:
+        payload = samples.astype(np.float32).tobytes()
+    else:
+        content['dtype'] = 'int16'
+        content['scale'] = int16_scale
+        payload = np.round(samples / int16_scale).astype(np.int16).tobytes()
+    header = {'message_no': sequence, 'type': 'data', 'content': content, 'data_size': len(payload)}
+    return [Frame(b'DATA/100/100\0'), Frame(json.dumps(header).encode('utf-8')), Frame(payload)]
+
+
+class TestProcessMessages(unittest.TestCase):
+    def setUp(self):
+        self.p = RecordingProcess()
+
+    def tearDown(self):
+        self.p.context.term()
+
+    def test_blocks_into_rings(self):
+        p = self.p
+        messages = [data_message(i, 30 * i, block(2, 30 * i, 30)) for i in range(3)]
+        # zero padding after the real samples is left out
+        messages.append(data_message(3, 90, np.hstack([block(2, 90, 20), np.zeros((2, 10))]), n_real=20))
+        p.process_messages(messages)
+        ring = p.rings['DATA/100/100']
+        self.assertEqual(ring.capacity, 100)
+        self.assertEqual(ring.written, 110)
+        self.assertEqual(p.updates, [('DATA/100/100', 100)])
+        np.testing.assert_array_equal(ring.last(100), block(2, 10, 100))
+        self.assertEqual(ring.sequence, 3)
+        self.assertEqual(p.stats['gaps'], 0)
+        self.assertEqual(p.stats['missing_messages'], 0)
+
+    def test_int16_and_gaps(self):
+        p = self.p
+        samples = block(2, 0, 10) * 0.25
+        p.process_messages([data_message(0, 0, samples, int16_scale=0.25),
+                            data_message(3, 40, samples, int16_scale=0.25)])
+        ring = p.rings['DATA/100/100']
+        np.testing.assert_allclose(ring.last(10), samples, rtol=1e-6)
+        self.assertEqual(p.stats['gaps'], 1)
+        self.assertEqual(p.stats['missing_messages'], 2)
+        self.assertEqual(ring.timestamp, 40)
+
+    def test_malformed(self):
+        p = self.p
+        p.process_messages([[Frame(b'DATA/100/100\0'), Frame(b'{not json')],
+                            data_message(0, 0, block(1, 0, 5))])
+        self.assertEqual(p.stats['malformed'], 1)
+        self.assertEqual(p.rings['DATA/100/100'].written, 5)
+
+
+if __name__ == '__main__':
+    unittest.main()
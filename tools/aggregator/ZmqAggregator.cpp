@@ -0,0 +1,484 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqAggregator.cpp
+    Merges the data sockets of several ZMQ Interface plugins (one per rig)
+    into a single time ordered stream.
+
+    The sample numbers of every rig are mapped to wall clock time with the
+    line fitted on its SYNC messages (see ClockFit.h), so the rigs must keep
+    their clocks in sync (NTP or PTP). Until a rig has sent two SYNC messages
+    its messages are timed by their arrival here.
+
+    Messages wait in a reorder buffer until they are --window ms old, or
+    until the buffer holds --max-messages, and go out in time order:
+    envelope    "<rig>/" + the original envelope, e.g. "rig1/DATA/100/30000"
+    header      the original one, with message_no renumbered for the merged
+                stream and "aggregate": {"source", "source_message_no",
+                "time_ns", "synced"}
+    data        the original frames, not copied
+    A message arriving after messages of a later time went out is sent
+    right away and counted as late.
+
+  ==============================================================================
+*/
+
+#include <zmq.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include "../common/JsonLite.h"
+#include "../common/MultipartMessage.h"
+#include "../common/ClockFit.h"
+#include "../common/SequenceTracker.h"
+
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void handleSignal(int)
+{
+    stopRequested = 1;
+}
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t realtimeNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+//=============================================================================
+class ZmqAggregator
+{
+public:
+    struct SourceOptions {
+        std::string name;
+        std::string endpoint;
+    };
+
+    struct Options {
+        std::vector<SourceOptions> sources;
+        std::vector<std::string> topics; // empty for all
+        std::string output = "tcp://*:5566";
+        double windowMs = 200.;
+        int maxMessages = 100000;
+        double reportInterval = 2.;
+    };
+
+    ZmqAggregator(const Options &o) : options(o) {}
+
+    ~ZmqAggregator()
+    {
+        for(std::multimap<Key, Pending *>::iterator it = buffer.begin(); it != buffer.end(); ++it)
+            delete it->second;
+        for(size_t i = 0; i < sources.size(); i++)
+        {
+            if(sources[i]->socket) zmq_close(sources[i]->socket);
+            delete sources[i];
+        }
+        if(output) zmq_close(output);
+        if(context) zmq_ctx_destroy(context);
+    }
+
+    int run()
+    {
+        context = zmq_ctx_new();
+        int linger = 0;
+
+        output = zmq_socket(context, ZMQ_XPUB);
+        int verbose = 1;
+        zmq_setsockopt(output, ZMQ_XPUB_VERBOSE, &verbose, sizeof(verbose));
+        zmq_setsockopt(output, ZMQ_LINGER, &linger, sizeof(linger));
+        if(zmq_bind(output, options.output.c_str()) != 0)
+        {
+            std::cout << "couldn't bind " << options.output << ": " << zmq_strerror(zmq_errno()) << std::endl;
+            return 1;
+        }
+
+        for(size_t i = 0; i < options.sources.size(); i++)
+        {
+            Source *s = new Source;
+            s->name = options.sources[i].name;
+            s->endpoint = options.sources[i].endpoint;
+            s->socket = zmq_socket(context, ZMQ_SUB);
+            sources.push_back(s);
+            int hwm = 100000;
+            zmq_setsockopt(s->socket, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+            zmq_setsockopt(s->socket, ZMQ_LINGER, &linger, sizeof(linger));
+            if(options.topics.empty())
+                zmq_setsockopt(s->socket, ZMQ_SUBSCRIBE, "", 0);
+            for(size_t j = 0; j < options.topics.size(); j++)
+                zmq_setsockopt(s->socket, ZMQ_SUBSCRIBE, options.topics[j].data(), options.topics[j].size());
+            // needed here whatever the topics
+            zmq_setsockopt(s->socket, ZMQ_SUBSCRIBE, "SYNC", 4);
+            zmq_setsockopt(s->socket, ZMQ_SUBSCRIBE, "METADATA", 8);
+            if(zmq_connect(s->socket, s->endpoint.c_str()) != 0)
+            {
+                std::cout << "couldn't connect to " << s->endpoint << ": " << zmq_strerror(zmq_errno()) << std::endl;
+                return 1;
+            }
+            std::cout << "source " << s->name << ": " << s->endpoint << std::endl;
+        }
+        std::cout << "merged stream on " << options.output << ", reorder window "
+                  << options.windowMs << " ms" << std::endl;
+
+        std::vector<zmq_pollitem_t> items(sources.size() + 1);
+        for(size_t i = 0; i < sources.size(); i++)
+        {
+            items[i].socket = sources[i]->socket;
+            items[i].events = ZMQ_POLLIN;
+        }
+        items[sources.size()].socket = output;
+        items[sources.size()].events = ZMQ_POLLIN;
+
+        double lastReport = now();
+        while(!stopRequested)
+        {
+            // wake up often enough to release the messages on time
+            zmq_poll(&items[0], (int)items.size(), std::max(1, (int)(options.windowMs / 10.)));
+            for(size_t i = 0; i < sources.size(); i++)
+            {
+                while(true)
+                {
+                    Pending *p = new Pending;
+                    if(!p->message.recv(sources[i]->socket, ZMQ_DONTWAIT))
+                    {
+                        delete p;
+                        break;
+                    }
+                    receive(i, p);
+                }
+            }
+            if(items[sources.size()].revents & ZMQ_POLLIN)
+                handleSubscriptions();
+            release(realtimeNs() - (int64_t)(options.windowMs * 1e6));
+
+            double t = now();
+            if(t - lastReport >= options.reportInterval)
+            {
+                report();
+                lastReport = t;
+            }
+        }
+
+        release(INT64_MAX);
+        std::cout << "stopped. " << messageNo << " messages merged, " << late << " late, "
+                  << forced << " released early (buffer full)" << std::endl;
+        return 0;
+    }
+
+private:
+    struct Source {
+        std::string name;
+        std::string endpoint;
+        void *socket = 0;
+        ClockSet clocks;
+        MultipartMessage metadata; // latest, for the late subscribers
+        SequenceTracker sequences; // per topic, see -t
+        int64_t messages = 0, missing = 0, late = 0;
+        int64_t newestNs = 0; // time of the newest message
+        double lagSum = 0., lagMax = 0.; // arrival - time, ms, since the last report
+        int64_t lagCount = 0;
+    };
+
+    struct Pending {
+        MultipartMessage message;
+        JsonLite::Value header;
+        size_t source;
+        int64_t timeNs;
+        bool synced;
+    };
+
+    // time, then arrival order
+    typedef std::pair<int64_t, uint64_t> Key;
+
+    /** Time of a sample number of the source, on its fitted clock */
+    bool sampleTime(Source &s, const std::string &topic, int64_t sample, int64_t arrivalNs, int64_t &t)
+    {
+        const ClockFit *fit = s.clocks.find(topic);
+        if(!fit || !fit->isValid())
+            fit = s.clocks.find(std::string());
+        if(!fit || !fit->isValid() || sample < 0)
+        {
+            t = arrivalNs;
+            return false;
+        }
+        t = fit->toRealtimeNs(sample);
+        return true;
+    }
+
+    void receive(size_t index, Pending *p)
+    {
+        Source &s = *sources[index];
+        int64_t arrivalNs = realtimeNs();
+        if(!p->message.parseHeader(p->header))
+        {
+            delete p;
+            return;
+        }
+        s.messages++;
+        const JsonLite::Value &h = p->header;
+        const std::string &type = h["type"].asString();
+        s.missing += s.sequences.check(p->message.getEnvelope(), h);
+
+        // the sample number that tells the time of the message
+        int64_t sample = -1;
+        std::string topic;
+        if(type == "data")
+        {
+            sample = h["content"]["timestamp"].asInt(-1);
+            topic = p->message.getEnvelope();
+        }
+        else if(type == "event")
+        {
+            // sample_num is the offset in the block that starts at timestamp
+            const JsonLite::Value &c = h["content"];
+            int64_t blockStart = c["timestamp"].asInt(-1);
+            if(blockStart >= 0)
+                sample = blockStart + c["sample_num"].asInt(0);
+        }
+        else if(type == "spike")
+            sample = h["spike"]["timestamp"].asInt(-1);
+        else if(type == "spike_batch" || type == "features")
+            sample = h["content"]["timestamp"].asInt(-1);
+        else if(type == "sync")
+            s.clocks.addSync(h);
+        else if(type == "metadata")
+            s.metadata.copyFrom(p->message);
+
+        p->source = index;
+        p->synced = sampleTime(s, topic, sample, arrivalNs, p->timeNs);
+        if(p->synced)
+        {
+            double lag = (arrivalNs - p->timeNs) / 1e6;
+            s.lagSum += lag;
+            s.lagMax = s.lagCount ? std::max(s.lagMax, lag) : lag;
+            s.lagCount++;
+        }
+        s.newestNs = std::max(s.newestNs, p->timeNs);
+
+        if(p->timeNs < lastReleasedNs)
+        {
+            // its turn is over, better late than never
+            late++;
+            s.late++;
+            send(p);
+            return;
+        }
+        buffer.insert(std::make_pair(Key(p->timeNs, order++), p));
+        while((int)buffer.size() > options.maxMessages)
+        {
+            forced++;
+            releaseFirst();
+        }
+    }
+
+    void release(int64_t untilNs)
+    {
+        while(!buffer.empty() && buffer.begin()->first.first <= untilNs)
+            releaseFirst();
+    }
+
+    void releaseFirst()
+    {
+        Pending *p = buffer.begin()->second;
+        buffer.erase(buffer.begin());
+        lastReleasedNs = std::max(lastReleasedNs, p->timeNs);
+        send(p);
+    }
+
+    /** Sends p with the envelope and header of the merged stream, and deletes it */
+    void send(Pending *p)
+    {
+        Source &s = *sources[p->source];
+        JsonLite::Value &h = p->header;
+        int64_t sourceMessageNo = h["message_no"].asInt(-1);
+        if(sourceMessageNo >= 0)
+            h.member("message_no") = JsonLite::Value(messageNo++);
+        JsonLite::Value &a = h.member("aggregate");
+        a.member("source") = JsonLite::Value(s.name);
+        a.member("source_message_no") = JsonLite::Value(sourceMessageNo);
+        a.member("time_ns") = JsonLite::Value(p->timeNs);
+        a.member("synced") = JsonLite::Value((int64_t)(p->synced ? 1 : 0));
+
+        MultipartMessage out;
+        buildMessage(s, p->message, h.toString(), out);
+        out.send(output, ZMQ_DONTWAIT);
+        delete p;
+    }
+
+    void buildMessage(Source &s, MultipartMessage &in, const std::string &header, MultipartMessage &out)
+    {
+        std::string envelope = s.name + "/";
+        envelope.append((const char *)in.getData(0), in.getSize(0));
+        out.addPart(envelope.data(), envelope.size());
+        out.addPart(header.data(), header.size());
+        for(size_t i = 2; i < in.getNumParts(); i++)
+            out.addPartFrom(in, i);
+    }
+
+    /** The latched metadata of every rig for the new subscribers, as the plugin does */
+    void handleSubscriptions()
+    {
+        char buffer[256];
+        while(true)
+        {
+            int size = zmq_recv(output, buffer, sizeof(buffer), ZMQ_DONTWAIT);
+            if(size < 1)
+                break;
+            if(buffer[0] != 1)
+                continue;
+            std::string topic(buffer + 1, std::min(size, (int)sizeof(buffer)) - 1);
+            for(size_t i = 0; i < sources.size(); i++)
+            {
+                Source &s = *sources[i];
+                if(s.metadata.getNumParts() < 2 || (s.name + "/METADATA").compare(0, topic.size(), topic) != 0)
+                    continue;
+                MultipartMessage out;
+                buildMessage(s, s.metadata, std::string((const char *)s.metadata.getData(1),
+                                                         s.metadata.getSize(1)), out);
+                out.send(output, ZMQ_DONTWAIT);
+            }
+        }
+    }
+
+    void report()
+    {
+        int64_t newest = 0;
+        for(size_t i = 0; i < sources.size(); i++)
+            newest = std::max(newest, sources[i]->newestNs);
+        std::cout << messageNo << " messages merged, " << buffer.size() << " buffered, "
+                  << late << " late, " << forced << " released early" << std::endl;
+        for(size_t i = 0; i < sources.size(); i++)
+        {
+            Source &s = *sources[i];
+            const ClockFit *fit = s.clocks.find(std::string());
+            std::cout << "  " << s.name << ": " << s.messages << " messages, " << s.missing << " missing, "
+                      << s.late << " late";
+            if(fit && fit->isValid())
+            {
+                // skew: how far the newest message is behind the newest of all rigs
+                std::cout << ", lag " << (s.lagCount ? s.lagSum / s.lagCount : 0.) << " ms (max "
+                          << s.lagMax << "), skew " << (s.newestNs - newest) / 1e6 << " ms, rate "
+                          << 1e9 / fit->nsPerSample << " Hz, sync residual " << fit->residualNs / 1e3 << " us";
+            }
+            else
+                std::cout << ", no clock yet (SYNC)";
+            std::cout << std::endl;
+            s.lagSum = 0.;
+            s.lagMax = 0.;
+            s.lagCount = 0;
+        }
+    }
+
+    Options options;
+    void *context = 0;
+    void *output = 0;
+    std::vector<Source *> sources;
+
+    std::multimap<Key, Pending *> buffer;
+    uint64_t order = 0;
+    int64_t lastReleasedNs = INT64_MIN;
+    int64_t messageNo = 0;
+    int64_t late = 0;
+    int64_t forced = 0;
+};
+
+
+static void usage()
+{
+    std::cout << "usage: zmq_aggregator [options] -s NAME=URL -s NAME=URL ...\n"
+              << "  -s, --source NAME=URL  data socket of a rig, e.g. rig1=tcp://rig1:5556\n"
+              << "  -o, --output URL       merged stream (tcp://*:5566)\n"
+              << "  -t, --topic PREFIX     topic to take from the rigs, can be repeated (all)\n"
+              << "  -w, --window MS        reorder window (200)\n"
+              << "  -m, --max-messages N   reorder buffer size (100000)\n"
+              << "  -r, --report SECONDS   skew and lag report interval (2)\n";
+}
+
+int main(int argc, char **argv)
+{
+    ZmqAggregator::Options options;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if((a == "-s" || a == "--source") && hasValue)
+        {
+            std::string v = argv[++i];
+            ZmqAggregator::SourceOptions s;
+            size_t eq = v.find('=');
+            if(eq != std::string::npos && v.compare(0, 6, "tcp://") != 0)
+            {
+                s.name = v.substr(0, eq);
+                s.endpoint = v.substr(eq + 1);
+            }
+            else
+            {
+                s.name = "rig" + std::to_string(options.sources.size() + 1);
+                s.endpoint = v;
+            }
+            options.sources.push_back(s);
+        }
+        else if((a == "-o" || a == "--output") && hasValue)
+            options.output = argv[++i];
+        else if((a == "-t" || a == "--topic") && hasValue)
+            options.topics.push_back(argv[++i]);
+        else if((a == "-w" || a == "--window") && hasValue)
+            options.windowMs = atof(argv[++i]);
+        else if((a == "-m" || a == "--max-messages") && hasValue)
+            options.maxMessages = std::max(1, atoi(argv[++i]));
+        else if((a == "-r" || a == "--report") && hasValue)
+            options.reportInterval = atof(argv[++i]);
+        else
+        {
+            usage();
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+    if(options.sources.empty())
+    {
+        usage();
+        return 1;
+    }
+
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+
+    ZmqAggregator aggregator(options);
+    return aggregator.run();
+}
@@ -0,0 +1,483 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqClient.cpp
+
+  ==============================================================================
+*/
+
+#include <zmq.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <random>
+#include <chrono>
+#include "ZmqClient.h"
+
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string makeUuid()
+{
+    std::random_device rd;
+    std::mt19937_64 gen(rd());
+    char s[40];
+    uint64_t a = gen(), b = gen();
+    snprintf(s, sizeof(s), "%08x-%04x-4%03x-%04x-%012llx",
+             (unsigned)(a >> 32), (unsigned)(a >> 16) & 0xffff, (unsigned)a & 0xfff,
+             ((unsigned)(b >> 48) & 0x3fff) | 0x8000, (unsigned long long)(b & 0xffffffffffffULL));
+    return s;
+}
+
+static std::string escapeJson(const std::string &s)
+{
+    std::string r;
+    for(size_t i = 0; i < s.size(); i++)
+    {
+        if(s[i] == '"' || s[i] == '\\')
+            r += '\\';
+        r += s[i];
+    }
+    return r;
+}
+
+
+ZmqClient::ZmqClient(const Options &o) : options(o), running(false)
+{
+    if(options.uuid.empty())
+        options.uuid = makeUuid();
+    for(int i = 0; i < options.ringBlocks; i++)
+        blockRing.push_back(new BlockSlot);
+    for(int i = 0; i < options.ringMessages; i++)
+        messageRing.push_back(new MessageSlot);
+    memset(&stats, 0, sizeof(stats));
+}
+
+ZmqClient::~ZmqClient()
+{
+    stop();
+    for(size_t i = 0; i < blockRing.size(); i++)
+        delete blockRing[i];
+    for(size_t i = 0; i < messageRing.size(); i++)
+        delete messageRing[i];
+}
+
+bool ZmqClient::start()
+{
+    if(running)
+        return true;
+    context = zmq_ctx_new();
+    dataSocket = zmq_socket(context, ZMQ_SUB);
+    int hwm = 100000;
+    zmq_setsockopt(dataSocket, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+    if(options.topics.empty())
+        zmq_setsockopt(dataSocket, ZMQ_SUBSCRIBE, "", 0);
+    for(size_t i = 0; i < options.topics.size(); i++)
+        zmq_setsockopt(dataSocket, ZMQ_SUBSCRIBE, options.topics[i].data(), options.topics[i].size());
+    std::string url = "tcp://" + options.host + ":" + std::to_string(options.dataPort);
+    if(zmq_connect(dataSocket, url.c_str()) != 0)
+    {
+        std::cout << "couldn't connect to " << url << ": " << zmq_strerror(zmq_errno()) << std::endl;
+        zmq_close(dataSocket);
+        zmq_ctx_destroy(context);
+        dataSocket = context = 0;
+        return false;
+    }
+    openEventSocket();
+
+    running = true;
+    thread = std::thread(&ZmqClient::run, this);
+    return true;
+}
+
+void ZmqClient::stop()
+{
+    if(!running)
+        return;
+    running = false;
+    thread.join();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for(size_t i = 0; i < blockRing.size(); i++)
+            blockRing[i]->message.clear();
+        for(size_t i = 0; i < messageRing.size(); i++)
+            messageRing[i]->message.clear();
+    }
+    zmq_close(dataSocket);
+    zmq_close(eventSocket);
+    zmq_ctx_destroy(context);
+    dataSocket = eventSocket = context = 0;
+}
+
+void ZmqClient::openEventSocket()
+{
+    if(eventSocket)
+        zmq_close(eventSocket);
+    // a DEALER, so that events don't wait for the reply to the previous request
+    eventSocket = zmq_socket(context, ZMQ_DEALER);
+    int linger = 0;
+    zmq_setsockopt(eventSocket, ZMQ_LINGER, &linger, sizeof(linger));
+    std::string url = "tcp://" + options.host + ":" + std::to_string(options.listenPort);
+    zmq_connect(eventSocket, url.c_str());
+    outstandingReplies = 0;
+}
+
+void ZmqClient::sendRequest(const std::string &json)
+{
+    zmq_send(eventSocket, "", 0, ZMQ_SNDMORE | ZMQ_DONTWAIT);
+    zmq_send(eventSocket, json.data(), json.size(), ZMQ_DONTWAIT);
+    if(outstandingReplies == 0)
+        lastReply = now(); // the timeout counts from the first unanswered request
+    outstandingReplies++;
+}
+
+void ZmqClient::sendEvent(int eventType, int64_t sampleNum, int eventId, int eventChannel)
+{
+    char e[256];
+    snprintf(e, sizeof(e), "\"event\": {\"type\": %d, \"sample_num\": %lld, \"event_id\": %d, \"event_channel\": %d}",
+             eventType, (long long)sampleNum, eventId, eventChannel);
+    std::string json = "{\"application\": \"" + escapeJson(options.appName) + "\", \"uuid\": \"" +
+        options.uuid + "\", \"type\": \"event\", " + e + "}";
+    std::unique_lock<std::mutex> lock(mutex);
+    pendingRequests.push_back(json);
+}
+
+void ZmqClient::serviceEventSocket(double t)
+{
+    // replies
+    MultipartMessage reply;
+    while(reply.recv(eventSocket, ZMQ_DONTWAIT))
+    {
+        if(outstandingReplies > 0)
+            outstandingReplies--;
+        lastReply = t;
+        std::unique_lock<std::mutex> lock(statsMutex);
+        stats.replies_received++;
+        stats.server_alive = 1;
+    }
+
+    // lazy pirate: no answer for too long, start over with a new socket
+    if(outstandingReplies > 0 && t - lastReply > options.serverTimeout)
+    {
+        std::cout << "no reply from the plugin, reconnecting" << std::endl;
+        openEventSocket();
+        lastReply = t;
+        std::unique_lock<std::mutex> lock(statsMutex);
+        stats.server_alive = 0;
+    }
+
+    if(t - lastHeartbeat >= options.heartbeatInterval)
+    {
+        sendRequest("{\"application\": \"" + escapeJson(options.appName) + "\", \"uuid\": \"" +
+                    options.uuid + "\", \"type\": \"heartbeat\"}");
+        lastHeartbeat = t;
+        std::unique_lock<std::mutex> lock(statsMutex);
+        stats.heartbeats_sent++;
+    }
+
+    std::deque<std::string> requests;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        requests.swap(pendingRequests);
+    }
+    for(size_t i = 0; i < requests.size(); i++)
+    {
+        sendRequest(requests[i]);
+        std::unique_lock<std::mutex> lock(statsMutex);
+        stats.events_sent++;
+    }
+}
+
+void ZmqClient::run()
+{
+    MultipartMessage m;
+    while(running)
+    {
+        zmq_pollitem_t items[] = {
+            { dataSocket, 0, ZMQ_POLLIN, 0 },
+            { eventSocket, 0, ZMQ_POLLIN, 0 }
+        };
+        zmq_poll(items, 2, 10);
+
+        while(m.recv(dataSocket, ZMQ_DONTWAIT))
+        {
+            JsonLite::Value header;
+            if(!m.parseHeader(header))
+                continue;
+            int64_t missing = sequences.check(m.getEnvelope(), header);
+            {
+                std::unique_lock<std::mutex> lock(statsMutex);
+                stats.messages++;
+                if(missing > 0)
+                {
+                    stats.gaps++;
+                    stats.missing_messages += missing;
+                }
+            }
+            // blocks are handed out as floats, int16 data goes out as a message
+            if(header["type"].asString() == "data" && !header["content"].has("dtype"))
+                handleData(m, header);
+            else if(header["type"].asString() == "sync")
+            {
+                {
+                    std::unique_lock<std::mutex> lock(clockMutex);
+                    clocks.addSync(header);
+                }
+                handleOther(m, header);
+            }
+            else
+                handleOther(m, header);
+        }
+
+        serviceEventSocket(now());
+    }
+}
+
+void ZmqClient::handleData(MultipartMessage &m, const JsonLite::Value &header)
+{
+    const JsonLite::Value &c = header["content"];
+    int nChannels = (int)c["n_channels"].asInt();
+    int nSamples = (int)c["n_samples"].asInt();
+    int nReal = (int)c["n_real_samples"].asInt(nSamples);
+    if(m.getNumParts() < 3 || m.getSize(2) < (size_t)nChannels * nSamples * sizeof(float))
+        return;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t inUse = blocksWritten - blocksRead + (blockCheckedOut ? 1 : 0);
+    if(inUse >= blockRing.size())
+    {
+        std::unique_lock<std::mutex> slock(statsMutex);
+        stats.dropped_blocks++;
+        return;
+    }
+    BlockSlot *slot = blockRing[blocksWritten % blockRing.size()];
+    slot->message.swap(m);
+    zic_block &b = slot->block;
+    b.message_no = header["message_no"].asInt();
+    b.timestamp = c["timestamp"].asInt(-1);
+    b.sequence = blocksWritten;
+    b.n_channels = nChannels;
+    b.n_samples = nReal;
+    b.stride = nSamples;
+    b.reserved = 0;
+    b.data = (const float *)slot->message.getData(2);
+    slot->topic = slot->message.getEnvelope();
+    b.topic = slot->topic.c_str();
+    blocksWritten++;
+    lock.unlock();
+    blockAvailable.notify_one();
+
+    std::unique_lock<std::mutex> slock(statsMutex);
+    stats.blocks++;
+}
+
+void ZmqClient::handleOther(MultipartMessage &m, const JsonLite::Value &header)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t inUse = messagesWritten - messagesRead + (messageCheckedOut ? 1 : 0);
+    if(inUse >= messageRing.size())
+    {
+        std::unique_lock<std::mutex> slock(statsMutex);
+        stats.dropped_messages++;
+        return;
+    }
+    MessageSlot *slot = messageRing[messagesWritten % messageRing.size()];
+    slot->message.swap(m);
+    slot->envelope = slot->message.getEnvelope();
+    slot->type = header["type"].asString();
+
+    zic_message &i = slot->info;
+    memset(&i, 0, sizeof(i));
+    i.message_no = header["message_no"].asInt();
+    i.envelope = slot->envelope.c_str();
+    i.type = slot->type.c_str();
+    i.header = (const char *)slot->message.getData(1);
+    i.header_size = slot->message.getSize(1);
+    if(slot->message.getNumParts() > 2)
+    {
+        i.payload = slot->message.getData(2);
+        i.payload_size = slot->message.getSize(2);
+    }
+    if(slot->type == "event")
+    {
+        const JsonLite::Value &c = header["content"];
+        i.event_type = (int32_t)c["type"].asInt();
+        i.sample_num = c["sample_num"].asInt();
+        i.event_id = (int32_t)c["event_id"].asInt();
+        i.event_channel = (int32_t)c["event_channel"].asInt();
+    }
+    else if(slot->type == "spike")
+    {
+        const JsonLite::Value &s = header["spike"];
+        i.event_type = 4;
+        i.sample_num = s["timestamp"].asInt();
+        i.event_channel = (int32_t)s["electrode_id"].asInt();
+    }
+    messagesWritten++;
+    lock.unlock();
+    messageAvailable.notify_one();
+}
+
+bool ZmqClient::getClock(const std::string &topic, zic_clock &clock) const
+{
+    memset(&clock, 0, sizeof(clock));
+    std::unique_lock<std::mutex> lock(clockMutex);
+    const ClockFit *fit = clocks.find(topic);
+    if(!fit)
+        return false;
+    clock.ref_sample = fit->refSample;
+    clock.ref_monotonic_ns = fit->refMonotonicNs;
+    clock.ref_realtime_ns = fit->refRealtimeNs;
+    clock.ns_per_sample = fit->nsPerSample;
+    clock.nominal_rate = fit->nominalRate;
+    clock.residual_ns = fit->residualNs;
+    clock.n_points = fit->getNumPoints();
+    return fit->isValid();
+}
+
+bool ZmqClient::nextBlock(zic_block &block, int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    blockCheckedOut = false;
+    if(!blockAvailable.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                                [this] { return blocksWritten > blocksRead; }))
+        return false;
+    block = blockRing[blocksRead % blockRing.size()]->block;
+    blocksRead++;
+    blockCheckedOut = true;
+    return true;
+}
+
+bool ZmqClient::nextMessage(zic_message &message, int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    messageCheckedOut = false;
+    if(!messageAvailable.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                                  [this] { return messagesWritten > messagesRead; }))
+        return false;
+    message = messageRing[messagesRead % messageRing.size()]->info;
+    messagesRead++;
+    messageCheckedOut = true;
+    return true;
+}
+
+zic_stats ZmqClient::getStats() const
+{
+    std::unique_lock<std::mutex> lock(statsMutex);
+    return stats;
+}
+
+
+//=============================================================================
+// C interface
+
+struct zic_client {
+    ZmqClient::Options options;
+    ZmqClient *client;
+};
+
+extern "C" {
+
+zic_client *zic_create(const char *host, int data_port, int listen_port, const char *app_name)
+{
+    zic_client *c = new zic_client;
+    if(host)
+        c->options.host = host;
+    if(data_port > 0)
+        c->options.dataPort = data_port;
+    if(listen_port > 0)
+        c->options.listenPort = listen_port;
+    if(app_name)
+        c->options.appName = app_name;
+    c->client = 0;
+    return c;
+}
+
+void zic_destroy(zic_client *c)
+{
+    if(!c)
+        return;
+    delete c->client;
+    delete c;
+}
+
+int zic_subscribe(zic_client *c, const char *topic)
+{
+    if(c->client)
+        return -1;
+    // a final '$' stands for the NUL that ends the envelope: exact match
+    std::string t(topic);
+    if(!t.empty() && t[t.size() - 1] == '$')
+        t[t.size() - 1] = '\0';
+    c->options.topics.push_back(t);
+    return 0;
+}
+
+int zic_start(zic_client *c)
+{
+    if(!c->client)
+        c->client = new ZmqClient(c->options);
+    return c->client->start() ? 0 : -1;
+}
+
+int zic_next_block(zic_client *c, zic_block *block, int timeout_ms)
+{
+    return (c->client && c->client->nextBlock(*block, timeout_ms)) ? 1 : 0;
+}
+
+int zic_next_message(zic_client *c, zic_message *message, int timeout_ms)
+{
+    return (c->client && c->client->nextMessage(*message, timeout_ms)) ? 1 : 0;
+}
+
+int zic_send_event(zic_client *c, int event_type, int64_t sample_num, int event_id, int event_channel)
+{
+    if(!c->client)
+        return -1;
+    c->client->sendEvent(event_type, sample_num, event_id, event_channel);
+    return 0;
+}
+
+void zic_get_stats(zic_client *c, zic_stats *stats)
+{
+    if(c->client)
+        *stats = c->client->getStats();
+    else
+        memset(stats, 0, sizeof(*stats));
+}
+
+int zic_get_clock(zic_client *c, const char *topic, zic_clock *clock)
+{
+    if(!c->client)
+    {
+        memset(clock, 0, sizeof(*clock));
+        return 0;
+    }
+    return c->client->getClock(topic ? topic : "", *clock) ? 1 : 0;
+}
+
+}
@@ -0,0 +1,146 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqClient.h
+    Native client of the ZMQ Interface, the C++ counterpart of PlotProcess
+    in python_clients/ZMQPlugins/plot_process_zmq.py.
+
+    A background thread receives and decodes the data socket, and handles
+    the heartbeats and the events sent to the listen socket. Data blocks
+    are kept in a ring of received messages, so the consumer gets
+    pointers into the ZeroMQ frames without any copy.
+
+  ==============================================================================
+*/
+
+#ifndef ZMQCLIENT_H_INCLUDED
+#define ZMQCLIENT_H_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "zmq_client.h"
+#include "../common/MultipartMessage.h"
+#include "../common/ClockFit.h"
+#include "../common/SequenceTracker.h"
+
+
+class ZmqClient
+{
+public:
+    struct Options {
+        std::string host = "localhost";
+        int dataPort = 5556;
+        int listenPort = 5557;
+        std::string appName = "Native Client";
+        std::string uuid;                   // generated if empty
+        std::vector<std::string> topics;    // empty for all
+        int ringBlocks = 64;
+        int ringMessages = 1024;
+        double heartbeatInterval = 2.;      // seconds
+        double serverTimeout = 10.;         // reconnect the event socket after this
+    };
+
+    ZmqClient(const Options &options);
+    ~ZmqClient();
+
+    bool start();
+    void stop();
+
+    /** Waits up to timeoutMs for the next block. The previous block is released */
+    bool nextBlock(zic_block &block, int timeoutMs);
+    bool nextMessage(zic_message &message, int timeoutMs);
+
+    /** Queues a TTL-like event for the plugin, sent by the background thread */
+    void sendEvent(int eventType, int64_t sampleNum, int eventId, int eventChannel);
+
+    zic_stats getStats() const;
+
+    /** Clock fit of a DATA topic, the first one if topic is empty */
+    bool getClock(const std::string &topic, zic_clock &clock) const;
+
+private:
+    struct BlockSlot {
+        MultipartMessage message;
+        std::string topic;
+        zic_block block;
+    };
+
+    struct MessageSlot {
+        MultipartMessage message;
+        std::string envelope;
+        std::string type;
+        zic_message info;
+    };
+
+    void run();
+    void handleData(MultipartMessage &m, const JsonLite::Value &header);
+    void handleOther(MultipartMessage &m, const JsonLite::Value &header);
+    void openEventSocket();
+    void sendRequest(const std::string &json);
+    void serviceEventSocket(double t);
+
+    Options options;
+    void *context = 0;
+    void *dataSocket = 0;
+    void *eventSocket = 0;
+    std::thread thread;
+    std::atomic<bool> running;
+
+    // rings: written by the background thread, read by the consumer. A slot is
+    // reused only after the consumer moved past it (the newest is dropped when
+    // the ring is full), so the pointers handed out stay valid.
+    std::mutex mutex;
+    std::condition_variable blockAvailable;
+    std::condition_variable messageAvailable;
+    std::vector<BlockSlot *> blockRing;
+    uint64_t blocksWritten = 0;
+    uint64_t blocksRead = 0;
+    bool blockCheckedOut = false;
+    std::vector<MessageSlot *> messageRing;
+    uint64_t messagesWritten = 0;
+    uint64_t messagesRead = 0;
+    bool messageCheckedOut = false;
+
+    std::deque<std::string> pendingRequests;
+
+    SequenceTracker sequences; // per topic, message_no counts the unsubscribed ones too
+    double lastHeartbeat = 0.;
+    double lastReply = 0.;
+    int outstandingReplies = 0;
+
+    mutable std::mutex statsMutex;
+    zic_stats stats;
+
+    mutable std::mutex clockMutex;
+    ClockSet clocks;
+};
+
+
+#endif  // ZMQCLIENT_H_INCLUDED
@@ -0,0 +1,141 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    zmq_client.h
+    C interface of the native client library, for bindings (see
+    python_clients/ZMQPlugins/native_client.py).
+
+  ==============================================================================
+*/
+
+#ifndef ZMQ_CLIENT_H_INCLUDED
+#define ZMQ_CLIENT_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct zic_client zic_client;
+
+/** A data block. data points into the received message (no copy) and stays
+ valid until the next call to zic_next_block. DATA sent as int16 (data_format
+ of the plugin) comes as a message instead, see zic_next_message */
+typedef struct {
+    int64_t message_no;
+    int64_t timestamp;      /* first sample of the block, -1 if unknown */
+    uint64_t sequence;      /* blocks received by this client */
+    int32_t n_channels;
+    int32_t n_samples;      /* real samples in each row */
+    int32_t stride;         /* floats from one channel to the next */
+    int32_t reserved;
+    const float *data;
+    const char *topic;      /* envelope, e.g. "DATA/100/30000" */
+} zic_block;
+
+/** Any other message (events, spikes, features...). The pointers stay valid
+ until the next call to zic_next_message */
+typedef struct {
+    int64_t message_no;
+    const char *envelope;
+    const char *type;
+    const char *header;     /* JSON, not null terminated */
+    size_t header_size;
+    const void *payload;    /* first binary frame, if any */
+    size_t payload_size;
+    int64_t sample_num;     /* sample_num of events, timestamp of spikes */
+    int32_t event_type;
+    int32_t event_id;
+    int32_t event_channel;  /* or electrode for spikes */
+    int32_t reserved;
+} zic_message;
+
+typedef struct {
+    int64_t messages;
+    int64_t blocks;
+    int64_t gaps;               /* from the per topic sequence numbers (DATA, SYNC) */
+    int64_t missing_messages;
+    int64_t dropped_blocks;     /* ring full, the consumer is too slow */
+    int64_t dropped_messages;
+    int64_t heartbeats_sent;
+    int64_t replies_received;
+    int64_t events_sent;
+    int32_t server_alive;
+    int32_t reserved;
+} zic_stats;
+
+/** Mapping of the sample numbers of a DATA topic to the host clocks of the
+ plugin machine, fitted over the recent SYNC messages (least squares, so the
+ drift of the acquisition clock is followed). Start over when acquisition
+ restarts */
+typedef struct {
+    int64_t ref_sample;         /* a sample number on the line... */
+    int64_t ref_monotonic_ns;   /* ...and its CLOCK_MONOTONIC time */
+    int64_t ref_realtime_ns;    /* ...and CLOCK_REALTIME time */
+    double ns_per_sample;       /* fitted, 1e9 / sample rate */
+    double nominal_rate;        /* sample rate announced by the plugin */
+    double residual_ns;         /* rms distance of the sync points to the line */
+    int32_t n_points;           /* sync messages in the fit */
+    int32_t reserved;
+} zic_clock;
+
+zic_client *zic_create(const char *host, int data_port, int listen_port, const char *app_name);
+void zic_destroy(zic_client *client);
+
+/** Restricts the subscription to an envelope prefix (e.g. "DATA", or
+ "EVENT/TTL/" for the TTL events). A final '$' asks for the exact envelope
+ ("EVENT/TTL/3$" is channel 3 but not 31). Call before zic_start, as many
+ times as needed. Without calls everything is received */
+int zic_subscribe(zic_client *client, const char *topic);
+int zic_start(zic_client *client);
+
+/** Return 1 when a block/message was returned, 0 on timeout */
+int zic_next_block(zic_client *client, zic_block *block, int timeout_ms);
+int zic_next_message(zic_client *client, zic_message *message, int timeout_ms);
+
+int zic_send_event(zic_client *client, int event_type, int64_t sample_num, int event_id, int event_channel);
+void zic_get_stats(zic_client *client, zic_stats *stats);
+
+/** Current clock fit of the DATA topic (e.g. "DATA/100/30000"), or of the
+ first source with a NULL topic. Needs "SYNC" in the subscriptions.
+ Returns 1 when at least two sync messages were received */
+int zic_get_clock(zic_client *client, const char *topic, zic_clock *clock);
+
+static inline int64_t zic_sample_to_monotonic_ns(const zic_clock *clock, int64_t sample)
+{
+    return clock->ref_monotonic_ns + (int64_t)((double)(sample - clock->ref_sample) * clock->ns_per_sample);
+}
+
+static inline int64_t zic_sample_to_realtime_ns(const zic_clock *clock, int64_t sample)
+{
+    return clock->ref_realtime_ns + (int64_t)((double)(sample - clock->ref_sample) * clock->ns_per_sample);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ZMQ_CLIENT_H_INCLUDED
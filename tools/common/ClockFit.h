@@ -0,0 +1,192 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ClockFit.h
+    Mapping of the sample numbers of the ZMQ Interface sources to the host
+    clocks of the acquisition machine, fitted on the SYNC messages.
+
+  ==============================================================================
+*/
+
+#ifndef CLOCKFIT_H_INCLUDED
+#define CLOCKFIT_H_INCLUDED
+
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "JsonLite.h"
+
+
+/** Least squares line through the last sync points of one source, so that
+ the drift of the acquisition clock is followed and the jitter of the
+ audio thread averaged out. Starts over when acquisition restarts */
+class ClockFit
+{
+public:
+    enum { MAX_POINTS = 60 };
+
+    std::string topic;
+    double nominalRate = 0.;
+
+    // the line: refSample was acquired at refMonotonicNs / refRealtimeNs
+    int64_t refSample = 0;
+    int64_t refMonotonicNs = 0;
+    int64_t refRealtimeNs = 0;
+    double nsPerSample = 0.;
+    double residualNs = 0.; // rms distance of the points to the line
+
+    int getNumPoints() const { return (int)samples.size(); }
+    bool isValid() const { return samples.size() >= 2; }
+
+    int64_t toMonotonicNs(int64_t sample) const
+    {
+        return refMonotonicNs + (int64_t)((double)(sample - refSample) * nsPerSample);
+    }
+    int64_t toRealtimeNs(int64_t sample) const
+    {
+        return refRealtimeNs + (int64_t)((double)(sample - refSample) * nsPerSample);
+    }
+
+    void add(int64_t sample, int64_t monotonicNs, int64_t realtimeNs)
+    {
+        // acquisition restarted, the old points are of another line
+        if(!samples.empty() && sample <= samples.back())
+        {
+            samples.clear();
+            monotonic.clear();
+            realtime.clear();
+        }
+        samples.push_back(sample);
+        monotonic.push_back(monotonicNs);
+        realtime.push_back(realtimeNs);
+        if(samples.size() > MAX_POINTS)
+        {
+            samples.pop_front();
+            monotonic.pop_front();
+            realtime.pop_front();
+        }
+        fit();
+    }
+
+private:
+    void fit()
+    {
+        size_t n = samples.size();
+
+        // relative to the first point, so that the doubles keep the nanoseconds
+        int64_t s0 = samples.front(), m0 = monotonic.front(), r0 = realtime.front();
+        double sMean = 0., mMean = 0., rMean = 0.;
+        for(size_t i = 0; i < n; i++)
+        {
+            sMean += (double)(samples[i] - s0);
+            mMean += (double)(monotonic[i] - m0);
+            rMean += (double)(realtime[i] - r0);
+        }
+        sMean /= n;
+        mMean /= n;
+        rMean /= n;
+
+        double sxx = 0., sxy = 0.;
+        for(size_t i = 0; i < n; i++)
+        {
+            double x = (double)(samples[i] - s0) - sMean;
+            double y = (double)(monotonic[i] - m0) - mMean;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        nsPerSample = sxx > 0. ? sxy / sxx : (nominalRate > 0. ? 1.e9 / nominalRate : 0.);
+
+        double ss = 0.;
+        for(size_t i = 0; i < n; i++)
+        {
+            double x = (double)(samples[i] - s0) - sMean;
+            double y = (double)(monotonic[i] - m0) - mMean;
+            double r = y - nsPerSample * x;
+            ss += r * r;
+        }
+        residualNs = n > 2 ? sqrt(ss / (n - 2)) : 0.;
+
+        // the line goes through the mean point. The realtime clock gets the
+        // same slope, with its mean offset to the monotonic clock
+        refSample = s0 + (int64_t)llround(sMean);
+        double shift = (double)(refSample - s0) - sMean;
+        refMonotonicNs = m0 + (int64_t)llround(mMean + shift * nsPerSample);
+        refRealtimeNs = r0 + (int64_t)llround(rMean + shift * nsPerSample);
+    }
+
+    std::deque<int64_t> samples, monotonic, realtime;
+};
+
+
+/** The clock fits of all the sources of a plugin */
+class ClockSet
+{
+public:
+    /** Adds the points of a "sync" message */
+    void addSync(const JsonLite::Value &header)
+    {
+        const JsonLite::Value &c = header["content"];
+        int64_t monotonicNs = c["monotonic_ns"].asInt();
+        int64_t realtimeNs = c["realtime_ns"].asInt();
+        const JsonLite::Value &sources = c["sources"];
+        for(size_t i = 0; i < sources.size(); i++)
+        {
+            const JsonLite::Value &source = sources[i];
+            const std::string &topic = source["topic"].asString();
+            ClockFit *fit = find(topic);
+            if(!fit)
+            {
+                fits.push_back(ClockFit());
+                fit = &fits.back();
+                fit->topic = topic;
+            }
+            fit->nominalRate = source["sample_rate"].asDouble();
+            fit->add(source["sample_num"].asInt(), monotonicNs, realtimeNs);
+        }
+    }
+
+    /** The fit of a DATA topic, the first one if topic is empty */
+    ClockFit *find(const std::string &topic)
+    {
+        for(size_t i = 0; i < fits.size(); i++)
+            if(topic.empty() || fits[i].topic == topic)
+                return &fits[i];
+        return 0;
+    }
+    const ClockFit *find(const std::string &topic) const
+    {
+        for(size_t i = 0; i < fits.size(); i++)
+            if(topic.empty() || fits[i].topic == topic)
+                return &fits[i];
+        return 0;
+    }
+
+private:
+    std::deque<ClockFit> fits; // stable addresses
+};
+
+
+#endif  // CLOCKFIT_H_INCLUDED
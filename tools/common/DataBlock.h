@@ -0,0 +1,123 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    DataBlock.h
+    The samples of a DATA message as float32, whatever the data_format and
+    data_decimation of the plugin (or the relay) that sent it.
+
+  ==============================================================================
+*/
+
+#ifndef DATABLOCK_H_INCLUDED
+#define DATABLOCK_H_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "JsonLite.h"
+
+
+/** One DATA message, decoded. The samples are channel major, stride apart;
+ sample i of the block stands for the source samples timestamp + i * decimation
+ to timestamp + (i + 1) * decimation - 1 (the timestamps stay in source
+ samples, see the plugin) */
+class DataBlock
+{
+public:
+    int nChannels = 0;
+    int nSamples = 0; // per channel in the frame
+    int nReal = 0; // the ones to use
+    int64_t timestamp = 0;
+    int64_t sequence = -1;
+    int decimation = 1;
+    double sampleRate = 0.; // of the samples sent
+    bool int16 = false;
+    double scale = 1.; // of the int16 samples
+    const float *samples = 0;
+    int stride = 0;
+    std::string error; // when decode() fails
+
+    /** header: the JSON header of the message, data and size: its third
+     frame. int16 samples are converted into a buffer of the block, float32
+     ones are used in place */
+    bool decode(const JsonLite::Value &header, const void *data, size_t size)
+    {
+        const JsonLite::Value &c = header["content"];
+        nChannels = (int)c["n_channels"].asInt();
+        nSamples = (int)c["n_samples"].asInt();
+        nReal = (int)c["n_real_samples"].asInt(nSamples);
+        timestamp = c["timestamp"].asInt();
+        sequence = c["sequence"].asInt(-1);
+        decimation = (int)c["decimation"].asInt(1);
+        if(decimation < 1)
+            decimation = 1;
+        sampleRate = c["sample_rate"].asDouble();
+        int16 = c["dtype"].asString() == "int16";
+        scale = int16 ? c["scale"].asDouble(1.) : 1.;
+        samples = 0;
+        stride = nSamples;
+        if(nChannels <= 0 || nReal <= 0 || nReal > nSamples)
+        {
+            error = "empty data block";
+            return false;
+        }
+        size_t sampleSize = int16 ? sizeof(int16_t) : sizeof(float);
+        if(size < (size_t)nChannels * nSamples * sampleSize)
+        {
+            error = "short data frame";
+            return false;
+        }
+        if(!int16)
+        {
+            samples = (const float *)data;
+            return true;
+        }
+        // only the real samples, packed
+        converted.resize((size_t)nChannels * nReal);
+        const int16_t *src = (const int16_t *)data;
+        const float k = (float)scale;
+        for(int ch = 0; ch < nChannels; ch++)
+        {
+            const int16_t *s = src + (size_t)ch * nSamples;
+            float *d = &converted[(size_t)ch * nReal];
+            for(int i = 0; i < nReal; i++)
+                d[i] = s[i] * k;
+        }
+        samples = &converted[0];
+        stride = nReal;
+        return true;
+    }
+
+    const float *getChannel(int ch) const { return samples + (size_t)ch * stride; }
+
+    /** The source sample number of sample i */
+    int64_t getSampleNumber(int i) const { return timestamp + (int64_t)i * decimation; }
+
+private:
+    std::vector<float> converted;
+};
+
+
+#endif  // DATABLOCK_H_INCLUDED
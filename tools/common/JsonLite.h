@@ -0,0 +1,390 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    JsonLite.h
+    Minimal JSON reader and writer for the message headers of the ZMQ
+    Interface, for the native tools that can't use JUCE.
+
+  ==============================================================================
+*/
+
+#ifndef JSONLITE_H_INCLUDED
+#define JSONLITE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+
+namespace JsonLite {
+
+class Value
+{
+public:
+    enum Type { Null, Bool, Number, String, Array, Object };
+
+    Value() : type(Null), boolean(false), number(0.), integer(0) {}
+    Value(int64_t i) : type(Number), boolean(false), number((double)i), integer(i) {}
+    Value(int i) : type(Number), boolean(false), number(i), integer(i) {}
+    Value(double d) : type(Number), boolean(false), number(d), integer((int64_t)d) {}
+    Value(const std::string &s) : type(String), boolean(false), number(0.), integer(0), str(s) {}
+    Value(const char *s) : type(String), boolean(false), number(0.), integer(0), str(s) {}
+
+    Type getType() const { return type; }
+    bool isNull() const { return type == Null; }
+    bool isNumber() const { return type == Number; }
+    bool isString() const { return type == String; }
+    bool isArray() const { return type == Array; }
+    bool isObject() const { return type == Object; }
+
+    /** integers are kept exactly, so that 64 bit timestamps survive */
+    int64_t asInt(int64_t def = 0) const
+    {
+        if(type == Number) return integer;
+        if(type == Bool) return boolean ? 1 : 0;
+        return def;
+    }
+    double asDouble(double def = 0.) const
+    {
+        if(type == Number) return number;
+        return def;
+    }
+    bool asBool(bool def = false) const
+    {
+        if(type == Bool) return boolean;
+        if(type == Number) return integer != 0;
+        return def;
+    }
+    const std::string &asString() const { return str; }
+
+    size_t size() const { return type == Array ? items.size() : members.size(); }
+
+    const Value &operator[](size_t i) const
+    {
+        return (type == Array && i < items.size()) ? items[i] : nullValue();
+    }
+    const Value &operator[](const char *key) const
+    {
+        if(type == Object)
+            for(size_t i = 0; i < members.size(); i++)
+                if(members[i].first == key)
+                    return members[i].second;
+        return nullValue();
+    }
+    bool has(const char *key) const { return !(*this)[key].isNull(); }
+
+    /** Member key, added if missing (a null value becomes an object) */
+    Value &member(const char *key)
+    {
+        if(type == Null)
+            type = Object;
+        for(size_t i = 0; i < members.size(); i++)
+            if(members[i].first == key)
+                return members[i].second;
+        members.push_back(std::make_pair(std::string(key), Value()));
+        return members.back().second;
+    }
+    Value &item(size_t i) { return items[i]; }
+    void remove(const char *key)
+    {
+        for(size_t i = 0; i < members.size(); i++)
+            if(members[i].first == key)
+            {
+                members.erase(members.begin() + i);
+                return;
+            }
+    }
+
+    const std::vector<std::pair<std::string, Value> > &getMembers() const { return members; }
+
+    static const Value &nullValue()
+    {
+        static Value v;
+        return v;
+    }
+
+    /** Compact JSON, numbers parsed as integers are written back as such */
+    void write(std::string &out) const
+    {
+        char buf[32];
+        switch(type)
+        {
+            case Null: out += "null"; break;
+            case Bool: out += boolean ? "true" : "false"; break;
+            case Number:
+                if((double)integer == number)
+                    snprintf(buf, sizeof(buf), "%lld", (long long)integer);
+                else
+                    snprintf(buf, sizeof(buf), "%.17g", number);
+                out += buf;
+                break;
+            case String: writeString(str, out); break;
+            case Array:
+                out += '[';
+                for(size_t i = 0; i < items.size(); i++)
+                {
+                    if(i) out += ", ";
+                    items[i].write(out);
+                }
+                out += ']';
+                break;
+            case Object:
+                out += '{';
+                for(size_t i = 0; i < members.size(); i++)
+                {
+                    if(i) out += ", ";
+                    writeString(members[i].first, out);
+                    out += ": ";
+                    members[i].second.write(out);
+                }
+                out += '}';
+                break;
+        }
+    }
+
+    std::string toString() const
+    {
+        std::string out;
+        write(out);
+        return out;
+    }
+
+private:
+    static void writeString(const std::string &s, std::string &out)
+    {
+        out += '"';
+        for(size_t i = 0; i < s.size(); i++)
+        {
+            char c = s[i];
+            if(c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if((unsigned char)c < 0x20)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+                out += buf;
+            }
+            else
+                out += c;
+        }
+        out += '"';
+    }
+
+    friend class Parser;
+    Type type;
+    bool boolean;
+    double number;
+    int64_t integer;
+    std::string str;
+    std::vector<Value> items;
+    std::vector<std::pair<std::string, Value> > members;
+};
+
+
+class Parser
+{
+public:
+    Parser(const char *text, size_t length) : p(text), end(text + length) {}
+
+    bool parse(Value &v)
+    {
+        if(!parseValue(v, 0))
+            return false;
+        skipSpace();
+        return p == end || *p == 0;
+    }
+
+private:
+    enum { MAX_DEPTH = 32 };
+
+    void skipSpace()
+    {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            p++;
+    }
+
+    bool literal(const char *s)
+    {
+        size_t n = strlen(s);
+        if((size_t)(end - p) < n || strncmp(p, s, n) != 0)
+            return false;
+        p += n;
+        return true;
+    }
+
+    bool parseString(std::string &s)
+    {
+        if(p >= end || *p != '"')
+            return false;
+        p++;
+        s.clear();
+        while(p < end && *p != '"')
+        {
+            char c = *p++;
+            if(c == '\\' && p < end)
+            {
+                char e = *p++;
+                switch(e)
+                {
+                    case 'n': s += '\n'; break;
+                    case 't': s += '\t'; break;
+                    case 'r': s += '\r'; break;
+                    case 'b': s += '\b'; break;
+                    case 'f': s += '\f'; break;
+                    case 'u':
+                    {
+                        // headers are ASCII in practice, keep the low byte only
+                        if(end - p < 4)
+                            return false;
+                        s += (char)strtol(std::string(p, 4).c_str(), 0, 16);
+                        p += 4;
+                        break;
+                    }
+                    default: s += e; break;
+                }
+            }
+            else
+                s += c;
+        }
+        if(p >= end)
+            return false;
+        p++;
+        return true;
+    }
+
+    bool parseNumber(Value &v)
+    {
+        const char *start = p;
+        bool isInteger = true;
+        if(p < end && (*p == '-' || *p == '+'))
+            p++;
+        while(p < end && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '-' || *p == '+'))
+        {
+            if(*p == '.' || *p == 'e' || *p == 'E')
+                isInteger = false;
+            p++;
+        }
+        if(p == start)
+            return false;
+        std::string s(start, p - start);
+        v.type = Value::Number;
+        v.number = strtod(s.c_str(), 0);
+        v.integer = isInteger ? strtoll(s.c_str(), 0, 10) : (int64_t)v.number;
+        return true;
+    }
+
+    bool parseValue(Value &v, int depth)
+    {
+        if(depth > MAX_DEPTH)
+            return false;
+        skipSpace();
+        if(p >= end)
+            return false;
+        switch(*p)
+        {
+            case '{':
+            {
+                p++;
+                v.type = Value::Object;
+                skipSpace();
+                if(p < end && *p == '}') { p++; return true; }
+                while(true)
+                {
+                    skipSpace();
+                    std::pair<std::string, Value> m;
+                    if(!parseString(m.first))
+                        return false;
+                    skipSpace();
+                    if(p >= end || *p != ':')
+                        return false;
+                    p++;
+                    if(!parseValue(m.second, depth + 1))
+                        return false;
+                    v.members.push_back(m);
+                    skipSpace();
+                    if(p < end && *p == ',') { p++; continue; }
+                    if(p < end && *p == '}') { p++; return true; }
+                    return false;
+                }
+            }
+            case '[':
+            {
+                p++;
+                v.type = Value::Array;
+                skipSpace();
+                if(p < end && *p == ']') { p++; return true; }
+                while(true)
+                {
+                    Value item;
+                    if(!parseValue(item, depth + 1))
+                        return false;
+                    v.items.push_back(item);
+                    skipSpace();
+                    if(p < end && *p == ',') { p++; continue; }
+                    if(p < end && *p == ']') { p++; return true; }
+                    return false;
+                }
+            }
+            case '"':
+                v.type = Value::String;
+                return parseString(v.str);
+            case 't':
+                v.type = Value::Bool;
+                v.boolean = true;
+                return literal("true");
+            case 'f':
+                v.type = Value::Bool;
+                v.boolean = false;
+                return literal("false");
+            case 'n':
+                v.type = Value::Null;
+                return literal("null");
+            default:
+                return parseNumber(v);
+        }
+    }
+
+    const char *p;
+    const char *end;
+};
+
+
+inline bool parse(const void *text, size_t length, Value &v)
+{
+    v = Value();
+    Parser parser((const char *)text, length);
+    return parser.parse(v);
+}
+
+} // namespace JsonLite
+
+
+#endif  // JSONLITE_H_INCLUDED
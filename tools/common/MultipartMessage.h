@@ -0,0 +1,171 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    MultipartMessage.h
+    A received multi-part ZeroMQ message in the ZMQ Interface format:
+    envelope, JSON header and optional binary frames.
+
+  ==============================================================================
+*/
+
+#ifndef MULTIPARTMESSAGE_H_INCLUDED
+#define MULTIPARTMESSAGE_H_INCLUDED
+
+#include <zmq.h>
+#include <string>
+#include <deque>
+#include <string.h>
+#include <errno.h>
+#include "JsonLite.h"
+
+
+class MultipartMessage
+{
+public:
+    MultipartMessage() {}
+    ~MultipartMessage() { clear(); }
+
+    void clear()
+    {
+        for(size_t i = 0; i < parts.size(); i++)
+            zmq_msg_close(&parts[i]);
+        parts.clear();
+    }
+
+    /** Receives all the parts of the next message. Returns false on EAGAIN or
+     error, with no parts */
+    bool recv(void *socket, int flags = 0)
+    {
+        clear();
+        while(true)
+        {
+            parts.push_back(zmq_msg_t());
+            zmq_msg_t &m = parts.back();
+            zmq_msg_init(&m);
+            if(zmq_msg_recv(&m, socket, flags) == -1)
+            {
+                zmq_msg_close(&m);
+                parts.pop_back();
+                // the other parts of a started message are already there,
+                // only a signal can get in the way
+                if(!parts.empty() && zmq_errno() == EINTR)
+                    continue;
+                clear(); // e.g. ETERM: no half message
+                return false;
+            }
+            if(!zmq_msg_more(&m))
+                return true;
+        }
+    }
+
+    /** Sends (and releases) all the parts */
+    bool send(void *socket, int flags = 0)
+    {
+        bool ok = true;
+        for(size_t i = 0; i < parts.size(); i++)
+        {
+            int more = (i + 1 < parts.size()) ? ZMQ_SNDMORE : 0;
+            if(zmq_msg_send(&parts[i], socket, flags | more) == -1)
+                ok = false;
+        }
+        clear();
+        return ok;
+    }
+
+    /** Exchanges the frames of the two messages */
+    void swap(MultipartMessage &other)
+    {
+        parts.swap(other.parts);
+    }
+
+    /** Makes this message share the frames of other (no data copy) */
+    void copyFrom(MultipartMessage &other)
+    {
+        clear();
+        for(size_t i = 0; i < other.parts.size(); i++)
+        {
+            parts.push_back(zmq_msg_t());
+            zmq_msg_init(&parts.back());
+            zmq_msg_copy(&parts.back(), &other.parts[i]);
+        }
+    }
+
+    /** Appends part i of other, sharing its data */
+    void addPartFrom(MultipartMessage &other, size_t i)
+    {
+        parts.push_back(zmq_msg_t());
+        zmq_msg_init(&parts.back());
+        zmq_msg_copy(&parts.back(), &other.parts[i]);
+    }
+
+    void addPart(const void *data, size_t size)
+    {
+        parts.push_back(zmq_msg_t());
+        zmq_msg_init_size(&parts.back(), size);
+        if(size)
+            memcpy(zmq_msg_data(&parts.back()), data, size);
+    }
+
+    size_t getNumParts() const { return parts.size(); }
+    const void *getData(size_t i) const { return zmq_msg_data(const_cast<zmq_msg_t *>(&parts[i])); }
+    void *getData(size_t i) { return zmq_msg_data(&parts[i]); }
+    size_t getSize(size_t i) const { return zmq_msg_size(const_cast<zmq_msg_t *>(&parts[i])); }
+
+    size_t getTotalSize() const
+    {
+        size_t n = 0;
+        for(size_t i = 0; i < parts.size(); i++)
+            n += getSize(i);
+        return n;
+    }
+
+    /** The envelope, without the terminating null */
+    std::string getEnvelope() const
+    {
+        if(parts.empty())
+            return std::string();
+        const char *s = (const char *)getData(0);
+        size_t n = getSize(0);
+        while(n > 0 && s[n - 1] == 0)
+            n--;
+        return std::string(s, n);
+    }
+
+    bool parseHeader(JsonLite::Value &header) const
+    {
+        if(parts.size() < 2)
+            return false;
+        return JsonLite::parse(getData(1), getSize(1), header);
+    }
+
+private:
+    MultipartMessage(const MultipartMessage &);
+    MultipartMessage &operator=(const MultipartMessage &);
+
+    // a deque, because zmq_msg_t must not be moved around once initialized
+    std::deque<zmq_msg_t> parts;
+};
+
+
+#endif  // MULTIPARTMESSAGE_H_INCLUDED
@@ -0,0 +1,75 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    SequenceTracker.h
+    Losses counted from the per stream "sequence" numbers (DATA, SYNC). The
+    global message_no can't be used by clients subscribed to some of the
+    topics only: the messages of the other topics would count as missing.
+
+  ==============================================================================
+*/
+
+#ifndef SEQUENCETRACKER_H_INCLUDED
+#define SEQUENCETRACKER_H_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include "JsonLite.h"
+
+
+class SequenceTracker
+{
+public:
+    /** The messages of topic missing before this one, 0 for the messages
+     without a sequence number. A number going back (acquisition restarted)
+     starts over */
+    int64_t check(const std::string &topic, int64_t sequence)
+    {
+        if(sequence < 0)
+            return 0;
+        std::map<std::string, int64_t>::iterator it = last.find(topic);
+        if(it == last.end())
+        {
+            last[topic] = sequence;
+            return 0;
+        }
+        int64_t missing = sequence > it->second + 1 ? sequence - it->second - 1 : 0;
+        it->second = sequence;
+        return missing;
+    }
+
+    int64_t check(const std::string &topic, const JsonLite::Value &header)
+    {
+        return check(topic, header["content"]["sequence"].asInt(-1));
+    }
+
+    void clear() { last.clear(); }
+
+private:
+    std::map<std::string, int64_t> last;
+};
+
+
+#endif  // SEQUENCETRACKER_H_INCLUDED
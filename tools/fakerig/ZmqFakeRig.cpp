@@ -0,0 +1,349 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqFakeRig.cpp
+    Synthetic stand-in for the data socket of the ZMQ Interface, to try the
+    clients, zmq_relay and zmq_aggregator without an acquisition system.
+
+    Publishes, in the format of the plugin, the latched METADATA message,
+    "DATA/100/<rate>" blocks of sine waves, a TTL event ("EVENT/TTL/1") every
+    --ttl seconds and a SYNC message every second. The sample clock can run
+    off the nominal rate (--drift-ppm) and start at any sample number
+    (--start), and the messages can go out late (--delay, --jitter), as a
+    rig behind a slow network would.
+
+  ==============================================================================
+*/
+
+#include <zmq.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <thread>
+#include "../common/MultipartMessage.h"
+
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void handleSignal(int)
+{
+    stopRequested = 1;
+}
+
+static int64_t monotonicNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t realtimeNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+//=============================================================================
+class ZmqFakeRig
+{
+public:
+    struct Options {
+        std::string endpoint = "tcp://*:5556";
+        int channels = 16;
+        double sampleRate = 30000.;
+        int blockSize = 1024;
+        double driftPpm = 0.;
+        int64_t startSample = 0;
+        double delayMs = 0.;
+        double jitterMs = 0.;
+        double ttlInterval = 1.;
+    };
+
+    ZmqFakeRig(const Options &o) : options(o), random(12345) {}
+
+    ~ZmqFakeRig()
+    {
+        if(socket) zmq_close(socket);
+        if(context) zmq_ctx_destroy(context);
+    }
+
+    int run()
+    {
+        context = zmq_ctx_new();
+        socket = zmq_socket(context, ZMQ_XPUB);
+        int verbose = 1, linger = 0;
+        zmq_setsockopt(socket, ZMQ_XPUB_VERBOSE, &verbose, sizeof(verbose));
+        zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+        if(zmq_bind(socket, options.endpoint.c_str()) != 0)
+        {
+            std::cout << "couldn't bind " << options.endpoint << ": " << zmq_strerror(zmq_errno()) << std::endl;
+            return 1;
+        }
+        int rate = (int)lround(options.sampleRate);
+        snprintf(dataTopic, sizeof(dataTopic), "DATA/100/%d", rate);
+        prepareMetadata();
+
+        // the rig's clock: samples acquired = (t - t0) * rate * (1 + drift)
+        double actualRate = options.sampleRate * (1. + options.driftPpm * 1e-6);
+        std::cout << "fake rig on " << options.endpoint << ": " << options.channels << " channels at "
+                  << actualRate << " Hz, from sample " << options.startSample << std::endl;
+
+        std::uniform_real_distribution<double> jitter(0., options.jitterMs * 1e6);
+        int64_t t0 = monotonicNs();
+        int64_t sample = options.startSample; // next block
+        int64_t sequence = 0, ttlSample = options.startSample;
+        bool ttlState = false;
+        int64_t nextSyncNs = t0;
+        std::vector<float> block((size_t)options.channels * options.blockSize);
+
+        while(!stopRequested)
+        {
+            handleSubscriptions();
+            int64_t t = monotonicNs();
+
+            // blocks complete by now, sent once their delay has passed
+            int64_t acquired = options.startSample + (int64_t)((t - t0) * 1e-9 * actualRate);
+            while(sample + options.blockSize <= acquired)
+            {
+                int64_t completeNs = t0 + (int64_t)((sample + options.blockSize - options.startSample)
+                                                    / actualRate * 1e9);
+                Pending p;
+                p.dueNs = completeNs + (int64_t)(options.delayMs * 1e6) + (int64_t)jitter(random);
+                buildData(p.message, sample, sequence++, block);
+                queue.push_back(std::move(p));
+
+                while(ttlSample < sample + options.blockSize)
+                {
+                    if(ttlSample >= sample)
+                    {
+                        Pending e;
+                        e.dueNs = queue.back().dueNs;
+                        buildEvent(e.message, sample, (int)(ttlSample - sample), ttlState);
+                        queue.push_back(std::move(e));
+                        ttlState = !ttlState;
+                    }
+                    ttlSample += std::max<int64_t>(1, (int64_t)(options.ttlInterval * actualRate));
+                }
+                sample += options.blockSize;
+            }
+
+            // the plugin takes the clocks at the start of process()
+            if(t >= nextSyncNs)
+            {
+                sendSync(t, acquired);
+                nextSyncNs += 1000000000LL;
+            }
+
+            while(!queue.empty() && queue.front().dueNs <= t)
+            {
+                queue.front().message.send(socket, ZMQ_DONTWAIT);
+                queue.pop_front();
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::cout << "stopped at sample " << sample << std::endl;
+        return 0;
+    }
+
+private:
+    struct Pending {
+        int64_t dueNs;
+        MultipartMessage message;
+        Pending() {}
+        Pending(Pending &&other) : dueNs(other.dueNs) { message.swap(other.message); }
+    };
+
+    void prepareMetadata()
+    {
+        std::string channels;
+        std::string indices;
+        for(int i = 0; i < options.channels; i++)
+        {
+            char c[160];
+            snprintf(c, sizeof(c), "%s{\"name\": \"CH%d\", \"bit_volts\": 0.195, \"sample_rate\": %g, "
+                     "\"source_node_id\": 100}", i ? ", " : "", i + 1, options.sampleRate);
+            channels += c;
+            indices += (i ? ", " : "") + std::to_string(i);
+        }
+        char head[128];
+        snprintf(head, sizeof(head), "{\"message_no\": -1, \"type\": \"metadata\", \"content\": "
+                 "{\"schema_id\": 1, \"n_channels\": %d, \"channels\": [", options.channels);
+        char sources[128];
+        snprintf(sources, sizeof(sources), "], \"sources\": [{\"source_node_id\": 100, \"sample_rate\": %g, "
+                 "\"channels\": [", options.sampleRate);
+        metadata = std::string(head) + channels + sources + indices + "]}]}, \"data_size\": 0}";
+    }
+
+    void buildData(MultipartMessage &m, int64_t sample, int64_t sequence, std::vector<float> &block)
+    {
+        int n = options.blockSize;
+        for(int c = 0; c < options.channels; c++)
+        {
+            double f = 2. * M_PI * (c + 1) / options.sampleRate;
+            for(int i = 0; i < n; i++)
+                block[(size_t)c * n + i] = (float)(100. * sin(f * (double)(sample + i)));
+        }
+        size_t dataSize = block.size() * sizeof(float);
+        char header[512];
+        int size = snprintf(header, sizeof(header),
+            "{\"message_no\": %lld, \"type\": \"data\", \"content\": {\"n_channels\": %d, \"n_samples\": %d, "
+            "\"n_real_samples\": %d, \"timestamp\": %lld, \"sequence\": %lld, \"n_blocks\": 1, "
+            "\"source_node_id\": 100, \"sample_rate\": %g}, \"schema_id\": 1, \"data_size\": %zu}",
+            (long long)messageNo++, options.channels, n, n, (long long)sample, (long long)sequence,
+            options.sampleRate, dataSize);
+        m.addPart(dataTopic, strlen(dataTopic));
+        m.addPart(header, size);
+        m.addPart(block.data(), dataSize);
+    }
+
+    void buildEvent(MultipartMessage &m, int64_t blockStart, int offset, bool on)
+    {
+        // TTL channel 1, with the state in the data byte as the plugin passes it on.
+        // Like the plugin: sample_num is the offset in the block, timestamp the
+        // first sample of the block
+        static const char envelope[] = "EVENT/TTL/1";
+        uint8_t state = on ? 1 : 0;
+        char header[256];
+        int size = snprintf(header, sizeof(header),
+            "{\"message_no\": %lld, \"type\": \"event\", \"content\": {\"type\": 3, \"sample_num\": %d, "
+            "\"timestamp\": %lld, \"event_id\": %d, \"event_channel\": 1}, \"data_size\": 1}",
+            (long long)messageNo++, offset, (long long)blockStart, on ? 1 : 0);
+        m.addPart(envelope, sizeof(envelope)); // with the terminating null, as in the plugin
+        m.addPart(header, size);
+        m.addPart(&state, 1);
+    }
+
+    void sendSync(int64_t monotonic, int64_t acquired)
+    {
+        char header[512];
+        int size = snprintf(header, sizeof(header),
+            "{\"message_no\": -1, \"type\": \"sync\", \"content\": {\"sequence\": %lld, \"monotonic_ns\": %lld, "
+            "\"realtime_ns\": %lld, \"sources\": [{\"topic\": \"%s\", \"source_node_id\": 100, "
+            "\"sample_rate\": %g, \"sample_num\": %lld}]}, \"data_size\": 0}",
+            (long long)syncSequence++, (long long)monotonic, (long long)realtimeNs(), dataTopic,
+            options.sampleRate, (long long)acquired);
+        MultipartMessage m;
+        m.addPart("SYNC", 4);
+        m.addPart(header, size);
+        m.send(socket, ZMQ_DONTWAIT);
+    }
+
+    /** METADATA for the new subscribers, as the plugin does */
+    void handleSubscriptions()
+    {
+        char buffer[256];
+        while(true)
+        {
+            int size = zmq_recv(socket, buffer, sizeof(buffer), ZMQ_DONTWAIT);
+            if(size < 1)
+                break;
+            std::string topic(buffer + 1, std::min(size, (int)sizeof(buffer)) - 1);
+            if(buffer[0] != 1 || std::string("METADATA").compare(0, topic.size(), topic) != 0)
+                continue;
+            MultipartMessage m;
+            m.addPart("METADATA", 8);
+            m.addPart(metadata.data(), metadata.size());
+            m.send(socket, ZMQ_DONTWAIT);
+        }
+    }
+
+    Options options;
+    void *context = 0;
+    void *socket = 0;
+    std::mt19937 random;
+    char dataTopic[32];
+    std::string metadata;
+    std::deque<Pending> queue;
+    int64_t messageNo = 0;
+    int64_t syncSequence = 0;
+};
+
+
+static void usage()
+{
+    std::cout << "usage: zmq_fake_rig [options]\n"
+              << "  -e, --endpoint URL     data socket (tcp://*:5556)\n"
+              << "  -c, --channels N       channels (16)\n"
+              << "  -r, --rate HZ          nominal sample rate (30000)\n"
+              << "  -b, --block N          samples per block (1024)\n"
+              << "  -d, --drift-ppm PPM    sample clock error (0)\n"
+              << "  -s, --start SAMPLE     first sample number (0)\n"
+              << "      --delay MS         publication delay (0)\n"
+              << "      --jitter MS        random extra delay, up to (0)\n"
+              << "      --ttl SECONDS      TTL event interval (1)\n";
+}
+
+int main(int argc, char **argv)
+{
+    ZmqFakeRig::Options options;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if((a == "-e" || a == "--endpoint") && hasValue)
+            options.endpoint = argv[++i];
+        else if((a == "-c" || a == "--channels") && hasValue)
+            options.channels = std::max(1, atoi(argv[++i]));
+        else if((a == "-r" || a == "--rate") && hasValue)
+            options.sampleRate = atof(argv[++i]);
+        else if((a == "-b" || a == "--block") && hasValue)
+            options.blockSize = std::max(1, atoi(argv[++i]));
+        else if((a == "-d" || a == "--drift-ppm") && hasValue)
+            options.driftPpm = atof(argv[++i]);
+        else if((a == "-s" || a == "--start") && hasValue)
+            options.startSample = atoll(argv[++i]);
+        else if(a == "--delay" && hasValue)
+            options.delayMs = atof(argv[++i]);
+        else if(a == "--jitter" && hasValue)
+            options.jitterMs = atof(argv[++i]);
+        else if(a == "--ttl" && hasValue)
+            options.ttlInterval = atof(argv[++i]);
+        else
+        {
+            usage();
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+    if(options.sampleRate <= 0.)
+    {
+        usage();
+        return 1;
+    }
+
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+
+    ZmqFakeRig rig(options);
+    return rig.run();
+}
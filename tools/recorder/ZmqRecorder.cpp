@@ -0,0 +1,759 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqRecorder.cpp
+    Records the DATA and EVENT streams of the ZMQ Interface to disk, for a
+    redundant recording on a second machine.
+
+    Output, in the output directory:
+    continuous_NNN.dat  float32 samples, interleaved (sample major), one file
+                        per segment (a new segment starts when the channel
+                        count or the decimation changes). int16 blocks are
+                        converted with their scale. Only one DATA topic (one
+                        group of channels with the same source and sample
+                        rate) is recorded, see --topic
+    events.idx          fixed size EventIndexRecord's
+    events.payload      binary frames of the events (e.g. spike waveforms)
+    events.jsonl        the JSON header of every event, one per line
+    recording.json      the list of segments, rewritten at every change
+
+  ==============================================================================
+*/
+
+#include <zmq.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "../common/JsonLite.h"
+#include "../common/MultipartMessage.h"
+#include "../common/DataBlock.h"
+
+
+/** One event in events.idx */
+struct EventIndexRecord {
+    int64_t messageNo;
+    int64_t dataSampleIndex;    // samples already in the data files when the event arrived
+    int64_t sampleNum;          // sample_num, or the timestamp for spikes
+    int64_t payloadOffset;      // in events.payload
+    int32_t payloadSize;
+    int32_t eventType;          // Open Ephys event type (4 for spikes, -1 for a gap marker)
+    int32_t eventChannel;       // channel, or electrode for spikes; missing messages for gaps
+    int32_t eventId;
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void handleSignal(int)
+{
+    stopRequested = 1;
+}
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+//=============================================================================
+/** Sequential writer of a flat binary file */
+class FlatFileWriter
+{
+public:
+    virtual ~FlatFileWriter() {}
+    virtual bool open(const std::string &path, int64_t preallocateBytes) = 0;
+    virtual bool write(const void *data, size_t size) = 0;
+    virtual void close() = 0;
+    int64_t getBytesWritten() const { return bytesWritten; }
+
+protected:
+    int64_t bytesWritten = 0;
+};
+
+
+/** Writes through a sliding memory mapped window over a preallocated file.
+ The kernel writes back the pages asynchronously. */
+class MappedFileWriter : public FlatFileWriter
+{
+public:
+    ~MappedFileWriter() { close(); }
+
+    bool open(const std::string &path, int64_t preallocateBytes) override
+    {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+        {
+            std::cout << "couldn't open " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        growBy = roundUp(preallocateBytes > 0 ? preallocateBytes : (int64_t)WINDOW_SIZE);
+        allocated = 0;
+        bytesWritten = 0;
+        windowStart = 0;
+        return grow() && mapWindow(0);
+    }
+
+    bool write(const void *data, size_t size) override
+    {
+        const char *src = (const char *)data;
+        while(size > 0)
+        {
+            int64_t inWindow = bytesWritten - windowStart;
+            if(inWindow == WINDOW_SIZE)
+            {
+                if(!mapWindow(windowStart + WINDOW_SIZE))
+                    return false;
+                inWindow = 0;
+            }
+            size_t n = (size_t)std::min<int64_t>(size, WINDOW_SIZE - inWindow);
+            memcpy(window + inWindow, src, n);
+            src += n;
+            size -= n;
+            bytesWritten += n;
+        }
+        return true;
+    }
+
+    void close() override
+    {
+        if(fd < 0)
+            return;
+        unmapWindow();
+        if(ftruncate(fd, bytesWritten) != 0)
+            std::cout << "couldn't truncate data file: " << strerror(errno) << std::endl;
+        ::close(fd);
+        fd = -1;
+    }
+
+private:
+    enum { WINDOW_SIZE = 64 << 20 };
+
+    static int64_t roundUp(int64_t n)
+    {
+        return ((n + WINDOW_SIZE - 1) / WINDOW_SIZE) * WINDOW_SIZE;
+    }
+
+    bool grow()
+    {
+        int64_t newSize = allocated + growBy;
+#ifdef __linux__
+        int rc = posix_fallocate(fd, allocated, growBy);
+#else
+        int rc = ftruncate(fd, newSize) == 0 ? 0 : errno;
+#endif
+        if(rc != 0)
+        {
+            std::cout << "couldn't preallocate data file: " << strerror(rc) << std::endl;
+            return false;
+        }
+        allocated = newSize;
+        return true;
+    }
+
+    void unmapWindow()
+    {
+        if(window)
+        {
+            msync(window, WINDOW_SIZE, MS_ASYNC);
+            munmap(window, WINDOW_SIZE);
+            window = 0;
+        }
+    }
+
+    bool mapWindow(int64_t start)
+    {
+        unmapWindow();
+        while(start + WINDOW_SIZE > allocated)
+            if(!grow())
+                return false;
+        void *p = mmap(0, WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, start);
+        if(p == MAP_FAILED)
+        {
+            std::cout << "mmap failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        window = (char *)p;
+        windowStart = start;
+        return true;
+    }
+
+    int fd = -1;
+    char *window = 0;
+    int64_t windowStart = 0;
+    int64_t allocated = 0;
+    int64_t growBy = 0;
+};
+
+
+/** Writes large aligned buffers with O_DIRECT (F_NOCACHE on macOS), from a
+ writer thread, so that the receiving thread never waits for the disk */
+class DirectFileWriter : public FlatFileWriter
+{
+public:
+    ~DirectFileWriter() { close(); }
+
+    bool open(const std::string &path, int64_t preallocateBytes) override
+    {
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+        flags |= O_DIRECT;
+#endif
+        fd = ::open(path.c_str(), flags, 0644);
+        if(fd < 0)
+        {
+            std::cout << "couldn't open " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+#ifdef F_NOCACHE
+        fcntl(fd, F_NOCACHE, 1);
+#endif
+#ifdef __linux__
+        if(preallocateBytes > 0)
+            posix_fallocate(fd, 0, preallocateBytes);
+#endif
+        for(int i = 0; i < N_BUFFERS; i++)
+        {
+            void *p = 0;
+            if(posix_memalign(&p, ALIGNMENT, BUFFER_SIZE) != 0)
+                return false;
+            freeBuffers.push_back((char *)p);
+        }
+        current = takeFreeBuffer();
+        fill = 0;
+        bytesWritten = 0;
+        fileOffset = 0;
+        running = true;
+        writerThread = std::thread(&DirectFileWriter::writerLoop, this);
+        return true;
+    }
+
+    bool write(const void *data, size_t size) override
+    {
+        const char *src = (const char *)data;
+        while(size > 0)
+        {
+            size_t n = std::min(size, (size_t)BUFFER_SIZE - fill);
+            memcpy(current + fill, src, n);
+            fill += n;
+            src += n;
+            size -= n;
+            bytesWritten += n;
+            if(fill == BUFFER_SIZE)
+            {
+                queueBuffer(current, BUFFER_SIZE);
+                current = takeFreeBuffer();
+                fill = 0;
+            }
+        }
+        return !failed;
+    }
+
+    void close() override
+    {
+        if(fd < 0)
+            return;
+        // the last buffer is padded to the alignment, and the file truncated after
+        size_t padded = ((fill + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+        memset(current + fill, 0, padded - fill);
+        if(padded)
+            queueBuffer(current, padded);
+        else
+            freeBuffers.push_back(current);
+        current = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            running = false;
+        }
+        cond.notify_all();
+        writerThread.join();
+        if(ftruncate(fd, bytesWritten) != 0)
+            std::cout << "couldn't truncate data file: " << strerror(errno) << std::endl;
+        ::close(fd);
+        fd = -1;
+        for(size_t i = 0; i < freeBuffers.size(); i++)
+            free(freeBuffers[i]);
+        freeBuffers.clear();
+    }
+
+private:
+    enum { BUFFER_SIZE = 8 << 20, ALIGNMENT = 4096, N_BUFFERS = 8 };
+
+    struct Pending {
+        char *buffer;
+        size_t size;
+    };
+
+    char *takeFreeBuffer()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(freeBuffers.empty())
+        {
+            // the disk is not keeping up, this is where we block
+            cond.wait(lock);
+        }
+        char *b = freeBuffers.back();
+        freeBuffers.pop_back();
+        return b;
+    }
+
+    void queueBuffer(char *b, size_t size)
+    {
+        Pending pd = { b, size };
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            pending.push_back(pd);
+        }
+        cond.notify_all();
+    }
+
+    void writerLoop()
+    {
+        while(true)
+        {
+            Pending pd;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while(pending.empty() && running)
+                    cond.wait(lock);
+                if(pending.empty())
+                    return;
+                pd = pending.front();
+                pending.pop_front();
+            }
+            size_t done = 0;
+            while(done < pd.size)
+            {
+                ssize_t n = pwrite(fd, pd.buffer + done, pd.size - done, fileOffset);
+                if(n <= 0)
+                {
+                    std::cout << "write failed: " << strerror(errno) << std::endl;
+                    failed = true;
+                    break;
+                }
+                done += n;
+                fileOffset += n;
+            }
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                freeBuffers.push_back(pd.buffer);
+            }
+            cond.notify_all();
+        }
+    }
+
+    int fd = -1;
+    char *current = 0;
+    size_t fill = 0;
+    int64_t fileOffset = 0;
+    bool running = false;
+    volatile bool failed = false;
+    std::vector<char *> freeBuffers;
+    std::deque<Pending> pending;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread writerThread;
+};
+
+
+//=============================================================================
+class ZmqRecorder
+{
+public:
+    struct Options {
+        std::string endpoint = "tcp://localhost:5556";
+        std::string outputDir = ".";
+        bool direct = false;
+        int64_t preallocateBytes = (int64_t)4 << 30;
+        double reportInterval = 2.;
+        std::string topic = "DATA"; // prefix, the first matching topic is recorded
+    };
+
+    ZmqRecorder(const Options &o) : options(o) {}
+
+    ~ZmqRecorder()
+    {
+        closeSegment();
+        if(eventIndex) fclose(eventIndex);
+        if(eventPayload) fclose(eventPayload);
+        if(eventHeaders) fclose(eventHeaders);
+        if(socket) zmq_close(socket);
+        if(context) zmq_ctx_destroy(context);
+    }
+
+    int run()
+    {
+        mkdir(options.outputDir.c_str(), 0755);
+        eventIndex = openEventFile("events.idx");
+        eventPayload = openEventFile("events.payload");
+        eventHeaders = openEventFile("events.jsonl");
+        if(!eventIndex || !eventPayload || !eventHeaders)
+            return 1;
+
+        context = zmq_ctx_new();
+        socket = zmq_socket(context, ZMQ_SUB);
+        int hwm = 100000; // messages, a few seconds of 384 channels in small blocks
+        zmq_setsockopt(socket, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+        int rcvbuf = 16 << 20;
+        zmq_setsockopt(socket, ZMQ_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        // all topics, so that the message numbers of other streams don't look like gaps
+        zmq_setsockopt(socket, ZMQ_SUBSCRIBE, "", 0);
+        if(zmq_connect(socket, options.endpoint.c_str()) != 0)
+        {
+            std::cout << "couldn't connect to " << options.endpoint << ": "
+                      << zmq_strerror(zmq_errno()) << std::endl;
+            return 1;
+        }
+        std::cout << "recording " << options.endpoint << " to " << options.outputDir
+                  << (options.direct ? " (O_DIRECT)" : " (mmap)") << std::endl;
+
+        MultipartMessage message;
+        double lastReport = now();
+        int64_t lastBytes = 0;
+        zmq_pollitem_t items[] = { { socket, 0, ZMQ_POLLIN, 0 } };
+
+        while(!stopRequested)
+        {
+            zmq_poll(items, 1, 100);
+            // drain everything that is queued before looking at the clock again
+            while(message.recv(socket, ZMQ_DONTWAIT))
+                handleMessage(message);
+
+            double t = now();
+            if(t - lastReport >= options.reportInterval)
+            {
+                int64_t bytes = totalDataBytes();
+                std::cout << "data " << (bytes - lastBytes) / (t - lastReport) / 1e6 << " MB/s, "
+                          << bytes / 1e6 << " MB total, " << nMessages << " messages, "
+                          << nEvents << " events, " << nMissing << " missing messages in "
+                          << nGaps << " gaps" << std::endl;
+                lastReport = t;
+                lastBytes = bytes;
+            }
+        }
+
+        closeSegment();
+        writeDescriptor();
+        std::cout << "stopped. " << totalDataBytes() / 1e6 << " MB in " << segments.size()
+                  << " segments, " << nMissing << " missing messages" << std::endl;
+        return 0;
+    }
+
+private:
+    struct Segment {
+        std::string file;
+        int nChannels;
+        int decimation; // source samples per sample
+        double sampleRate; // of the samples written
+        int64_t firstSample;
+        int64_t nSamples;
+    };
+
+    FILE *openEventFile(const char *name)
+    {
+        std::string path = options.outputDir + "/" + name;
+        FILE *f = fopen(path.c_str(), "wb");
+        if(!f)
+        {
+            std::cout << "couldn't open " << path << ": " << strerror(errno) << std::endl;
+            return 0;
+        }
+        setvbuf(f, 0, _IOFBF, 1 << 20);
+        return f;
+    }
+
+    int64_t totalDataBytes() const
+    {
+        return closedBytes + (writer ? writer->getBytesWritten() : 0);
+    }
+
+    void checkSequence(int64_t messageNo)
+    {
+        if(lastMessageNo >= 0 && messageNo != lastMessageNo + 1)
+        {
+            int64_t missing = messageNo - lastMessageNo - 1;
+            if(missing > 0)
+            {
+                nGaps++;
+                nMissing += missing;
+                // gap marker in the event index
+                EventIndexRecord r;
+                memset(&r, 0, sizeof(r));
+                r.messageNo = lastMessageNo + 1;
+                r.dataSampleIndex = samplesWritten;
+                r.eventType = -1;
+                r.eventChannel = (int32_t)missing;
+                fwrite(&r, sizeof(r), 1, eventIndex);
+            }
+            else
+                std::cout << "message numbers restarted at " << messageNo << std::endl;
+        }
+        lastMessageNo = messageNo;
+    }
+
+    void handleMessage(MultipartMessage &message)
+    {
+        JsonLite::Value header;
+        if(!message.parseHeader(header))
+        {
+            std::cout << "could not parse header of a " << message.getEnvelope() << " message" << std::endl;
+            return;
+        }
+        nMessages++;
+        // METADATA, STATUS and SYNC are not numbered (message_no -1)
+        int64_t messageNo = header["message_no"].asInt(-1);
+        if(messageNo >= 0)
+            checkSequence(messageNo);
+
+        const std::string &type = header["type"].asString();
+        if(type == "data")
+            handleData(message, header);
+        else if(type == "event" || type == "spike")
+            handleEvent(message, header);
+    }
+
+    void handleData(MultipartMessage &message, const JsonLite::Value &header)
+    {
+        if(message.getNumParts() < 3)
+            return;
+        if(!block.decode(header, message.getData(2), message.getSize(2)))
+        {
+            std::cout << block.error << std::endl;
+            return;
+        }
+        const int nChannels = block.nChannels;
+        const int nReal = block.nReal;
+
+        // the plugin publishes one DATA topic per group of channels, stick to one
+        std::string envelope = message.getEnvelope();
+        if(envelope.compare(0, options.topic.size(), options.topic) != 0)
+            return;
+        if(dataTopic.empty())
+        {
+            dataTopic = envelope;
+            std::cout << "recording data topic " << dataTopic << std::endl;
+        }
+        if(envelope != dataTopic)
+        {
+            if(ignoredTopics.insert(envelope).second)
+                std::cout << "ignoring data topic " << envelope << " (see --topic)" << std::endl;
+            return;
+        }
+
+        if(!writer || nChannels != segments.back().nChannels || block.decimation != segments.back().decimation)
+            openSegment(nChannels, block.decimation, block.sampleRate);
+        if(!writer)
+            return;
+
+        // channel major block -> sample major rows
+        interleaved.resize((size_t)nChannels * nReal);
+        for(int ch = 0; ch < nChannels; ch++)
+        {
+            const float *s = block.getChannel(ch);
+            float *d = &interleaved[ch];
+            for(int i = 0; i < nReal; i++)
+                d[(size_t)i * nChannels] = s[i];
+        }
+        if(!writer->write(&interleaved[0], interleaved.size() * sizeof(float)))
+        {
+            std::cout << "write error, stopping" << std::endl;
+            stopRequested = 1;
+        }
+        samplesWritten += nReal;
+        segments.back().nSamples += nReal;
+    }
+
+    void handleEvent(MultipartMessage &message, const JsonLite::Value &header)
+    {
+        EventIndexRecord r;
+        memset(&r, 0, sizeof(r));
+        r.messageNo = header["message_no"].asInt();
+        r.dataSampleIndex = samplesWritten;
+        if(header["type"].asString() == "spike")
+        {
+            const JsonLite::Value &s = header["spike"];
+            r.sampleNum = s["timestamp"].asInt();
+            r.eventType = 4;
+            r.eventChannel = (int32_t)s["electrode_id"].asInt();
+        }
+        else
+        {
+            const JsonLite::Value &c = header["content"];
+            r.sampleNum = c["sample_num"].asInt();
+            r.eventType = (int32_t)c["type"].asInt();
+            r.eventChannel = (int32_t)c["event_channel"].asInt();
+            r.eventId = (int32_t)c["event_id"].asInt();
+        }
+        r.payloadOffset = payloadBytes;
+        for(size_t i = 2; i < message.getNumParts(); i++)
+        {
+            fwrite(message.getData(i), 1, message.getSize(i), eventPayload);
+            r.payloadSize += (int32_t)message.getSize(i);
+        }
+        payloadBytes += r.payloadSize;
+        fwrite(&r, sizeof(r), 1, eventIndex);
+        fwrite(message.getData(1), 1, message.getSize(1), eventHeaders);
+        fputc('\n', eventHeaders);
+        nEvents++;
+    }
+
+    void openSegment(int nChannels, int decimation, double sampleRate)
+    {
+        closeSegment();
+        char name[64];
+        snprintf(name, sizeof(name), "continuous_%03d.dat", (int)segments.size());
+        if(options.direct)
+            writer = new DirectFileWriter;
+        else
+            writer = new MappedFileWriter;
+        if(!writer->open(options.outputDir + "/" + name, options.preallocateBytes))
+        {
+            delete writer;
+            writer = 0;
+            stopRequested = 1;
+            return;
+        }
+        Segment s = { name, nChannels, decimation, sampleRate, samplesWritten, 0 };
+        segments.push_back(s);
+        std::cout << "new segment " << name << " with " << nChannels << " channels";
+        if(decimation > 1)
+            std::cout << ", decimated by " << decimation;
+        std::cout << std::endl;
+        writeDescriptor();
+    }
+
+    void closeSegment()
+    {
+        if(writer)
+        {
+            writer->close();
+            closedBytes += writer->getBytesWritten();
+            delete writer;
+            writer = 0;
+        }
+    }
+
+    void writeDescriptor()
+    {
+        std::string path = options.outputDir + "/recording.json";
+        FILE *f = fopen(path.c_str(), "w");
+        if(!f)
+            return;
+        fprintf(f, "{\"endpoint\": \"%s\", \"topic\": \"%s\", \"dtype\": \"float32\", \"layout\": \"interleaved\",\n"
+                   " \"missing_messages\": %lld,\n \"segments\": [", options.endpoint.c_str(),
+                dataTopic.c_str(), (long long)nMissing);
+        for(size_t i = 0; i < segments.size(); i++)
+        {
+            fprintf(f, "%s\n  {\"file\": \"%s\", \"n_channels\": %d, \"decimation\": %d, \"sample_rate\": %g,"
+                       " \"first_sample\": %lld, \"n_samples\": %lld}",
+                    i ? "," : "", segments[i].file.c_str(), segments[i].nChannels, segments[i].decimation,
+                    segments[i].sampleRate, (long long)segments[i].firstSample, (long long)segments[i].nSamples);
+        }
+        fprintf(f, "\n ]\n}\n");
+        fclose(f);
+    }
+
+    Options options;
+    void *context = 0;
+    void *socket = 0;
+
+    FlatFileWriter *writer = 0;
+    DataBlock block;
+    std::string dataTopic;
+    std::set<std::string> ignoredTopics;
+    std::vector<Segment> segments;
+    std::vector<float> interleaved;
+    int64_t samplesWritten = 0;
+    int64_t closedBytes = 0;
+
+    FILE *eventIndex = 0;
+    FILE *eventPayload = 0;
+    FILE *eventHeaders = 0;
+    int64_t payloadBytes = 0;
+
+    int64_t lastMessageNo = -1;
+    int64_t nMessages = 0;
+    int64_t nEvents = 0;
+    int64_t nGaps = 0;
+    int64_t nMissing = 0;
+};
+
+
+static void usage()
+{
+    std::cout << "usage: zmq_recorder [options]\n"
+              << "  -e, --endpoint URL     data socket of the ZMQ Interface (tcp://localhost:5556)\n"
+              << "  -o, --output DIR       output directory (.)\n"
+              << "  -p, --preallocate MB   preallocation step of the data files (4096)\n"
+              << "  -d, --direct           O_DIRECT writes instead of a memory mapped file\n"
+              << "  -r, --report SECONDS   bandwidth report interval (2)\n"
+              << "  -t, --topic PREFIX     data topic to record, e.g. DATA/100/30000 (first DATA topic)\n";
+}
+
+int main(int argc, char **argv)
+{
+    ZmqRecorder::Options options;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if((a == "-e" || a == "--endpoint") && hasValue)
+            options.endpoint = argv[++i];
+        else if((a == "-o" || a == "--output") && hasValue)
+            options.outputDir = argv[++i];
+        else if((a == "-p" || a == "--preallocate") && hasValue)
+            options.preallocateBytes = (int64_t)atoll(argv[++i]) << 20;
+        else if((a == "-r" || a == "--report") && hasValue)
+            options.reportInterval = atof(argv[++i]);
+        else if((a == "-t" || a == "--topic") && hasValue)
+            options.topic = argv[++i];
+        else if(a == "-d" || a == "--direct")
+            options.direct = true;
+        else
+        {
+            usage();
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+
+    ZmqRecorder recorder(options);
+    return recorder.run();
+}
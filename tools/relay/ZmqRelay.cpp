@@ -0,0 +1,574 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqRelay.cpp
+    Republishes the data socket of the ZMQ Interface to many subscribers from
+    another machine, so that the acquisition machine only serves one.
+
+    Each output is an XPUB socket of its own. The subscriptions of all the
+    outputs are merged and forwarded upstream, so the plugin still only builds
+    the streams somebody listens to, and the METADATA message is latched here
+    for the subscribers joining later.
+
+    Messages are passed on without copying, unless the output re-encodes
+    the DATA messages:
+    decimate=N  averages N samples (aligned on the sample numbers, so the
+                "timestamp" stays in source samples). Messages without a
+                complete group of N samples are skipped, "sample_rate" is
+                divided by N and "decimation" multiplied by N in the header
+    int16=S     samples as int16 in units of S (e.g. the bit volts), with
+                "dtype": "int16" and "scale": S in the header
+    The input can be int16 and decimated (data_format, data_decimation), a
+    re-encoded output is float32 unless int16=S is given
+
+    Drops are counted from the per stream "sequence" numbers of the DATA
+    messages, which have no gaps upstream.
+
+  ==============================================================================
+*/
+
+#include <zmq.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include "../common/JsonLite.h"
+#include "../common/MultipartMessage.h"
+#include "../common/DataBlock.h"
+#include "../common/SequenceTracker.h"
+
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void handleSignal(int)
+{
+    stopRequested = 1;
+}
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+//=============================================================================
+class ZmqRelay
+{
+public:
+    struct OutputOptions {
+        std::string endpoint;
+        int decimate = 1;
+        double int16Scale = 0.; // 0 for float32
+    };
+
+    struct Options {
+        std::string endpoint = "tcp://localhost:5556";
+        std::vector<OutputOptions> outputs;
+        int hwm = 10000; // messages, per subscriber
+        double reportInterval = 2.;
+    };
+
+    ZmqRelay(const Options &o) : options(o) {}
+
+    ~ZmqRelay()
+    {
+        metadata.clear();
+        for(size_t i = 0; i < outputs.size(); i++)
+            if(outputs[i].socket) zmq_close(outputs[i].socket);
+        if(upstream) zmq_close(upstream);
+        if(context) zmq_ctx_destroy(context);
+    }
+
+    int run()
+    {
+        context = zmq_ctx_new();
+        int linger = 0;
+
+        upstream = zmq_socket(context, ZMQ_XSUB);
+        int hwm = 100000;
+        zmq_setsockopt(upstream, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+        int rcvbuf = 16 << 20;
+        zmq_setsockopt(upstream, ZMQ_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        zmq_setsockopt(upstream, ZMQ_LINGER, &linger, sizeof(linger));
+        if(zmq_connect(upstream, options.endpoint.c_str()) != 0)
+        {
+            std::cout << "couldn't connect to " << options.endpoint << ": "
+                      << zmq_strerror(zmq_errno()) << std::endl;
+            return 1;
+        }
+        // always, to have the metadata at hand for the late subscribers
+        sendSubscription(true, "METADATA", 8);
+
+        for(size_t i = 0; i < options.outputs.size(); i++)
+        {
+            Output o;
+            o.options = options.outputs[i];
+            o.socket = zmq_socket(context, ZMQ_XPUB);
+            zmq_setsockopt(o.socket, ZMQ_SNDHWM, &options.hwm, sizeof(options.hwm));
+            zmq_setsockopt(o.socket, ZMQ_LINGER, &linger, sizeof(linger));
+            // every subscription and unsubscription, to keep the counts
+            int verbose = 1;
+#ifdef ZMQ_XPUB_VERBOSER
+            zmq_setsockopt(o.socket, ZMQ_XPUB_VERBOSER, &verbose, sizeof(verbose));
+#else
+            zmq_setsockopt(o.socket, ZMQ_XPUB_VERBOSE, &verbose, sizeof(verbose));
+#endif
+            if(zmq_bind(o.socket, o.options.endpoint.c_str()) != 0)
+            {
+                std::cout << "couldn't bind " << o.options.endpoint << ": "
+                          << zmq_strerror(zmq_errno()) << std::endl;
+                zmq_close(o.socket);
+                return 1;
+            }
+            std::cout << "relaying " << options.endpoint << " to " << o.options.endpoint;
+            if(o.options.decimate > 1)
+                std::cout << ", decimated by " << o.options.decimate;
+            if(o.options.int16Scale > 0.)
+                std::cout << ", int16 x " << o.options.int16Scale;
+            std::cout << std::endl;
+            outputs.push_back(o);
+        }
+
+        std::vector<zmq_pollitem_t> items(outputs.size() + 1);
+        items[0].socket = upstream;
+        items[0].events = ZMQ_POLLIN;
+        for(size_t i = 0; i < outputs.size(); i++)
+        {
+            items[i + 1].socket = outputs[i].socket;
+            items[i + 1].events = ZMQ_POLLIN;
+        }
+
+        MultipartMessage message;
+        double lastReport = now();
+        while(!stopRequested)
+        {
+            zmq_poll(&items[0], (int)items.size(), 100);
+            for(size_t i = 0; i < outputs.size(); i++)
+                if(items[i + 1].revents & ZMQ_POLLIN)
+                    handleSubscriptions(outputs[i]);
+            // drain everything that is queued before looking at the clock again
+            while(message.recv(upstream, ZMQ_DONTWAIT))
+                handleMessage(message);
+
+            double t = now();
+            if(t - lastReport >= options.reportInterval)
+            {
+                report(t - lastReport);
+                lastReport = t;
+            }
+        }
+
+        std::cout << "stopped. " << nMessages << " messages, " << nDropped
+                  << " dropped upstream" << std::endl;
+        return 0;
+    }
+
+private:
+    /** Running sums of a decimated DATA stream, carried over the messages */
+    struct Decimator {
+        int64_t next = -1; // sample number expected next
+        int count = 0;
+        int inputDecimation = 1;
+        std::vector<double> sums;
+    };
+
+    struct Output {
+        OutputOptions options;
+        void *socket = 0;
+        std::map<std::string, int> subscriptions; // topic, count
+        std::map<std::string, Decimator> decimators; // per DATA topic
+        int64_t messages = 0, bytes = 0, failed = 0;
+        int64_t lastMessages = 0, lastBytes = 0;
+
+        bool reencodes() const { return options.decimate > 1 || options.int16Scale > 0.; }
+    };
+
+    void sendSubscription(bool subscribe, const char *topic, size_t size)
+    {
+        std::string m(1, subscribe ? 1 : 0);
+        m.append(topic, size);
+        zmq_send(upstream, m.data(), m.size(), 0);
+    }
+
+    /** Counts the subscriptions of an output, forwards the first and last of
+     every topic upstream, and gives the metadata to the new subscribers */
+    void handleSubscriptions(Output &o)
+    {
+        char buffer[256];
+        while(true)
+        {
+            int size = zmq_recv(o.socket, buffer, sizeof(buffer), ZMQ_DONTWAIT);
+            if(size < 1)
+                break;
+            size = std::min(size, (int)sizeof(buffer));
+            bool subscribe = buffer[0] == 1;
+            std::string topic(buffer + 1, size - 1);
+            int &count = o.subscriptions[topic];
+            int &total = allSubscriptions[topic];
+            if(subscribe)
+            {
+                count++;
+                if(total++ == 0)
+                    sendSubscription(true, topic.data(), topic.size());
+                // to all the metadata subscribers of this output, as the plugin does
+                if(std::string("METADATA").compare(0, topic.size(), topic) == 0
+                   && metadata.getNumParts() > 0)
+                    sendMetadata(o, metadata, true);
+            }
+            else if(count > 0)
+            {
+                count--;
+                if(--total == 0)
+                {
+                    // METADATA stays subscribed upstream
+                    if(topic != "METADATA")
+                        sendSubscription(false, topic.data(), topic.size());
+                    allSubscriptions.erase(topic);
+                }
+                if(count == 0)
+                    o.subscriptions.erase(topic);
+            }
+        }
+    }
+
+    void handleMessage(MultipartMessage &message)
+    {
+        nMessages++;
+        JsonLite::Value header;
+        bool parsed = message.parseHeader(header);
+        const std::string &type = header["type"].asString();
+        bool isData = parsed && type == "data" && message.getNumParts() >= 3;
+        bool isMetadata = parsed && type == "metadata";
+        std::string envelope = message.getEnvelope();
+
+        if(isData)
+            nDropped += sequences.check(envelope, header);
+        if(isMetadata)
+            metadata.copyFrom(message);
+
+        for(size_t i = 0; i < outputs.size(); i++)
+        {
+            Output &o = outputs[i];
+            if(!isSubscribed(o, envelope))
+                continue;
+            if(isData && o.reencodes())
+            {
+                MultipartMessage m;
+                if(reencodeData(o, envelope, header, message, m))
+                    forward(o, m, false);
+            }
+            else if(isMetadata)
+            {
+                sendMetadata(o, message, false);
+            }
+            else
+            {
+                MultipartMessage m;
+                m.copyFrom(message);
+                forward(o, m, false);
+            }
+        }
+    }
+
+    static bool isSubscribed(const Output &o, const std::string &envelope)
+    {
+        for(std::map<std::string, int>::const_iterator it = o.subscriptions.begin(); it != o.subscriptions.end(); ++it)
+            if(envelope.compare(0, it->first.size(), it->first) == 0)
+                return true;
+        return false;
+    }
+
+    void sendMetadata(Output &o, MultipartMessage &message, bool latched)
+    {
+        MultipartMessage m;
+        JsonLite::Value header;
+        if(o.options.decimate > 1 && message.parseHeader(header))
+            reencodeMetadata(o, header, message, m);
+        else
+            m.copyFrom(message);
+        forward(o, m, latched);
+    }
+
+    void forward(Output &o, MultipartMessage &m, bool latched)
+    {
+        size_t size = m.getTotalSize();
+        if(!m.send(o.socket, ZMQ_DONTWAIT))
+        {
+            o.failed++;
+            return;
+        }
+        if(!latched)
+        {
+            o.messages++;
+            o.bytes += size;
+        }
+    }
+
+    /** Builds the message of output o for a DATA message. False when there is
+     nothing to send (no complete group of decimated samples yet) */
+    bool reencodeData(Output &o, const std::string &envelope, const JsonLite::Value &header,
+                      MultipartMessage &in, MultipartMessage &out)
+    {
+        if(in.getNumParts() < 3 || !block.decode(header, in.getData(2), in.getSize(2)))
+            return false;
+        const int nChannels = block.nChannels;
+        const int nReal = block.nReal;
+        // the input can be decimated already, its samples are dIn source
+        // samples apart
+        const int dIn = block.decimation;
+
+        int n = nReal;
+        int64_t first = block.timestamp;
+        const float *samples = block.samples;
+        int stride = block.stride;
+        int d = o.options.decimate;
+        if(d > 1)
+        {
+            Decimator &dec = o.decimators[envelope];
+            if(dec.next != block.timestamp || (int)dec.sums.size() != nChannels || dec.inputDecimation != dIn)
+            {
+                // start over at the next multiple of d input samples
+                dec.sums.assign(nChannels, 0.);
+                dec.count = 0;
+                dec.inputDecimation = dIn;
+            }
+            scratch.resize((size_t)nChannels * (nReal / d + 1));
+            n = 0;
+            first = -1;
+            for(int i = 0; i < nReal; i++)
+            {
+                int64_t s = block.getSampleNumber(i);
+                int64_t phase = ((s / dIn % d) + d) % d;
+                if(dec.count == 0 && phase != 0)
+                    continue; // before the first aligned group
+                for(int ch = 0; ch < nChannels; ch++)
+                    dec.sums[ch] += block.getChannel(ch)[i];
+                dec.count++;
+                if(phase == d - 1)
+                {
+                    if(first < 0)
+                        first = s - (int64_t)(d - 1) * dIn;
+                    for(int ch = 0; ch < nChannels; ch++)
+                    {
+                        scratch[(size_t)ch * (nReal / d + 1) + n] = (float)(dec.sums[ch] / dec.count);
+                        dec.sums[ch] = 0.;
+                    }
+                    dec.count = 0;
+                    n++;
+                }
+            }
+            dec.next = block.getSampleNumber(nReal);
+            if(n == 0)
+                return false;
+            samples = &scratch[0];
+            stride = nReal / d + 1;
+        }
+
+        JsonLite::Value h = header;
+        JsonLite::Value &hc = h.member("content");
+        hc.member("n_samples") = JsonLite::Value(n);
+        hc.member("n_real_samples") = JsonLite::Value(n);
+        hc.member("timestamp") = JsonLite::Value(first);
+        if(d > 1)
+        {
+            hc.member("sample_rate") = JsonLite::Value(block.sampleRate / d);
+            hc.member("decimation") = JsonLite::Value(dIn * d);
+        }
+
+        size_t dataSize;
+        if(o.options.int16Scale > 0.)
+        {
+            encoded16.resize((size_t)nChannels * n);
+            double k = 1. / o.options.int16Scale;
+            for(int ch = 0; ch < nChannels; ch++)
+                for(int i = 0; i < n; i++)
+                {
+                    double v = floor(samples[(size_t)ch * stride + i] * k + 0.5);
+                    encoded16[(size_t)ch * n + i] = (int16_t)std::max(-32768., std::min(32767., v));
+                }
+            hc.member("dtype") = JsonLite::Value("int16");
+            hc.member("scale") = JsonLite::Value(o.options.int16Scale);
+            dataSize = encoded16.size() * sizeof(int16_t);
+        }
+        else
+        {
+            hc.remove("dtype");
+            hc.remove("scale");
+            packed.resize((size_t)nChannels * n);
+            for(int ch = 0; ch < nChannels; ch++)
+                memcpy(&packed[(size_t)ch * n], samples + (size_t)ch * stride, n * sizeof(float));
+            dataSize = packed.size() * sizeof(float);
+        }
+        h.member("dataSize") = JsonLite::Value((int64_t)dataSize);
+
+        std::string headerText = h.toString();
+        out.addPart(in.getData(0), in.getSize(0));
+        out.addPart(headerText.data(), headerText.size());
+        if(o.options.int16Scale > 0.)
+            out.addPart(&encoded16[0], dataSize);
+        else
+            out.addPart(&packed[0], dataSize);
+        return true;
+    }
+
+    /** The sample rates of a decimated output */
+    void reencodeMetadata(Output &o, const JsonLite::Value &header, MultipartMessage &in, MultipartMessage &out)
+    {
+        int d = o.options.decimate;
+        JsonLite::Value h = header;
+        JsonLite::Value &c = h.member("content");
+        const char *lists[] = { "channels", "sources" };
+        for(int l = 0; l < 2; l++)
+        {
+            JsonLite::Value &list = c.member(lists[l]);
+            for(size_t i = 0; list.isArray() && i < list.size(); i++)
+            {
+                JsonLite::Value &item = list.item(i);
+                item.member("sample_rate") = JsonLite::Value(item["sample_rate"].asDouble() / d);
+                if(l == 1) // the plugin's own decimation, per source
+                    item.member("decimation") = JsonLite::Value(item["decimation"].asInt(1) * d);
+            }
+        }
+        c.member("decimation") = JsonLite::Value(d);
+        std::string headerText = h.toString();
+        out.addPart(in.getData(0), in.getSize(0));
+        out.addPart(headerText.data(), headerText.size());
+    }
+
+    void report(double elapsed)
+    {
+        std::cout << nMessages << " messages in, " << nDropped << " dropped upstream" << std::endl;
+        for(size_t i = 0; i < outputs.size(); i++)
+        {
+            Output &o = outputs[i];
+            int nSubscriptions = 0;
+            for(std::map<std::string, int>::iterator it = o.subscriptions.begin(); it != o.subscriptions.end(); ++it)
+                nSubscriptions += it->second;
+            std::cout << "  " << o.options.endpoint << ": " << nSubscriptions << " subscriptions, "
+                      << (o.messages - o.lastMessages) / elapsed << " msg/s, "
+                      << (o.bytes - o.lastBytes) / elapsed / 1e6 << " MB/s, "
+                      << o.failed << " send errors" << std::endl;
+            o.lastMessages = o.messages;
+            o.lastBytes = o.bytes;
+        }
+    }
+
+    Options options;
+    void *context = 0;
+    void *upstream = 0;
+    std::vector<Output> outputs;
+    std::map<std::string, int> allSubscriptions;
+    MultipartMessage metadata;
+    SequenceTracker sequences; // per DATA topic
+
+    DataBlock block;
+    std::vector<float> scratch;
+    std::vector<float> packed;
+    std::vector<int16_t> encoded16;
+
+    int64_t nMessages = 0;
+    int64_t nDropped = 0;
+};
+
+
+/** Output specification, e.g. "tcp://0.0.0.0:6556,decimate=4,int16=0.195" */
+static bool parseOutput(const std::string &spec, ZmqRelay::OutputOptions &o)
+{
+    size_t comma = spec.find(',');
+    o.endpoint = spec.substr(0, comma);
+    while(comma != std::string::npos)
+    {
+        size_t next = spec.find(',', comma + 1);
+        std::string item = spec.substr(comma + 1, next == std::string::npos ? std::string::npos : next - comma - 1);
+        std::string key = item.substr(0, item.find('='));
+        std::string value = item.find('=') != std::string::npos ? item.substr(item.find('=') + 1) : "";
+        if(key == "decimate")
+            o.decimate = std::max(1, atoi(value.c_str()));
+        else if(key == "int16")
+            o.int16Scale = value.empty() ? 1. : atof(value.c_str());
+        else
+        {
+            std::cout << "unknown output option " << key << std::endl;
+            return false;
+        }
+        comma = next;
+    }
+    return !o.endpoint.empty();
+}
+
+static void usage()
+{
+    std::cout << "usage: zmq_relay [options] -o URL[,decimate=N][,int16=SCALE] ...\n"
+              << "  -e, --endpoint URL     data socket of the ZMQ Interface (tcp://localhost:5556)\n"
+              << "  -o, --output SPEC      endpoint to publish on, can be repeated. decimate=N\n"
+              << "                         averages N samples, int16=SCALE sends int16 samples\n"
+              << "                         in units of SCALE\n"
+              << "  -w, --hwm MESSAGES     queue per subscriber (10000)\n"
+              << "  -r, --report SECONDS   throughput report interval (2)\n";
+}
+
+int main(int argc, char **argv)
+{
+    ZmqRelay::Options options;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        ZmqRelay::OutputOptions output;
+        if((a == "-e" || a == "--endpoint") && hasValue)
+            options.endpoint = argv[++i];
+        else if((a == "-o" || a == "--output") && hasValue && parseOutput(argv[i + 1], output))
+        {
+            options.outputs.push_back(output);
+            i++;
+        }
+        else if((a == "-w" || a == "--hwm") && hasValue)
+            options.hwm = atoi(argv[++i]);
+        else if((a == "-r" || a == "--report") && hasValue)
+            options.reportInterval = atof(argv[++i]);
+        else
+        {
+            usage();
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+    if(options.outputs.empty())
+    {
+        usage();
+        return 1;
+    }
+
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+
+    ZmqRelay relay(options);
+    return relay.run();
+}
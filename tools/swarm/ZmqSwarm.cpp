@@ -0,0 +1,565 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ZmqSwarm.cpp
+    Load generator for the listen socket of the ZMQ Interface: simulates many
+    applications sending heartbeats and events, to size a deployment.
+
+    Each simulated application has its own REQ socket and behaves like
+    plot_process_zmq.py: a heartbeat every --heartbeat seconds, and events
+    (Poisson, --events per second) with --payload bytes of padding, never
+    more than one request waiting for its reply. The applications can be
+    started gradually (--ramp) to find where the plugin stops keeping up.
+
+    Reported for every interval: requests offered and sent, replies (the
+    accept rate), reply latency percentiles, requests held back because the
+    previous one was unanswered, and timeouts. With --data, the STATUS
+    messages of the plugin add its side: requests answered by the listening
+    thread, events taken per block and the time receiveEvents() costs the
+    audio thread.
+
+  ==============================================================================
+*/
+
+#include <zmq.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <sys/resource.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include "../common/MultipartMessage.h"
+
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void handleSignal(int)
+{
+    stopRequested = 1;
+}
+
+static int64_t monotonicNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+//=============================================================================
+/** Log-spaced histogram of latencies in ms, 20 bins per decade from 1 us to
+ 100 s, for percentiles without keeping every value */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram() : bins(NUM_BINS, 0) {}
+
+    void add(double ms)
+    {
+        int bin = (int)floor((log10(std::max(ms, MIN_MS)) - log10(MIN_MS)) * BINS_PER_DECADE);
+        bins[std::min(std::max(bin, 0), NUM_BINS - 1)]++;
+        count++;
+        max = std::max(max, ms);
+    }
+
+    void add(const LatencyHistogram &other)
+    {
+        for(int i = 0; i < NUM_BINS; i++)
+            bins[i] += other.bins[i];
+        count += other.count;
+        max = std::max(max, other.max);
+    }
+
+    /** Upper edge of the bin holding the p-th percentile */
+    double percentile(double p) const
+    {
+        if(count == 0)
+            return 0.;
+        int64_t rank = (int64_t)ceil(p / 100. * count), seen = 0;
+        for(int i = 0; i < NUM_BINS; i++)
+        {
+            seen += bins[i];
+            if(seen >= rank)
+                return std::min(max, MIN_MS * pow(10., (i + 1) / (double)BINS_PER_DECADE));
+        }
+        return max;
+    }
+
+    int64_t getCount() const { return count; }
+    double getMax() const { return max; }
+
+private:
+    static constexpr double MIN_MS = 1e-3;
+    enum { BINS_PER_DECADE = 20, NUM_BINS = 8 * BINS_PER_DECADE };
+    std::vector<int64_t> bins;
+    int64_t count = 0;
+    double max = 0.;
+};
+
+constexpr double LatencyHistogram::MIN_MS;
+
+
+//=============================================================================
+class ZmqSwarm
+{
+public:
+    struct Options {
+        std::string listenUrl = "tcp://localhost:5557";
+        std::string dataUrl; // empty for no STATUS
+        int clients = 100;
+        double heartbeatInterval = 2.;
+        double eventRate = 0.5; // per client and second
+        int payloadBytes = 0;
+        int eventChannel = 1;
+        double rampSeconds = 0.;
+        double duration = 0.; // 0 until stopped
+        double reportInterval = 1.;
+        double timeoutMs = 2000.;
+        std::string name = "swarm";
+    };
+
+    ZmqSwarm(const Options &o) : options(o), random(std::random_device()()) {}
+
+    ~ZmqSwarm()
+    {
+        for(size_t i = 0; i < clients.size(); i++)
+            if(clients[i].socket)
+                zmq_close(clients[i].socket);
+        if(statusSocket) zmq_close(statusSocket);
+        if(context) zmq_ctx_destroy(context);
+    }
+
+    int run()
+    {
+        raiseFileLimit();
+        context = zmq_ctx_new();
+        zmq_ctx_set(context, ZMQ_MAX_SOCKETS, options.clients + 16);
+        if(!options.dataUrl.empty())
+        {
+            statusSocket = zmq_socket(context, ZMQ_SUB);
+            zmq_setsockopt(statusSocket, ZMQ_SUBSCRIBE, "STATUS", 6);
+            if(zmq_connect(statusSocket, options.dataUrl.c_str()) != 0)
+            {
+                std::cout << "couldn't connect " << options.dataUrl << ": " << zmq_strerror(zmq_errno()) << std::endl;
+                return 1;
+            }
+        }
+        padding.assign((size_t)options.payloadBytes, 'x');
+
+        std::cout << options.clients << " applications on " << options.listenUrl << ": heartbeat every "
+                  << options.heartbeatInterval << " s, " << options.eventRate << " events/s with "
+                  << options.payloadBytes << " bytes of padding";
+        if(options.rampSeconds > 0.)
+            std::cout << ", started over " << options.rampSeconds << " s";
+        std::cout << std::endl;
+
+        startNs = lastReportNs = monotonicNs();
+        clients.resize((size_t)options.clients);
+        for(int i = 0; i < options.clients; i++)
+        {
+            Client &c = clients[(size_t)i];
+            c.index = i;
+            c.startNs = startNs + (int64_t)(options.rampSeconds * 1e9 * i / options.clients);
+            char uuid[40];
+            snprintf(uuid, sizeof(uuid), "%08x-0000-4000-8000-%012x", (unsigned)random(), i);
+            c.uuid = uuid;
+        }
+
+        int64_t nextReport = startNs + (int64_t)(options.reportInterval * 1e9);
+        int64_t endNs = options.duration > 0. ? startNs + (int64_t)(options.duration * 1e9) : 0;
+        std::vector<zmq_pollitem_t> items;
+        std::vector<Client *> polled;
+        while(!stopRequested && (endNs == 0 || monotonicNs() < endNs))
+        {
+            int64_t now = monotonicNs();
+            int64_t nextDue = nextReport;
+            items.clear();
+            polled.clear();
+            for(size_t i = 0; i < clients.size(); i++)
+            {
+                Client &c = clients[i];
+                if(!c.socket)
+                {
+                    if(now >= c.startNs)
+                        startClient(c, now);
+                    else
+                    {
+                        nextDue = std::min(nextDue, c.startNs);
+                        continue;
+                    }
+                }
+                if(!c.socket)
+                    break; // out of sockets, stopping
+                if(c.waiting && now - c.sentNs > (int64_t)(options.timeoutMs * 1e6))
+                {
+                    // given up, a late reply will be dropped (ZMQ_REQ_CORRELATE)
+                    interval.timeouts++;
+                    c.waiting = false;
+                }
+                if(!c.waiting)
+                    sendDue(c, now);
+                if(c.waiting)
+                {
+                    zmq_pollitem_t item = { c.socket, 0, ZMQ_POLLIN, 0 };
+                    items.push_back(item);
+                    polled.push_back(&c);
+                    nextDue = std::min(nextDue, c.sentNs + (int64_t)(options.timeoutMs * 1e6));
+                }
+                else
+                    nextDue = std::min(nextDue, std::min(c.nextHeartbeatNs, c.nextEventNs));
+            }
+            if(statusSocket)
+            {
+                zmq_pollitem_t item = { statusSocket, 0, ZMQ_POLLIN, 0 };
+                items.push_back(item);
+            }
+
+            long timeoutMs = (long)std::max<int64_t>(0, (nextDue - now + 999999) / 1000000);
+            zmq_poll(items.data(), (int)items.size(), std::min(timeoutMs, 100L));
+            now = monotonicNs();
+            for(size_t i = 0; i < polled.size(); i++)
+                if(items[i].revents & ZMQ_POLLIN)
+                    receiveReply(*polled[i], now);
+            if(statusSocket && (items.back().revents & ZMQ_POLLIN))
+                receiveStatus();
+
+            if(now >= nextReport)
+            {
+                report(now);
+                nextReport += (int64_t)(options.reportInterval * 1e9);
+            }
+        }
+        summary(monotonicNs());
+        return 0;
+    }
+
+private:
+    struct Client {
+        int index = 0;
+        std::string uuid;
+        void *socket = 0;
+        int64_t startNs = 0;
+        int64_t nextHeartbeatNs = 0, nextEventNs = 0;
+        bool waiting = false;
+        bool held = false; // a request came due while waiting
+        int64_t sentNs = 0;
+        int eventId = 0;
+    };
+
+    struct Counters {
+        int64_t offered = 0, heartbeats = 0, events = 0, replies = 0, held = 0, timeouts = 0, errors = 0;
+        LatencyHistogram latency;
+
+        void add(const Counters &o)
+        {
+            offered += o.offered;
+            heartbeats += o.heartbeats;
+            events += o.events;
+            replies += o.replies;
+            held += o.held;
+            timeouts += o.timeouts;
+            errors += o.errors;
+            latency.add(o.latency);
+        }
+    };
+
+    /** What the plugin reported in its STATUS messages */
+    struct PluginCounters {
+        int64_t statuses = 0, blocks = 0, receivedEvents = 0, listenRequests = 0;
+        double receiveSum = 0., receiveMax = 0., processMax = 0., intervalMax = 0.;
+    };
+
+    static void raiseFileLimit()
+    {
+        // one connection and one mailbox per application
+        struct rlimit limit;
+        if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+        {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+
+    void startClient(Client &c, int64_t now)
+    {
+        c.socket = zmq_socket(context, ZMQ_REQ);
+        if(!c.socket)
+        {
+            std::cout << "couldn't create socket " << c.index << ": " << zmq_strerror(zmq_errno())
+                      << " (see ulimit -n)" << std::endl;
+            stopRequested = 1;
+            return;
+        }
+        // a new request after a timeout, instead of a new socket
+        int linger = 0, on = 1;
+        zmq_setsockopt(c.socket, ZMQ_LINGER, &linger, sizeof(linger));
+        zmq_setsockopt(c.socket, ZMQ_REQ_RELAXED, &on, sizeof(on));
+        zmq_setsockopt(c.socket, ZMQ_REQ_CORRELATE, &on, sizeof(on));
+        zmq_connect(c.socket, options.listenUrl.c_str());
+        // the first heartbeat makes the application known
+        c.nextHeartbeatNs = now;
+        c.nextEventNs = now + nextEventDelay();
+    }
+
+    int64_t nextEventDelay()
+    {
+        if(options.eventRate <= 0.)
+            return INT64_MAX / 2;
+        std::exponential_distribution<double> d(options.eventRate);
+        return (int64_t)(d(random) * 1e9);
+    }
+
+    void sendDue(Client &c, int64_t now)
+    {
+        char text[512];
+        int size;
+        if(c.nextEventNs <= now)
+        {
+            size = snprintf(text, sizeof(text), "{\"application\": \"%s-%d\", \"uuid\": \"%s\", \"type\": \"event\", "
+                            "\"event\": {\"type\": 3, \"sample_num\": 0, \"event_id\": %d, \"event_channel\": %d}",
+                            options.name.c_str(), c.index, c.uuid.c_str(), c.eventId % 2 + 1, options.eventChannel);
+            c.eventId++;
+            // Poisson from the nominal times, unless far behind
+            c.nextEventNs = std::max<int64_t>(c.nextEventNs + nextEventDelay(), now - 1000000000LL);
+            interval.events++;
+        }
+        else if(c.nextHeartbeatNs <= now)
+        {
+            size = snprintf(text, sizeof(text), "{\"application\": \"%s-%d\", \"uuid\": \"%s\", \"type\": \"heartbeat\"",
+                            options.name.c_str(), c.index, c.uuid.c_str());
+            c.nextHeartbeatNs = now + (int64_t)(options.heartbeatInterval * 1e9);
+            interval.heartbeats++;
+        }
+        else
+            return;
+
+        message.assign(text, (size_t)size);
+        if(!padding.empty())
+            message += ", \"padding\": \"" + padding + "\"";
+        message += "}";
+        if(zmq_send(c.socket, message.data(), message.size(), ZMQ_DONTWAIT) < 0)
+        {
+            interval.errors++;
+            return;
+        }
+        interval.offered += c.held ? 0 : 1;
+        c.held = false;
+        c.waiting = true;
+        c.sentNs = now;
+    }
+
+    void receiveReply(Client &c, int64_t now)
+    {
+        char reply[256];
+        int size = zmq_recv(c.socket, reply, sizeof(reply) - 1, ZMQ_DONTWAIT);
+        if(size < 0)
+            return;
+        reply[std::min(size, (int)sizeof(reply) - 1)] = 0;
+        if(strstr(reply, "could not be read"))
+            interval.errors++;
+        interval.replies++;
+        interval.latency.add((now - c.sentNs) * 1e-6);
+        c.waiting = false;
+
+        // what came due meanwhile had to wait for this reply
+        if(c.nextEventNs <= now || c.nextHeartbeatNs <= now)
+        {
+            c.held = true;
+            interval.held++;
+            interval.offered++;
+        }
+    }
+
+    void receiveStatus()
+    {
+        MultipartMessage m;
+        while(m.recv(statusSocket, ZMQ_DONTWAIT))
+        {
+            JsonLite::Value header;
+            if(!m.parseHeader(header))
+                continue;
+            const JsonLite::Value &content = header["content"];
+            const JsonLite::Value &timing = content["timing"];
+            int64_t blocks = timing["blocks"].asInt();
+            plugin.statuses++;
+            plugin.blocks += blocks;
+            plugin.receivedEvents += timing["received_events"].asInt();
+            plugin.receiveSum += timing["receive_mean_ms"].asDouble() * blocks;
+            plugin.receiveMax = std::max(plugin.receiveMax, timing["receive_max_ms"].asDouble());
+            plugin.processMax = std::max(plugin.processMax, timing["process_max_ms"].asDouble());
+            plugin.intervalMax = std::max(plugin.intervalMax, timing["interval_max_ms"].asDouble());
+            plugin.listenRequests += content["listen_requests"].asInt();
+        }
+    }
+
+    int countStarted(int64_t now) const
+    {
+        int n = 0;
+        for(size_t i = 0; i < clients.size(); i++)
+            n += clients[i].startNs <= now;
+        return n;
+    }
+
+    int countWaiting() const
+    {
+        int n = 0;
+        for(size_t i = 0; i < clients.size(); i++)
+            n += clients[i].waiting;
+        return n;
+    }
+
+    void printCounters(const Counters &c, double seconds, const PluginCounters &p) const
+    {
+        double accepted = c.replies + c.timeouts > 0 ? 100. * c.replies / (c.replies + c.timeouts) : 100.;
+        std::cout << "  offered " << c.offered / seconds << "/s, sent " << (c.heartbeats + c.events) / seconds
+                  << "/s (" << c.heartbeats << " heartbeats, " << c.events << " events), replies "
+                  << c.replies / seconds << "/s, " << accepted << "% accepted\n"
+                  << "  latency p50 " << c.latency.percentile(50.) << " p99 " << c.latency.percentile(99.)
+                  << " max " << c.latency.getMax() << " ms, " << c.held << " held back, " << c.timeouts
+                  << " timeouts, " << c.errors << " errors" << std::endl;
+        if(p.statuses > 0)
+        {
+            // one STATUS per second
+            std::cout << "  plugin: " << (double)p.listenRequests / p.statuses << " requests/s, "
+                      << (p.blocks ? (double)p.receivedEvents / p.blocks : 0.) << " events/block, receiveEvents "
+                      << (p.blocks ? p.receiveSum / p.blocks : 0.) << " ms mean, " << p.receiveMax
+                      << " ms max, process max " << p.processMax << " ms, block interval max "
+                      << p.intervalMax << " ms" << std::endl;
+        }
+    }
+
+    void report(int64_t now)
+    {
+        std::cout << "t=" << (now - startNs) * 1e-9 << " s, " << countStarted(now) << " applications, "
+                  << countWaiting() << " waiting for a reply\n";
+        printCounters(interval, std::max(1e-9, (now - lastReportNs) * 1e-9), plugin);
+        lastReportNs = now;
+        total.add(interval);
+        interval = Counters();
+        totalPlugin.statuses += plugin.statuses;
+        totalPlugin.blocks += plugin.blocks;
+        totalPlugin.receivedEvents += plugin.receivedEvents;
+        totalPlugin.listenRequests += plugin.listenRequests;
+        totalPlugin.receiveSum += plugin.receiveSum;
+        totalPlugin.receiveMax = std::max(totalPlugin.receiveMax, plugin.receiveMax);
+        totalPlugin.processMax = std::max(totalPlugin.processMax, plugin.processMax);
+        totalPlugin.intervalMax = std::max(totalPlugin.intervalMax, plugin.intervalMax);
+        plugin = PluginCounters();
+    }
+
+    void summary(int64_t now)
+    {
+        if(now - lastReportNs > (int64_t)(options.reportInterval * 1e8))
+            report(now); // the last partial interval
+        else
+            total.add(interval);
+        std::cout << "total over " << (now - startNs) * 1e-9 << " s:\n";
+        printCounters(total, std::max(1e-9, (now - startNs) * 1e-9), totalPlugin);
+    }
+
+    Options options;
+    void *context = 0;
+    void *statusSocket = 0;
+    std::mt19937 random;
+    std::vector<Client> clients;
+    std::string padding;
+    std::string message;
+    int64_t startNs = 0, lastReportNs = 0;
+    Counters interval, total;
+    PluginCounters plugin, totalPlugin;
+};
+
+
+static void usage()
+{
+    std::cout << "usage: zmq_swarm [options]\n"
+              << "  -l, --listen URL       listen socket of the plugin (tcp://localhost:5557)\n"
+              << "  -d, --data URL         data socket, for the STATUS messages (none)\n"
+              << "  -n, --clients N        simulated applications (100)\n"
+              << "  -b, --heartbeat S      heartbeat interval (2)\n"
+              << "  -e, --events RATE      events per second and application (0.5)\n"
+              << "  -p, --payload BYTES    padding added to each request (0)\n"
+              << "  -c, --channel N        event channel (1)\n"
+              << "      --ramp S           start the applications over S seconds (0)\n"
+              << "  -t, --duration S       stop after S seconds (0, until interrupted)\n"
+              << "  -r, --report S         report interval (1)\n"
+              << "      --timeout MS       wait for a reply before starting over (2000)\n"
+              << "      --name NAME        application name prefix (swarm)\n";
+}
+
+int main(int argc, char **argv)
+{
+    ZmqSwarm::Options options;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if((a == "-l" || a == "--listen") && hasValue)
+            options.listenUrl = argv[++i];
+        else if((a == "-d" || a == "--data") && hasValue)
+            options.dataUrl = argv[++i];
+        else if((a == "-n" || a == "--clients") && hasValue)
+            options.clients = std::max(1, atoi(argv[++i]));
+        else if((a == "-b" || a == "--heartbeat") && hasValue)
+            options.heartbeatInterval = atof(argv[++i]);
+        else if((a == "-e" || a == "--events") && hasValue)
+            options.eventRate = atof(argv[++i]);
+        else if((a == "-p" || a == "--payload") && hasValue)
+            options.payloadBytes = std::max(0, atoi(argv[++i]));
+        else if((a == "-c" || a == "--channel") && hasValue)
+            options.eventChannel = atoi(argv[++i]);
+        else if(a == "--ramp" && hasValue)
+            options.rampSeconds = atof(argv[++i]);
+        else if((a == "-t" || a == "--duration") && hasValue)
+            options.duration = atof(argv[++i]);
+        else if((a == "-r" || a == "--report") && hasValue)
+            options.reportInterval = atof(argv[++i]);
+        else if(a == "--timeout" && hasValue)
+            options.timeoutMs = atof(argv[++i]);
+        else if(a == "--name" && hasValue)
+            options.name = argv[++i];
+        else
+        {
+            usage();
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+    if(options.heartbeatInterval <= 0. || options.reportInterval <= 0. || options.timeoutMs <= 0.)
+    {
+        usage();
+        return 1;
+    }
+
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+
+    ZmqSwarm swarm(options);
+    return swarm.run();
+}
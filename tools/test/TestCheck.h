@@ -0,0 +1,88 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    TestCheck.h
+    The checks of the unit tests (make test). Each test is a program whose
+    main() calls TEST() for its cases and returns testResult().
+
+  ==============================================================================
+*/
+
+#ifndef TESTCHECK_H_INCLUDED
+#define TESTCHECK_H_INCLUDED
+
+#include <math.h>
+#include <iostream>
+
+
+static int testFailures = 0;
+static const char *testName = "";
+
+#define CHECK(condition) \
+    do { \
+        if(!(condition)) \
+        { \
+            std::cout << __FILE__ << ":" << __LINE__ << ": " << testName \
+                << ": CHECK(" #condition ") failed" << std::endl; \
+            testFailures++; \
+        } \
+    } while(0)
+
+#define CHECK_EQUAL(a, b) \
+    do { \
+        if(!((a) == (b))) \
+        { \
+            std::cout << __FILE__ << ":" << __LINE__ << ": " << testName \
+                << ": " #a " is " << (a) << ", expected " << (b) << std::endl; \
+            testFailures++; \
+        } \
+    } while(0)
+
+#define CHECK_NEAR(a, b, tolerance) \
+    do { \
+        if(!(fabs((double)(a) - (double)(b)) <= (tolerance))) \
+        { \
+            std::cout << __FILE__ << ":" << __LINE__ << ": " << testName \
+                << ": " #a " is " << (a) << ", expected " << (b) << " +- " << (tolerance) << std::endl; \
+            testFailures++; \
+        } \
+    } while(0)
+
+#define TEST(function) \
+    do { \
+        testName = #function; \
+        function(); \
+    } while(0)
+
+static int testResult(const char *program)
+{
+    if(testFailures)
+        std::cout << program << ": " << testFailures << " checks failed" << std::endl;
+    else
+        std::cout << program << ": ok" << std::endl;
+    return testFailures ? 1 : 0;
+}
+
+
+#endif  // TESTCHECK_H_INCLUDED
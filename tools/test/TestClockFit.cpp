@@ -0,0 +1,146 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    TestClockFit.cpp
+    The sample number to host clock mapping fitted on the SYNC messages.
+
+  ==============================================================================
+*/
+
+#include <stdlib.h>
+#include <string>
+#include "../common/ClockFit.h"
+#include "TestCheck.h"
+
+
+static const double RATE = 30000.;
+static const int64_t MONOTONIC0 = 5000000000000LL;
+static const int64_t REALTIME0 = 1700000000000000000LL;
+
+/** A clock 20 ppm fast, sync points every 1 s */
+static void exactLine()
+{
+    const double nsPerSample = 1.e9 / RATE * (1. + 20.e-6);
+    ClockFit fit;
+    fit.nominalRate = RATE;
+    CHECK(!fit.isValid());
+    for(int i = 0; i < 10; i++)
+    {
+        int64_t sample = 1000 + i * 30000;
+        int64_t ns = (int64_t)llround(sample * nsPerSample);
+        fit.add(sample, MONOTONIC0 + ns, REALTIME0 + ns);
+    }
+    CHECK(fit.isValid());
+    CHECK_EQUAL(fit.getNumPoints(), 10);
+    CHECK_NEAR(fit.nsPerSample, nsPerSample, 1.e-6);
+    CHECK_NEAR(fit.residualNs, 0., 1.);
+    // within the points and an hour beyond
+    CHECK_NEAR(fit.toMonotonicNs(150000), MONOTONIC0 + 150000 * nsPerSample, 2.);
+    int64_t later = 1000 + 3600 * 30000LL;
+    CHECK_NEAR(fit.toMonotonicNs(later), MONOTONIC0 + later * nsPerSample, 100.);
+    CHECK_NEAR(fit.toRealtimeNs(later) - fit.toMonotonicNs(later), REALTIME0 - MONOTONIC0, 2.);
+}
+
+/** Points late by 0 to 2 ms (the audio thread), the line averages them */
+static void jitterAveraged()
+{
+    const double nsPerSample = 1.e9 / RATE;
+    srand(1);
+    ClockFit fit;
+    fit.nominalRate = RATE;
+    double worst = 0.;
+    for(int i = 0; i < ClockFit::MAX_POINTS; i++)
+    {
+        int64_t sample = i * 30000LL;
+        int64_t late = rand() % 2000000;
+        int64_t ns = (int64_t)llround(sample * nsPerSample) + late;
+        fit.add(sample, MONOTONIC0 + ns, REALTIME0 + ns);
+        worst = late > worst ? late : worst;
+    }
+    CHECK(fit.residualNs > 100000.);
+    CHECK(fit.residualNs < 1000000.);
+    // the mean lateness (1 ms) is a constant offset, the slope is unbiased
+    CHECK_NEAR(fit.nsPerSample, nsPerSample, nsPerSample * 5.e-6);
+    CHECK_NEAR(fit.toMonotonicNs(30 * 30000) - MONOTONIC0, 30 * 1.e9 + 1.e6, 300000.);
+}
+
+/** The last MAX_POINTS are kept, a sample number going back starts over */
+static void windowAndRestart()
+{
+    ClockFit fit;
+    fit.nominalRate = RATE;
+    for(int i = 0; i < ClockFit::MAX_POINTS + 10; i++)
+        fit.add(i * 30000LL, MONOTONIC0 + i * 1000000000LL, REALTIME0 + i * 1000000000LL);
+    CHECK_EQUAL(fit.getNumPoints(), (int)ClockFit::MAX_POINTS);
+
+    fit.add(500, MONOTONIC0 + 900 * 1000000000LL, REALTIME0 + 900 * 1000000000LL);
+    CHECK_EQUAL(fit.getNumPoints(), 1);
+    CHECK(!fit.isValid());
+    fit.add(30500, MONOTONIC0 + 901 * 1000000000LL, REALTIME0 + 901 * 1000000000LL);
+    CHECK(fit.isValid());
+    CHECK_NEAR(fit.toMonotonicNs(500), MONOTONIC0 + 900 * 1000000000LL, 1.);
+}
+
+static std::string syncHeader(int64_t sample, int64_t monotonicNs)
+{
+    return "{\"message_no\": -1, \"type\": \"sync\", \"content\": {\"sequence\": 0, \"monotonic_ns\": " +
+        std::to_string(monotonicNs) + ", \"realtime_ns\": " + std::to_string(monotonicNs + 1000) +
+        ", \"sources\": [{\"topic\": \"DATA/100/30000\", \"source_node_id\": 100, \"sample_rate\": 30000, "
+        "\"sample_num\": " + std::to_string(sample) + "}, {\"topic\": \"DATA/101/1000\", \"source_node_id\": 101, "
+        "\"sample_rate\": 1000, \"sample_num\": " + std::to_string(sample / 30) + "}]}, \"data_size\": 0}";
+}
+
+/** One fit per source of the SYNC messages */
+static void clockSetFromSync()
+{
+    ClockSet clocks;
+    for(int i = 1; i <= 5; i++)
+    {
+        std::string text = syncHeader(i * 30000LL, MONOTONIC0 + i * 1000000000LL);
+        JsonLite::Value header;
+        CHECK(JsonLite::parse(text.data(), text.size(), header));
+        clocks.addSync(header);
+    }
+    const ClockFit *fast = clocks.find("DATA/100/30000");
+    const ClockFit *slow = clocks.find("DATA/101/1000");
+    CHECK(fast && slow && fast != slow);
+    CHECK(clocks.find("DATA/102/30000") == 0);
+    CHECK(clocks.find("") == fast);
+    if(!fast || !slow)
+        return;
+    CHECK_EQUAL(fast->getNumPoints(), 5);
+    CHECK_NEAR(fast->nominalRate, 30000., 0.);
+    CHECK_NEAR(fast->nsPerSample, 1.e9 / 30000., 1.e-6);
+    CHECK_NEAR(slow->nsPerSample, 1.e6, 1.e-3);
+    CHECK_NEAR(slow->toRealtimeNs(2500) - slow->toMonotonicNs(2500), 1000., 1.);
+}
+
+int main()
+{
+    TEST(exactLine);
+    TEST(jitterAveraged);
+    TEST(windowAndRestart);
+    TEST(clockSetFromSync);
+    return testResult("TestClockFit");
+}
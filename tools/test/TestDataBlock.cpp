@@ -0,0 +1,115 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    TestDataBlock.cpp
+    Decoding of the DATA messages as sent by the plugin and the relay:
+    float32 or int16, decimated or not, with padding after the real samples.
+
+  ==============================================================================
+*/
+
+#include <string>
+#include <vector>
+#include "../common/DataBlock.h"
+#include "TestCheck.h"
+
+
+static JsonLite::Value header(const std::string &content)
+{
+    std::string text = "{\"message_no\": 5, \"type\": \"data\", \"content\": {" + content + "}, \"dataSize\": 0}";
+    JsonLite::Value h;
+    CHECK(JsonLite::parse(text.data(), text.size(), h));
+    return h;
+}
+
+/** float32 samples are used in place, with the stride of the frame */
+static void float32InPlace()
+{
+    std::vector<float> frame(2 * 8);
+    for(size_t i = 0; i < frame.size(); i++)
+        frame[i] = i * 0.25f;
+    DataBlock block;
+    CHECK(block.decode(header("\"n_channels\": 2, \"n_samples\": 8, \"n_real_samples\": 6, "
+                              "\"timestamp\": 1000, \"sequence\": 3, \"sample_rate\": 30000"),
+                       &frame[0], frame.size() * sizeof(float)));
+    CHECK(!block.int16);
+    CHECK_EQUAL(block.decimation, 1);
+    CHECK_EQUAL(block.nReal, 6);
+    CHECK_EQUAL(block.sequence, 3);
+    CHECK(block.samples == &frame[0]);
+    CHECK_EQUAL(block.getChannel(1)[0], 8 * 0.25f);
+    CHECK_EQUAL(block.getSampleNumber(5), 1005);
+}
+
+/** int16 samples are scaled into a packed buffer of the real samples, the
+ sample numbers of a decimated block are decimation apart */
+static void int16Decimated()
+{
+    const int16_t frame[] = { -32768, -2, 0, 2, 32767, 99,
+                              10, 20, 30, 40, 50, 99 };
+    DataBlock block;
+    CHECK(block.decode(header("\"n_channels\": 2, \"n_samples\": 6, \"n_real_samples\": 5, "
+                              "\"timestamp\": 4000, \"sample_rate\": 7500, \"decimation\": 4, "
+                              "\"dtype\": \"int16\", \"scale\": 0.5"),
+                       frame, sizeof(frame)));
+    CHECK(block.int16);
+    CHECK_EQUAL(block.decimation, 4);
+    CHECK_NEAR(block.sampleRate, 7500., 0.);
+    CHECK_EQUAL(block.stride, 5);
+    CHECK_EQUAL(block.getChannel(0)[0], -16384.f);
+    CHECK_EQUAL(block.getChannel(0)[1], -1.f);
+    CHECK_EQUAL(block.getChannel(0)[4], 16383.5f);
+    CHECK_EQUAL(block.getChannel(1)[0], 5.f);
+    CHECK_EQUAL(block.getChannel(1)[4], 25.f);
+    CHECK_EQUAL(block.getSampleNumber(0), 4000);
+    CHECK_EQUAL(block.getSampleNumber(3), 4012);
+}
+
+/** Frames shorter than the header says and empty blocks are refused */
+static void malformed()
+{
+    std::vector<char> frame(2 * 8 * sizeof(float));
+    DataBlock block;
+    const std::string twoBy8 = "\"n_channels\": 2, \"n_samples\": 8, \"timestamp\": 0";
+    CHECK(block.decode(header(twoBy8), &frame[0], frame.size()));
+    CHECK_EQUAL(block.nReal, 8);
+    CHECK(!block.decode(header(twoBy8), &frame[0], frame.size() - 1));
+    CHECK_EQUAL(block.error, "short data frame");
+    // the same frame is long enough as int16
+    CHECK(block.decode(header(twoBy8 + ", \"dtype\": \"int16\", \"scale\": 1"), &frame[0], frame.size() / 2));
+    CHECK(!block.decode(header(twoBy8 + ", \"n_real_samples\": 9"), &frame[0], frame.size()));
+    CHECK_EQUAL(block.error, "empty data block");
+    CHECK(!block.decode(header("\"n_channels\": 0, \"n_samples\": 8"), &frame[0], frame.size()));
+    // no decimation below 1
+    CHECK(block.decode(header(twoBy8 + ", \"decimation\": 0"), &frame[0], frame.size()));
+    CHECK_EQUAL(block.decimation, 1);
+}
+
+int main()
+{
+    TEST(float32InPlace);
+    TEST(int16Decimated);
+    TEST(malformed);
+    return testResult("TestDataBlock");
+}
@@ -0,0 +1,176 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    TestInjector.cpp
+    The jitter buffer of the injected channels: blocks in any order, late,
+    missing or too far ahead.
+
+  ==============================================================================
+*/
+
+#include <vector>
+#include "ZmqInjector.h"
+#include "TestCheck.h"
+
+
+static const int DELAY = 100;
+static const int BLOCK = 64;
+
+/** The value injected for sample s of channel ch */
+static float value(int ch, int64 s)
+{
+    return (float)(ch * 1000000 + s);
+}
+
+static bool write(ZmqInjector &injector, const char *name, int64 sampleNum,
+                  int firstChannel, int nChannels, int nSamples)
+{
+    ZmqInjectHeader header;
+    header.sampleNum = sampleNum;
+    header.firstChannel = firstChannel;
+    header.nChannels = nChannels;
+    header.nSamples = nSamples;
+    header.reserved = 0;
+    std::vector<float> data((size_t)nChannels * nSamples);
+    for(int c = 0; c < nChannels; c++)
+        for(int i = 0; i < nSamples; i++)
+            data[c * nSamples + i] = value(firstChannel + c, sampleNum + i);
+    return injector.write(name, header, data.data());
+}
+
+/** Samples rendered at timestamp - DELAY that are the ones written (or 0) */
+static int countCorrect(const AudioSampleBuffer &buffer, int firstChannel, int nChannels, int64 timestamp)
+{
+    int correct = 0;
+    for(int c = 0; c < nChannels; c++)
+    {
+        const float *out = buffer.getReadPointer(firstChannel + c);
+        for(int i = 0; i < buffer.getNumSamples(); i++)
+            correct += out[i] == value(c, timestamp - DELAY + i);
+    }
+    return correct;
+}
+
+/** Blocks coming back within the delay, in any order, are all rendered */
+static void inTime()
+{
+    ZmqInjector injector;
+    injector.prepare(2, DELAY);
+    CHECK_EQUAL(injector.getNumChannels(), 2);
+    CHECK_EQUAL(injector.getDelaySamples(), DELAY);
+    // two extra channels in front, as in the signal chain
+    AudioSampleBuffer buffer(4, BLOCK);
+
+    int64 t = 10000;
+    write(injector, "filtered", t - DELAY, 0, 2, BLOCK);
+    for(int b = 0; b < 50; b++, t += BLOCK)
+    {
+        // the next block, and every other time the two after it swapped
+        if(b % 2 == 0)
+        {
+            write(injector, "filtered", t - DELAY + 2 * BLOCK, 0, 2, BLOCK);
+            write(injector, "filtered", t - DELAY + BLOCK, 0, 2, BLOCK);
+        }
+        buffer.clear();
+        injector.render(buffer, 2, t, BLOCK);
+        CHECK_EQUAL(countCorrect(buffer, 2, 2, t), 2 * BLOCK);
+    }
+    CHECK_EQUAL(injector.getNumStreams(), 1);
+    const ZmqInjector::Stats &st = injector.getStats(0);
+    CHECK_EQUAL(String(st.name), String("filtered"));
+    CHECK_EQUAL(st.blocks, 51);
+    CHECK_EQUAL(st.samples, 51 * BLOCK);
+    CHECK_EQUAL(st.late + st.overrun + st.underrun, 0);
+}
+
+/** Missing samples are zeros, samples already read or too far ahead are dropped */
+static void lateMissingAhead()
+{
+    ZmqInjector injector;
+    injector.prepare(1, DELAY);
+    AudioSampleBuffer buffer(1, BLOCK);
+
+    const int64 t = 5000;
+    // half of the first block only
+    write(injector, "a", t - DELAY, 0, 1, BLOCK / 2);
+    injector.render(buffer, 0, t, BLOCK);
+    const float *out = buffer.getReadPointer(0);
+    CHECK_EQUAL(out[BLOCK / 2 - 1], value(0, t - DELAY + BLOCK / 2 - 1));
+    CHECK_EQUAL(out[BLOCK / 2], 0.f);
+    CHECK_EQUAL(injector.getStats(0).underrun, BLOCK / 2);
+
+    // the rest comes too late, with 10 samples of the next block
+    write(injector, "a", t - DELAY + BLOCK / 2, 0, 1, BLOCK / 2 + 10);
+    CHECK_EQUAL(injector.getStats(0).late, BLOCK / 2);
+    injector.render(buffer, 0, t + BLOCK, BLOCK);
+    CHECK_EQUAL(out[9], value(0, t - DELAY + BLOCK + 9));
+    CHECK_EQUAL(out[10], 0.f);
+    CHECK_EQUAL(injector.getStats(0).underrun, BLOCK / 2 + BLOCK - 10);
+
+    // beyond the ring: the part that fits is kept
+    const int64 next = t - DELAY + 2 * BLOCK;
+    const int64 far = next + (1 << 15) - 16;
+    write(injector, "a", far, 0, 1, 32);
+    CHECK_EQUAL(injector.getStats(0).overrun, 16);
+    CHECK_EQUAL(injector.getStats(0).late, BLOCK / 2);
+}
+
+/** Blocks that don't fit the injected channels are refused, the streams
+ are counted apart */
+static void channelsAndStreams()
+{
+    ZmqInjector injector;
+    injector.prepare(3, DELAY);
+    CHECK(!write(injector, "a", 0, 2, 2, BLOCK));
+    CHECK(!write(injector, "a", 0, -1, 1, BLOCK));
+    CHECK(!write(injector, "a", 0, 0, 1, 0));
+    CHECK(write(injector, "a", 0, 0, 2, BLOCK));
+    CHECK(write(injector, "b", 0, 2, 1, BLOCK));
+    CHECK_EQUAL(injector.getNumStreams(), 2);
+    CHECK_EQUAL(injector.getStats(1).samples, BLOCK);
+
+    // the last slot is shared by the streams that don't fit
+    for(int i = 0; i < ZmqInjector::MAX_STREAMS + 2; i++)
+        write(injector, String("s" + std::to_string(i)).toRawUTF8(), 0, 0, 1, 1);
+    CHECK_EQUAL(injector.getNumStreams(), (int)ZmqInjector::MAX_STREAMS);
+    CHECK_EQUAL(injector.getStats(ZmqInjector::MAX_STREAMS - 1).blocks, 5); // s5 to s9
+
+    // a channel nobody wrote to is silent and not an underrun
+    injector.reset();
+    CHECK_EQUAL(injector.getNumStreams(), 0);
+    write(injector, "a", 1000 - DELAY, 0, 1, BLOCK);
+    AudioSampleBuffer buffer(3, BLOCK);
+    injector.render(buffer, 0, 1000, BLOCK);
+    CHECK_EQUAL(countCorrect(buffer, 0, 1, 1000), BLOCK);
+    CHECK_EQUAL(buffer.getReadPointer(2)[0], 0.f);
+    CHECK_EQUAL(injector.getStats(0).underrun, 0);
+}
+
+int main()
+{
+    TEST(inTime);
+    TEST(lateMissingAhead);
+    TEST(channelsAndStreams);
+    return testResult("TestInjector");
+}
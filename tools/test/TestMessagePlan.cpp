@@ -0,0 +1,263 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    TestMessagePlan.cpp
+    The message plans of the plugin: the patched headers are the JSON the
+    clients expect, the slots are reused, and building a message takes no
+    memory (operator new is counted, as JUCE strings and JSON would use it).
+
+  ==============================================================================
+*/
+
+#include <zmq.h>
+#include <stdlib.h>
+#include <new>
+#include <string>
+#include <vector>
+#include "ZmqMessagePlan.h"
+#include "../common/JsonLite.h"
+#include "TestCheck.h"
+
+
+static int64 allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+
+/** A PAIR socket pair, the plan sends on out */
+struct Sockets
+{
+    Sockets()
+    {
+        context = zmq_ctx_new();
+        in = zmq_socket(context, ZMQ_PAIR);
+        out = zmq_socket(context, ZMQ_PAIR);
+        zmq_bind(in, "inproc://plan");
+        zmq_connect(out, "inproc://plan");
+    }
+    ~Sockets()
+    {
+        zmq_close(in);
+        zmq_close(out);
+        zmq_ctx_term(context);
+    }
+
+    /** The frames of the next message, false if there is none */
+    bool receive(std::vector<std::string> &frames)
+    {
+        frames.clear();
+        int more = 1;
+        while(more)
+        {
+            zmq_msg_t frame;
+            zmq_msg_init(&frame);
+            if(zmq_msg_recv(&frame, in, ZMQ_DONTWAIT) == -1)
+            {
+                zmq_msg_close(&frame);
+                return false;
+            }
+            frames.push_back(std::string((const char *)zmq_msg_data(&frame), zmq_msg_size(&frame)));
+            more = zmq_msg_more(&frame);
+            zmq_msg_close(&frame);
+        }
+        return true;
+    }
+
+    void *context, *in, *out;
+};
+
+static String spikeTemplate()
+{
+    return String("{\"message_no\": \"${message_no}\", \"type\": \"spike_batch\", \"content\": "
+                  "{\"n_spikes\": \"${n_spikes}\", \"snippet_length\": 40, \"electrodes\": \"") +
+        ZmqMessagePlan::getArrayTemplate("electrodes", 4) + "\", \"variance\": \"" +
+        ZmqMessagePlan::getArrayTemplate("variance", 2) + "\", \"timestamp\": \"${timestamp}\"}, "
+        "\"data_size\": \"${data_size}\"}";
+}
+
+/** The numbers and arrays patched in are read back by a JSON parser */
+static void fieldsAndArrays()
+{
+    Sockets sockets;
+    ZmqMessagePlan plan;
+    plan.prepare("SPIKES", spikeTemplate(), 64, 2);
+    CHECK(plan.isPrepared());
+    CHECK_EQUAL(plan.getField("missing"), -1);
+    const int messageNo = plan.getField("message_no");
+    const int spikes = plan.getField("n_spikes");
+    const int electrodes = plan.getField("electrodes");
+    const int variance = plan.getField("variance");
+    const int timestamp = plan.getField("timestamp");
+    CHECK(messageNo >= 0 && spikes >= 0 && electrodes >= 0 && variance >= 0 && timestamp >= 0);
+
+    float *payload = (float *)plan.begin();
+    for(int i = 0; i < 16; i++)
+        payload[i] = i * 0.5f;
+    plan.setField(messageNo, 12);
+    plan.setField(spikes, 3);
+    plan.setField(timestamp, -9007199254740993LL);
+    plan.setField(plan.getField("data_size"), 64);
+    plan.beginArray(electrodes);
+    plan.addInteger(7);
+    plan.addInteger(-1);
+    plan.addInteger(1000000);
+    plan.endArray();
+    plan.beginArray(variance);
+    plan.addFloat(0.125);
+    plan.addFloat(1.0 / 0.0); // no infinity in JSON
+    plan.endArray();
+    CHECK(plan.send(sockets.out, 64) > 0);
+
+    std::vector<std::string> frames;
+    CHECK(sockets.receive(frames));
+    CHECK_EQUAL(frames.size(), 3u);
+    if(frames.size() != 3)
+        return;
+    CHECK_EQUAL(frames[0], std::string("SPIKES", 7));
+    JsonLite::Value header;
+    CHECK(JsonLite::parse(frames[1].data(), frames[1].size(), header));
+    CHECK_EQUAL(header["message_no"].asInt(), 12);
+    CHECK_EQUAL(header["type"].asString(), "spike_batch");
+    const JsonLite::Value &c = header["content"];
+    CHECK_EQUAL(c["n_spikes"].asInt(), 3);
+    CHECK_EQUAL(c["snippet_length"].asInt(), 40);
+    CHECK_EQUAL(c["timestamp"].asInt(), -9007199254740993LL);
+    CHECK_EQUAL(c["electrodes"].size(), 3u);
+    CHECK_EQUAL(c["electrodes"][(size_t)0].asInt(), 7);
+    CHECK_EQUAL(c["electrodes"][(size_t)1].asInt(), -1);
+    CHECK_EQUAL(c["electrodes"][(size_t)2].asInt(), 1000000);
+    CHECK_EQUAL(c["variance"].size(), 2u);
+    CHECK_NEAR(c["variance"][(size_t)0].asDouble(), 0.125, 0.);
+    CHECK(c["variance"][(size_t)1].isNull());
+    CHECK_EQUAL(header["data_size"].asInt(), 64);
+    CHECK_EQUAL(frames[2].size(), 64u);
+    CHECK(frames[2].size() == 64 && ((const float *)frames[2].data())[15] == 7.5f);
+
+    // the template again: arrays not written are null, numbers 0
+    plan.begin();
+    plan.beginArray(electrodes);
+    for(int i = 0; i < 5; i++) // one more than the field was made for
+        plan.addInteger(9000000000000000000LL);
+    plan.endArray();
+    plan.setEnvelope("SPIKES/2");
+    CHECK(plan.send(sockets.out, 0) > 0);
+    CHECK(sockets.receive(frames));
+    CHECK_EQUAL(frames.size(), 2u);
+    if(frames.size() != 2)
+        return;
+    CHECK_EQUAL(frames[0], std::string("SPIKES/2", 9));
+    CHECK(JsonLite::parse(frames[1].data(), frames[1].size(), header));
+    CHECK_EQUAL(header["content"]["n_spikes"].asInt(-1), 0);
+    CHECK(header["content"]["electrodes"].isNull());
+    CHECK(header["content"]["variance"].isNull());
+}
+
+/** Messages still queued keep their slot, the next ones are copied */
+static void slotsReused()
+{
+    Sockets sockets;
+    ZmqMessagePlan plan;
+    plan.prepare("DATA", "{\"n\": \"${n}\"}", 1024, 3);
+    const int n = plan.getField("n");
+    for(int i = 0; i < 5; i++)
+    {
+        memset(plan.begin(), i, 1024);
+        plan.setField(n, i);
+        CHECK(plan.send(sockets.out, 1024) > 0);
+    }
+    CHECK_EQUAL(plan.getNumCopies(), 2);
+
+    // the copies are the same messages
+    std::vector<std::string> frames;
+    for(int i = 0; i < 5; i++)
+    {
+        CHECK(sockets.receive(frames));
+        JsonLite::Value header;
+        CHECK(frames.size() == 3 && JsonLite::parse(frames[1].data(), frames[1].size(), header));
+        CHECK_EQUAL(header["n"].asInt(-1), i);
+        CHECK(frames.size() == 3 && frames[2].size() == 1024 && frames[2][1023] == (char)i);
+    }
+
+    // received and closed, the slots are free again
+    for(int i = 0; i < 3; i++)
+    {
+        plan.begin();
+        plan.setField(n, i);
+        CHECK(plan.send(sockets.out, 1024) > 0);
+        CHECK(sockets.receive(frames));
+    }
+    CHECK_EQUAL(plan.getNumCopies(), 2);
+}
+
+/** A prepared plan builds its messages without operator new: no JUCE
+ String, var or JSON on the way (libzmq allocates its frames itself) */
+static void noAllocations()
+{
+    ZmqMessagePlan plan;
+    plan.prepare("SPIKES", spikeTemplate(), 4096, 4);
+    const int messageNo = plan.getField("message_no");
+    const int electrodes = plan.getField("electrodes");
+    const int variance = plan.getField("variance");
+    const int64 before = allocations;
+    for(int i = 0; i < 1000; i++)
+    {
+        char *payload = plan.begin();
+        memset(payload, 0, 4096);
+        plan.setField(messageNo, i);
+        plan.setEnvelope(i % 2 ? "SPIKES" : "EVENT/SPIKE/3");
+        plan.beginArray(electrodes);
+        for(int e = 0; e < 4; e++)
+            plan.addInteger(e * i);
+        plan.endArray();
+        plan.beginArray(variance);
+        plan.addFloat(i / 3.);
+        plan.endArray();
+    }
+    CHECK_EQUAL(allocations - before, 0);
+}
+
+int main()
+{
+    TEST(fieldsAndArrays);
+    TEST(slotsReused);
+    TEST(noAllocations);
+    return testResult("TestMessagePlan");
+}
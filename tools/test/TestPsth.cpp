@@ -0,0 +1,192 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    TestPsth.cpp
+    The peri-event time histograms of the plugin (PSTH messages).
+
+  ==============================================================================
+*/
+
+#include <vector>
+#include "ZmqPsth.h"
+#include "TestCheck.h"
+
+
+// 1 sample per ms: windows of 100 ms before and 200 ms after, 10 ms bins
+static const double RATE = 1000.;
+
+static void prepare(ZmqPsth &psth, const Array<int> &channels = Array<int>())
+{
+    psth.prepare(channels, RATE, 100., 200., 10.);
+}
+
+/** The counts of one trigger row and electrode row */
+static std::vector<uint32> row(const ZmqPsth &psth, int trigger, int electrode)
+{
+    std::vector<uint32> counts(psth.getMaxCountsSize() / sizeof(uint32));
+    size_t size = psth.copyCounts(counts.data());
+    CHECK_EQUAL(size, psth.getNumTriggers() * psth.getNumElectrodes() * psth.getNumBins() * sizeof(uint32));
+    const int nBins = psth.getNumBins();
+    const uint32 *r = counts.data() + (trigger * psth.getNumElectrodes() + electrode) * nBins;
+    return std::vector<uint32>(r, r + nBins);
+}
+
+/** The lags go to their bins, the window is [-pre, post) */
+static void bins()
+{
+    ZmqPsth psth;
+    prepare(psth);
+    CHECK_EQUAL(psth.getNumBins(), 30);
+    CHECK_EQUAL(psth.getNumTriggers(), 0);
+
+    psth.addSpike(7, 900);  // -100: first bin
+    psth.addSpike(7, 899);  // -101: before the window
+    psth.addSpike(7, 950);  // -50
+    psth.addTrigger(1, 1000);
+    psth.addSpike(7, 1005); // +5
+    psth.addSpike(7, 1009); // +9, same bin
+    psth.addSpike(7, 1199); // +199: last bin
+    psth.addSpike(7, 1200); // +200: after the window
+
+    CHECK_EQUAL(psth.getNumTriggers(), 1);
+    CHECK_EQUAL(psth.getNumElectrodes(), 1);
+    CHECK_EQUAL(psth.getTriggerChannel(0), 1);
+    CHECK_EQUAL(psth.getElectrodeId(0), 7);
+    CHECK_EQUAL(psth.getTrials(0), 1);
+    CHECK_EQUAL(psth.getNumSpikes(), 7);
+
+    std::vector<uint32> counts = row(psth, 0, 0);
+    uint32 total = 0;
+    for(size_t i = 0; i < counts.size(); i++)
+        total += counts[i];
+    CHECK_EQUAL(total, 5u);
+    CHECK_EQUAL(counts[0], 1u);
+    CHECK_EQUAL(counts[5], 1u);
+    CHECK_EQUAL(counts[10], 2u);
+    CHECK_EQUAL(counts[29], 1u);
+}
+
+/** The same events in another order (within a block) give the same counts */
+static void orderDoesNotMatter()
+{
+    ZmqPsth inOrder, reversed;
+    prepare(inOrder);
+    prepare(reversed);
+    const int64 spikes[] = { 905, 990, 1010, 1150, 1320, 1410, 1600 };
+    const int64 triggers[] = { 1000, 1400 };
+    std::vector<std::pair<int64, int> > events;
+    for(int i = 0; i < 7; i++)
+        events.push_back(std::make_pair(spikes[i], 0));
+    for(int i = 0; i < 2; i++)
+        events.push_back(std::make_pair(triggers[i], 1));
+    std::sort(events.begin(), events.end());
+
+    for(size_t i = 0; i < events.size(); i++)
+        if(events[i].second)
+            inOrder.addTrigger(3, events[i].first);
+        else
+            inOrder.addSpike(2, events[i].first);
+    for(size_t i = events.size(); i-- > 0; )
+        if(events[i].second)
+            reversed.addTrigger(3, events[i].first);
+        else
+            reversed.addSpike(2, events[i].first);
+
+    CHECK(row(inOrder, 0, 0) == row(reversed, 0, 0));
+    CHECK_EQUAL(inOrder.getTrials(0), 2);
+    std::vector<uint32> counts = row(inOrder, 0, 0);
+    // 1000: -95, -10, +10, +150 (1320 and 1410 are +320, +410: out)
+    // 1400: -80, +10, +200 (out), the rest out
+    CHECK_EQUAL(counts[0], 1u);  // -95
+    CHECK_EQUAL(counts[2], 1u);  // -80
+    CHECK_EQUAL(counts[9], 1u);  // -10
+    CHECK_EQUAL(counts[11], 2u); // +10 twice
+    CHECK_EQUAL(counts[25], 1u); // +150
+}
+
+/** Rows in the order seen, laid out [trigger][electrode][bin] */
+static void rowsAndTrials()
+{
+    ZmqPsth psth;
+    prepare(psth, Array<int>({ 2, 4 }));
+    psth.addTrigger(4, 1000);
+    psth.addTrigger(1, 1000); // not a trigger channel
+    psth.addTrigger(2, 2000);
+    psth.addTrigger(4, 3000);
+    psth.addSpike(10, 1015);
+    psth.addSpike(11, 2025);
+    psth.addSpike(11, 3035);
+
+    CHECK_EQUAL(psth.getNumTriggers(), 2);
+    CHECK_EQUAL(psth.getTriggerChannel(0), 4);
+    CHECK_EQUAL(psth.getTriggerChannel(1), 2);
+    CHECK_EQUAL(psth.getTrials(0), 2);
+    CHECK_EQUAL(psth.getTrials(1), 1);
+    CHECK_EQUAL(psth.getNumElectrodes(), 2);
+    CHECK_EQUAL(psth.getElectrodeId(1), 11);
+
+    CHECK_EQUAL(row(psth, 0, 0)[11], 1u); // channel 4, electrode 10, +15
+    CHECK_EQUAL(row(psth, 0, 1)[13], 1u); // channel 4, electrode 11, +35
+    CHECK_EQUAL(row(psth, 1, 1)[12], 1u); // channel 2, electrode 11, +25
+    CHECK_EQUAL(row(psth, 1, 0)[11], 0u);
+
+    psth.reset();
+    CHECK_EQUAL(psth.getNumTriggers(), 0);
+    CHECK_EQUAL(psth.getNumElectrodes(), 0);
+    CHECK_EQUAL(psth.getNumSpikes(), 0);
+    psth.addTrigger(2, 5000);
+    psth.addSpike(12, 5000);
+    std::vector<uint32> counts = row(psth, 0, 0);
+    CHECK_EQUAL(counts[10], 1u);
+    CHECK_EQUAL(counts[11] + counts[12] + counts[13], 0u);
+}
+
+/** Past MAX_TRIGGERS and MAX_ELECTRODES the events are ignored and counted */
+static void limits()
+{
+    ZmqPsth psth;
+    prepare(psth);
+    for(int c = 0; c <= ZmqPsth::MAX_TRIGGERS; c++)
+        psth.addTrigger(c, 1000);
+    for(int e = 0; e <= ZmqPsth::MAX_ELECTRODES; e++)
+        psth.addSpike(e, 1010);
+    CHECK_EQUAL(psth.getNumTriggers(), (int)ZmqPsth::MAX_TRIGGERS);
+    CHECK_EQUAL(psth.getNumElectrodes(), (int)ZmqPsth::MAX_ELECTRODES);
+    CHECK_EQUAL(psth.getNumIgnored(), 2);
+    CHECK_EQUAL(row(psth, ZmqPsth::MAX_TRIGGERS - 1, ZmqPsth::MAX_ELECTRODES - 1)[11], 1u);
+
+    // windows too long for MAX_BINS get wider bins, not more
+    psth.prepare(Array<int>(), 30000., 1000., 1000., 0.1);
+    CHECK_EQUAL(psth.getNumBins(), (int)ZmqPsth::MAX_BINS);
+    CHECK(psth.getMaxCountsSize() > 0);
+}
+
+int main()
+{
+    TEST(bins);
+    TEST(orderDoesNotMatter);
+    TEST(rowsAndTrials);
+    TEST(limits);
+    return testResult("TestPsth");
+}
@@ -0,0 +1,74 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    TestSequenceTracker.cpp
+    Losses counted per topic from the "sequence" numbers.
+
+  ==============================================================================
+*/
+
+#include <string>
+#include "../common/SequenceTracker.h"
+#include "TestCheck.h"
+
+
+/** Gaps of one topic don't show on the others */
+static void perTopic()
+{
+    SequenceTracker tracker;
+    CHECK_EQUAL(tracker.check("DATA/100/30000", 10), 0);
+    CHECK_EQUAL(tracker.check("DATA/101/1000", 0), 0);
+    CHECK_EQUAL(tracker.check("DATA/100/30000", 11), 0);
+    CHECK_EQUAL(tracker.check("DATA/101/1000", 4), 3);
+    CHECK_EQUAL(tracker.check("DATA/100/30000", 12), 0);
+    CHECK_EQUAL(tracker.check("DATA/100/30000", 15), 2);
+}
+
+/** A number going back starts over, messages without one are not counted */
+static void restartAndUnnumbered()
+{
+    SequenceTracker tracker;
+    tracker.check("SYNC", 100);
+    CHECK_EQUAL(tracker.check("SYNC", 0), 0);
+    CHECK_EQUAL(tracker.check("SYNC", 2), 1);
+    CHECK_EQUAL(tracker.check("EVENT/TTL", -1), 0);
+
+    std::string text = "{\"message_no\": 7, \"type\": \"data\", \"content\": {\"sequence\": 5}}";
+    JsonLite::Value header;
+    CHECK(JsonLite::parse(text.data(), text.size(), header));
+    CHECK_EQUAL(tracker.check("SYNC", header), 2);
+    text = "{\"message_no\": 8, \"type\": \"event\", \"content\": {\"sample_num\": 5}}";
+    CHECK(JsonLite::parse(text.data(), text.size(), header));
+    CHECK_EQUAL(tracker.check("SYNC", header), 0);
+
+    tracker.clear();
+    CHECK_EQUAL(tracker.check("SYNC", 50), 0);
+}
+
+int main()
+{
+    TEST(perTopic);
+    TEST(restartAndUnnumbered);
+    return testResult("TestSequenceTracker");
+}
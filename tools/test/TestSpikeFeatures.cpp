@@ -0,0 +1,241 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    TestSpikeFeatures.cpp
+    The waveform features of the plugin (SPIKE_FEATURES messages): peak,
+    trough and width, and the incremental principal components, on
+    synthetic spikes made of two known shapes and noise.
+
+  ==============================================================================
+*/
+
+#include <math.h>
+#include <vector>
+#include "ZmqSpikeFeatures.h"
+#include "TestCheck.h"
+
+
+static const double RATE = 30000.;
+static const int SAMPLES = 40;
+static const int PC = 3 * ZmqSpikeFeatures::MAX_CHANNELS; // first projection
+
+/** Gaussian noise, the same on every run */
+static double gaussian()
+{
+    double u = (rand() + 1.) / (RAND_MAX + 2.);
+    double v = (rand() + 1.) / (RAND_MAX + 2.);
+    return sqrt(-2. * log(u)) * cos(2. * M_PI * v);
+}
+
+/** The two shapes of the spikes: a trough and a later bump, both unit norm */
+static void shapes(std::vector<double> &u, std::vector<double> &v)
+{
+    u.assign(SAMPLES, 0.);
+    v.assign(SAMPLES, 0.);
+    double nu = 0., nv = 0.;
+    for(int i = 0; i < SAMPLES; i++)
+    {
+        u[i] = -exp(-0.5 * (i - 10) * (i - 10) / 4.);
+        v[i] = exp(-0.5 * (i - 25) * (i - 25) / 9.);
+        nu += u[i] * u[i];
+        nv += v[i] * v[i];
+    }
+    for(int i = 0; i < SAMPLES; i++)
+    {
+        u[i] /= sqrt(nu);
+        v[i] /= sqrt(nv);
+    }
+}
+
+/** A spike of a u + b v + noise (uV), in SpikeObject units at 0.1 uV per unit */
+static void spike(const std::vector<double> &u, const std::vector<double> &v,
+                  double a, double b, double noise, uint16 *data)
+{
+    for(int i = 0; i < SAMPLES; i++)
+        data[i] = (uint16)lround(32768. + 10. * (a * u[i] + b * v[i] + noise * gaussian()));
+}
+
+static const float GAIN[ZmqSpikeFeatures::MAX_CHANNELS] = { 10000.f, 20000.f, 10000.f, 10000.f };
+
+/** Per channel extrema in uV and the trough to peak time in ms */
+static void peakTroughWidth()
+{
+    ZmqSpikeFeatures features;
+    features.prepare(RATE, 3, 1000);
+    uint16 data[2 * SAMPLES];
+    for(int i = 0; i < 2 * SAMPLES; i++)
+        data[i] = 32768;
+    data[10] = 32768 - 1000; // channel 0: -100 uV at 10
+    data[22] = 32768 + 500;  //            +50 uV at 22
+    data[5] = 32768 + 800;   //            +80 uV before the trough
+    data[SAMPLES + 3] = 32768 - 2000; // channel 1 (twice the gain): -100 uV at 3
+    data[SAMPLES + 4] = 32768 + 400;  //                              +20 uV at 4
+    features.addSpike(7, 123456789012LL, 2, SAMPLES, data, GAIN);
+
+    CHECK_EQUAL(features.getNumSpikes(), 1);
+    CHECK_EQUAL(features.getNumFeatures(), 3 * ZmqSpikeFeatures::MAX_CHANNELS + 3);
+    CHECK_EQUAL(features.getFeatureNames().size(), features.getNumFeatures());
+    CHECK_EQUAL(features.getFeatureNames()[PC], String("pc_0"));
+    const SpikeFeatureRecord &r = features.getRecords()[0];
+    CHECK_EQUAL(r.timestamp, 123456789012LL);
+    CHECK_EQUAL(r.electrodeId, 7);
+    CHECK_EQUAL(r.basisVersion, 0);
+
+    const float *f = features.getFeatures();
+    const int C = ZmqSpikeFeatures::MAX_CHANNELS;
+    CHECK_NEAR(f[0], 80., 1.e-3);
+    CHECK_NEAR(f[C], -100., 1.e-3);
+    CHECK_NEAR(f[2 * C], 12 * 1000. / RATE, 1.e-5); // to the peak after the trough
+    CHECK_NEAR(f[1], 20., 1.e-3);
+    CHECK_NEAR(f[C + 1], -100., 1.e-3);
+    CHECK_NEAR(f[2 * C + 1], 1000. / RATE, 1.e-5);
+    // channels not in the spike, no basis yet
+    CHECK_NEAR(f[2] + f[C + 2] + f[2 * C + 2] + f[PC], 0., 0.);
+
+    features.clearBatch();
+    CHECK_EQUAL(features.getNumSpikes(), 0);
+    CHECK_EQUAL(features.getNumElectrodes(), 1);
+}
+
+/** Correlation of the first projections with the amplitudes of a shape */
+static double correlation(const std::vector<double> &x, const std::vector<double> &y)
+{
+    double mx = 0., my = 0., sxy = 0., sxx = 0., syy = 0.;
+    const size_t n = x.size();
+    for(size_t i = 0; i < n; i++)
+    {
+        mx += x[i] / n;
+        my += y[i] / n;
+    }
+    for(size_t i = 0; i < n; i++)
+    {
+        sxy += (x[i] - mx) * (y[i] - my);
+        sxx += (x[i] - mx) * (x[i] - mx);
+        syy += (y[i] - my) * (y[i] - my);
+    }
+    return sxy / sqrt(sxx * syy);
+}
+
+/** The basis finds the two shapes, in order of variance, and keeps its signs */
+static void principalComponents()
+{
+    std::vector<double> u, v;
+    shapes(u, v);
+    srand(2);
+    ZmqSpikeFeatures features;
+    features.prepare(RATE, 2, 500);
+    uint16 data[SAMPLES];
+
+    // amplitudes around 150 and 60 uV, spread 40 and 15: the variance of
+    // the noise (2 uV per sample) is 160 out of 1985
+    for(int i = 0; i < 500; i++)
+    {
+        spike(u, v, 150. + 40. * gaussian(), 60. + 15. * gaussian(), 2., data);
+        features.addSpike(3, i, 1, SAMPLES, data, GAIN);
+    }
+    CHECK_EQUAL(features.getBasisVersion(0), 1);
+    CHECK_NEAR(features.getExplainedVariance(0), 1825. / 1985., 0.03);
+    features.clearBatch();
+
+    std::vector<double> a, b, pc0, pc1;
+    for(int i = 0; i < 400; i++)
+    {
+        a.push_back(150. + 40. * gaussian());
+        b.push_back(60. + 15. * gaussian());
+        spike(u, v, a.back(), b.back(), 2., data);
+        features.addSpike(3, 500 + i, 1, SAMPLES, data, GAIN);
+        const float *f = features.getFeatures() + i * features.getNumFeatures();
+        pc0.push_back(f[PC]);
+        pc1.push_back(f[PC + 1]);
+        CHECK_EQUAL(features.getRecords()[i].basisVersion, 1);
+    }
+    CHECK(fabs(correlation(pc0, a)) > 0.98);
+    CHECK(fabs(correlation(pc1, b)) > 0.9);
+    // a trough: the largest weight of the first component is negative, so
+    // larger spikes project lower
+    const double sign0 = correlation(pc0, a) > 0. ? 1. : -1.;
+    CHECK(sign0 < 0.);
+
+    // the refresh after 500 spikes keeps the signs
+    for(int i = 0; i < 200; i++)
+    {
+        double ai = 150. + 40. * gaussian();
+        spike(u, v, ai, 60. + 15. * gaussian(), 2., data);
+        features.addSpike(3, 900 + i, 1, SAMPLES, data, GAIN);
+    }
+    CHECK_EQUAL(features.getBasisVersion(0), 2);
+    features.clearBatch();
+    a.clear();
+    pc0.clear();
+    for(int i = 0; i < 200; i++)
+    {
+        a.push_back(150. + 40. * gaussian());
+        spike(u, v, a.back(), 60. + 15. * gaussian(), 2., data);
+        features.addSpike(3, 1100 + i, 1, SAMPLES, data, GAIN);
+        pc0.push_back(features.getFeatures()[i * features.getNumFeatures() + PC]);
+    }
+    CHECK(correlation(pc0, a) * sign0 > 0.98);
+}
+
+/** Spikes that don't fit are dropped and counted, a new length starts over */
+static void limits()
+{
+    ZmqSpikeFeatures features;
+    features.prepare(RATE, 3, 10);
+    std::vector<uint16> data(8 * SAMPLES, 32768);
+    data[5] = 30000;
+    features.addSpike(1, 0, ZmqSpikeFeatures::MAX_CHANNELS + 1, SAMPLES, data.data(), GAIN);
+    features.addSpike(1, 0, 1, ZmqSpikeFeatures::MAX_SAMPLES + 1, data.data(), GAIN);
+    CHECK_EQUAL(features.getNumDropped(), 2);
+    CHECK_EQUAL(features.getNumElectrodes(), 0);
+
+    for(int e = 0; e <= ZmqSpikeFeatures::MAX_ELECTRODES; e++)
+        features.addSpike(e, e, 1, SAMPLES, data.data(), GAIN);
+    CHECK_EQUAL(features.getNumElectrodes(), (int)ZmqSpikeFeatures::MAX_ELECTRODES);
+    CHECK_EQUAL(features.getNumDropped(), 3);
+
+    for(int i = 0; i < 10; i++)
+        features.addSpike(0, i, 1, SAMPLES, data.data(), GAIN);
+    CHECK_EQUAL(features.getBasisVersion(0), 1);
+    features.addSpike(0, 10, 1, SAMPLES / 2, data.data(), GAIN);
+    CHECK_EQUAL(features.getBasisVersion(0), 0);
+
+    features.clearBatch();
+    for(int i = 0; i <= ZmqSpikeFeatures::MAX_BATCH; i++)
+        features.addSpike(1, i, 1, SAMPLES, data.data(), GAIN);
+    CHECK_EQUAL(features.getNumSpikes(), (int)ZmqSpikeFeatures::MAX_BATCH);
+    CHECK_EQUAL(features.getNumDropped(), 1);
+
+    features.reset();
+    CHECK_EQUAL(features.getNumElectrodes(), 0);
+    CHECK_EQUAL(features.getNumSpikes(), 0);
+}
+
+int main()
+{
+    TEST(peakTroughWidth);
+    TEST(principalComponents);
+    TEST(limits);
+    return testResult("TestSpikeFeatures");
+}
@@ -0,0 +1,51 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    TracerStub.cpp
+    ZmqTracer for the tests of the plugin files that mark their stages with
+    ZMQ_TRACE: never enabled, records nothing.
+
+  ==============================================================================
+*/
+
+#include "ZmqTracer.h"
+
+
+struct ZmqTracer::ThreadBuffer
+{
+};
+
+OwnedArray<ZmqTracer::ThreadBuffer> ZmqTracer::buffers;
+Atomic<int> ZmqTracer::enabled;
+Atomic<int> ZmqTracer::generation;
+Atomic<int> ZmqTracer::numThreads;
+Atomic<int64> ZmqTracer::dropped;
+
+void ZmqTracer::setEnabled(bool)
+{
+}
+
+void ZmqTracer::record(const char *, int64, int64)
+{
+}
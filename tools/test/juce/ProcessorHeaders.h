@@ -0,0 +1,369 @@
+/*
+ ------------------------------------------------------------------
+
+ ZMQInterface
+ Copyright (C) 2016 FP Battaglia
+
+ ------------------------------------------------------------------
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+/*
+  ==============================================================================
+
+    ProcessorHeaders.h
+    Stands in for the Open Ephys headers in the tests: the few JUCE classes
+    used by the plugin files that don't need the GUI (ZmqPsth,
+    ZmqSpikeFeatures, ZmqMessagePlan, ZmqInjector), with the same behaviour,
+    on the standard library.
+
+  ==============================================================================
+*/
+
+#ifndef TEST_PROCESSORHEADERS_H_INCLUDED
+#define TEST_PROCESSORHEADERS_H_INCLUDED
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+
+typedef int64_t int64;
+typedef int32_t int32;
+typedef uint64_t uint64;
+typedef uint32_t uint32;
+typedef uint16_t uint16;
+typedef uint8_t uint8;
+typedef int16_t int16;
+typedef intptr_t pointer_sized_int;
+
+#define jassert(x) assert(x)
+#define jassertfalse assert(false)
+#define JUCE_DECLARE_NON_COPYABLE(className) \
+    className(const className &) = delete; \
+    className &operator=(const className &) = delete;
+#define JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(className) JUCE_DECLARE_NON_COPYABLE(className)
+
+template <typename T> T jmax(T a, T b) { return a < b ? b : a; }
+template <typename T> T jmin(T a, T b) { return b < a ? b : a; }
+template <typename T> T jmax(T a, T b, T c) { return jmax(a, jmax(b, c)); }
+template <typename T> T jmin(T a, T b, T c) { return jmin(a, jmin(b, c)); }
+template <typename T> T jlimit(T low, T high, T value) { return value < low ? low : (high < value ? high : value); }
+template <typename T> void zerostruct(T &structure) { memset(&structure, 0, sizeof(structure)); }
+inline int nextPowerOfTwo(int n)
+{
+    int p = 1;
+    while(p < n)
+        p <<= 1;
+    return p;
+}
+
+
+template <typename T>
+class Atomic
+{
+public:
+    Atomic(T initial = T()) : value(initial) {}
+    T get() const { return value.load(); }
+    Atomic &operator=(T v) { value.store(v); return *this; }
+    T operator++() { return ++value; }
+    T operator--() { return --value; }
+    T operator+=(T v) { return value += v; }
+    T exchange(T v) { return value.exchange(v); }
+    bool compareAndSetBool(T newValue, T comparand) { return value.compare_exchange_strong(comparand, newValue); }
+
+private:
+    std::atomic<T> value;
+};
+
+
+class String
+{
+public:
+    String() {}
+    String(const char *s) : s(s) {}
+    String(const std::string &s) : s(s) {}
+    explicit String(int v) : s(std::to_string(v)) {}
+    explicit String(int64 v) : s(std::to_string(v)) {}
+
+    const char *toRawUTF8() const { return s.c_str(); }
+    size_t getNumBytesAsUTF8() const { return s.size(); }
+    int length() const { return (int)s.size(); }
+    bool isEmpty() const { return s.empty(); }
+    bool isNotEmpty() const { return !s.empty(); }
+
+    int indexOf(int start, const char *other) const
+    {
+        size_t i = s.find(other, (size_t)jmax(0, start));
+        return i == std::string::npos ? -1 : (int)i;
+    }
+    bool containsChar(char c) const { return s.find(c) != std::string::npos; }
+    String substring(int start, int end) const { return s.substr(start, end - start); }
+    String substring(int start) const { return start < length() ? s.substr(start) : std::string(); }
+    String fromLastOccurrenceOf(const char *sub, bool include, bool) const
+    {
+        size_t i = s.rfind(sub);
+        if(i == std::string::npos)
+            return *this;
+        return s.substr(include ? i : i + strlen(sub));
+    }
+    String upToLastOccurrenceOf(const char *sub, bool include, bool) const
+    {
+        size_t i = s.rfind(sub);
+        if(i == std::string::npos)
+            return *this;
+        return s.substr(0, include ? i + strlen(sub) : i);
+    }
+    int getIntValue() const { return atoi(s.c_str()); }
+    static String repeatedString(const char *text, int n)
+    {
+        std::string r;
+        for(int i = 0; i < n; i++)
+            r += text;
+        return r;
+    }
+
+    String &operator+=(const String &other) { s += other.s; return *this; }
+    friend String operator+(const String &a, const String &b) { return a.s + b.s; }
+    friend String operator+(const char *a, const String &b) { return a + b.s; }
+    friend String operator+(const String &a, const char *b) { return a.s + b; }
+    bool operator==(const String &other) const { return s == other.s; }
+    bool operator!=(const String &other) const { return s != other.s; }
+    friend std::ostream &operator<<(std::ostream &out, const String &string) { return out << string.s; }
+
+private:
+    std::string s;
+};
+
+
+template <typename T>
+class Array
+{
+public:
+    Array() {}
+    Array(std::initializer_list<T> values) : items(values) {}
+
+    int size() const { return (int)items.size(); }
+    void add(const T &v) { items.push_back(v); }
+    void set(int i, const T &v) { items[i] = v; }
+    T operator[](int i) const { return i >= 0 && i < size() ? items[i] : T(); }
+    T getUnchecked(int i) const { return items[i]; }
+    T &getReference(int i) { return items[i]; }
+    const T &getReference(int i) const { return items[i]; }
+    T *getRawDataPointer() { return items.data(); }
+    int indexOf(const T &v) const
+    {
+        typename std::vector<T>::const_iterator it = std::find(items.begin(), items.end(), v);
+        return it == items.end() ? -1 : (int)(it - items.begin());
+    }
+    bool contains(const T &v) const { return indexOf(v) >= 0; }
+    void remove(int i) { items.erase(items.begin() + i); }
+    void clear() { items.clear(); items.shrink_to_fit(); }
+    void clearQuick() { items.clear(); }
+    void insertMultiple(int index, const T &v, int n) { items.insert(items.begin() + index, n, v); }
+    void ensureStorageAllocated(int n) { items.reserve(n); }
+
+private:
+    std::vector<T> items;
+};
+
+
+class StringArray
+{
+public:
+    int size() const { return items.size(); }
+    void add(const String &s) { items.add(s); }
+    String operator[](int i) const { return items[i]; }
+    int indexOf(const String &s) const { return items.indexOf(s); }
+    bool contains(const String &s) const { return items.contains(s); }
+    void clear() { items.clear(); }
+
+private:
+    Array<String> items;
+};
+
+
+template <typename T>
+class OwnedArray
+{
+public:
+    OwnedArray() {}
+    ~OwnedArray() { clear(); }
+
+    int size() const { return (int)items.size(); }
+    T *add(T *item) { items.push_back(item); return item; }
+    T *operator[](int i) const { return i >= 0 && i < size() ? items[i] : nullptr; }
+    T *getUnchecked(int i) const { return items[i]; }
+    void clear()
+    {
+        for(size_t i = 0; i < items.size(); i++)
+            delete items[i];
+        items.clear();
+    }
+
+private:
+    std::vector<T *> items;
+    JUCE_DECLARE_NON_COPYABLE(OwnedArray)
+};
+
+
+template <typename T>
+class HeapBlock
+{
+public:
+    HeapBlock() {}
+    ~HeapBlock() { ::free(data); }
+
+    void malloc(size_t n) { ::free(data); data = (T *)::malloc(jmax((size_t)1, n) * sizeof(T)); }
+    void calloc(size_t n) { ::free(data); data = (T *)::calloc(jmax((size_t)1, n), sizeof(T)); }
+    void allocate(size_t n, bool clear) { if(clear) calloc(n); else malloc(n); }
+    void free() { ::free(data); data = nullptr; }
+
+    T *getData() const { return data; }
+    operator T *() const { return data; }
+    T *operator->() const { return data; }
+
+private:
+    T *data = nullptr;
+    JUCE_DECLARE_NON_COPYABLE(HeapBlock)
+};
+
+
+class ReferenceCountedObject
+{
+public:
+    void incReferenceCount() { ++refCount; }
+    void decReferenceCount()
+    {
+        if(--refCount == 0)
+            delete this;
+    }
+    int getReferenceCount() const { return refCount.get(); }
+
+protected:
+    ReferenceCountedObject() {}
+    virtual ~ReferenceCountedObject() {}
+
+private:
+    Atomic<int> refCount;
+};
+
+template <typename T>
+class ReferenceCountedObjectPtr
+{
+public:
+    ReferenceCountedObjectPtr() {}
+    ReferenceCountedObjectPtr(T *o) : object(o) { if(object) object->incReferenceCount(); }
+    ReferenceCountedObjectPtr(const ReferenceCountedObjectPtr &other) : ReferenceCountedObjectPtr(other.object) {}
+    ~ReferenceCountedObjectPtr() { if(object) object->decReferenceCount(); }
+    ReferenceCountedObjectPtr &operator=(T *o)
+    {
+        if(o)
+            o->incReferenceCount();
+        if(object)
+            object->decReferenceCount();
+        object = o;
+        return *this;
+    }
+    ReferenceCountedObjectPtr &operator=(const ReferenceCountedObjectPtr &other) { return operator=(other.object); }
+    T *operator->() const { return object; }
+    T *get() const { return object; }
+    operator T *() const { return object; }
+
+private:
+    T *object = nullptr;
+};
+
+
+template <typename T>
+class Range
+{
+public:
+    Range(T start, T end) : start(start), end(end) {}
+    T getStart() const { return start; }
+    T getEnd() const { return end; }
+    T getLength() const { return end - start; }
+
+private:
+    T start, end;
+};
+
+struct FloatVectorOperations
+{
+    static void clear(float *dest, int n) { memset(dest, 0, n * sizeof(float)); }
+    static void copy(float *dest, const float *src, int n) { memcpy(dest, src, n * sizeof(float)); }
+    static void add(float *dest, const float *src, int n) { for(int i = 0; i < n; i++) dest[i] += src[i]; }
+    static void subtract(float *dest, const float *src, int n) { for(int i = 0; i < n; i++) dest[i] -= src[i]; }
+    static void multiply(float *dest, float k, int n) { for(int i = 0; i < n; i++) dest[i] *= k; }
+    static void negate(float *dest, const float *src, int n) { for(int i = 0; i < n; i++) dest[i] = -src[i]; }
+    static void addWithMultiply(float *dest, const float *src, float k, int n)
+    {
+        for(int i = 0; i < n; i++)
+            dest[i] += src[i] * k;
+    }
+    static float findMaximum(const float *x, int n) { return findMinAndMax(x, n).getEnd(); }
+    static float findMinimum(const float *x, int n) { return findMinAndMax(x, n).getStart(); }
+    static Range<float> findMinAndMax(const float *x, int n)
+    {
+        if(n <= 0)
+            return Range<float>(0.f, 0.f);
+        float low = x[0], high = x[0];
+        for(int i = 1; i < n; i++)
+        {
+            low = jmin(low, x[i]);
+            high = jmax(high, x[i]);
+        }
+        return Range<float>(low, high);
+    }
+};
+
+
+class AudioSampleBuffer
+{
+public:
+    AudioSampleBuffer(int numChannels, int numSamples)
+        : numChannels(numChannels), numSamples(numSamples), data((size_t)numChannels * numSamples) {}
+
+    int getNumChannels() const { return numChannels; }
+    int getNumSamples() const { return numSamples; }
+    const float *getReadPointer(int channel) const { return data.data() + (size_t)channel * numSamples; }
+    float *getWritePointer(int channel) { return data.data() + (size_t)channel * numSamples; }
+    void clear() { std::fill(data.begin(), data.end(), 0.f); }
+
+private:
+    int numChannels, numSamples;
+    std::vector<float> data;
+};
+
+
+struct Time
+{
+    static int64 getHighResolutionTicks()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    static int64 getHighResolutionTicksPerSecond() { return 1000000000; }
+};
+
+class File; // ZmqTracer::writeChromeTrace(), not in the tests (see TracerStub.cpp)
+
+
+#endif  // TEST_PROCESSORHEADERS_H_INCLUDED
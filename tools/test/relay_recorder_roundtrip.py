@@ -0,0 +1,135 @@
+#!/usr/bin/env python
+"""Round trip of DATA blocks through zmq_relay (decimate=4, int16=0.5) and
+zmq_recorder: the recorded samples are the averages of the ones sent, and
+recording.json describes them. Run by make test, with the build directory as
+argument. Needs pyzmq, skipped without it."""
+
+import json
+import os
+import shutil
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+try:
+    import zmq
+except ImportError:
+    print('relay_recorder_roundtrip: skipped (no pyzmq)')
+    sys.exit(0)
+
+RATE = 30000
+CHANNELS = 3
+BLOCK = 128
+BLOCKS = 40
+FIRST = 2  # not a multiple of the decimation, the relay starts at 4
+DECIMATE = 4
+SCALE = 0.5
+
+
+def sample(ch, s):
+    """what the rig sends: the averages of 4 samples are exact in int16 units of 0.5, channel 2 saturates"""
+    return (2. * s, -float(s), 100000.)[ch]
+
+
+def data_message(message_no, timestamp):
+    samples = [sample(ch, timestamp + i) for ch in range(CHANNELS) for i in range(BLOCK)]
+    payload = struct.pack('<%df' % len(samples), *samples)
+    header = {'message_no': message_no, 'type': 'data',
+              'content': {'n_channels': CHANNELS, 'n_samples': BLOCK, 'n_real_samples': BLOCK,
+                          'timestamp': timestamp, 'sequence': message_no, 'sample_rate': RATE},
+              'dataSize': len(payload)}
+    return [b'DATA/100/30000\0', json.dumps(header).encode('utf-8'), payload]
+
+
+def check(condition, what):
+    if not condition:
+        raise AssertionError(what)
+
+
+def free_port():
+    s = socket.socket()
+    s.bind(('127.0.0.1', 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+def main(build):
+    out = tempfile.mkdtemp(prefix='zmq_roundtrip_')
+    context = zmq.Context()
+    rig = context.socket(zmq.XPUB)
+    rig_port = rig.bind_to_random_port('tcp://127.0.0.1')
+    relay_port = free_port()
+    procs = []
+    log = []
+    try:
+        relay = subprocess.Popen([os.path.join(build, 'zmq_relay'), '-e', 'tcp://127.0.0.1:%d' % rig_port,
+                                  '-o', 'tcp://127.0.0.1:%d,decimate=%d,int16=%g' % (relay_port, DECIMATE, SCALE)],
+                                 stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        procs.append(relay)
+        recorder = subprocess.Popen([os.path.join(build, 'zmq_recorder'), '-e', 'tcp://127.0.0.1:%d' % relay_port,
+                                     '-o', out, '-r', '0.1'], stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        procs.append(recorder)
+
+        # the recorder subscribes to everything, the relay passes it on
+        rig.setsockopt(zmq.RCVTIMEO, 10000)
+        while rig.recv() != b'\x01':
+            pass
+        for i in range(BLOCKS):
+            rig.send_multipart(data_message(i, FIRST + i * BLOCK))
+
+        # until the report of the recorder counts them all
+        deadline = time.time() + 10.
+        while time.time() < deadline:
+            line = recorder.stdout.readline().decode('utf-8', 'replace')
+            log.append(line)
+            if ' %d messages,' % BLOCKS in line or not line:
+                break
+        for p in procs:
+            p.send_signal(signal.SIGINT)
+        for p in procs:
+            p.wait(10)
+
+        expected = (BLOCKS * BLOCK - DECIMATE) // DECIMATE  # groups after the first aligned sample
+        with open(os.path.join(out, 'recording.json')) as f:
+            recording = json.load(f)
+        check(recording['missing_messages'] == 0, 'messages missing: %s' % recording)
+        check(len(recording['segments']) == 1, 'one segment: %s' % recording)
+        seg = recording['segments'][0]
+        check(seg['n_channels'] == CHANNELS and seg['decimation'] == DECIMATE, 'segment %s' % seg)
+        check(seg['sample_rate'] == RATE / DECIMATE, 'sample rate %s' % seg)
+        check(seg['n_samples'] == expected, '%d samples, expected %d' % (seg['n_samples'], expected))
+
+        with open(os.path.join(out, seg['file']), 'rb') as f:
+            data = f.read()
+        n = seg['n_samples']
+        check(len(data) == n * CHANNELS * 4, 'file size %d' % len(data))
+        values = struct.unpack('<%df' % (n * CHANNELS), data)
+        for k in range(n):
+            s = DECIMATE * (k + 1)  # the first aligned group starts at 4
+            average = [sum(sample(ch, s + i) for i in range(DECIMATE)) / DECIMATE for ch in range(CHANNELS)]
+            average[2] = 32767 * SCALE  # int16 saturates
+            row = values[k * CHANNELS:(k + 1) * CHANNELS]
+            check(list(row) == average, 'row %d is %s, expected %s' % (k, row, average))
+        print('relay_recorder_roundtrip: ok')
+        return 0
+    except AssertionError as e:
+        print('relay_recorder_roundtrip: %s' % e)
+        print(''.join(log) + recorder.stdout.read().decode('utf-8', 'replace'))
+        print(relay.stdout.read().decode('utf-8', 'replace'))
+        return 1
+    finally:
+        for p in procs:
+            if p.poll() is None:
+                p.kill()
+        rig.close(0)
+        context.term()
+        shutil.rmtree(out, ignore_errors=True)
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1] if len(sys.argv) > 1 else 'build'))